@@ -1,19 +1,65 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Networks with fewer wires than this are routed by a single thread */
+#define BENES_PAR_CUTOFF 4096
+/* Minimum number of wires handed to a thread at once on the deep levels.
+   A multiple of 128, so that concurrent chunks never share a 64-switch word. */
+#define BENES_PAR_GRAIN 1024
+_Static_assert(BENES_PAR_GRAIN % 128 == 0, "chunks must own whole switch words");
+/* Largest network: wire indices stay in int and 2^28 wires need about 5 GB (see README) */
+#define BENES_MAX_K 28
+
+/**
+ * Scratch memory for the router, carved from a single allocation of O(N).
+ * Every level of the network splits the wires into disjoint sub-network slices,
+ * so each array is indexed by absolute wire number and is reused level after level.
+ * cur/next: permutations of all sub-networks of the current / next level.
+ * aux: output partners during coloring, then output ranks.
+ * first: first input seen for each output pair.
+ * up_in/up_out: 1 if the input/output goes through the upper sub-network (0xFF = unvisited).
+ * bound/nbound: first wire of every sub-network of the current / next level, plus N;
+ *     only for N that is not a power of two (NULL otherwise).
+ */
+typedef struct {
+    int *cur, *next, *aux, *first, *bound, *nbound;
+    uint8_t *up_in, *up_out;
+    void *mem;
+} BenesArena;
 
 /**
  * Struct representing a Benes Network.
- * N: Number of inputs/outputs.
- * k: log2(N).
+ * N: Number of inputs/outputs, any N >= 1. When N is odd, a sub-network of n wires
+ *    has n/2 switches per outer stage; its last wire passes straight into the lower
+ *    half, which has (n + 1) / 2 wires.
+ * k: ceil(log2(N)).
  * stages: Total number of stages (2k - 1).
- * sw: 2D array [stage][switch_index] storing configuration (0=straight, 1=cross).
+ * sw: bit matrix [stage][switch_index] storing configuration (0=straight, 1=cross),
+ *     one bit per switch; the switch on wires w and w + 1 has index w / 2. All stages share one 64-byte aligned allocation; each
+ *     stage row is row_words 64-bit words, rounded up to a whole cache line.
+ * arena: routing scratch, sized once from N and reused by every route() call.
+ * waksman: 1 for the Waksman variant, where the last-stage switch carrying output 0
+ *     of every sub-network with 4 or more wires is fixed straight (its bit stays 0).
  */
 typedef struct {
-    int N, k, stages;
-    uint8_t **sw;   
+    int N, k, stages, waksman;
+    uint64_t *sw;
+    size_t row_words;
+    BenesArena arena;
 } Benes;
 
 // ---------- Utilities ----------
@@ -28,6 +74,9 @@ static int ilog2u(unsigned x) {
     return k;
 }
 
+/* Heap blocks handed out by xmalloc; -bench reports them per route and verify call */
+static long long xmalloc_calls = 0;
+
 /* Safe malloc with error checking */
 static void *xmalloc(size_t n) {
     void *p = malloc(n);
@@ -35,202 +84,1938 @@ static void *xmalloc(size_t n) {
         perror("malloc");
         exit(1);
     }
+    #pragma omp atomic
+    xmalloc_calls++;
     return p;
 }
 
+/* xorshift64 step; *x must be nonzero */
+static inline uint64_t rand_next(uint64_t *x) {
+    *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+    return *x;
+}
+
+/* Random permutation of 0..N-1 (Fisher-Yates) */
+static void rand_perm(int *p, int N, uint64_t *x) {
+    for (int i = 0; i < N; i++) p[i] = i;
+    for (int i = N - 1; i > 0; i--) {
+        int j = (int)(rand_next(x) % (uint64_t)(i + 1));
+        int t = p[i]; p[i] = p[j]; p[j] = t;
+    }
+}
+
+/* First word of a stage row */
+static inline uint64_t *sw_row(const Benes *b, int s) {
+    return b->sw + (size_t)s * b->row_words;
+}
+
+/* Setting of switch i of stage s */
+static inline int sw_get(const Benes *b, int s, int i) {
+    return (int)(sw_row(b, s)[i >> 6] >> (i & 63)) & 1;
+}
+
+/*
+ * Writes switches base..base+m-1 of a stage row, switch p being crossed when
+ * flag[2p] is 0. Groups of 64 switches are packed and stored as whole words;
+ * a group smaller than a word (m < 64) or not aligned to one is merged.
+ */
+static void sw_put(uint64_t *row, int base, int m, const uint8_t *flag) {
+    for (int p0 = 0; p0 < m; p0 += 64) {
+        int cnt = (m - p0 < 64) ? m - p0 : 64;
+        uint64_t w = 0;
+        for (int j = 0; j < cnt; j++)
+            w |= (uint64_t)(flag[2 * (p0 + j)] == 0) << j;
+        uint64_t *dst = row + ((base + p0) >> 6);
+        int sh = (base + p0) & 63;
+        if (cnt == 64 && sh == 0) {
+            *dst = w;
+        } else {
+            // merge; a group that straddles a word boundary (odd-sized networks) spills into dst[1]
+            uint64_t mask = cnt == 64 ? ~0ull : (1ull << cnt) - 1;
+            dst[0] = (dst[0] & ~(mask << sh)) | (w << sh);
+            if (sh + cnt > 64) dst[1] = (dst[1] & ~(mask >> (64 - sh))) | (w >> (64 - sh));
+        }
+    }
+}
+
+/* Allocate the routing scratch for networks of N wires in one block */
+static void arena_init(BenesArena *a, int N) {
+    size_t n = (size_t)N, nb = (N & (N - 1)) ? n + 1 : 0;
+    char *m = xmalloc(sizeof(int) * (4 * n + 2 * nb) + 2 * n);
+    a->mem = m;
+    a->cur = (int *)m;
+    a->next = a->cur + n;
+    a->aux = a->next + n;
+    a->first = a->aux + n;
+    a->bound = nb ? a->first + n : NULL;
+    a->nbound = nb ? a->bound + nb : NULL;
+    a->up_in = (uint8_t *)(a->first + n + 2 * nb);
+    a->up_out = a->up_in + n;
+}
+
+static void arena_free(BenesArena *a) {
+    free(a->mem);
+    a->mem = NULL;
+}
+
+/* Topology of the networks created by benes_init (-waksman) */
+static int benes_waksman = 0;
+
 /* Initialize Benes structure and allocate switch memory */
 static void benes_init(Benes *b, int N) {
     b->N = N;
-    b->k = ilog2u((unsigned)N);
+    b->waksman = benes_waksman && !(N & (N - 1));  // Waksman needs N = 2^k; main rejects other N
+    b->k = N > 1 ? ilog2u((unsigned)(N - 1)) + 1 : 0;
     b->stages = 2 * b->k - 1;
 
-    b->sw = (uint8_t **)xmalloc(sizeof(uint8_t *) * b->stages);
-    for (int s = 0; s < b->stages; s++)
-        b->sw[s] = (uint8_t *)calloc(N / 2, 1);
+    // N/2 switches per stage, rounded up to whole 64-byte lines (8 words)
+    b->row_words = (((size_t)N / 2 + 63) / 64 + 7) / 8 * 8;
+    size_t bytes = b->row_words * 8 * (size_t)(b->stages > 0 ? b->stages : 1);
+    b->sw = aligned_alloc(64, bytes);
+    if (!b->sw) {
+        perror("aligned_alloc");
+        exit(1);
+    }
+    memset(b->sw, 0, bytes);
+    arena_init(&b->arena, N);
 }
 
 /* Free allocated memory for Benes structure */
 static void benes_free(Benes *b) {
-    for (int s = 0; s < b->stages; s++)
-        free(b->sw[s]);
     free(b->sw);
+    b->sw = NULL;
+    arena_free(&b->arena);
 }
 
-// ---------- Recursive Routing (Lee-Paull Algorithm) ----------
-
-static void route_rec(int N, const int *perm, int stage_off, int wire_off, Benes *b) {
-    int k_local = ilog2u((unsigned)N);
-    int s_first = stage_off;
-    int s_last  = stage_off + 2 * k_local - 2;
-
-    // Base case: 2x2 switch
-    if (N == 2) {
-        b->sw[s_first][wire_off / 2] = (perm[0] == 1) ? 1 : 0;
-        return;
+/*
+ * Configurable switches: (2k - 1) N/2 for Benes, (k - 1) N + 1 for Waksman.
+ * For other N, S(n) = 2 (n/2) + S(n/2) + S(n - n/2) with S(2) = 1 and S(1) = 0;
+ * every level holds at most two sizes, n and n + 1.
+ */
+static long long benes_switches(const Benes *b) {
+    if (b->N < 2) return 0;
+    if (b->waksman) return (long long)(b->k - 1) * b->N + 1;
+    long long total = 0, ca = 1, cb = 0;  // ca sub-networks of size a, cb of size a + 1
+    for (int a = b->N; ca || cb; a /= 2) {
+        long long na = 0, nb = 0;
+        for (int h = 0; h < 2; h++) {
+            int n = a + h;
+            long long c = h ? cb : ca;
+            if (!c) continue;
+            if (n == 2) { total += c; continue; }  // single switch, two plain wires below
+            if (n < 2) continue;
+            total += c * 2 * (n / 2);
+            // halves n/2 and n - n/2, expressed as sizes a/2 and a/2 + 1
+            if ((n / 2) == a / 2) na += c; else nb += c;
+            if ((n - n / 2) == a / 2) na += c; else nb += c;
+        }
+        ca = na; cb = nb;
     }
+    return total;
+}
 
-    int m = N / 2;
+// ---------- Iterative Routing (Lee-Paull Algorithm) ----------
 
-    // 1) Find Output Partners: pairs of outputs sharing a switch
-    int *first = xmalloc(sizeof(int) * m);
-    int *second = xmalloc(sizeof(int) * m);
-    for (int p = 0; p < m; p++) first[p] = second[p] = -1;
+/*
+ * Routes one sub-network of n wires starting at wire off, whose first and last
+ * stages are s_first and s_last. Its local permutation is a->cur[off .. off+n);
+ * the permutations of its upper and lower halves are written to
+ * a->next[off .. off+n/2) and a->next[off+n/2 .. off+n). For odd n the last
+ * input and the last output have no partner and always use the lower half.
+ * A sub-network of 2 wires is a single switch in stage s_first.
+ */
+static void route_node(Benes *b, BenesArena *a, int n, int off, int s_first, int s_last) {
+    const int *perm = a->cur + off;
+    int base = off / 2;
 
-    for (int i = 0; i < N; i++) {
-        int o = perm[i], pair = o >> 1;
-        if (first[pair] == -1) first[pair] = i;
-        else second[pair] = i;
+    // Base cases: a plain wire, a 2x2 switch
+    if (n < 2) return;
+    if (n == 2) {
+        uint64_t *w = sw_row(b, s_first) + (base >> 6);
+        uint64_t bit = 1ull << (base & 63);
+        *w = (perm[0] == 1) ? (*w | bit) : (*w & ~bit);
+        return;
     }
 
-    int *opart = xmalloc(sizeof(int) * N);
-    for (int p = 0; p < m; p++) {
-        int a = first[p], c = second[p];
-        opart[a] = c; opart[c] = a;
-    }
+    int m = n / 2, odd = n & 1;
+    int *opart = a->aux + off, *first = a->first + off;
+    uint8_t *up_in = a->up_in + off, *up_out = a->up_out + off;
 
-    // 2) Coloring/Path tracing to decide upper vs lower subnetwork
-    uint8_t *up_in = xmalloc(N);
-    uint8_t *vis = xmalloc(N);
-    memset(up_in, 0, N);
-    memset(vis, 0, N);
+    // 1) Find Output Partners: pairs of inputs whose outputs share a switch
+    //    (the unpaired output n - 1 of an odd sub-network has none: -1)
+    for (int p = 0; p < m + odd; p++) first[p] = -1;
+    for (int i = 0; i < n; i++) {
+        int pair = perm[i] >> 1;
+        if (first[pair] == -1) { first[pair] = i; opart[i] = -1; }
+        else { opart[first[pair]] = i; opart[i] = first[pair]; }
+    }
 
-    for (int start = 0; start < N; start++) {
-        if (vis[start]) continue;
-        int cur = start, col = 1; // col 1 = Upper, 0 = Lower
-        while (!vis[cur]) {
-            vis[cur] = 1;
+    // 2) Coloring/Path tracing to decide upper vs lower subnetwork.
+    //    Odd n: the path from the unpaired input goes first, starting lower; it
+    //    ends at the input of the unpaired output, which it reaches as lower too.
+    //    Waksman: the cycle through output 0 goes next and starts upper, so the
+    //    last-stage switch of output pair 0 stays straight.
+    for (int i = 0; i < n; i++) up_in[i] = 0xFF;
+    for (int s = odd ? -2 : -1; s < n; s++) {
+        if (s == -1 && !b->waksman) continue;
+        int start = s >= 0 ? s : s == -2 ? n - 1 : perm[first[0]] == 0 ? first[0] : opart[first[0]];
+        if (up_in[start] != 0xFF) continue;
+        int cur = start, col = s == -2 ? 0 : 1; // col 1 = Upper, 0 = Lower
+        while (cur >= 0 && up_in[cur] == 0xFF) {
             up_in[cur] = (uint8_t)col;
-            int ip = cur ^ 1; // input partner
-            if (!vis[ip]) {
-                cur = ip;
-                col ^= 1;
-                continue;
-            }
-            cur = opart[cur]; // output partner path
+            int ip = odd && cur == n - 1 ? cur : cur ^ 1; // input partner
+            cur = (up_in[ip] == 0xFF) ? ip : opart[cur]; // else output partner path
             col ^= 1;
         }
     }
-    free(vis);
 
     // 3) Map input decisions to output decisions through the permutation
-    uint8_t *up_out = xmalloc(N);
-    for (int i = 0; i < N; i++)
+    for (int i = 0; i < n; i++)
         up_out[perm[i]] = up_in[i];
 
     // Configure the first and last stages of the current Benes layer
-    int base = wire_off / 2;
-    for (int p = 0; p < m; p++)
-        b->sw[s_first][base + p] = up_in[2 * p] ? 0 : 1;
-    for (int q = 0; q < m; q++)
-        b->sw[s_last][base + q] = up_out[2 * q] ? 0 : 1;
-
-    // 4) Build permutations for subnetworks
-    int *inU = xmalloc(sizeof(int) * m), *inL = xmalloc(sizeof(int) * m);
-    int *outU = xmalloc(sizeof(int) * m), *outL = xmalloc(sizeof(int) * m);
+    sw_put(sw_row(b, s_first), base, m, up_in);
+    sw_put(sw_row(b, s_last), base, m, up_out);
+
+    // 4) Build permutations for subnetworks: outputs are renumbered by their rank
+    //    inside their half, inputs are taken in order
+    int *rank = opart;
     int cu = 0, cl = 0;
+    for (int o = 0; o < n; o++)
+        rank[o] = up_out[o] ? cu++ : cl++;
+    int *nextU = a->next + off, *nextL = nextU + m;
+    cu = cl = 0;
+    for (int i = 0; i < n; i++) {
+        if (up_in[i]) nextU[cu++] = rank[perm[i]];
+        else nextL[cl++] = rank[perm[i]];
+    }
+}
 
-    for (int i = 0; i < N; i++)
-        if (up_in[i]) inU[cu++] = i; else inL[cl++] = i;
+/*
+ * Level-by-level routing: level l holds 2^l independent sub-networks of N >> l
+ * wires, stored side by side, so the recursion becomes two nested loops and all
+ * scratch lives in the arena. No heap allocation happens per permutation.
+ * The sub-networks of a level touch disjoint slices of the arena and of each
+ * stage, so they are routed in parallel; only the first levels (few, large
+ * sub-networks whose coloring is sequential) limit the speedup.
+ * For N that is not a power of two the sizes differ by one within a level and
+ * are kept in a->bound; that case runs on one thread, since sub-networks at odd
+ * wires do not own whole switch words.
+ */
+static void route_looping(int N, const int *perm, Benes *b) {
+    BenesArena *a = &b->arena;
+    if (N < 2) return;
+    memcpy(a->cur, perm, sizeof(int) * (size_t)N);
+    if (a->bound) {
+        int subs = 1;
+        a->bound[0] = 0;
+        a->bound[1] = N;
+        for (int l = 0; l < b->k; l++) {
+            for (int s = 0; s < subs; s++) {
+                int off = a->bound[s], n = a->bound[s + 1] - off;
+                route_node(b, a, n, off, l, b->stages - 1 - l);
+                if (l + 1 < b->k) { a->nbound[2 * s] = off; a->nbound[2 * s + 1] = off + n / 2; }
+            }
+            if (l + 1 == b->k) break;
+            subs *= 2;
+            a->nbound[subs] = N;
+            int *t = a->cur; a->cur = a->next; a->next = t;
+            t = a->bound; a->bound = a->nbound; a->nbound = t;
+        }
+        return;
+    }
+    #pragma omp parallel if(N >= BENES_PAR_CUTOFF)
+    for (int l = 0; l < b->k; l++) {
+        int n = N >> l;
+        // chunks of about BENES_PAR_GRAIN wires
+        #pragma omp for schedule(dynamic, n >= BENES_PAR_GRAIN ? 1 : BENES_PAR_GRAIN / n)
+        for (int off = 0; off < N; off += n)
+            route_node(b, a, n, off, l, b->stages - 1 - l);
+        #pragma omp single
+        { int *t = a->cur; a->cur = a->next; a->next = t; }
+    }
+}
 
-    cu = cl = 0;
-    for (int o = 0; o < N; o++)
-        if (up_out[o]) outU[cu++] = o; else outL[cl++] = o;
+// ---------- Structured Permutations (Closed-Form Routing) ----------
+
+/*
+ * Two classes are routed without the looping algorithm, level by level, in
+ * O(N / 64) word stores per stage:
+ *  - affine over GF(2): perm(x) = A x ^ c with A an invertible bit matrix.
+ *    This covers BPC (bit-permute-complement), bit reversal, perfect shuffles,
+ *    XOR with a constant and power-of-two transposes. Coloring input x up
+ *    when f(x) = 0, for a linear f with f(1) = 1 and f(A^-1 1) = 1, satisfies
+ *    both pair rules; every sub-network of a level is then affine with the
+ *    same matrix and its own constant.
+ *  - cyclic shifts: perm(x) = (x + s) mod N. Keeping the first stage straight
+ *    leaves shifts by floor(s/2) and ceil(s/2) in the halves; the last stage
+ *    crosses exactly when s is odd (Waksman moves that crossing to the first).
+ * The settings equal those of a valid looping route, so incremental rerouting
+ * and the simulator work on them unchanged.
+ */
+enum { ROUTE_LOOPING, ROUTE_AFFINE, ROUTE_SHIFT };
+static const char *const ROUTE_NAMES[] = {"looping", "affine", "shift"};
 
-    int *rankU = xmalloc(sizeof(int) * N), *rankL = xmalloc(sizeof(int) * N);
-    for (int r = 0; r < m; r++) {
-        rankU[outU[r]] = r;
-        rankL[outL[r]] = r;
+static int route_classify = 1;  /* 0: always run the looping algorithm (-looping) */
+
+static inline int parity32(unsigned x) {
+    x ^= x >> 16; x ^= x >> 8; x ^= x >> 4;
+    return (0x6996 >> (x & 15)) & 1;
+}
+
+/* Bit t of the switch/wire index, repeated over a 64-bit word (t < 6) */
+static const uint64_t INDEX_BIT[6] = {
+    0xAAAAAAAAAAAAAAAAull, 0xCCCCCCCCCCCCCCCCull, 0xF0F0F0F0F0F0F0F0ull,
+    0xFF00FF00FF00FF00ull, 0xFFFF0000FFFF0000ull, 0xFFFFFFFF00000000ull
+};
+
+/*
+ * Writes a stage row of M switches in sub-networks of m switches each: switch g
+ * is parity(lin & g), inverted for the whole sub-network s when
+ * parity(cons[s] & cmask) is 1 (cons may be NULL). lin < m.
+ */
+static void row_fill(uint64_t *row, int M, int m, unsigned lin, const int *cons, unsigned cmask) {
+    uint64_t P = 0;
+    for (int t = 0; t < 6; t++)
+        if ((lin >> t) & 1u) P ^= INDEX_BIT[t];
+    int words = (M + 63) / 64, lm = ilog2u((unsigned)m);
+    for (int w = 0; w < words; w++) {
+        uint64_t v = P ^ (parity32((lin >> 6) & (unsigned)w) ? ~0ull : 0);
+        if (cons) {
+            if (m >= 64) {
+                if (parity32((unsigned)cons[(64 * w) >> lm] & cmask)) v = ~v;
+            } else {
+                uint64_t ones = (1ull << m) - 1;
+                for (int s = (64 * w) >> lm, e = s + (64 >> lm); s < e && s * m < M; s++)
+                    if (parity32((unsigned)cons[s] & cmask)) v ^= ones << ((s * m) & 63);
+            }
+        }
+        if (M < 64) v &= (1ull << M) - 1;
+        row[w] = v;
     }
+}
 
-    int *permU = xmalloc(sizeof(int) * m), *permL = xmalloc(sizeof(int) * m);
-    for (int r = 0; r < m; r++)
-        permU[r] = rankU[perm[inU[r]]];
-    for (int r = 0; r < m; r++)
-        permL[r] = rankL[perm[inL[r]]];
+/* Inverts the b x b bit matrix with columns col; rows of the inverse go to inv. 0 if singular. */
+static int gf2_inverse(const unsigned *col, int b, unsigned *inv) {
+    unsigned lhs[32];
+    for (int r = 0; r < b; r++) {
+        lhs[r] = 0;
+        for (int t = 0; t < b; t++) lhs[r] |= ((col[t] >> r) & 1u) << t;
+        inv[r] = 1u << r;
+    }
+    for (int c = 0; c < b; c++) {
+        int p = c;
+        while (p < b && !((lhs[p] >> c) & 1u)) p++;
+        if (p == b) return 0;
+        unsigned t = lhs[p]; lhs[p] = lhs[c]; lhs[c] = t;
+        t = inv[p]; inv[p] = inv[c]; inv[c] = t;
+        for (int r = 0; r < b; r++)
+            if (r != c && ((lhs[r] >> c) & 1u)) { lhs[r] ^= lhs[c]; inv[r] ^= inv[c]; }
+    }
+    return 1;
+}
 
-    // 5) Recurse on upper and lower sub-Benes networks
-    route_rec(m, permU, stage_off + 1, wire_off, b);
-    route_rec(m, permL, stage_off + 1, wire_off + m, b);
+/* Routes perm if it is affine over GF(2); 0 (nothing written) otherwise */
+static int route_affine(int N, const int *perm, Benes *b) {
+    int k = b->k;
+    unsigned col[32], inv[32];
+    for (int t = 0; t < k; t++) col[t] = (unsigned)(perm[1 << t] ^ perm[0]);
+    // perm(x) = perm(x without its lowest bit) ^ col[lowest bit]
+    for (int i = 1; i < N; i++) {
+        int low = i & -i;
+        if (perm[i] != (perm[i ^ low] ^ perm[low] ^ perm[0])) return 0;
+    }
+    if (!gf2_inverse(col, k, inv)) return 0;
 
-    // Cleanup local allocations
-    free(first); free(second); free(opart);
-    free(up_in); free(up_out);
-    free(inU); free(inL); free(outU); free(outL);
-    free(rankU); free(rankL);
-    free(permU); free(permL);
+    int *cons = b->arena.cur, *next = b->arena.next;
+    cons[0] = perm[0];
+    for (int l = 0, bits = k; l < k; l++, bits--) {
+        int m = (N >> l) / 2, subs = 1 << l;
+        if (bits == 1) {  // x -> x ^ c: the middle switch crosses when c = 1
+            row_fill(sw_row(b, l), N / 2, 1, 0, cons, 1);
+            break;
+        }
+        if (l > 0 && !gf2_inverse(col, bits, inv)) return 0;
+        // f = x0 (+ one set bit of d = A^-1 e0 when d0 = 0)
+        unsigned d = 0;
+        for (int r = 0; r < bits; r++) d |= (inv[r] & 1u) << r;
+        unsigned F = 1u;
+        if (!(d & 1u)) { unsigned low = d & (~d + 1u); F |= low; }
+        unsigned H = 0;  // h = f(A^-1 y) as a mask on y
+        for (int r = 0; r < bits; r++)
+            if ((F >> r) & 1u) H ^= inv[r];
+        // Waksman: sub-network s flips its coloring when h(c_s) = 1, which moves
+        // the flip from the last stage (output pair 0 straight) to the first
+        if (b->waksman) {
+            row_fill(sw_row(b, l), N / 2, m, F >> 1, cons, H);
+            row_fill(sw_row(b, b->stages - 1 - l), N / 2, m, H >> 1, NULL, 0);
+        } else {
+            row_fill(sw_row(b, l), N / 2, m, F >> 1, NULL, 0);
+            row_fill(sw_row(b, b->stages - 1 - l), N / 2, m, H >> 1, cons, H);
+        }
+
+        // halves: upper input j is 2j + f(2j), lower input j the other one of the pair
+        unsigned Fp = F >> 1, a0 = col[0];
+        for (int t = 0; t + 1 < bits; t++)
+            col[t] = (col[t + 1] ^ (((Fp >> t) & 1u) ? a0 : 0u)) >> 1;
+        for (int s = 0; s < subs; s++) {
+            int fl = b->waksman && parity32((unsigned)cons[s] & H);
+            next[2 * s] = (cons[s] ^ (fl ? (int)a0 : 0)) >> 1;
+            next[2 * s + 1] = (cons[s] ^ (fl ? 0 : (int)a0)) >> 1;
+        }
+        int *tmp = cons; cons = next; next = tmp;
+    }
+    return 1;
 }
 
-static void route(int N, const int *perm, Benes *b) {
-    route_rec(N, perm, 0, 0, b);
+/* Routes perm if it is a cyclic shift x -> (x + s) mod N; 0 (nothing written) otherwise */
+static int route_shift(int N, const int *perm, Benes *b) {
+    int s0 = perm[0];
+    for (int i = 1; i < N; i++)
+        if (perm[i] != ((i + s0) & (N - 1))) return 0;
+    int *sh = b->arena.cur, *next = b->arena.next;
+    sh[0] = s0;
+    for (int l = 0; l < b->k; l++) {
+        int n = N >> l, m = n / 2, subs = 1 << l;
+        if (n == 2) {  // x -> x + s mod 2: crossed when s is odd
+            row_fill(sw_row(b, l), N / 2, 1, 0, sh, 1);
+            break;
+        }
+        // Waksman: odd shifts cross the first stage instead of the last one,
+        // so the upper half takes the odd inputs and the shift by ceil(s/2)
+        int wk = b->waksman;
+        row_fill(sw_row(b, l), N / 2, m, 0, wk ? sh : NULL, 1);
+        row_fill(sw_row(b, b->stages - 1 - l), N / 2, m, 0, wk ? NULL : sh, 1);
+        for (int s = 0; s < subs; s++) {
+            int lo = sh[s] >> 1, hi = ((sh[s] + 1) >> 1) & (m - 1);
+            next[2 * s] = wk ? hi : lo;
+            next[2 * s + 1] = wk ? lo : hi;
+        }
+        int *tmp = sh; sh = next; next = tmp;
+    }
+    return 1;
 }
 
-// ---------- Simulator (Verification) ----------
+/*
+ * Routes perm into b and returns how (ROUTE_*): closed form for the structured
+ * classes, the looping algorithm otherwise. Classifying stops at the first
+ * entry that breaks a class, so unstructured permutations pay a few compares.
+ */
+static int route(int N, const int *perm, Benes *b) {
+    if (N < 2) return ROUTE_LOOPING;
+    if (route_classify && !(N & (N - 1))) {
+        if (route_affine(N, perm, b)) return ROUTE_AFFINE;
+        if (route_shift(N, perm, b)) return ROUTE_SHIFT;
+    }
+    route_looping(N, perm, b);
+    return ROUTE_LOOPING;
+}
 
-static void sim_rec(const Benes *b, int N, int stage_off, int wire_off, int *w) {
-    int k_local = ilog2u((unsigned)N);
-    int s_first = stage_off;
-    int s_last  = stage_off + 2 * k_local - 2;
+// ---------- Bit-Sliced Simulator (Verification) ----------
 
-    int base = wire_off / 2;
-    // Stage 1 switch logic
-    for (int p = 0; p < N / 2; ++p) {
-        int a = wire_off + 2 * p, c = a + 1;
-        if (b->sw[s_first][base + p]) {
-            int t = w[a]; w[a] = w[c]; w[c] = t;
+/*
+ * Wire data is bit-sliced: plane t holds bit t of the value on every wire
+ * (bit i of the plane = wire i). If the unshuffles between stages are skipped,
+ * sub-network j of level l (j counted in wire order) keeps its local wire u on
+ * physical wire (u << l) | rev_l(j), so every switch of level l pairs physical
+ * wires 2^l apart and the outputs end up on their own wires. Each stage is then
+ * a single masked delta swap per plane, a few instructions per 64 wires.
+ */
+
+/* Number of 64-bit words in a bit plane of N wires */
+static size_t plane_words(int N) {
+    return ((size_t)N + 63) / 64;
+}
+
+/*
+ * Swaps index bits a < b of the bit array x (N = 2^k bits, plane_words(N)
+ * words): the bit at an index with bit a = 1, bit b = 0 trades places with
+ * the one at the index with the two bits exchanged. O(N / 64) word operations:
+ * a delta swap inside each word (b < 6), a masked exchange between word pairs
+ * (a < 6 <= b) or a swap of whole words (6 <= a).
+ */
+static void index_bit_swap(uint64_t *x, int k, int a, int b) {
+    size_t words = plane_words(1 << k);
+    if (b < 6) {
+        int sh = (1 << b) - (1 << a);
+        uint64_t m = INDEX_BIT[a] & ~INDEX_BIT[b];
+        for (size_t w = 0; w < words; w++) {
+            uint64_t t = ((x[w] >> sh) ^ x[w]) & m;
+            x[w] ^= t ^ (t << sh);
+        }
+    } else if (a < 6) {
+        size_t d = (size_t)1 << (b - 6);
+        int sh = 1 << a;
+        uint64_t m = INDEX_BIT[a];
+        for (size_t w = 0; w < words; w++) {
+            if (w & d) continue;
+            uint64_t lo = x[w], hi = x[w + d];
+            x[w] = (lo & ~m) | ((hi << sh) & m);
+            x[w + d] = (hi & m) | ((lo >> sh) & ~m);
+        }
+    } else {
+        size_t da = (size_t)1 << (a - 6), db = (size_t)1 << (b - 6);
+        for (size_t w = 0; w < words; w++) {
+            if (!(w & da) || (w & db)) continue;
+            uint64_t t = x[w]; x[w] = x[w - da + db]; x[w - da + db] = t;
+        }
+    }
+}
+
+/*
+ * Physical mask of stage s: bit w is set when the switch pairing w and w + 2^l
+ * crosses. Switch q of sub-network j is row bit (j << h) | q (h = k-1-l) and
+ * physical wire (q << (l + 1)) | rev_l(j), so the mask is the row (zero-padded
+ * to N bits) with its index bits permuted: at most k - 1 index_bit_swap()
+ * passes over whole words instead of one step per switch.
+ */
+static void stage_mask(const Benes *b, int s, uint64_t *mask) {
+    int k = b->k, l = s < k ? s : 2 * k - 2 - s, h = k - 1 - l;
+    size_t words = plane_words(b->N), used = ((size_t)b->N / 2 + 63) / 64;
+    memcpy(mask, sw_row(b, s), used * sizeof(uint64_t));
+    memset(mask + used, 0, (words - used) * sizeof(uint64_t));
+    if (b->N < 128) mask[0] &= (1ull << (b->N / 2)) - 1;
+
+    // want[d]: index bit of the row that ends up as bit d of the physical wire
+    int want[BENES_MAX_K], cur[BENES_MAX_K];
+    for (int t = 0; t < l; t++) want[l - 1 - t] = h + t;
+    want[l] = k - 1;  // always 0: the padding
+    for (int u = 0; u < h; u++) want[l + 1 + u] = u;
+    for (int d = 0; d < k; d++) cur[d] = d;
+    for (int d = 0; d < k; d++) {
+        int e = d;
+        while (cur[e] != want[d]) e++;
+        if (e == d) continue;
+        index_bit_swap(mask, k, d, e);
+        cur[e] = cur[d];
+        cur[d] = want[d];
+    }
+}
+
+/* Applies one stage (level l) to nplanes planes: x ^= t ^ (t << 2^l), t = ((x >> 2^l) ^ x) & mask */
+static void stage_apply(uint64_t *planes, int nplanes, size_t words, int l, const uint64_t *mask) {
+    for (int p = 0; p < nplanes; p++) {
+        uint64_t *x = planes + (size_t)p * words;
+        if (l < 6) {
+            int sh = 1 << l;
+            #pragma omp simd
+            for (size_t w = 0; w < words; w++) {
+                uint64_t t = ((x[w] >> sh) ^ x[w]) & mask[w];
+                x[w] ^= t ^ (t << sh);
+            }
+        } else {
+            // partners are d words apart; the mask lives on the lower word
+            size_t d = (size_t)1 << (l - 6);
+            for (size_t w0 = 0; w0 < words; w0 += 2 * d) {
+                #pragma omp simd
+                for (size_t w = w0; w < w0 + d; w++) {
+                    uint64_t t = (x[w] ^ x[w + d]) & mask[w];
+                    x[w] ^= t;
+                    x[w + d] ^= t;
+                }
+            }
         }
     }
+}
+
+/*
+ * Routes nplanes bit planes (plane_words(N) words each) through the configured
+ * network in place. mask is one plane of scratch; every stage mask is built
+ * once and shared by all planes, so wide data is bandwidth bound.
+ */
+static void sim_planes(const Benes *b, uint64_t *planes, int nplanes, uint64_t *mask) {
+    size_t words = plane_words(b->N);
+    for (int s = 0; s < b->stages; s++) {
+        stage_mask(b, s, mask);
+        stage_apply(planes, nplanes, words, s < b->k ? s : 2 * b->k - 2 - s, mask);
+    }
+}
 
-    if (N > 2) {
-        int m = N / 2;
-        // Unshuffle to subnetworks
-        int *upper = xmalloc(sizeof(int) * m), *lower = xmalloc(sizeof(int) * m);
-        int cu = 0, cl = 0;
-        for (int p = 0; p < N / 2; ++p) {
-            int a = wire_off + 2 * p, c = a + 1;
-            if (b->sw[s_first][base + p] == 0) {
-                upper[cu++] = w[a]; lower[cl++] = w[c];
+/*
+ * Simulator for N that is not a power of two: pushes the labels x[0..N-1]
+ * through the network, x[i] entering on input i. Labels move through the
+ * sub-networks level by level (first stages and halving on the way down, last
+ * stages and interleaving on the way up), one int per wire, O(N) per stage.
+ * y is N ints of scratch and bnd 2^k + k + 1. Returns x or y, whichever holds
+ * the label of every output.
+ */
+static int *sim_labels(const Benes *b, int *x, int *y, int *bnd) {
+    int N = b->N, K = b->k;
+    // bounds of level l start at bnd + 2^l - 1 + l
+    bnd[0] = 0;
+    bnd[1] = N;
+    for (int l = 0; l < K; l++) {
+        int subs = 1 << l, *B = bnd + subs - 1 + l, *Bn = B + subs + 1;
+        for (int s = 0; s < subs; s++) {
+            int off = B[s], n = B[s + 1] - off, m = n / 2;
+            if (l + 1 < K) { Bn[2 * s] = off; Bn[2 * s + 1] = off + m; }
+            if (n < 2) { if (n) y[off] = x[off]; continue; }
+            for (int j = 0; j < m; j++) {
+                int t = x[off + 2 * j], u = x[off + 2 * j + 1];
+                if (sw_get(b, l, off / 2 + j)) { int v = t; t = u; u = v; }
+                if (n == 2) { y[off] = t; y[off + 1] = u; }
+                else { y[off + j] = t; y[off + m + j] = u; }
+            }
+            if (n & 1) y[off + n - 1] = x[off + n - 1];
+        }
+        if (l + 1 < K) Bn[2 * subs] = N;
+        int *t = x; x = y; y = t;
+    }
+    for (int l = K - 1; l >= 0; l--) {
+        int subs = 1 << l, *B = bnd + subs - 1 + l;
+        for (int s = 0; s < subs; s++) {
+            int off = B[s], n = B[s + 1] - off, m = n / 2;
+            if (n <= 2) { for (int j = 0; j < n; j++) y[off + j] = x[off + j]; continue; }
+            for (int q = 0; q < m; q++) {
+                int t = x[off + q], u = x[off + m + q];
+                if (sw_get(b, b->stages - 1 - l, off / 2 + q)) { int v = t; t = u; u = v; }
+                y[off + 2 * q] = t;
+                y[off + 2 * q + 1] = u;
+            }
+            if (n & 1) y[off + n - 1] = x[off + n - 1];
+        }
+        int *t = x; x = y; y = t;
+    }
+    return x;
+}
+
+/* verify() for any N: every output must carry the label perm sends there */
+static int verify_general(const Benes *b, const int *perm) {
+    int N = b->N, K = b->k;
+    int *x = xmalloc(sizeof(int) * ((size_t)2 * N + ((size_t)1 << K) + K + 1));
+    for (int i = 0; i < N; i++) x[i] = i;
+    const int *out = sim_labels(b, x, x + N, x + 2 * N);
+    int ok = 1;
+    for (int i = 0; i < N && ok; i++) ok = out[perm[i]] == i;
+    free(x);
+    return ok;
+}
+
+static int verify(const Benes *b, const int *perm) {
+    int N = b->N, k = b->k > 0 ? b->k : 0;
+    if (N & (N - 1)) return verify_general(b, perm);
+    // Waksman: the fixed switch (output pair 0 of each sub-network of 4+ wires) must be straight
+    for (int l = 0; b->waksman && l + 1 < k; l++)
+        for (int g = 0; g < N / 2; g += (N >> l) / 2)
+            if (sw_get(b, b->stages - 1 - l, g)) return 0;
+
+    size_t words = plane_words(N);
+    uint64_t *planes = xmalloc(sizeof(uint64_t) * words * (size_t)(k + 1));
+    uint64_t *mask = planes + words * (size_t)k;
+
+    // input wire i carries the value i
+    for (int t = 0; t < k; t++)
+        for (size_t w = 0; w < words; w++)
+            planes[(size_t)t * words + w] = t < 6 ? INDEX_BIT[t] : (((w >> (t - 6)) & 1) ? ~0ull : 0);
+
+    sim_planes(b, planes, k, mask);
+
+    int ok = 1;
+    for (int i = 0; i < N && ok; i++) {
+        size_t o = (size_t)perm[i];
+        for (int t = 0; t < k; t++)
+            if ((int)((planes[(size_t)t * words + (o >> 6)] >> (o & 63)) & 1) != ((i >> t) & 1)) { ok = 0; break; }
+    }
+
+    free(planes);
+    return ok;
+}
+
+// ---------- Batch Routing ----------
+
+/*
+ * Batch input: records of a uint32 N followed by the N uint32 outputs of one
+ * permutation, in host byte order. Consecutive records with the same N are
+ * read in chunks and spread over the threads; each thread routes into its own
+ * reusable network (and arena), rebuilt only when N changes.
+ */
+#define BATCH_CHUNK_WORDS (1 << 22)  /* permutation entries buffered per chunk */
+#define BATCH_MAX_K 26
+
+/* Called for every routed permutation, from the thread that routed it */
+typedef void (*BatchFn)(const Benes *b, const int *perm, long long index, void *ctx);
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* 1 if perm is a permutation of 0..N-1; seen is N bytes of scratch */
+static int is_perm(const int *perm, int N, uint8_t *seen) {
+    memset(seen, 0, (size_t)N);
+    for (int i = 0; i < N; i++) {
+        unsigned v = (unsigned)perm[i];
+        if (v >= (unsigned)N || seen[v]) return 0;
+        seen[v] = 1;
+    }
+    return 1;
+}
+
+/*
+ * Routes cnt permutations stored back to back; returns how many were invalid
+ * and adds the number routed in closed form to *fast
+ */
+static long long route_many(const int *perms, long long cnt, int N, Benes *nets,
+                            long long first, BatchFn fn, void *ctx, long long *fast) {
+    long long bad = 0, closed = 0;
+    // chunks of about 4096 wires
+    #pragma omp parallel for schedule(dynamic, N >= 4096 ? 1 : 4096 / N) reduction(+:bad, closed)
+    for (long long i = 0; i < cnt; i++) {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        Benes *b = &nets[t];
+        if (b->N != N) {
+            if (b->sw) benes_free(b);
+            benes_init(b, N);
+        }
+        const int *p = perms + i * N;
+        // the arena's output flags double as the "seen" map; they are routing scratch
+        if (!is_perm(p, N, b->arena.up_out)) { bad++; continue; }
+        if (route(N, p, b) != ROUTE_LOOPING) closed++;
+        if (fn) fn(b, p, first + i, ctx);
+    }
+    *fast += closed;
+    return bad;
+}
+
+/* State of the current run of equal-N records */
+typedef struct {
+    int N, *buf;
+    long long per_chunk, cnt, index, perms, bad, fast;
+    double route_sec, t_start;
+} BatchRun;
+
+/* Routes the buffered records of the run */
+static void batch_flush(BatchRun *r, Benes *nets, BatchFn fn, void *ctx) {
+    if (!r->cnt) return;
+    double t0 = now_sec();
+    r->bad += route_many(r->buf, r->cnt, r->N, nets, r->index, fn, ctx, &r->fast);
+    r->route_sec += now_sec() - t0;
+    r->perms += r->cnt;
+    r->index += r->cnt;
+    r->cnt = 0;
+}
+
+static void batch_report(const BatchRun *r) {
+    if (!r->perms) return;
+    double total = now_sec() - r->t_start;
+    printf("BATCH N=%d perms=%lld invalid=%lld closed_form=%lld route=%.6f sec total=%.6f sec rate=%.0f perms/s\n",
+           r->N, r->perms, r->bad, r->fast, r->route_sec, total, total > 0.0 ? (double)r->perms / total : 0.0);
+}
+
+/* Routes every record of in; prints one BATCH line per run of equal N. Returns 0 on success. */
+static int route_batch(FILE *in, BatchFn fn, void *ctx) {
+    int nt = 1;
+#ifdef _OPENMP
+    nt = omp_get_max_threads();
+#endif
+    Benes *nets = calloc((size_t)nt, sizeof(Benes));
+    if (!nets) { perror("calloc"); exit(1); }
+
+    BatchRun r;
+    memset(&r, 0, sizeof r);
+    int err = 0;
+    uint32_t hdr;
+    while (fread(&hdr, sizeof hdr, 1, in) == 1) {
+        if (hdr < 2 || hdr > (1u << BATCH_MAX_K)) {
+            fprintf(stderr, "Error: record %lld has N=%u (must be 2..2^%d).\n",
+                    r.index + r.cnt, hdr, BATCH_MAX_K);
+            err = 1;
+            break;
+        }
+        if (benes_waksman && (hdr & (hdr - 1))) {
+            fprintf(stderr, "Error: record %lld has N=%u (-waksman needs N = 2^k).\n", r.index + r.cnt, hdr);
+            err = 1;
+            break;
+        }
+        if ((int)hdr != r.N) {
+            batch_flush(&r, nets, fn, ctx);
+            batch_report(&r);
+            long long index = r.index;
+            free(r.buf);
+            memset(&r, 0, sizeof r);
+            r.N = (int)hdr;
+            r.index = index;
+            r.per_chunk = BATCH_CHUNK_WORDS / r.N > 0 ? BATCH_CHUNK_WORDS / r.N : 1;
+            r.buf = xmalloc(sizeof(int) * (size_t)r.per_chunk * (size_t)r.N);
+            r.t_start = now_sec();
+        } else if (r.cnt == r.per_chunk) {
+            batch_flush(&r, nets, fn, ctx);
+        }
+        if (fread(r.buf + r.cnt * r.N, sizeof(int), (size_t)r.N, in) != (size_t)r.N) {
+            fprintf(stderr, "Error: record %lld is truncated.\n", r.index + r.cnt);
+            err = 1;
+            break;
+        }
+        r.cnt++;
+    }
+    batch_flush(&r, nets, fn, ctx);
+    batch_report(&r);
+
+    for (int t = 0; t < nt; t++)
+        if (nets[t].sw) benes_free(&nets[t]);
+    free(nets);
+    free(r.buf);
+    return err;
+}
+
+/* Writes count random permutations of N wires as batch records (Fisher-Yates, xorshift64) */
+static void gen_batch(FILE *out, int N, long long count, uint64_t seed) {
+    uint32_t *p = xmalloc(sizeof(uint32_t) * ((size_t)N + 1));
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    p[0] = (uint32_t)N;
+    for (long long c = 0; c < count; c++) {
+        for (int i = 0; i < N; i++) p[i + 1] = (uint32_t)i;
+        for (int i = N - 1; i > 0; i--) {
+            int j = (int)(rand_next(&x) % (uint64_t)(i + 1));
+            uint32_t t = p[i + 1]; p[i + 1] = p[j + 1]; p[j + 1] = t;
+        }
+        fwrite(p, sizeof(uint32_t), (size_t)N + 1, out);
+    }
+    free(p);
+}
+
+/* -verify: checks every routed permutation with the simulator */
+static void verify_one(const Benes *b, const int *perm, long long index, void *ctx) {
+    (void)index;
+    if (!verify(b, perm)) {
+        #pragma omp atomic
+        (*(long long *)ctx)++;
+    }
+}
+
+/*
+ * -simbench <planes>: routes a random permutation of N wires, then pushes
+ * nplanes random bit planes through it (best of 5) and reports wire bits/s.
+ */
+static int sim_bench(int N, int nplanes, uint64_t seed) {
+    int *perm = xmalloc(sizeof(int) * N);
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    rand_perm(perm, N, &x);
+    Benes b;
+    benes_init(&b, N);
+    route(N, perm, &b);
+
+    size_t words = plane_words(N);
+    uint64_t *planes = xmalloc(sizeof(uint64_t) * words * ((size_t)nplanes + 1));
+    uint64_t *mask = planes + words * (size_t)nplanes;
+    double best = 1e30;
+    for (int rep = 0; rep < 5; rep++) {
+        for (size_t w = 0; w < words * (size_t)nplanes; w++) planes[w] = rand_next(&x);
+        double t0 = now_sec();
+        sim_planes(&b, planes, nplanes, mask);
+        double dt = now_sec() - t0;
+        if (dt < best) best = dt;
+    }
+    double bits = (double)N * nplanes;
+    printf("simbench N=%d planes=%d stages=%d time=%.6f sec wire_bits/s=%.3e plane_GB/s=%.2f\n",
+           N, nplanes, b.stages, best, bits / best,
+           (double)words * 8 * nplanes * b.stages * 2 / best / 1e9);
+    free(planes);
+    benes_free(&b);
+    free(perm);
+    return 0;
+}
+
+/*
+ * -compare <kmax>: for N = 2, 4, ..., 2^kmax routes one random permutation on
+ * a Benes and on a Waksman network and reports switch counts, routing time and
+ * verification (simulation) time, best of 3 runs each.
+ */
+static int topology_compare(int kmax, uint64_t seed) {
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    int saved = benes_waksman, bad = 0;
+    printf("%10s %14s %14s %8s %12s %12s %12s %12s\n", "N", "benes_sw", "waksman_sw", "saved",
+           "benes_route", "waks_route", "benes_sim", "waks_sim");
+    for (int k = 1; k <= kmax; k++) {
+        int N = 1 << k;
+        int *perm = xmalloc(sizeof(int) * (size_t)N);
+        rand_perm(perm, N, &x);
+        long long sw[2];
+        double rt[2], st[2];
+        for (int w = 0; w < 2; w++) {
+            benes_waksman = w;
+            Benes b;
+            benes_init(&b, N);
+            rt[w] = st[w] = 1e30;
+            for (int rep = 0; rep < 3; rep++) {
+                double t0 = now_sec();
+                route(N, perm, &b);
+                double t1 = now_sec();
+                if (!verify(&b, perm)) bad++;
+                double t2 = now_sec();
+                if (t1 - t0 < rt[w]) rt[w] = t1 - t0;
+                if (t2 - t1 < st[w]) st[w] = t2 - t1;
+            }
+            sw[w] = benes_switches(&b);
+            benes_free(&b);
+        }
+        printf("%10d %14lld %14lld %8lld %9.3f ms %9.3f ms %9.3f ms %9.3f ms\n", N, sw[0], sw[1], sw[0] - sw[1],
+               rt[0] * 1e3, rt[1] * 1e3, st[0] * 1e3, st[1] * 1e3);
+        free(perm);
+    }
+    benes_waksman = saved;
+    printf("Verification: %s\n", bad ? "FAILED" : "OK");
+    return bad != 0;
+}
+
+// ---------- Configuration Export ----------
+
+/*
+ * Binary configuration for hardware models (host byte order):
+ *   char magic[8] = "BENESCFG"; uint32 N, stages, words_per_stage;
+ *   then stages rows of words_per_stage uint64 words. Bit i of word j of a row
+ *   is switch 64 * j + i of that stage (1 = cross). Padding bits are 0.
+ */
+static int benes_export(const Benes *b, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) { perror(path); return 0; }
+    uint32_t hdr[3] = { (uint32_t)b->N, (uint32_t)b->stages, (uint32_t)((b->N / 2 + 63) / 64) };
+    int ok = fwrite("BENESCFG", 1, 8, f) == 8 && fwrite(hdr, sizeof hdr, 1, f) == 1;
+    for (int s = 0; ok && s < b->stages; s++)
+        ok = fwrite(sw_row(b, s), sizeof(uint64_t), hdr[2], f) == hdr[2];
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "Error: cannot write %s\n", path);
+    return ok;
+}
+
+// ---------- Bit-Permutation Engine ----------
+
+/*
+ * A routed network of n = 32, 64 or 128 wires, simulated on the bits of a
+ * single word, is a bit permutation of that word. Compiling keeps, for every
+ * stage with at least one crossed switch, the shift 2^l and the delta-swap
+ * mask built by stage_mask(); applying is then at most 2 log2(n) - 1 masked
+ * swaps per word, with no per-bit work. The apply loops run the same stage over
+ * a block of words so the compiler vectorises them (AVX2 / AVX-512 with
+ * -march=native) with the mask broadcast in a register.
+ */
+#define BITPERM_MAX_STAGES 13     /* 2 * log2(128) - 1 */
+#define BITPERM_BLOCK 1024        /* words per block; every stage runs over a block while it is in L1 */
+#define BITPERM_PAR_CUTOFF 65536  /* fewer words than this are permuted by a single thread */
+
+/**
+ * Compiled bit permutation: input bit i moves to output bit perm[i].
+ * n: word width (32, 64 or 128). stages: stages kept (all-straight stages dropped).
+ * level[s]: the swap distance is 2^level[s] bits.
+ * mask[s]: low bit of every swapped pair; mask[s][1] is the upper half for n = 128.
+ */
+typedef struct {
+    int n, stages;
+    int level[BITPERM_MAX_STAGES];
+    uint64_t mask[BITPERM_MAX_STAGES][2];
+} BitPerm;
+
+/* Routes perm (n entries) and keeps the non-empty stage masks; 0 if n or perm is invalid */
+static int bitperm_compile(BitPerm *bp, const int *perm, int n) {
+    uint8_t seen[128];
+    if ((n != 32 && n != 64 && n != 128) || !is_perm(perm, n, seen)) return 0;
+    Benes b;
+    benes_init(&b, n);
+    route(n, perm, &b);
+    bp->n = n;
+    bp->stages = 0;
+    uint64_t mask[2];
+    for (int s = 0; s < b.stages; s++) {
+        stage_mask(&b, s, mask);
+        if (!(mask[0] | (n == 128 ? mask[1] : 0))) continue;
+        bp->level[bp->stages] = s < b.k ? s : 2 * b.k - 2 - s;
+        bp->mask[bp->stages][0] = mask[0];
+        bp->mask[bp->stages][1] = n == 128 ? mask[1] : 0;
+        bp->stages++;
+    }
+    benes_free(&b);
+    return 1;
+}
+
+/* Permutes cnt 32-bit words in place */
+static void bitperm_apply32(const BitPerm *bp, uint32_t *x, size_t cnt) {
+    #pragma omp parallel for schedule(static) if (cnt >= BITPERM_PAR_CUTOFF)
+    for (size_t b0 = 0; b0 < cnt; b0 += BITPERM_BLOCK) {
+        size_t b1 = cnt - b0 < BITPERM_BLOCK ? cnt : b0 + BITPERM_BLOCK;
+        for (int s = 0; s < bp->stages; s++) {
+            uint32_t m = (uint32_t)bp->mask[s][0];
+            int sh = 1 << bp->level[s];
+            #pragma omp simd
+            for (size_t i = b0; i < b1; i++) {
+                uint32_t t = ((x[i] >> sh) ^ x[i]) & m;
+                x[i] ^= t ^ (t << sh);
+            }
+        }
+    }
+}
+
+/* Permutes cnt 64-bit words in place */
+static void bitperm_apply64(const BitPerm *bp, uint64_t *x, size_t cnt) {
+    #pragma omp parallel for schedule(static) if (cnt >= BITPERM_PAR_CUTOFF)
+    for (size_t b0 = 0; b0 < cnt; b0 += BITPERM_BLOCK) {
+        size_t b1 = cnt - b0 < BITPERM_BLOCK ? cnt : b0 + BITPERM_BLOCK;
+        for (int s = 0; s < bp->stages; s++) {
+            uint64_t m = bp->mask[s][0];
+            int sh = 1 << bp->level[s];
+            #pragma omp simd
+            for (size_t i = b0; i < b1; i++) {
+                uint64_t t = ((x[i] >> sh) ^ x[i]) & m;
+                x[i] ^= t ^ (t << sh);
+            }
+        }
+    }
+}
+
+/* Permutes cnt 128-bit words in place; word i is x[2i] (bits 0..63) and x[2i + 1] */
+static void bitperm_apply128(const BitPerm *bp, uint64_t *x, size_t cnt) {
+    #pragma omp parallel for schedule(static) if (cnt >= BITPERM_PAR_CUTOFF)
+    for (size_t b0 = 0; b0 < cnt; b0 += BITPERM_BLOCK) {
+        size_t b1 = cnt - b0 < BITPERM_BLOCK ? cnt : b0 + BITPERM_BLOCK;
+        for (int s = 0; s < bp->stages; s++) {
+            uint64_t m0 = bp->mask[s][0], m1 = bp->mask[s][1];
+            if (bp->level[s] == 6) {
+                // the halves are the two partners
+                #pragma omp simd
+                for (size_t i = b0; i < b1; i++) {
+                    uint64_t t = (x[2 * i] ^ x[2 * i + 1]) & m0;
+                    x[2 * i] ^= t;
+                    x[2 * i + 1] ^= t;
+                }
             } else {
-                lower[cl++] = w[a]; upper[cu++] = w[c];
+                int sh = 1 << bp->level[s];
+                #pragma omp simd
+                for (size_t i = b0; i < b1; i++) {
+                    uint64_t t0 = ((x[2 * i] >> sh) ^ x[2 * i]) & m0;
+                    uint64_t t1 = ((x[2 * i + 1] >> sh) ^ x[2 * i + 1]) & m1;
+                    x[2 * i] ^= t0 ^ (t0 << sh);
+                    x[2 * i + 1] ^= t1 ^ (t1 << sh);
+                }
+            }
+        }
+    }
+}
+
+/* Reference: one bit at a time. Words of n bits are n / 64 uint64 (one uint32 for n = 32). */
+static void bitperm_naive(const int *perm, int n, void *data, size_t cnt) {
+    if (n == 32) {
+        uint32_t *x = data;
+        for (size_t i = 0; i < cnt; i++) {
+            uint32_t o = 0;
+            for (int j = 0; j < 32; j++) o |= ((x[i] >> j) & 1u) << perm[j];
+            x[i] = o;
+        }
+        return;
+    }
+    uint64_t *x = data;
+    int w = n / 64;
+    for (size_t i = 0; i < cnt; i++) {
+        uint64_t o[2] = {0, 0};
+        for (int j = 0; j < n; j++)
+            o[perm[j] >> 6] |= ((x[w * i + (j >> 6)] >> (j & 63)) & 1) << (perm[j] & 63);
+        for (int h = 0; h < w; h++) x[w * i + h] = o[h];
+    }
+}
+
+/*
+ * -bitbench <n>: compiles perm (or a random one) for n-bit words, permutes
+ * 2^22 random words with the compiled stages and with the per-bit loop, and
+ * reports Mwords/s for both and whether the results agree.
+ */
+static int bitperm_bench(int n, const int *perm, uint64_t seed) {
+    int rp[128];
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    if (!perm) { rand_perm(rp, n, &x); perm = rp; }
+    BitPerm bp;
+    if (!bitperm_compile(&bp, perm, n)) { fprintf(stderr, "Error: -bitbench needs n = 32, 64 or 128 and a permutation of n bits.\n"); return 1; }
+
+    size_t cnt = (size_t)1 << 22, bytes = cnt * (size_t)(n / 8);
+    uint64_t *src = xmalloc(bytes), *a = xmalloc(bytes), *ref = xmalloc(bytes);
+    for (size_t i = 0; i < bytes / 8; i++) src[i] = rand_next(&x);
+
+    double fast = 1e30, naive = 1e30;
+    for (int rep = 0; rep < 3; rep++) {
+        memcpy(a, src, bytes);
+        double t0 = now_sec();
+        if (n == 32) bitperm_apply32(&bp, (uint32_t *)a, cnt);
+        else if (n == 64) bitperm_apply64(&bp, a, cnt);
+        else bitperm_apply128(&bp, a, cnt);
+        double dt = now_sec() - t0;
+        if (dt < fast) fast = dt;
+    }
+    memcpy(ref, src, bytes);
+    double t0 = now_sec();
+    bitperm_naive(perm, n, ref, cnt);
+    naive = now_sec() - t0;
+
+    int same = memcmp(a, ref, bytes) == 0;
+    printf("bitbench n=%d stages=%d words=%zu compiled=%.1f Mwords/s naive=%.1f Mwords/s speedup=%.1fx result=%s\n",
+           n, bp.stages, cnt, cnt / fast / 1e6, cnt / naive / 1e6, naive / fast, same ? "OK" : "MISMATCH");
+    free(src); free(a); free(ref);
+    return !same;
+}
+
+// ---------- Incremental Rerouting ----------
+
+/*
+ * A route keeps, besides the switches, the permutation of every sub-network at
+ * every level. Switch i of the first stage of a level gives the colors of its
+ * two inputs (input 2i goes up when the switch is straight), so a valid
+ * coloring is always available from the switches themselves.
+ *
+ * When some inputs get new outputs, only output pairs that received one of them
+ * can break the rule "the two inputs of an output pair take different halves".
+ * Each broken pair is repaired by flipping first-stage switches along its cycle
+ * until the walk meets the next broken pair (a cycle always holds an even number
+ * of them). The two directions are walked in lockstep and the shorter one is
+ * flipped. Only input pairs that were flipped or changed give new entries to the
+ * sub-networks below, so the work per level follows the change, not N.
+ */
+#define REROUTE_LIMIT_DIV 8  /* fall back to a full route after N / 8 units of work */
+
+/**
+ * Routing state for incremental updates of one network of N wires.
+ * p/inv: k levels of N entries; p[l*N + w] is the local output of wire w inside
+ *        its level-l sub-network, inv the local input of each local output.
+ * dcur/dnext: wires whose p changed, for the current and the next level.
+ * walk: the two repair walks. mark/epoch: duplicate filter without clearing.
+ */
+typedef struct {
+    int N, k;
+    int *p, *inv, *dcur, *dnext, *walk[2];
+    unsigned *mark, epoch;
+    void *mem;
+} BenesTrack;
+
+static void track_init(BenesTrack *t, int N) {
+    size_t n = (size_t)N, lv = (size_t)(N > 1 ? ilog2u((unsigned)N) : 1);
+    t->N = N;
+    t->k = ilog2u((unsigned)N);
+    t->mem = xmalloc(sizeof(int) * (2 * lv * n + 5 * n));
+    t->p = t->mem;
+    t->inv = t->p + lv * n;
+    t->dcur = t->inv + lv * n;
+    t->dnext = t->dcur + n;
+    t->walk[0] = t->dnext + n;
+    t->walk[1] = t->walk[0] + n;
+    t->mark = (unsigned *)(t->walk[1] + n);
+    memset(t->mark, 0, sizeof(unsigned) * n);
+    t->epoch = 0;
+}
+
+static void track_free(BenesTrack *t) {
+    free(t->mem);
+    t->mem = NULL;
+}
+
+/* Fresh epoch for the mark filter */
+static unsigned track_epoch(BenesTrack *t) {
+    if (++t->epoch == 0) {
+        memset(t->mark, 0, sizeof(unsigned) * (size_t)t->N);
+        t->epoch = 1;
+    }
+    return t->epoch;
+}
+
+/* 1 if wire w goes to the upper half at level l (input 2i is up when switch i is straight) */
+static inline int up_in_of(const Benes *b, int l, int w) {
+    return sw_get(b, l, w >> 1) ^ (~w & 1);
+}
+
+/* Rebuilds every level's sub-network permutations from perm and the routed switches */
+static void track_build(const Benes *b, BenesTrack *t, const int *perm) {
+    int N = t->N;
+    if (t->p != perm) memcpy(t->p, perm, sizeof(int) * (size_t)N);
+    for (int l = 0; l < t->k; l++) {
+        int n = N >> l, m = n / 2;
+        int *p = t->p + (size_t)l * N, *inv = t->inv + (size_t)l * N;
+        for (int w = 0; w < N; w++) inv[(w & ~(n - 1)) + p[w]] = w & (n - 1);
+        if (l + 1 == t->k) break;
+        int *q = p + N;
+        for (int off = 0; off < N; off += n)
+            for (int j = 0; j < m; j++) {
+                int u = off + 2 * j + !up_in_of(b, l, off + 2 * j);
+                q[off + j] = p[u] >> 1;
+                q[off + m + j] = p[u ^ 1] >> 1;
             }
+    }
+}
+
+/*
+ * One step of a repair walk from wire z of the sub-network at off: flips z's
+ * switch (recorded in w[*len]) and returns the next wire to flip, or -1 when
+ * the broken output pair ahead is repaired by this flip.
+ */
+static int walk_step(const Benes *b, const int *p, const int *inv, int l, int off, int z, int *w, int *len) {
+    w[(*len)++] = z >> 1;
+    int z1 = z ^ 1, y = off + inv[off + (p[z1] ^ 1)];
+    return up_in_of(b, l, z1) == up_in_of(b, l, y) ? -1 : y;
+}
+
+/*
+ * Gives input in[j] the output out[j] (j < m) and updates the routed network.
+ * Returns -1 if the change does not keep a permutation (nothing is modified),
+ * 0 after an incremental update, 1 if it fell back to a full route.
+ */
+static int reroute(Benes *b, BenesTrack *t, const int *in, const int *out, int m) {
+    int N = t->N;
+    if (N < 2) return -1;
+    unsigned e = track_epoch(t);
+    for (int j = 0; j < m; j++) {
+        if (in[j] < 0 || in[j] >= N || out[j] < 0 || out[j] >= N || t->mark[in[j]] == e) return -1;
+        t->mark[in[j]] = e;
+    }
+    // the new outputs must be exactly the outputs given up
+    e = track_epoch(t);
+    for (int j = 0; j < m; j++) t->mark[t->p[in[j]]] = e;
+    unsigned used = track_epoch(t);
+    for (int j = 0; j < m; j++) {
+        if (t->mark[out[j]] != e) return -1;
+        t->mark[out[j]] = used;
+    }
+
+    int nd = 0;
+    for (int j = 0; j < m; j++) {
+        if (t->p[in[j]] == out[j]) continue;
+        t->p[in[j]] = out[j];
+        t->dcur[nd++] = in[j];
+    }
+    for (int j = 0; j < nd; j++) t->inv[t->p[t->dcur[j]]] = t->dcur[j];
+
+    long long work = 0, limit = N / REROUTE_LIMIT_DIV + 16;
+    for (int l = 0; l < t->k && nd > 0; l++) {
+        int n = N >> l, half = n / 2, s_last = b->stages - 1 - l;
+        int *p = t->p + (size_t)l * N, *inv = t->inv + (size_t)l * N;
+        uint64_t *first = sw_row(b, l), *last = sw_row(b, s_last);
+
+        // Base case: 2x2 switches of the middle stage
+        if (n == 2) {
+            for (int j = 0; j < nd; j++) {
+                int w = t->dcur[j] >> 1;
+                uint64_t bit = 1ull << (w & 63);
+                first[w >> 6] = p[2 * w] == 1 ? first[w >> 6] | bit : first[w >> 6] & ~bit;
+            }
+            break;
         }
-        for (int i = 0; i < m; i++) w[wire_off + i] = upper[i];
-        for (int i = 0; i < m; i++) w[wire_off + m + i] = lower[i];
-        free(upper); free(lower);
 
-        sim_rec(b, m, stage_off + 1, wire_off, w);
-        sim_rec(b, m, stage_off + 1, wire_off + m, w);
+        // 1) Repair the output pairs that received a changed input
+        unsigned seen = track_epoch(t);
+        int nt = 0;  // touched switches, kept in dnext until step 2 moves them
+        int *touched = t->dnext;
+        for (int j = 0; j < nd; j++) {
+            int i = t->dcur[j], off = i & ~(n - 1), o = off + (p[i] & ~1);
+            if (t->mark[i >> 1] != seen) { t->mark[i >> 1] = seen; touched[nt++] = i >> 1; }
+            int u = off + inv[o], v = off + inv[o + 1];
+            if (up_in_of(b, l, u) != up_in_of(b, l, v)) continue;
+            // walk both ways in lockstep without flipping, then flip the shorter walk
+            int za = u, zb = v, la = 0, lb = 0, win;
+            for (;;) {
+                za = walk_step(b, p, inv, l, off, za, t->walk[0], &la);
+                if (za < 0) { win = 0; break; }
+                zb = walk_step(b, p, inv, l, off, zb, t->walk[1], &lb);
+                if (zb < 0) { win = 1; break; }
+            }
+            int len = win ? lb : la;
+            work += la + lb;
+            if (work > limit) goto full;
+            for (int x = 0; x < len; x++) {
+                int s = t->walk[win][x];
+                first[s >> 6] ^= 1ull << (s & 63);
+                if (t->mark[s] != seen) { t->mark[s] = seen; touched[nt++] = s; }
+            }
+        }
 
-        // Shuffle back
-        int *tmp = xmalloc(sizeof(int) * N);
-        for (int p = 0; p < m; p++) {
-            tmp[2 * p] = w[wire_off + p];
-            tmp[2 * p + 1] = w[wire_off + m + p];
+        // Waksman: output 0 of a changed sub-network must come from its upper half;
+        // otherwise the whole cycle through it is flipped, which keeps every pair valid
+        if (b->waksman) {
+            for (int j = 0; j < nd; j++) {
+                int off = t->dcur[j] & ~(n - 1), u0 = off + inv[off], z = u0;
+                if (up_in_of(b, l, u0)) continue;
+                do {
+                    int s = z >> 1;
+                    first[s >> 6] ^= 1ull << (s & 63);
+                    if (t->mark[s] != seen) { t->mark[s] = seen; touched[nt++] = s; }
+                    z = off + inv[off + (p[z ^ 1] ^ 1)];
+                    work++;
+                } while (z != u0);
+                if (work > limit) goto full;
+            }
         }
-        for (int i = 0; i < N; i++) w[wire_off + i] = tmp[i];
-        free(tmp);
+
+        // 2) Last stage and next-level entries of every touched input pair
+        int *q = p + N, *qinv = inv + N, nn = 0;
+        for (int x = 0; x < nt; x++) t->walk[0][x] = touched[x];
+        for (int x = 0; x < nt; x++) {
+            int s = t->walk[0][x], off = (2 * s) & ~(n - 1), j = s - off / 2;
+            int u = 2 * s + !up_in_of(b, l, 2 * s);
+            for (int h = 0; h < 2; h++) {
+                int w = u ^ h, pos = off + h * half + j, val = p[w] >> 1;
+                // output pair of w: crossed when its even output comes from the lower half
+                int oe = off + (p[w] & ~1), sl = oe >> 1;
+                uint64_t bit = 1ull << (sl & 63);
+                last[sl >> 6] = up_in_of(b, l, off + inv[oe]) ? last[sl >> 6] & ~bit : last[sl >> 6] | bit;
+                if (q[pos] != val) { q[pos] = val; t->dnext[nn++] = pos; }
+            }
+        }
+        for (int x = 0; x < nn; x++) {
+            int pos = t->dnext[x], off2 = pos & ~(half - 1);
+            qinv[off2 + q[pos]] = pos - off2;
+        }
+        work += nt;
+        if (work > limit) goto full;
+        int *tmp = t->dcur; t->dcur = t->dnext; t->dnext = tmp;
+        nd = nn;
     }
+    return 0;
 
-    // Last stage switch logic
-    for (int p = 0; p < N / 2; ++p) {
-        int a = wire_off + 2 * p, c = a + 1;
-        if (b->sw[s_last][base + p]) {
-            int t = w[a]; w[a] = w[c]; w[c] = t;
+full:
+    route(N, t->p, b);
+    track_build(b, t, t->p);
+    return 1;
+}
+
+/*
+ * -reroute <count> [-swaps m]: routes perm, then applies count updates of m
+ * random transpositions each, incrementally, and compares the mean update
+ * time with one full route.
+ */
+static int reroute_bench(const int *perm, int N, long long count, int swaps, int check, uint64_t seed) {
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    int *in = xmalloc(sizeof(int) * 4 * (size_t)swaps), *out = in + 2 * swaps;
+    Benes b;
+    benes_init(&b, N);
+    double t0 = now_sec();
+    route(N, perm, &b);
+    double full = now_sec() - t0;
+    BenesTrack t;
+    track_init(&t, N);
+    track_build(&b, &t, perm);
+
+    long long inc = 0, fell = 0, bad = 0;
+    double total = 0.0;
+    for (long long c = 0; c < count; c++) {
+        // disjoint random transpositions of the outputs
+        int m = 0;
+        for (int s = 0; s < swaps; s++) {
+            int a = (int)(rand_next(&x) % (uint64_t)N), d = (int)(rand_next(&x) % (uint64_t)N), dup = a == d;
+            for (int j = 0; j < m && !dup; j++) dup = in[j] == a || in[j] == d;
+            if (dup) continue;
+            in[m] = a; out[m++] = t.p[d];
+            in[m] = d; out[m++] = t.p[a];
         }
+        t0 = now_sec();
+        int r = reroute(&b, &t, in, out, m);
+        total += now_sec() - t0;
+        if (r < 0) { bad++; continue; }
+        if (r) fell++; else inc++;
+        if (check && !verify(&b, t.p)) bad++;
     }
+    printf("reroute N=%d updates=%lld swaps=%d incremental=%lld full=%lld avg=%.3f us full_route=%.3f us%s\n",
+           N, count, swaps, inc, fell, count ? total / count * 1e6 : 0.0, full * 1e6,
+           check ? (bad ? " verification=FAILED" : " verification=OK") : "");
+    track_free(&t);
+    benes_free(&b);
+    free(in);
+    return bad != 0;
 }
 
-static int verify(const Benes *b, const int *perm) {
-    int N = b->N;
-    int *w = xmalloc(sizeof(int) * N);
-    for (int i = 0; i < N; i++) w[i] = i;
+// ---------- Multicast Routing ----------
+
+/*
+ * A multicast request gives every output the input it listens to (src[j], or
+ * -1 for an idle output); the outputs listening to one input are its fan-out
+ * set. N = 2^k wires are routed through three networks in series:
+ *   1. concentrator: a reverse butterfly (stage s exchanges wire bit s) moves
+ *      the r-th active input to wire r. Two packets meeting at a stage-s switch
+ *      have ranks exactly 2^s apart, so they never want the same output.
+ *   2. copy network: a butterfly (stage s exchanges bit k-1-s) whose switches
+ *      can also broadcast one input to both outputs. Active input r carries the
+ *      slot interval [c_r, c_r + f_r), c_r being the prefix sum of the fan-outs
+ *      f; an interval spanning both halves of a switch is split there. With
+ *      concentrated inputs and monotone intervals the network is nonblocking
+ *      (Lee's copy network), and copy t of input r leaves on wire c_r + t.
+ *   3. a Benes network permutes slot c_r + t to the t-th output of input r,
+ *      and the unused slots to the idle outputs.
+ * A request whose fan-outs are all 0 or 1 is a partial permutation and uses
+ * the Benes network alone: 2k - 1 stages instead of 4k - 1.
+ */
+typedef struct {
+    int N, k, direct;     // direct: the last request was routed by the Benes network alone
+    size_t row_words;
+    uint64_t *conc;       // k rows of cross bits
+    uint64_t *copy;       // 2k rows: cross bits of stage s at 2s, broadcast bits at 2s + 1
+    Benes perm;           // slots -> outputs
+    int *fan, *slot, *wire, *lo, *hi;  // scratch, N ints each
+} Multicast;
 
-    sim_rec(b, N, 0, 0, w);
+static void multicast_init(Multicast *mc, int N) {
+    mc->N = N;
+    mc->k = ilog2u((unsigned)N);
+    mc->direct = 1;
+    benes_init(&mc->perm, N);
+    mc->row_words = mc->perm.row_words;
+    mc->conc = aligned_alloc(64, mc->row_words * 8 * 3 * (size_t)mc->k);
+    if (!mc->conc) {
+        perror("aligned_alloc");
+        exit(1);
+    }
+    mc->copy = mc->conc + mc->row_words * (size_t)mc->k;
+    mc->fan = xmalloc(sizeof(int) * 5 * (size_t)N);
+    mc->slot = mc->fan + N;
+    mc->wire = mc->slot + N;
+    mc->lo = mc->wire + N;
+    mc->hi = mc->lo + N;
+}
+
+static void multicast_free(Multicast *mc) {
+    benes_free(&mc->perm);
+    free(mc->conc);
+    free(mc->fan);
+    mc->conc = NULL;
+    mc->fan = NULL;
+}
 
+/* Stages used by the last request */
+static int multicast_stages(const Multicast *mc) {
+    return mc->direct ? mc->perm.stages : mc->perm.stages + 2 * mc->k;
+}
+
+/* Index of the switch on wire w in a butterfly stage that exchanges bit b */
+static inline int bfly_switch(int w, int b) {
+    return ((w >> (b + 1)) << b) | (w & ((1 << b) - 1));
+}
+
+static inline void bit_set(uint64_t *row, int i) {
+    row[i >> 6] |= 1ull << (i & 63);
+}
+
+static inline int bit_get(const uint64_t *row, int i) {
+    return (int)(row[i >> 6] >> (i & 63)) & 1;
+}
+
+/*
+ * Routes the request src into mc. Returns 0 (and routes nothing) when an
+ * entry is outside -1..N-1.
+ */
+static int multicast_route(Multicast *mc, const int *src) {
+    int N = mc->N, k = mc->k, *fan = mc->fan, *slot = mc->slot;
+    int *wire = mc->wire, *lo = mc->lo, *hi = mc->hi;
+    memset(fan, 0, sizeof(int) * (size_t)N);
+    int maxf = 0;
+    for (int j = 0; j < N; j++) {
+        int v = src[j];
+        if (v < -1 || v >= N) return 0;
+        if (v >= 0 && ++fan[v] > maxf) maxf = fan[v];
+    }
+
+    mc->direct = maxf <= 1;
+    if (mc->direct) {
+        // partial permutation: idle outputs take the idle inputs in order
+        for (int j = 0; j < N; j++)
+            if (src[j] >= 0) slot[src[j]] = j;
+        for (int j = 0, i = 0; j < N; j++) {
+            if (src[j] >= 0) continue;
+            while (fan[i]) i++;
+            slot[i++] = j;
+        }
+        route(N, slot, &mc->perm);
+        return 1;
+    }
+
+    memset(mc->conc, 0, mc->row_words * 8 * 3 * (size_t)k);
+    // active inputs in order, with their slot intervals; fan[i] becomes the next free slot of i
+    int m = 0, c = 0;
+    for (int i = 0; i < N; i++) {
+        if (!fan[i]) continue;
+        wire[m] = i;
+        lo[m] = c;
+        hi[m] = c + fan[i] - 1;
+        fan[i] = c;
+        c += hi[m] - lo[m] + 1;
+        m++;
+    }
+
+    for (int s = 0; s < k; s++) {
+        uint64_t *row = mc->conc + (size_t)s * mc->row_words;
+        int bit = 1 << s;
+        for (int r = 0; r < m; r++) {
+            int w = wire[r], t = (w & ~bit) | (r & bit);
+            if (t != w) bit_set(row, bfly_switch(w, s));
+            wire[r] = t;
+        }
+    }
+
+    for (int s = 0; s < k; s++) {
+        int b = k - 1 - s, bit = 1 << b, cnt = m;
+        uint64_t *cross = mc->copy + (size_t)2 * s * mc->row_words, *bcast = cross + mc->row_words;
+        for (int q = 0; q < cnt; q++) {
+            int w = wire[q];
+            // lo and hi agree above bit b; when they differ at b the interval spans both outputs
+            if ((lo[q] ^ hi[q]) & bit) {
+                int sw = bfly_switch(w, b);
+                bit_set(bcast, sw);
+                if (w & bit) bit_set(cross, sw);  // the lower input is the one copied
+                wire[m] = w | bit;
+                lo[m] = hi[q] & ~(bit - 1);
+                hi[m] = hi[q];
+                m++;
+                wire[q] = w & ~bit;
+                hi[q] = lo[q] | (bit - 1);
+            } else {
+                int t = (w & ~bit) | (lo[q] & bit);
+                if (t != w) bit_set(cross, bfly_switch(w, b));
+                wire[q] = t;
+            }
+        }
+    }
+
+    for (int j = 0; j < N; j++)
+        if (src[j] >= 0) slot[fan[src[j]]++] = j;
+    for (int j = 0; j < N; j++)
+        if (src[j] < 0) slot[c++] = j;
+    route(N, slot, &mc->perm);
+    return 1;
+}
+
+/* Broadcast switches set by the last request */
+static long long multicast_broadcasts(const Multicast *mc) {
+    long long n = 0;
+    for (int s = 0; !mc->direct && s < mc->k; s++) {
+        const uint64_t *row = mc->copy + (size_t)(2 * s + 1) * mc->row_words;
+        for (size_t w = 0; w < mc->row_words; w++) n += __builtin_popcountll(row[w]);
+    }
+    return n;
+}
+
+/*
+ * Simulates the routed request with input labels and checks that every busy
+ * output j receives input src[j]. A collision in the concentrator or copy
+ * network would deliver a wrong label and fail the check.
+ */
+static int multicast_verify(const Multicast *mc, const int *src) {
+    int N = mc->N, k = mc->k;
+    int *x = xmalloc(sizeof(int) * ((size_t)2 * N + ((size_t)1 << k) + k + 1));
+    for (int i = 0; i < N; i++) x[i] = i;
+    if (!mc->direct) {
+        for (int s = 0; s < k; s++) {
+            const uint64_t *row = mc->conc + (size_t)s * mc->row_words;
+            for (int i = 0; i < N / 2; i++) {
+                if (!bit_get(row, i)) continue;
+                int a = ((i >> s) << (s + 1)) | (i & ((1 << s) - 1)), t = x[a];
+                x[a] = x[a | 1 << s];
+                x[a | 1 << s] = t;
+            }
+        }
+        for (int s = 0; s < k; s++) {
+            int b = k - 1 - s;
+            const uint64_t *cross = mc->copy + (size_t)2 * s * mc->row_words, *bcast = cross + mc->row_words;
+            for (int i = 0; i < N / 2; i++) {
+                int a = ((i >> b) << (b + 1)) | (i & ((1 << b) - 1)), z = a | 1 << b;
+                if (bit_get(bcast, i)) x[a] = x[z] = bit_get(cross, i) ? x[z] : x[a];
+                else if (bit_get(cross, i)) { int t = x[a]; x[a] = x[z]; x[z] = t; }
+            }
+        }
+    }
+    const int *out = sim_labels(&mc->perm, x, x + N, x + 2 * N);
     int ok = 1;
-    for (int i = 0; i < N; i++)
-        if (w[perm[i]] != i) { ok = 0; break; }
+    for (int j = 0; j < N && ok; j++) ok = src[j] < 0 || out[j] == src[j];
+    free(x);
+    return ok;
+}
+
+/*
+ * Parses fan-out sets "in:out,out,...;in:out,..." into src (N entries, -1 for
+ * outputs not listed). Returns 0 on a malformed list, an out-of-range wire or
+ * an output claimed twice.
+ */
+static int parse_fanout(const char *s, int N, int *src) {
+    for (int j = 0; j < N; j++) src[j] = -1;
+    const char *p = s;
+    while (*p) {
+        char *e;
+        long in = strtol(p, &e, 10);
+        if (e == p || *e != ':' || in < 0 || in >= N) return 0;
+        p = e + 1;
+        for (;;) {
+            long o = strtol(p, &e, 10);
+            if (e == p || o < 0 || o >= N || src[o] >= 0) return 0;
+            src[o] = (int)in;
+            p = e;
+            if (*p != ',') break;
+            p++;
+        }
+        if (*p == ';') p++;
+        else if (*p) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Random request with every output busy and about N / fanout active inputs
+ * (chosen at random); each output picks one of them.
+ */
+static void rand_request(int *src, int N, int fanout, uint64_t *x) {
+    int m = fanout < 1 ? N : (N / fanout > 0 ? N / fanout : 1);
+    rand_perm(src, N, x);  // the first m entries are the active inputs
+    int *act = xmalloc(sizeof(int) * (size_t)m);
+    memcpy(act, src, sizeof(int) * (size_t)m);
+    for (int j = 0; j < N; j++) src[j] = act[rand_next(x) % (uint64_t)m];
+    free(act);
+}
+
+/* -multicast -gen: count random requests as batch records (src entries, -1 = idle) */
+static void gen_mcast(FILE *out, int N, long long count, int fanout, uint64_t seed) {
+    int *p = xmalloc(sizeof(int) * ((size_t)N + 1));
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    p[0] = N;
+    for (long long c = 0; c < count; c++) {
+        rand_request(p + 1, N, fanout, &x);
+        fwrite(p, sizeof(int), (size_t)N + 1, out);
+    }
+    free(p);
+}
+
+/* State of the current run of equal-N multicast records */
+typedef struct {
+    int N, *buf;
+    long long per_chunk, cnt, index, reqs, bad, direct, busy;
+    double route_sec, t_start;
+} McastRun;
+
+/* Routes the buffered requests of the run, one Multicast per thread; adds verification failures to *failed */
+static void mcast_flush(McastRun *r, Multicast *mcs, int check, long long *failed) {
+    if (!r->cnt) return;
+    int N = r->N;
+    long long bad = 0, fail = 0, direct = 0, busy = 0;
+    double t0 = now_sec();
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:bad, fail, direct, busy)
+    for (long long i = 0; i < r->cnt; i++) {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        Multicast *mc = &mcs[t];
+        if (mc->N != N) {
+            if (mc->conc) multicast_free(mc);
+            multicast_init(mc, N);
+        }
+        const int *src = r->buf + i * N;
+        if (!multicast_route(mc, src)) { bad++; continue; }
+        direct += mc->direct;
+        for (int j = 0; j < N; j++) busy += src[j] >= 0;
+        if (check && !multicast_verify(mc, src)) fail++;
+    }
+    r->route_sec += now_sec() - t0;
+    r->bad += bad;
+    r->direct += direct;
+    r->busy += busy;
+    *failed += fail;
+    r->reqs += r->cnt;
+    r->index += r->cnt;
+    r->cnt = 0;
+}
+
+static void mcast_report(const McastRun *r) {
+    if (!r->reqs) return;
+    double total = now_sec() - r->t_start;
+    int k = ilog2u((unsigned)r->N);
+    long long routed = r->reqs - r->bad;
+    printf("MCAST N=%d requests=%lld invalid=%lld unicast=%lld busy=%.1f stages=%d unicast_stages=%d route=%.6f sec total=%.6f sec rate=%.0f req/s\n",
+           r->N, r->reqs, r->bad, r->direct, routed ? (double)r->busy / (double)routed : 0.0, 4 * k - 1, 2 * k - 1,
+           r->route_sec, total, total > 0.0 ? (double)r->reqs / total : 0.0);
+}
+
+/*
+ * -multicast -batch: records are a uint32 N = 2^k followed by N int32 src
+ * entries (-1 = idle output), in host byte order. Runs of equal N are read in
+ * chunks and routed in parallel; one MCAST line per run reports the requests,
+ * the invalid ones, those routed as permutations (unicast), the mean number
+ * of busy outputs and the rate. Returns 0 on success.
+ */
+static int mcast_batch(FILE *in, int check) {
+    int nt = 1;
+#ifdef _OPENMP
+    nt = omp_get_max_threads();
+#endif
+    Multicast *mcs = calloc((size_t)nt, sizeof(Multicast));
+    if (!mcs) { perror("calloc"); exit(1); }
+
+    McastRun r;
+    memset(&r, 0, sizeof r);
+    long long failed = 0;
+    int err = 0;
+    uint32_t hdr;
+    while (fread(&hdr, sizeof hdr, 1, in) == 1) {
+        if (hdr < 2 || hdr > (1u << BATCH_MAX_K) || (hdr & (hdr - 1))) {
+            fprintf(stderr, "Error: record %lld has N=%u (must be a power of two, 2..2^%d).\n",
+                    r.index + r.cnt, hdr, BATCH_MAX_K);
+            err = 1;
+            break;
+        }
+        if ((int)hdr != r.N) {
+            mcast_flush(&r, mcs, check, &failed);
+            mcast_report(&r);
+            long long index = r.index;
+            free(r.buf);
+            memset(&r, 0, sizeof r);
+            r.N = (int)hdr;
+            r.index = index;
+            r.per_chunk = BATCH_CHUNK_WORDS / r.N > 0 ? BATCH_CHUNK_WORDS / r.N : 1;
+            r.buf = xmalloc(sizeof(int) * (size_t)r.per_chunk * (size_t)r.N);
+            r.t_start = now_sec();
+        } else if (r.cnt == r.per_chunk) {
+            mcast_flush(&r, mcs, check, &failed);
+        }
+        if (fread(r.buf + r.cnt * r.N, sizeof(int), (size_t)r.N, in) != (size_t)r.N) {
+            fprintf(stderr, "Error: record %lld is truncated.\n", r.index + r.cnt);
+            err = 1;
+            break;
+        }
+        r.cnt++;
+    }
+    mcast_flush(&r, mcs, check, &failed);
+    mcast_report(&r);
+
+    for (int t = 0; t < nt; t++)
+        if (mcs[t].conc) multicast_free(&mcs[t]);
+    free(mcs);
+    free(r.buf);
+    if (check) printf("Verification: %s (%lld failed)\n", failed ? "FAILED" : "OK", failed);
+    return err || failed;
+}
+
+/*
+ * -mcbench <kmax>: for N = 2 .. 2^kmax and fan-outs 1 (permutation), 2, 16
+ * and N (broadcast), with every output busy: stages, switches, broadcast
+ * switches used, and the best of 3 routing and simulation times.
+ */
+static int mcast_bench(int kmax, uint64_t seed) {
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    int bad = 0;
+    printf("%10s %8s %8s %7s %12s %10s %12s %12s\n", "N", "fanout", "inputs", "stages", "switches",
+           "broadcast", "route", "sim");
+    for (int k = 1; k <= kmax; k++) {
+        int N = 1 << k, fans[4] = {1, 2, 16, N};
+        int *src = xmalloc(sizeof(int) * (size_t)N);
+        uint8_t *seen = xmalloc((size_t)N);
+        Multicast mc;
+        multicast_init(&mc, N);
+        for (int f = 0; f < 4; f++) {
+            if (fans[f] > N || (f > 0 && fans[f] <= fans[f - 1])) continue;
+            if (fans[f] == 1) rand_perm(src, N, &x);
+            else rand_request(src, N, fans[f], &x);
+            int inputs = 0;
+            memset(seen, 0, (size_t)N);
+            for (int j = 0; j < N; j++)
+                if (!seen[src[j]]) { seen[src[j]] = 1; inputs++; }
+            double rt = 1e30, st = 1e30;
+            for (int rep = 0; rep < 3; rep++) {
+                double t0 = now_sec();
+                multicast_route(&mc, src);
+                double t1 = now_sec();
+                if (!multicast_verify(&mc, src)) bad++;
+                double t2 = now_sec();
+                if (t1 - t0 < rt) rt = t1 - t0;
+                if (t2 - t1 < st) st = t2 - t1;
+            }
+            int stages = multicast_stages(&mc);
+            printf("%10d %8d %8d %7d %12lld %10lld %9.3f ms %9.3f ms\n", N, fans[f], inputs, stages,
+                   (long long)stages * (N / 2), multicast_broadcasts(&mc), rt * 1e3, st * 1e3);
+        }
+        multicast_free(&mc);
+        free(seen);
+        free(src);
+    }
+    printf("Verification: %s\n", bad ? "FAILED" : "OK");
+    return bad != 0;
+}
+
+/* Prints the copy-network stages of a routed request: 0/1 = straight/cross, u/l = broadcast of the upper/lower input */
+static void write_mcast(FILE *out, const Multicast *mc) {
+    for (int s = 0; s < mc->k && !mc->direct; s++) {
+        fprintf(out, "conc %d:", s);
+        for (int i = 0; i < mc->N / 2; i++) fprintf(out, " %d", bit_get(mc->conc + (size_t)s * mc->row_words, i));
+        fprintf(out, "\n");
+    }
+    for (int s = 0; s < mc->k && !mc->direct; s++) {
+        const uint64_t *cross = mc->copy + (size_t)2 * s * mc->row_words, *bcast = cross + mc->row_words;
+        fprintf(out, "copy %d:", s);
+        for (int i = 0; i < mc->N / 2; i++)
+            fprintf(out, " %c", bit_get(bcast, i) ? (bit_get(cross, i) ? 'l' : 'u') : (char)('0' + bit_get(cross, i)));
+        fprintf(out, "\n");
+    }
+}
+
+// ---------- Benchmark & Stress Harness ----------
+
+/*
+ * Permutation families timed by -bench. Random and shifts are drawn fresh for
+ * every repetition; the adversarial ones are:
+ *   longcycle: the first-level looping graph is a single cycle through all N/2
+ *              input and output pairs, so the top-level walk cannot stop early
+ *              and no closed form applies;
+ *   near-bpc:  a bit reversal with its last two outputs swapped, which passes
+ *              the affine check until the final entries.
+ */
+enum { FAM_RANDOM, FAM_BITREV, FAM_TRANSPOSE, FAM_SHIFT, FAM_LONGCYCLE, FAM_NEARBPC, FAM_COUNT };
+static const char *const FAM_NAMES[FAM_COUNT] = {"random", "bitrev", "transpose", "shift", "longcycle", "near-bpc"};
+
+/* Fills p (N = 2^k entries) with a member of family fam; scratch holds N ints */
+static void bench_perm(int fam, int *p, int k, int *scratch, uint64_t *x) {
+    int N = 1 << k, h = N / 2;
+    switch (fam) {
+    case FAM_RANDOM:
+        rand_perm(p, N, x);
+        break;
+    case FAM_BITREV:
+    case FAM_NEARBPC:
+        for (int i = 0; i < N; i++) {
+            int r = 0;
+            for (int j = 0; j < k; j++) r |= ((i >> j) & 1) << (k - 1 - j);
+            p[i] = r;
+        }
+        if (fam == FAM_NEARBPC && N > 2) { int t = p[N - 1]; p[N - 1] = p[N - 2]; p[N - 2] = t; }
+        break;
+    case FAM_TRANSPOSE: {
+        // R x C row-major matrix, R = 2^(k/2): element (r, c) moves to (c, r) of the C x R result
+        int R = 1 << (k / 2), C = N / R;
+        for (int r = 0; r < R; r++)
+            for (int c = 0; c < C; c++) p[r * C + c] = c * R + r;
+        break;
+    }
+    case FAM_SHIFT: {
+        int s = N > 1 ? 1 + (int)(rand_next(x) % (uint64_t)(N - 1)) : 0;
+        for (int i = 0; i < N; i++) p[i] = (i + s) & (N - 1);
+        break;
+    }
+    case FAM_LONGCYCLE: {
+        // cycle a0 - b0 - a1 - b1 - ... over random orders a of input pairs and b of output pairs
+        int *a = scratch, *b = scratch + h;
+        rand_perm(a, h, x);
+        rand_perm(b, h, x);
+        uint64_t fi = rand_next(x), fo = rand_next(x);  // which wire of a pair takes which edge
+        for (int t = 0; t < h; t++) {
+            int u = (t + 1) % h, f = (int)((fo >> (t & 63)) & 1);
+            int in_a = 2 * a[t] + (1 ^ (int)((fi >> (t & 63)) & 1)), in_b = 2 * a[u] + (int)((fi >> (u & 63)) & 1);
+            p[in_a] = 2 * b[t] + f;
+            p[in_b] = 2 * b[t] + (1 ^ f);
+        }
+        break;
+    }
+    }
+}
 
-    free(w);
+/* Peak resident set of the process so far, in MiB */
+static double peak_rss_mib(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0.0;
+    return (double)ru.ru_maxrss / 1024.0;  // ru_maxrss is in KiB on Linux
+}
+
+/*
+ * -bench [kmin:]kmax [-reps r]: for N = 2^kmin .. 2^kmax and every family, the
+ * mean route() and verify() times per call and per wire, the xmalloc calls
+ * made inside each, and the peak RSS. Every routed permutation is verified;
+ * returns 1 if any fails.
+ */
+static int route_bench(int kmin, int kmax, int reps, uint64_t seed) {
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    long long bad = 0;
+    printf("%10s %-10s %-7s %11s %8s %11s %8s %7s %7s %9s\n", "N", "family", "class", "route", "ns/wire",
+           "verify", "ns/wire", "alloc_r", "alloc_v", "peak_rss");
+    for (int k = kmin; k <= kmax; k++) {
+        int N = 1 << k;
+        int *perm = xmalloc(sizeof(int) * (size_t)N), *scratch = xmalloc(sizeof(int) * (size_t)N);
+        Benes b;
+        benes_init(&b, N);
+        for (int fam = 0; fam < FAM_COUNT; fam++) {
+            double rt = 0.0, vt = 0.0;
+            long long ra = 0, va = 0;
+            int how = ROUTE_LOOPING;
+            for (int rep = 0; rep < reps; rep++) {
+                bench_perm(fam, perm, k, scratch, &x);
+                long long a0 = xmalloc_calls;
+                double t0 = now_sec();
+                how = route(N, perm, &b);
+                double t1 = now_sec();
+                long long a1 = xmalloc_calls;
+                int ok = verify(&b, perm);
+                double t2 = now_sec();
+                ra += a1 - a0;
+                va += xmalloc_calls - a1;
+                rt += t1 - t0;
+                vt += t2 - t1;
+                if (!ok) {
+                    bad++;
+                    fprintf(stderr, "FAILED: N=%d family=%s repetition %d (seed %llu)\n", N, FAM_NAMES[fam], rep,
+                            (unsigned long long)seed);
+                }
+            }
+            rt /= reps;
+            vt /= reps;
+            printf("%10d %-10s %-7s %8.3f ms %8.2f %8.3f ms %8.2f %7.1f %7.1f %5.0f MiB\n", N, FAM_NAMES[fam],
+                   ROUTE_NAMES[how], rt * 1e3, rt * 1e9 / N, vt * 1e3, vt * 1e9 / N, (double)ra / reps,
+                   (double)va / reps, peak_rss_mib());
+            fflush(stdout);
+        }
+        benes_free(&b);
+        free(perm);
+        free(scratch);
+    }
+    printf("Verification: %s (%lld failed)\n", bad ? "FAILED" : "OK", bad);
+    return bad != 0;
+}
+
+// ---------- Large Networks: Mapped Input, Streamed Output ----------
+
+/*
+ * -permfile <file>: one batch record (uint32 N, then N uint32 outputs) mapped
+ * read-only, so a 2^28 permutation is paged in by the kernel instead of being
+ * parsed from argv or copied onto the heap. Returns N, or -1 on error.
+ */
+static int map_perm(const char *path, const int **perm, void **map, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 4) { fprintf(stderr, "Error: %s is not a permutation record.\n", path); close(fd); return -1; }
+    *len = (size_t)st.st_size;
+    *map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (*map == MAP_FAILED) { perror("mmap"); return -1; }
+    posix_madvise(*map, *len, POSIX_MADV_SEQUENTIAL);
+    uint32_t n = *(const uint32_t *)*map;
+    if (n < 1 || n > (1u << BENES_MAX_K) || *len != 4 * ((size_t)n + 1)) {
+        fprintf(stderr, "Error: %s must hold 1 <= N <= 2^%d and exactly N entries.\n", path, BENES_MAX_K);
+        munmap(*map, *len);
+        return -1;
+    }
+    *perm = (const int *)((const uint32_t *)*map + 1);
+    return (int)n;
+}
+
+/*
+ * Writes the "stage s: ..." lines through a fixed buffer, one switch word at a
+ * time, so the text for large N (2 bytes per switch) is streamed rather than
+ * formatted by one printf per switch.
+ */
+static int write_settings(FILE *out, const Benes *b) {
+    enum { CAP = 1 << 16 };
+    char buf[CAP + 160];
+    size_t len = 0;
+    int half = b->N / 2, ok = 1;
+    for (int s = 0; s < b->stages && ok; s++) {
+        len += (size_t)sprintf(buf + len, "stage %d:", s);
+        const uint64_t *row = sw_row(b, s);
+        for (int i0 = 0; i0 < half; i0 += 64) {
+            uint64_t w = row[i0 >> 6];
+            int cnt = half - i0 < 64 ? half - i0 : 64;
+            for (int j = 0; j < cnt; j++) {
+                buf[len++] = ' ';
+                buf[len++] = (char)('0' + ((w >> j) & 1));
+            }
+            if (len >= CAP) { ok = fwrite(buf, 1, len, out) == len; len = 0; }
+        }
+        buf[len++] = '\n';
+    }
+    if (ok && len) ok = fwrite(buf, 1, len, out) == len;
     return ok;
 }
 
@@ -256,41 +2041,241 @@ static int parse_perm(const char *s, int **out) {
 }
 
 int main(int argc, char **argv) {
-    int k = -1, *perm = NULL, N = 0;
+    int k = -1, n = 0, *perm = NULL, N = 0, check = 0;
+    const char *batch = NULL, *export_path = NULL, *permfile = NULL, *out_path = NULL;
+    int no_verify = 0;
+    long long gen = 0;
+    uint64_t seed = 1;
+    int simbench = 0, bitbench = 0, swaps = 1;
+    long long reroutes = 0;
+    int compare = 0;
+    int bench_lo = 0, bench_hi = 0, reps = 3;
+    int multicast = 0, fanout = 2, mcbench = 0;
+    const char *mcast = NULL;
 
     for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-k") && i + 1 < argc)
             k = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            n = atoi(argv[++i]);
         else if (!strcmp(argv[i], "-perm") && i + 1 < argc)
             N = parse_perm(argv[++i], &perm);
+        else if (!strcmp(argv[i], "-batch") && i + 1 < argc)
+            batch = argv[++i];
+        else if (!strcmp(argv[i], "-gen") && i + 1 < argc)
+            gen = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-verify"))
+            check = 1;
+        else if (!strcmp(argv[i], "-export") && i + 1 < argc)
+            export_path = argv[++i];
+        else if (!strcmp(argv[i], "-simbench") && i + 1 < argc)
+            simbench = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-bitbench") && i + 1 < argc)
+            bitbench = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-permfile") && i + 1 < argc)
+            permfile = argv[++i];
+        else if (!strcmp(argv[i], "-out") && i + 1 < argc)
+            out_path = argv[++i];
+        else if (!strcmp(argv[i], "-noverify"))
+            no_verify = 1;
+        else if (!strcmp(argv[i], "-reroute") && i + 1 < argc)
+            reroutes = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-swaps") && i + 1 < argc)
+            swaps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-looping"))
+            route_classify = 0;
+        else if (!strcmp(argv[i], "-waksman"))
+            benes_waksman = 1;
+        else if (!strcmp(argv[i], "-compare") && i + 1 < argc)
+            compare = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-multicast"))
+            multicast = 1;
+        else if (!strcmp(argv[i], "-fanout") && i + 1 < argc)
+            fanout = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-mcast") && i + 1 < argc)
+            mcast = argv[++i];
+        else if (!strcmp(argv[i], "-mcbench") && i + 1 < argc)
+            mcbench = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-bench") && i + 1 < argc) {
+            const char *r = argv[++i];
+            if (sscanf(r, "%d:%d", &bench_lo, &bench_hi) != 2) { bench_lo = 4; bench_hi = atoi(r); }
+        } else if (!strcmp(argv[i], "-reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+    }
+
+    // -bitbench <n> [-perm ...]: compiled bit permutation vs per-bit loop
+    if (bitbench) {
+        if (perm && N != bitbench) { fprintf(stderr, "Error: -bitbench %d needs %d -perm items, got %d.\n", bitbench, bitbench, N); return 1; }
+        int rc = bitperm_bench(bitbench, perm, seed);
+        free(perm);
+        return rc;
+    }
+
+    // -compare <kmax>: Benes vs Waksman for N = 2 .. 2^kmax
+    if (compare > 0) {
+        if (compare > BENES_MAX_K) { fprintf(stderr, "Error: -compare needs kmax between 1 and %d.\n", BENES_MAX_K); return 1; }
+        return topology_compare(compare, seed);
     }
 
-    if (k < 0) k = 3;
-    if (!perm) {
-        N = 1 << k;
-        perm = xmalloc(sizeof(int) * N);
+    // -bench [kmin:]kmax: route and verify timings per permutation family
+    if (bench_hi > 0) {
+        if (bench_lo < 1 || bench_lo > bench_hi || bench_hi > BENES_MAX_K || reps < 1) {
+            fprintf(stderr, "Error: -bench needs 1 <= kmin <= kmax <= %d and -reps >= 1.\n", BENES_MAX_K);
+            return 1;
+        }
+        return route_bench(bench_lo, bench_hi, reps, seed);
+    }
+
+    // -mcbench <kmax>: multicast stages and routing time for N = 2 .. 2^kmax
+    if (mcbench > 0) {
+        if (mcbench > BATCH_MAX_K) { fprintf(stderr, "Error: -mcbench needs kmax between 1 and %d.\n", BATCH_MAX_K); return 1; }
+        return mcast_bench(mcbench, seed);
+    }
+
+    // -simbench <planes>: bit-sliced simulator throughput on N = 2^k
+    if (simbench > 0) {
+        if (k < 1 || k > BENES_MAX_K) { fprintf(stderr, "Error: -simbench needs -k between 1 and %d.\n", BENES_MAX_K); return 1; }
+        return sim_bench(1 << k, simbench, seed);
+    }
+
+    // -n <N> is any size; -k <k> is shorthand for N = 2^k
+    if (k > BENES_MAX_K || n < 0 || n > (1 << BENES_MAX_K)) {
+        fprintf(stderr, "Error: N must be at most 2^%d.\n", BENES_MAX_K);
+        free(perm);
+        return 1;
+    }
+    if (k >= 0 && n > 0 && n != (1 << k)) { fprintf(stderr, "Error: -k defines N=%d but -n is %d.\n", 1 << k, n); free(perm); return 1; }
+    if (k >= 0) n = 1 << k;
+
+    // -gen <count>: random batch records of N wires on stdout
+    if (gen > 0) {
+        if (n < 2) { fprintf(stderr, "Error: -gen needs -n or -k with N >= 2.\n"); return 1; }
+        if (multicast && (n & (n - 1))) { fprintf(stderr, "Error: -multicast needs N = 2^k.\n"); return 1; }
+        if (multicast) gen_mcast(stdout, n, gen, fanout, seed);
+        else gen_batch(stdout, n, gen, seed);
+        return 0;
+    }
+
+    // -batch <file|->: route every record, report permutations/s per N
+    if (batch) {
+        FILE *in = strcmp(batch, "-") ? fopen(batch, "rb") : stdin;
+        if (!in) { perror(batch); return 1; }
+        if (multicast) {
+            int rc = mcast_batch(in, check);
+            if (in != stdin) fclose(in);
+            return rc;
+        }
+        long long failed = 0;
+        int err = route_batch(in, check ? verify_one : NULL, &failed);
+        if (in != stdin) fclose(in);
+        if (check) printf("Verification: %s (%lld failed)\n", failed ? "FAILED" : "OK", failed);
+        return err || failed;
+    }
+
+    // -mcast <sets>: one multicast request given as fan-out sets "in:out,out;in:out"
+    if (mcast) {
+        N = n > 0 ? n : 8;
+        free(perm);
+        if (N < 2 || (N & (N - 1)) || N > (1 << BATCH_MAX_K)) { fprintf(stderr, "Error: -mcast needs N = 2^k, 2..2^%d.\n", BATCH_MAX_K); return 1; }
+        int *src = xmalloc(sizeof(int) * (size_t)N);
+        if (!parse_fanout(mcast, N, src)) {
+            fprintf(stderr, "Error: bad fan-out sets for N=%d (in:out,out;... with every output listed once).\n", N);
+            free(src);
+            return 1;
+        }
+        Multicast mc;
+        multicast_init(&mc, N);
+        multicast_route(&mc, src);
+        fprintf(stderr, "Routing: %s on %d stages (%lld switches, %lld broadcasting)\n",
+                mc.direct ? "unicast" : "multicast", multicast_stages(&mc),
+                (long long)multicast_stages(&mc) * (N / 2), multicast_broadcasts(&mc));
+        write_mcast(stdout, &mc);
+        int rc = !write_settings(stdout, &mc.perm);
+        if (!no_verify) {
+            int ok = multicast_verify(&mc, src);
+            printf("Verification: %s\n", ok ? "OK" : "FAILED");
+            rc |= !ok;
+        }
+        multicast_free(&mc);
+        free(src);
+        return rc;
+    }
+
+    // -permfile <file>: mapped binary permutation, N taken from the record
+    const int *in = perm;
+    void *map = NULL;
+    size_t map_len = 0;
+    if (permfile) {
+        free(perm);
+        perm = NULL;
+        N = map_perm(permfile, &in, &map, &map_len);
+        if (N < 0) return 1;
+        if (n > 0 && n != N) { fprintf(stderr, "Error: N=%d was requested but %s contains %d items.\n", n, permfile, N); munmap(map, map_len); return 1; }
+    }
+
+    if (!in) {
+        N = n > 0 ? n : 8;
+        perm = xmalloc(sizeof(int) * (size_t)N);
         for (int i = 0; i < N; i++) perm[i] = i; // Identity
+        in = perm;
         fprintf(stderr, "(Default) Using identity permutation N=%d\n", N);
-    } else if (N != (1 << k)) {
-        fprintf(stderr, "Error: -k defines N=%d but -perm contains %d items.\n", 1 << k, N);
+    } else if (N < 1 || (n > 0 && N != n)) {
+        fprintf(stderr, "Error: N=%d was requested but -perm contains %d items.\n", n, N);
+        free(perm);
+        return 1;
+    }
+
+    // -reroute <count> [-swaps m]: incremental updates starting from the input permutation
+    if (reroutes > 0) {
+        uint8_t *seen = xmalloc((size_t)N);
+        int rc = 1;
+        if (N < 2 || (N & (N - 1)) || swaps < 1) fprintf(stderr, "Error: -reroute needs N = 2^k >= 2 and -swaps >= 1.\n");
+        else if (!is_perm(in, N, seen)) fprintf(stderr, "Error: the input is not a permutation of 0..%d.\n", N - 1);
+        else rc = reroute_bench(in, N, reroutes, swaps, check, seed);
+        free(seen);
+        free(perm);
+        if (map) munmap(map, map_len);
+        return rc;
+    }
+
+    if (benes_waksman && (N & (N - 1))) {
+        fprintf(stderr, "Error: -waksman needs N = 2^k.\n");
+        free(perm);
+        if (map) munmap(map, map_len);
         return 1;
     }
 
     Benes b;
     benes_init(&b, N);
-    route(N, perm, &b);
+    int rc = 0;
+    // the arena's up_in bytes are free until routing starts
+    if (!is_perm(in, N, b.arena.up_in)) {
+        fprintf(stderr, "Error: the input is not a permutation of 0..%d.\n", N - 1);
+        rc = 1;
+    } else {
+        int how = route(N, in, &b);
+        fprintf(stderr, "Routing: %s on %s (%lld switches", ROUTE_NAMES[how],
+                b.waksman ? "Waksman" : "Benes", benes_switches(&b));
+        if (N & (N - 1))
+            fprintf(stderr, "; %lld when padded to N=%d", (2ll * b.k - 1) << (b.k - 1), 1 << b.k);
+        fprintf(stderr, ")\n");
 
-    // Print switch configuration for each stage
-    for (int s = 0; s < b.stages; s++) {
-        printf("stage %d:", s);
-        for (int i = 0; i < N / 2; i++)
-            printf(" %d", b.sw[s][i]);
-        printf("\n");
-    }
+        // Switch configuration for each stage, on stdout or streamed to -out
+        FILE *out = out_path ? fopen(out_path, "w") : stdout;
+        if (!out) { perror(out_path); rc = 1; }
+        else {
+            if (!write_settings(out, &b)) { fprintf(stderr, "Error: cannot write switch settings\n"); rc = 1; }
+            if (out != stdout && fclose(out) != 0) rc = 1;
+        }
 
-    printf("Verification: %s\n", verify(&b, perm) ? "OK" : "FAILED");
+        if (!no_verify) printf("Verification: %s\n", verify(&b, in) ? "OK" : "FAILED");
+        if (export_path && !benes_export(&b, export_path)) rc = 1;
+    }
 
     benes_free(&b);
     free(perm);
-    return 0;
+    if (map) munmap(map, map_len);
+    return rc;
 }
@@ -0,0 +1,466 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Sub-problems with fewer edges than this are colored by the thread that split them */
+#define CLOS_TASK_CUTOFF 16384
+
+/**
+ * Three-stage Clos(m, n, r) network.
+ * r ingress switches (n x m), m middle switches (r x r), r egress switches (m x n);
+ * N = n * r wires. Input i enters ingress switch i / n on port i % n, and output o
+ * leaves egress switch o / n on port o % n. Rearrangeable when m >= n.
+ * ing[a * n + p]: middle switch that ingress switch a connects its port p to.
+ * mid[c * r + a]: egress switch that middle switch c connects ingress a to (-1 = idle).
+ * egr[b * m + c]: output port of egress switch b fed by middle switch c (-1 = idle).
+ */
+typedef struct {
+    int m, n, r, N;
+    int *ing, *mid, *egr;
+} Clos;
+
+// ---------- Utilities ----------
+
+/* Safe malloc with error checking */
+static void *xmalloc(size_t n) {
+    void *p = malloc(n);
+    if (!p) {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* xorshift64 step; *x must be nonzero */
+static inline uint64_t rand_next(uint64_t *x) {
+    *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+    return *x;
+}
+
+/* Random permutation of 0..N-1 (Fisher-Yates) */
+static void rand_perm(int *p, int N, uint64_t *x) {
+    for (int i = 0; i < N; i++) p[i] = i;
+    for (int i = N - 1; i > 0; i--) {
+        int j = (int)(rand_next(x) % (uint64_t)(i + 1));
+        int t = p[i]; p[i] = p[j]; p[j] = t;
+    }
+}
+
+static void clos_init(Clos *c, int m, int n, int r) {
+    c->m = m;
+    c->n = n;
+    c->r = r;
+    c->N = n * r;
+    c->ing = xmalloc(sizeof(int) * ((size_t)c->N + 2 * (size_t)m * r));
+    c->mid = c->ing + c->N;
+    c->egr = c->mid + (size_t)m * r;
+}
+
+static void clos_free(Clos *c) {
+    free(c->ing);
+    c->ing = c->mid = c->egr = NULL;
+}
+
+// ---------- Euler Partition ----------
+
+/*
+ * Splits the edges (lu[j], lv[j]) of a bipartite multigraph on r + r vertices,
+ * every vertex of even degree, into two halves with half of each vertex's
+ * degree in each: half[j] = 0 or 1. The edges are walked as closed trails; an
+ * edge walked from its left end goes to half 0, from its right end to half 1,
+ * so every pass through a vertex adds one edge to each half.
+ */
+static void euler_split(const int *lu, const int *lv, int E, int r, uint8_t *half) {
+    int V = 2 * r;
+    int *start = xmalloc(sizeof(int) * ((size_t)V + 1 + (size_t)V + 2 * (size_t)E));
+    int *ptr = start + V + 1, *adj = ptr + V;
+    uint8_t *used = xmalloc((size_t)E);
+    memset(start, 0, sizeof(int) * ((size_t)V + 1));
+    memset(used, 0, (size_t)E);
+    for (int j = 0; j < E; j++) {
+        start[lu[j] + 1]++;
+        start[r + lv[j] + 1]++;
+    }
+    for (int v = 0; v < V; v++) start[v + 1] += start[v];
+    memcpy(ptr, start, sizeof(int) * (size_t)V);
+    for (int j = 0; j < E; j++) {
+        adj[ptr[lu[j]]++] = j;
+        adj[ptr[r + lv[j]]++] = j;
+    }
+    memcpy(ptr, start, sizeof(int) * (size_t)V);
+
+    for (int s = 0; s < V; s++) {
+        for (;;) {
+            // skip the edges of s already walked from their other end
+            while (ptr[s] < start[s + 1] && used[adj[ptr[s]]]) ptr[s]++;
+            if (ptr[s] == start[s + 1]) break;
+            int v = s;
+            for (;;) {
+                while (ptr[v] < start[v + 1] && used[adj[ptr[v]]]) ptr[v]++;
+                if (ptr[v] == start[v + 1]) break;  // back at the start of the trail
+                int j = adj[ptr[v]++];
+                used[j] = 1;
+                if (v < r) { half[j] = 0; v = r + lv[j]; }
+                else { half[j] = 1; v = lu[j]; }
+            }
+        }
+    }
+    free(start);
+    free(used);
+}
+
+/*
+ * Perfect matching of a d-regular bipartite multigraph with E = d * r edges
+ * (Alon 2003). With 2^t >= E, every edge gets weight alpha = 2^t / d and a
+ * "bad" matching (left i, right i) gets weight beta = 2^t - alpha * d, which
+ * makes the graph 2^t-regular. Each round halves the weights with an Euler
+ * split of the odd-weight edges and keeps the half with less bad weight; after
+ * t rounds the graph is 1-regular and, the bad weight being below 1, made of
+ * real edges only. Writes the r chosen edge indices to out.
+ */
+static void alon_matching(const int *lu, const int *lv, int E, int d, int r, int *out) {
+    int t = 0;
+    while ((1ll << t) < (long long)E) t++;
+    long long alpha = (1ll << t) / d, beta = (1ll << t) - alpha * d;
+    int W = E + (beta ? r : 0);
+    int *wu = xmalloc(sizeof(int) * 5 * (size_t)W), *wv = wu + W, *id = wv + W, *ou = id + W, *ov = ou + W;
+    long long *w = xmalloc(sizeof(long long) * (size_t)W);
+    uint8_t *half = xmalloc((size_t)W);
+    int *oj = xmalloc(sizeof(int) * (size_t)W);
+    for (int j = 0; j < E; j++) { wu[j] = lu[j]; wv[j] = lv[j]; id[j] = j; w[j] = alpha; }
+    for (int i = 0; beta && i < r; i++) { wu[E + i] = wv[E + i] = i; id[E + i] = -1; w[E + i] = beta; }
+
+    for (int round = 0; round < t; round++) {
+        int odd = 0;
+        for (int j = 0; j < W; j++) {
+            half[j] = 0;
+            if (w[j] & 1) { ou[odd] = wu[j]; ov[odd] = wv[j]; oj[odd++] = j; }
+        }
+        if (odd) {
+            uint8_t *h = xmalloc((size_t)odd);
+            euler_split(ou, ov, odd, r, h);
+            for (int q = 0; q < odd; q++) half[oj[q]] = (uint8_t)(h[q] + 1);  // 1 or 2: the half that gets the odd copy
+            free(h);
+        }
+        long long bad[2] = {0, 0};
+        for (int j = 0; j < W; j++)
+            if (id[j] < 0)
+                for (int s = 0; s < 2; s++) bad[s] += w[j] / 2 + (half[j] == s + 1);
+        int keep = bad[1] < bad[0];
+        int nw = 0;
+        for (int j = 0; j < W; j++) {
+            long long x = w[j] / 2 + (half[j] == keep + 1);
+            if (!x) continue;
+            wu[nw] = wu[j]; wv[nw] = wv[j]; id[nw] = id[j]; w[nw] = x;
+            nw++;
+        }
+        W = nw;
+    }
+    // 1-regular now: one edge per left vertex, none of them bad
+    for (int j = 0; j < W; j++) out[wu[j]] = id[j];
+    free(wu);
+    free(w);
+    free(half);
+    free(oj);
+}
+
+// ---------- Edge Coloring ----------
+
+/*
+ * Colors the E = d * r edges listed in edges (input wires; left end eu, right
+ * end ev) of a d-regular bipartite multigraph with colors c0 .. c0 + d - 1.
+ * Odd d: a perfect matching takes one color. Even d: an Euler split gives two
+ * (d/2)-regular halves, colored independently (as OpenMP tasks when large).
+ */
+static void color_edges(const int *eu, const int *ev, int *edges, int E, int d, int c0, int r, int *color) {
+    if (d == 0) return;
+    if (d == 1) {
+        for (int j = 0; j < E; j++) color[edges[j]] = c0;
+        return;
+    }
+    int *lu = xmalloc(sizeof(int) * 2 * (size_t)E), *lv = lu + E;
+    for (int j = 0; j < E; j++) { lu[j] = eu[edges[j]]; lv[j] = ev[edges[j]]; }
+    if (d & 1) {
+        int *match = xmalloc(sizeof(int) * (size_t)r);
+        uint8_t *taken = calloc((size_t)E, 1);
+        if (!taken) { perror("calloc"); exit(1); }
+        alon_matching(lu, lv, E, d, r, match);
+        for (int i = 0; i < r; i++) { color[edges[match[i]]] = c0; taken[match[i]] = 1; }
+        int ne = 0;
+        for (int j = 0; j < E; j++)
+            if (!taken[j]) { lu[ne] = lu[j]; lv[ne] = lv[j]; edges[ne++] = edges[j]; }
+        free(match);
+        free(taken);
+        E = ne;
+        d--;
+        c0++;
+    }
+    uint8_t *half = xmalloc((size_t)E);
+    euler_split(lu, lv, E, r, half);
+    free(lu);
+    // half 0 first; both halves hold E / 2 edges
+    int i = 0, j = E - 1;
+    while (i < j) {
+        while (i < j && !half[i]) i++;
+        while (i < j && half[j]) j--;
+        if (i < j) { int t = edges[i]; edges[i] = edges[j]; edges[j] = t; half[i] = 0; half[j] = 1; }
+    }
+    free(half);
+    int h = E / 2;
+    #pragma omp task if (h >= CLOS_TASK_CUTOFF)
+    color_edges(eu, ev, edges, h, d / 2, c0, r, color);
+    color_edges(eu, ev, edges + h, h, d / 2, c0 + d / 2, r, color);
+    #pragma omp taskwait
+}
+
+/*
+ * Routes perm through c: input i and output perm[i] become an edge between
+ * ingress i / n and egress perm[i] / n, and its color is the middle switch.
+ * Only the first n middle switches are used.
+ */
+static void clos_route(Clos *c, const int *perm) {
+    int N = c->N, n = c->n, r = c->r, m = c->m;
+    int *eu = xmalloc(sizeof(int) * 4 * (size_t)N), *ev = eu + N, *edges = ev + N, *color = edges + N;
+    for (int i = 0; i < N; i++) { eu[i] = i / n; ev[i] = perm[i] / n; edges[i] = i; }
+    #pragma omp parallel
+    #pragma omp single
+    color_edges(eu, ev, edges, N, n, 0, r, color);
+
+    for (size_t q = 0; q < 2 * (size_t)m * r; q++) c->mid[q] = -1;
+    for (int i = 0; i < N; i++) {
+        int a = i / n, b = perm[i] / n, col = color[i];
+        c->ing[i] = col;
+        c->mid[(size_t)col * r + a] = b;
+        c->egr[(size_t)b * m + col] = perm[i] % n;
+    }
+    free(eu);
+}
+
+// ---------- Verification ----------
+
+/*
+ * Simulates the configured switches: every switch must connect distinct inputs
+ * to distinct outputs, and the label entering input i must leave on perm[i].
+ * Checks only the switch settings, not the coloring that produced them.
+ */
+static int clos_verify(const Clos *c, const int *perm) {
+    int N = c->N, n = c->n, r = c->r, m = c->m, ok = 1;
+    int *out = xmalloc(sizeof(int) * (size_t)N);
+    int most = m > r ? m : r;  // m >= n
+    uint8_t *seen = xmalloc((size_t)most);
+    for (int i = 0; i < N; i++) out[i] = -1;
+    // ingress: distinct middle switches per switch
+    for (int a = 0; a < r && ok; a++) {
+        memset(seen, 0, (size_t)m);
+        for (int p = 0; p < n && ok; p++) {
+            int col = c->ing[a * n + p];
+            ok = col >= 0 && col < m && !seen[col];
+            if (ok) seen[col] = 1;
+        }
+    }
+    // middle: distinct egress switches per switch
+    for (int col = 0; col < m && ok; col++) {
+        memset(seen, 0, (size_t)r);
+        for (int a = 0; a < r && ok; a++) {
+            int b = c->mid[(size_t)col * r + a];
+            if (b < 0) continue;
+            ok = b < r && !seen[b];
+            if (ok) seen[b] = 1;
+        }
+    }
+    // egress: distinct output ports per switch
+    for (int b = 0; b < r && ok; b++) {
+        memset(seen, 0, (size_t)n);
+        for (int col = 0; col < m && ok; col++) {
+            int q = c->egr[(size_t)b * m + col];
+            if (q < 0) continue;
+            ok = q < n && !seen[q];
+            if (ok) seen[q] = 1;
+        }
+    }
+    for (int i = 0; i < N && ok; i++) {
+        int a = i / n, col = c->ing[i], b = c->mid[(size_t)col * r + a];
+        int q = b < 0 ? -1 : c->egr[(size_t)b * m + col];
+        if (q < 0) ok = 0;
+        else out[b * n + q] = i;
+    }
+    for (int i = 0; i < N && ok; i++) ok = out[perm[i]] == i;
+    free(out);
+    free(seen);
+    return ok;
+}
+
+// ---------- Benchmark ----------
+
+/*
+ * -bench <rmax>: reconfiguration latency for r = 2, 4, ... rmax outer switches
+ * (random permutations, best of 3 routes), with every route verified.
+ */
+static int clos_bench(int m, int n, int rmax, uint64_t seed) {
+    uint64_t x = seed ? seed : 88172645463325252ull;
+    int bad = 0, nt = 1;
+#ifdef _OPENMP
+    nt = omp_get_max_threads();
+#endif
+    printf("Clos(m=%d, n=%d, r), %d thread(s)\n", m, n, nt);
+    printf("%10s %12s %12s %10s %12s\n", "r", "N", "route", "ns/wire", "verify");
+    for (int r = 2; r <= rmax; r *= 2) {
+        Clos c;
+        clos_init(&c, m, n, r);
+        int *perm = xmalloc(sizeof(int) * (size_t)c.N);
+        double rt = 1e30, vt = 1e30;
+        for (int rep = 0; rep < 3; rep++) {
+            rand_perm(perm, c.N, &x);
+            double t0 = now_sec();
+            clos_route(&c, perm);
+            double t1 = now_sec();
+            if (!clos_verify(&c, perm)) bad++;
+            double t2 = now_sec();
+            if (t1 - t0 < rt) rt = t1 - t0;
+            if (t2 - t1 < vt) vt = t2 - t1;
+        }
+        printf("%10d %12d %9.3f ms %10.1f %9.3f ms\n", r, c.N, rt * 1e3, rt * 1e9 / c.N, vt * 1e3);
+        fflush(stdout);
+        free(perm);
+        clos_free(&c);
+    }
+    printf("Verification: %s\n", bad ? "FAILED" : "OK");
+    return bad != 0;
+}
+
+// ---------- Main & CLI Parsing ----------
+
+static int parse_perm(const char *s, int **out) {
+    int cap = 128, n = 0;
+    int *v = xmalloc(sizeof(int) * cap);
+    const char *p = s;
+    while (*p) {
+        while (*p && isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+        char *e;
+        long val = strtol(p, &e, 10);
+        if (p == e) { if (*p == ',') { p++; continue; } break; }
+        if (n == cap) { cap *= 2; v = realloc(v, sizeof(int) * cap); }
+        v[n++] = (int)val;
+        p = e;
+        if (*p == ',') p++;
+    }
+    *out = v;
+    return n;
+}
+
+/* 1 if perm is a permutation of 0..N-1 */
+static int is_perm(const int *perm, int N) {
+    uint8_t *seen = calloc((size_t)N, 1);
+    if (!seen) { perror("calloc"); exit(1); }
+    int ok = 1;
+    for (int i = 0; i < N && ok; i++) {
+        unsigned v = (unsigned)perm[i];
+        ok = v < (unsigned)N && !seen[v];
+        if (ok) seen[v] = 1;
+    }
+    free(seen);
+    return ok;
+}
+
+/* Prints the three stages: middle switch per ingress port, egress per middle port, output port per egress port */
+static void clos_print(const Clos *c) {
+    for (int a = 0; a < c->r; a++) {
+        printf("ingress %d:", a);
+        for (int p = 0; p < c->n; p++) printf(" %d", c->ing[a * c->n + p]);
+        printf("\n");
+    }
+    for (int col = 0; col < c->m; col++) {
+        printf("middle %d:", col);
+        for (int a = 0; a < c->r; a++) {
+            int b = c->mid[(size_t)col * c->r + a];
+            if (b < 0) printf(" -"); else printf(" %d", b);
+        }
+        printf("\n");
+    }
+    for (int b = 0; b < c->r; b++) {
+        printf("egress %d:", b);
+        for (int col = 0; col < c->m; col++) {
+            int q = c->egr[(size_t)b * c->m + col];
+            if (q < 0) printf(" -"); else printf(" %d", q);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    int m = -1, n = 4, r = 4, N = 0, *perm = NULL, bench = 0, random = 0;
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-m") && i + 1 < argc)
+            m = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            n = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            r = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-perm") && i + 1 < argc)
+            N = parse_perm(argv[++i], &perm);
+        else if (!strcmp(argv[i], "-random"))
+            random = 1;
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-bench") && i + 1 < argc)
+            bench = atoi(argv[++i]);
+    }
+    if (m < 0) m = n;
+    if (n < 1 || r < 1 || m < n || (long long)n * r > (1 << 28)) {
+        fprintf(stderr, "Error: need n >= 1, r >= 1, m >= n (rearrangeable) and n * r <= 2^28.\n");
+        free(perm);
+        return 1;
+    }
+
+    // -bench <rmax>: reconfiguration latency as r grows
+    if (bench > 0) {
+        free(perm);
+        return clos_bench(m, n, bench, seed);
+    }
+
+    if (perm && N != n * r) {
+        fprintf(stderr, "Error: Clos(%d, %d, %d) has N=%d but -perm contains %d items.\n", m, n, r, n * r, N);
+        free(perm);
+        return 1;
+    }
+    N = n * r;
+    if (!perm) {
+        perm = xmalloc(sizeof(int) * (size_t)N);
+        uint64_t x = seed ? seed : 88172645463325252ull;
+        if (random) rand_perm(perm, N, &x);
+        else for (int i = 0; i < N; i++) perm[i] = i; // Identity
+        fprintf(stderr, "(Default) Using %s permutation N=%d\n", random ? "a random" : "identity", N);
+    }
+    if (!is_perm(perm, N)) {
+        fprintf(stderr, "Error: the input is not a permutation of 0..%d.\n", N - 1);
+        free(perm);
+        return 1;
+    }
+
+    Clos c;
+    clos_init(&c, m, n, r);
+    clos_route(&c, perm);
+    clos_print(&c);
+    int ok = clos_verify(&c, perm);
+    printf("Verification: %s\n", ok ? "OK" : "FAILED");
+    clos_free(&c);
+    free(perm);
+    return !ok;
+}
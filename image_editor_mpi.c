@@ -1,6 +1,6 @@
 // image_editor_mpi.c
 // MPI parallel implementation for P5/P6 PNM images
-// Supports: SELECT ALL, BENCH GAUSS_SOBEL, and SAVE
+// Supports: SELECT ALL, BENCH GAUSS_SOBEL, GRAYSCALE/TO_RGB/CONVERT, and SAVE
 // Compilation: mpicc -O3 -march=native -std=c11 image_editor_mpi.c -lm -o editor_mpi
 // Run: mpirun -np 8 ./editor_mpi < bench.in
 
@@ -35,6 +35,13 @@ typedef struct {
     int *displs;
 } MPIImage;
 
+// Clamps integer values to uint8_t range [0, 255]
+static inline uint8_t clamp_u8_int(int v) {
+    if (v < 0) return 0;
+    if (v > 255) return 255;
+    return (uint8_t)v;
+}
+
 // Clamps double values to uint8_t range [0, 255]
 static inline uint8_t clamp_u8_double(double v) {
     if (v < 0.0) return 0;
@@ -142,6 +149,7 @@ static void compute_row_partition(MPIImage *img) {
 // Prepare displacement and counts for Scatterv/Gatherv
 static void build_counts_displs_rank0(MPIImage *img) {
     if (img->rank != 0) return;
+    free(img->counts); free(img->displs);
     img->counts = (int*)malloc(img->size * sizeof(int));
     img->displs = (int*)malloc(img->size * sizeof(int));
     int base = img->h / img->size, rem = img->h % img->size, disp = 0;
@@ -284,6 +292,810 @@ static void mpi_apply_sobel(MPIImage *img) {
     if (img->rank == 0) printf("APPLY SOBEL done\n");
 }
 
+// ==== Color-space conversion (fixed-point, integer only) ====
+// Row kernels work on the interleaved layout and use only integer arithmetic,
+// so -O3 -march=native vectorizes them and the serial, OMP and MPI editors
+// produce bit-identical results. src and dst may alias for 3->3 kernels.
+typedef void (*RowKernel)(const uint8_t *src, uint8_t *dst, int n);
+
+// BT.601 luma with 8-bit weights (77 + 150 + 29 = 256)
+static void cvt_rgb_to_gray_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        dst[i] = (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+    }
+}
+
+// Replicates the gray value on all three channels
+static void cvt_gray_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        uint8_t v = src[i];
+        dst[3 * i] = v; dst[3 * i + 1] = v; dst[3 * i + 2] = v;
+    }
+}
+
+// Full-range (JPEG) YCbCr with 16-bit fixed-point coefficients
+static void cvt_rgb_to_ycbcr_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        int y  = ( 19595 * r + 38470 * g +  7471 * b + 32768) >> 16;
+        int cb = (-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16;
+        int cr = ( 32768 * r - 27439 * g -  5329 * b + (128 << 16) + 32768) >> 16;
+        dst[3 * i] = clamp_u8_int(y);
+        dst[3 * i + 1] = clamp_u8_int(cb);
+        dst[3 * i + 2] = clamp_u8_int(cr);
+    }
+}
+
+static void cvt_ycbcr_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int y = src[3 * i] << 16, cb = src[3 * i + 1] - 128, cr = src[3 * i + 2] - 128;
+        dst[3 * i]     = clamp_u8_int((y + 91881 * cr + 32768) >> 16);
+        dst[3 * i + 1] = clamp_u8_int((y - 22554 * cb - 46802 * cr + 32768) >> 16);
+        dst[3 * i + 2] = clamp_u8_int((y + 116130 * cb + 32768) >> 16);
+    }
+}
+
+// 8-bit HSV: hue is scaled to [0, 255] (43 units per 60 degree sector)
+static void cvt_rgb_to_hsv_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        int mx = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        int mn = r < g ? (r < b ? r : b) : (g < b ? g : b);
+        int d = mx - mn, h = 0, s = 0;
+        if (d != 0) {
+            s = (255 * d + mx / 2) / mx;
+            if (mx == r) h = (43 * (g - b)) / d;
+            else if (mx == g) h = 85 + (43 * (b - r)) / d;
+            else h = 171 + (43 * (r - g)) / d;
+        }
+        dst[3 * i] = (uint8_t)(h & 255);
+        dst[3 * i + 1] = (uint8_t)s;
+        dst[3 * i + 2] = (uint8_t)mx;
+    }
+}
+
+static void cvt_hsv_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int h = src[3 * i], s = src[3 * i + 1], v = src[3 * i + 2];
+        int region = h / 43, rem = (h - region * 43) * 6;
+        int p = (v * (255 - s)) >> 8;
+        int q = (v * (255 - ((s * rem) >> 8))) >> 8;
+        int t = (v * (255 - ((s * (255 - rem)) >> 8))) >> 8;
+        int r, g, b;
+        if (s == 0) { r = g = b = v; }
+        else switch (region) {
+            case 0:  r = v; g = t; b = p; break;
+            case 1:  r = q; g = v; b = p; break;
+            case 2:  r = p; g = v; b = t; break;
+            case 3:  r = p; g = q; b = v; break;
+            case 4:  r = t; g = p; b = v; break;
+            default: r = v; g = p; b = q; break;
+        }
+        dst[3 * i] = (uint8_t)r; dst[3 * i + 1] = (uint8_t)g; dst[3 * i + 2] = (uint8_t)b;
+    }
+}
+
+typedef struct {
+    const char *name;   // command argument / message
+    int in_ch, out_ch;
+    RowKernel fn;
+} ColorKernel;
+
+static const ColorKernel COLOR_KERNELS[] = {
+    {"GRAYSCALE", 3, 1, cvt_rgb_to_gray_row},
+    {"TO_RGB",    1, 3, cvt_gray_to_rgb_row},
+    {"RGB2YCBCR", 3, 3, cvt_rgb_to_ycbcr_row},
+    {"YCBCR2RGB", 3, 3, cvt_ycbcr_to_rgb_row},
+    {"RGB2HSV",   3, 3, cvt_rgb_to_hsv_row},
+    {"HSV2RGB",   3, 3, cvt_hsv_to_rgb_row},
+};
+
+static const ColorKernel *find_color_kernel(const char *name) {
+    for (size_t i = 0; i < sizeof(COLOR_KERNELS) / sizeof(COLOR_KERNELS[0]); i++)
+        if (strcmp(COLOR_KERNELS[i].name, name) == 0) return &COLOR_KERNELS[i];
+    return NULL;
+}
+
+// Converts every local row (halos included, the kernels are pointwise) and
+// re-partitions the scatter/gather metadata for the new channel count
+static void mpi_convert(MPIImage *img, const ColorKernel *k) {
+    if (!img->loaded) { if (img->rank == 0) printf("No image loaded\n"); return; }
+    if (img->ch != k->in_ch) {
+        if (img->rank == 0) printf(k->in_ch == 1 ? "Black and white image needed\n" : "Color image needed\n");
+        return;
+    }
+    size_t in_rb = (size_t)img->w * k->in_ch, out_rb = (size_t)img->w * k->out_ch;
+    size_t rows = (size_t)img->local_h + 2;
+    if (!ensure_local_buffers(img, rows * (in_rb > out_rb ? in_rb : out_rb))) {
+        fprintf(stderr, "malloc failed\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (size_t r = 0; r < rows; r++)
+        k->fn(img->cur + r * in_rb, img->next + r * out_rb, img->w);
+
+    uint8_t *t = img->cur; img->cur = img->next; img->next = t;
+    img->ch = k->out_ch;
+    build_counts_displs_rank0(img);
+    if (img->rank == 0) printf("%s done\n", k->name);
+}
+
+// ==== Noise and dithering (bit-identical to the serial and OMP editors) ====
+// Noise comes from Philox4x32-10, a counter-based RNG: the numbers of a pixel
+// depend only on (seed, stream, global pixel index), never on the visiting
+// order, so the serial, OMP and MPI editors produce the same image.
+enum { NOISE_GAUSSIAN, NOISE_SALT_PEPPER };
+
+typedef struct { uint32_t v[4]; } Philox4;
+
+static Philox4 philox4x32_10(uint64_t idx, uint32_t stream, uint64_t seed) {
+    uint32_t c0 = (uint32_t)idx, c1 = (uint32_t)(idx >> 32), c2 = stream, c3 = 0;
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+    for (int r = 0; r < 10; r++) {
+        uint64_t p0 = (uint64_t)0xD2511F53u * c0, p1 = (uint64_t)0xCD9E8D57u * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0, n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1; c3 = (uint32_t)p0;
+        c0 = n0; c2 = n2;
+        k0 += 0x9E3779B9u; k1 += 0xBB67AE85u;
+    }
+    Philox4 out = {{c0, c1, c2, c3}};
+    return out;
+}
+
+// Maps 32 random bits to (0, 1)
+static inline double u01(uint32_t u) { return ((double)u + 0.5) * (1.0 / 4294967296.0); }
+
+// Adds noise to n consecutive pixels; idx is the global index of the first one
+static void noise_span(uint8_t *p, int n, int ch, uint64_t idx, int kind, double amount, uint64_t seed) {
+    const double TWO_PI = 6.283185307179586;
+    for (int i = 0; i < n; i++, p += ch) {
+        Philox4 r = philox4x32_10(idx + (uint64_t)i, (uint32_t)kind, seed);
+        if (kind == NOISE_GAUSSIAN) {
+            // Box-Muller: one Philox block gives up to 4 normals, enough for RGB
+            double a = sqrt(-2.0 * log(u01(r.v[0]))), b = sqrt(-2.0 * log(u01(r.v[2])));
+            double z[3] = { a * cos(TWO_PI * u01(r.v[1])), a * sin(TWO_PI * u01(r.v[1])), b * cos(TWO_PI * u01(r.v[3])) };
+            for (int c = 0; c < ch; c++) p[c] = clamp_u8_double((double)p[c] + amount * z[c]);
+        } else {
+            double u = u01(r.v[0]);
+            if (u < 0.5 * amount) memset(p, 0, (size_t)ch);
+            else if (u < amount) memset(p, 255, (size_t)ch);
+        }
+    }
+}
+
+static const uint8_t BAYER8[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42}, {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38}, {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41}, {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37}, {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+// Value of quantization level q out of `levels` evenly spaced levels
+static inline int dither_level(int q, int levels) { return (q * 255 + (levels - 1) / 2) / (levels - 1); }
+
+// Ordered (Bayer 8x8) dithering of n pixels starting at column x of row y:
+// q = floor(v * (levels-1) / 255 + (b + 0.5) / 64), done in integers
+static void dither_ordered_span(uint8_t *p, int n, int ch, int x, int y, int levels) {
+    const uint8_t *b = BAYER8[y & 7];
+    for (int i = 0; i < n; i++, p += ch) {
+        int t = (2 * b[(x + i) & 7] + 1) * 255;
+        for (int c = 0; c < ch; c++)
+            p[c] = (uint8_t)dither_level((p[c] * (levels - 1) * 128 + t) / (255 * 128), levels);
+    }
+}
+
+// Floyd-Steinberg on pixels [x0, x1) of one row, raster order. Errors are integers
+// and the diffused parts are kept in 1/16 units: above[] holds what the previous
+// row pushed down, below[] receives 3/16, 5/16, 1/16 of this row's errors, carry[]
+// the 7/16 from the left neighbour. above/below are indexed by x + 1, so columns
+// -1 and w exist and need no bounds checks.
+static void dither_fs_span(uint8_t *row, int x0, int x1, int ch, int levels,
+                           const int16_t *above, int16_t *below, int *carry) {
+    for (int x = x0; x < x1; x++) {
+        uint8_t *p = row + (size_t)x * ch;
+        for (int c = 0; c < ch; c++) {
+            int v16 = p[c] * 16 + above[(size_t)(x + 1) * ch + c] + carry[c];
+            int v = (v16 + 8 + 16 * 1024) / 16 - 1024; // round to nearest, also for v16 < 0
+            int q = (clamp_u8_int(v) * (levels - 1) + 127) / 255;
+            int out = dither_level(q, levels);
+            int e = v - out;
+            p[c] = (uint8_t)out;
+            carry[c] = 7 * e;
+            below[(size_t)x * ch + c] += (int16_t)(3 * e);
+            below[(size_t)(x + 1) * ch + c] += (int16_t)(5 * e);
+            below[(size_t)(x + 2) * ch + c] += (int16_t)e;
+        }
+    }
+}
+
+// Every rank draws the numbers of its own global pixel indices: no communication
+static void mpi_noise(MPIImage *img, const char *kind, double amount, unsigned long long seed) {
+    if (!img->loaded) { if (img->rank == 0) printf("No image loaded\n"); return; }
+    int k;
+    if (strcmp(kind, "GAUSSIAN") == 0 && amount >= 0.0) k = NOISE_GAUSSIAN;
+    else if (strcmp(kind, "SALT_PEPPER") == 0 && amount >= 0.0 && amount <= 1.0) k = NOISE_SALT_PEPPER;
+    else { if (img->rank == 0) printf("NOISE parameter invalid\n"); return; }
+
+    size_t rb = (size_t)img->w * img->ch;
+    for (int ly = 1; ly <= img->local_h; ly++) {
+        uint64_t gy = (uint64_t)(img->start_row + ly - 1);
+        noise_span(img->cur + ly * rb, img->w, img->ch, gy * img->w, k, amount, seed);
+    }
+    exchange_halo(img);
+    if (img->rank == 0) printf("NOISE %s done\n", kind);
+}
+
+// Skewed column chunk j of global row gy: [j*C - 2*gy, (j+1)*C - 2*gy) clipped to
+// the image. Row gy's chunk j only needs row gy-1 up to its own chunk j, so the
+// ranks form a pipeline over the chunks instead of waiting for whole strips.
+#define FS_CHUNK 64
+
+static int fs_chunk(int j, int gy, int w, int *a, int *b) {
+    *a = j * FS_CHUNK - 2 * gy;
+    *b = *a + FS_CHUNK;
+    if (*a < 0) *a = 0;
+    if (*b > w) *b = w;
+    return *b > *a;
+}
+
+// Floyd-Steinberg pipelined over the row strips: after chunk j a rank sends the
+// errors its last row pushed into the next strip (columns [a, b+2) in acc units)
+static void mpi_dither_fs(MPIImage *img, int levels) {
+    int w = img->w, ch = img->ch, lh = img->local_h;
+    size_t rb = (size_t)w * ch, ab = (size_t)(w + 2) * ch;
+    int16_t *acc = (int16_t*)calloc((size_t)(lh + 1) * ab, sizeof(int16_t));
+    int *carry = (int*)calloc((size_t)(lh > 0 ? lh : 1) * 3, sizeof(int));
+    if (!acc || !carry) { fprintf(stderr, "malloc failed\n"); MPI_Abort(MPI_COMM_WORLD, 1); }
+
+    int nchunks = (w + 2 * (img->h - 1)) / FS_CHUNK + 1;
+    int last = img->start_row + lh - 1; // global row whose errors go to the next rank
+    for (int j = 0; j < nchunks; j++) {
+        int a, b;
+        if (img->rank > 0 && fs_chunk(j, img->start_row - 1, w, &a, &b))
+            MPI_Recv(acc + (size_t)a * ch, (b + 2 - a) * ch, MPI_SHORT, img->rank - 1, 20, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        for (int ly = 1; ly <= lh; ly++) {
+            int gy = img->start_row + ly - 1;
+            if (!fs_chunk(j, gy, w, &a, &b)) continue;
+            int *c = carry + (size_t)(ly - 1) * 3;
+            if (a == 0) c[0] = c[1] = c[2] = 0;
+            dither_fs_span(img->cur + ly * rb, a, b, ch, levels, acc + (size_t)(ly - 1) * ab, acc + (size_t)ly * ab, c);
+        }
+        if (img->rank < img->size - 1 && fs_chunk(j, last, w, &a, &b))
+            MPI_Send(acc + (size_t)lh * ab + (size_t)a * ch, (b + 2 - a) * ch, MPI_SHORT, img->rank + 1, 20, MPI_COMM_WORLD);
+    }
+    free(acc);
+    free(carry);
+}
+
+static void mpi_dither(MPIImage *img, const char *kind, int levels) {
+    if (!img->loaded) { if (img->rank == 0) printf("No image loaded\n"); return; }
+    if (levels < 2 || levels > 256 || (strcmp(kind, "ORDERED") != 0 && strcmp(kind, "FS") != 0)) {
+        if (img->rank == 0) printf("DITHER parameter invalid\n");
+        return;
+    }
+    size_t rb = (size_t)img->w * img->ch;
+    if (kind[0] == 'O') {
+        for (int ly = 1; ly <= img->local_h; ly++)
+            dither_ordered_span(img->cur + ly * rb, img->w, img->ch, 0, img->start_row + ly - 1, levels);
+    } else {
+        mpi_dither_fs(img, levels);
+    }
+    exchange_halo(img);
+    if (img->rank == 0) printf("DITHER %s done\n", kind);
+}
+
+// ==== Image statistics (same output as the serial and OMP editors) ====
+// One pass feeds a per-channel histogram (min, max, mean, variance and the
+// percentiles all follow exactly from it), the squared error against a
+// reference and the sums of the 8x8 SSIM blocks. Everything is accumulated in
+// integers (the SSIM of each block in 2^-32 units), so the output does not
+// depend on how the rows are split between threads or ranks.
+#define SSIM_B 8
+
+typedef struct { long long sx, sy, sxx, syy, sxy, n; } SsimSums;
+
+static const int STATS_PCT[] = {1, 5, 25, 50, 75, 95, 99};
+
+// Accumulates `rows` rows of a (and of the reference b, unless NULL). The rows
+// belong to one block row, whose block sums are s[bx * ch + c].
+static void stats_rows(const uint8_t *a, const uint8_t *b, int w, int ch, int rows,
+                       long long *hist, long long *sse, SsimSums *s) {
+    size_t rb = (size_t)w * ch;
+    for (int r = 0; r < rows; r++, a += rb) {
+        for (int x = 0; x < w; x++)
+            for (int c = 0; c < ch; c++) hist[c * 256 + a[(size_t)x * ch + c]]++;
+        if (!b) continue;
+
+        long long e = 0;  // plain reduction, vectorized by the compiler
+        for (size_t i = 0; i < rb; i++) {
+            int d = (int)a[i] - (int)b[i];
+            e += d * d;
+        }
+        *sse += e;
+
+        for (int x0 = 0; x0 < w; x0 += SSIM_B) {
+            int x1 = (x0 + SSIM_B < w) ? x0 + SSIM_B : w;
+            SsimSums *bs = s + (size_t)(x0 / SSIM_B) * ch;
+            for (int c = 0; c < ch; c++) {
+                int sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+                for (int x = x0; x < x1; x++) {
+                    int u = a[(size_t)x * ch + c], v = b[(size_t)x * ch + c];
+                    sx += u; sy += v; sxx += u * u; syy += v * v; sxy += u * v;
+                }
+                bs[c].sx += sx; bs[c].sy += sy; bs[c].sxx += sxx; bs[c].syy += syy; bs[c].sxy += sxy;
+                bs[c].n += x1 - x0;
+            }
+        }
+        b += rb;
+    }
+}
+
+// SSIM of the nb blocks of a finished block row, summed in 2^-32 units; clears s
+static long long ssim_blockrow_q(SsimSums *s, int nb) {
+    const double C1 = 6.5025, C2 = 58.5225;  // (0.01 * 255)^2, (0.03 * 255)^2
+    long long q = 0;
+    for (int i = 0; i < nb; i++) {
+        double n = (double)s[i].n, mx = s[i].sx / n, my = s[i].sy / n;
+        double vx = s[i].sxx / n - mx * mx, vy = s[i].syy / n - my * my, cxy = s[i].sxy / n - mx * my;
+        double v = (2.0 * mx * my + C1) * (2.0 * cxy + C2) / ((mx * mx + my * my + C1) * (vx + vy + C2));
+        q += llrint(v * 4294967296.0);
+    }
+    memset(s, 0, (size_t)nb * sizeof(SsimSums));
+    return q;
+}
+
+// Prints the machine-readable report (key=value, one record per line)
+static void stats_print(const long long *hist, int w, int h, int ch, const char *ref, long long sse, long long ssim_q) {
+    long long n = (long long)w * h;
+    printf("STATS w=%d h=%d ch=%d pixels=%lld\n", w, h, ch, n);
+    for (int c = 0; c < ch; c++) {
+        const long long *hc = hist + c * 256;
+        long long sum = 0, sq = 0;
+        int mn = -1, mx = 0;
+        for (int v = 0; v < 256; v++) {
+            if (!hc[v]) continue;
+            if (mn < 0) mn = v;
+            mx = v;
+            sum += hc[v] * v;
+            sq += hc[v] * v * v;
+        }
+        double mean = (double)sum / (double)n;
+        double var = ((double)sq - (double)sum * mean) / (double)n;
+        printf("STATS c=%d min=%d max=%d mean=%.4f var=%.4f", c, mn, mx, mean, var < 0 ? 0.0 : var);
+        long long cum = 0;
+        int v = 0;
+        for (size_t k = 0; k < sizeof(STATS_PCT) / sizeof(STATS_PCT[0]); k++) {
+            // nearest rank: smallest v with cum(v) >= p% of the pixels
+            while (v < 255 && (cum + hc[v]) * 100 < (long long)STATS_PCT[k] * n) cum += hc[v++];
+            printf(" p%d=%d", STATS_PCT[k], v);
+        }
+        putchar('\n');
+    }
+    if (!ref) return;
+    long long samples = n * ch, blocks = (long long)((w + SSIM_B - 1) / SSIM_B) * ((h + SSIM_B - 1) / SSIM_B) * ch;
+    double mse = (double)sse / (double)samples;
+    printf("STATS ref=%s mse=%.6f ", ref, mse);
+    if (sse == 0) printf("psnr=inf");
+    else printf("psnr=%.4f", 10.0 * log10(255.0 * 255.0 / mse));
+    printf(" ssim=%.6f\n", (double)ssim_q / 4294967296.0 / (double)blocks);
+}
+
+// Global first row of rank r (the block distribution of compute_row_partition)
+static int rank_start_row(const MPIImage *img, int r) {
+    int base = img->h / img->size, rem = img->h % img->size;
+    return r * base + (r < rem ? r : rem);
+}
+
+// Every rank reduces its own rows; block rows cut by a strip boundary keep their
+// partial SSIM sums, which travel in the same MPI_Allreduce as the histogram
+static void mpi_stats(MPIImage *img, const char *ref_path) {
+    if (!img->loaded) { if (img->rank == 0) printf("No image loaded\n"); return; }
+    size_t rb = (size_t)img->w * img->ch;
+    uint8_t *ref = NULL;
+    if (ref_path) {
+        uint8_t *full = NULL;
+        int ok = 1, rw, rh, rch;
+        if (img->rank == 0)
+            ok = load_pnm_rank0(&full, &rw, &rh, &rch, ref_path) && rw == img->w && rh == img->h && rch == img->ch;
+        MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (!ok) {
+            if (img->rank == 0) { printf("Invalid reference %s\n", ref_path); free(full); }
+            return;
+        }
+        ref = (uint8_t*)malloc(img->local_h > 0 ? img->local_h * rb : 1);
+        if (!ref) { fprintf(stderr, "malloc failed\n"); MPI_Abort(MPI_COMM_WORLD, 1); }
+        MPI_Scatterv(full, img->counts, img->displs, MPI_BYTE, ref, img->local_h * (int)rb, MPI_BYTE, 0, MPI_COMM_WORLD);
+        free(full);
+    }
+
+    int nb = (img->w + SSIM_B - 1) / SSIM_B * img->ch;
+    // block rows cut by a rank boundary, ascending (at most one per boundary)
+    int *split = (int*)malloc(sizeof(int) * (size_t)img->size), nsplit = 0;
+    if (!split) { fprintf(stderr, "malloc failed\n"); MPI_Abort(MPI_COMM_WORLD, 1); }
+    for (int r = 1; r < img->size; r++) {
+        int b = rank_start_row(img, r);
+        if (b > 0 && b < img->h && b % SSIM_B && (!nsplit || split[nsplit - 1] != b / SSIM_B))
+            split[nsplit++] = b / SSIM_B;
+    }
+    // layout: histogram (3 x 256), sse, ssim, then the split block rows' sums
+    size_t n = 3 * 256 + 2 + (size_t)nsplit * nb * (sizeof(SsimSums) / sizeof(long long));
+    long long *acc = (long long*)calloc(n, sizeof(long long));
+    SsimSums *s = (SsimSums*)calloc((size_t)nb, sizeof(SsimSums));
+    if (!acc || !s) { fprintf(stderr, "malloc failed\n"); MPI_Abort(MPI_COMM_WORLD, 1); }
+    SsimSums *ssplit = (SsimSums*)(acc + 3 * 256 + 2);
+
+    int y_lo = img->start_row, y_hi = img->start_row + img->local_h;
+    for (int y = y_lo; y < y_hi; ) {
+        int by = y / SSIM_B, y1 = (by + 1) * SSIM_B < y_hi ? (by + 1) * SSIM_B : y_hi;
+        int k = 0;
+        while (k < nsplit && split[k] != by) k++;
+        SsimSums *dst = (k < nsplit) ? ssplit + (size_t)k * nb : s;
+        stats_rows(img->cur + (size_t)(y - y_lo + 1) * rb, ref ? ref + (size_t)(y - y_lo) * rb : NULL,
+                   img->w, img->ch, y1 - y, acc, &acc[3 * 256], dst);
+        if (ref && k == nsplit) acc[3 * 256 + 1] += ssim_blockrow_q(s, nb);
+        y = y1;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, acc, (int)n, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (ref)
+        for (int k = 0; k < nsplit; k++) acc[3 * 256 + 1] += ssim_blockrow_q(ssplit + (size_t)k * nb, nb);
+
+    if (img->rank == 0) stats_print(acc, img->w, img->h, img->ch, ref_path, acc[3 * 256], acc[3 * 256 + 1]);
+    free(acc);
+    free(s);
+    free(split);
+    free(ref);
+}
+
+// ==== Compressed tiled checkpoints (same format as the serial and OMP editors) ====
+// File layout (little-endian): header, ntiles index entries, then the tile
+// payloads. Every tile is an independent rectangle, so a writer may cut the image
+// however suits it and a reader decodes only the tiles it needs. A payload is the
+// tile's rows, delta-filtered against the previous pixel and LZ-compressed, or the
+// raw rows when compression does not pay off.
+#define CKPT_MAGIC "PNMCKPT1"
+#define CKPT_TILE 128
+#define LZ_HASH_BITS 12
+
+typedef struct { char magic[8]; uint32_t w, h, ch, ntiles; } CkptHeader;
+typedef struct { uint64_t offset; uint32_t x0, y0, w, h, size, flags; } CkptTile; // flags: 1 = delta + LZ
+
+// Upper bound of the compressed size of n bytes
+static size_t lz_bound(size_t n) { return n + n / 255 + 16; }
+
+static size_t lz_put_len(uint8_t *dst, size_t op, size_t len) {
+    for (; len >= 255; len -= 255) dst[op++] = 255;
+    dst[op++] = (uint8_t)len;
+    return op;
+}
+
+// One LZ4-style sequence: token (literal count << 4 | match length - 4, a nibble of
+// 15 continues in extra bytes), the literals, a 16-bit offset and the extra length.
+// The last sequence of a block has literals only.
+static size_t lz_emit(uint8_t *dst, size_t op, const uint8_t *lit, size_t nlit, size_t off, size_t mlen) {
+    size_t ml = mlen ? mlen - 4 : 0;
+    dst[op++] = (uint8_t)(((nlit < 15 ? nlit : 15) << 4) | (ml < 15 ? ml : 15));
+    if (nlit >= 15) op = lz_put_len(dst, op, nlit - 15);
+    memcpy(dst + op, lit, nlit);
+    op += nlit;
+    if (!mlen) return op;
+    dst[op++] = (uint8_t)(off & 255);
+    dst[op++] = (uint8_t)(off >> 8);
+    if (ml >= 15) op = lz_put_len(dst, op, ml - 15);
+    return op;
+}
+
+// Greedy single-probe hash matcher; dst must hold lz_bound(n) bytes
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+    uint32_t table[1 << LZ_HASH_BITS] = {0}; // position + 1 of the last 4-byte prefix
+    size_t ip = 0, anchor = 0, op = 0;
+    while (ip + 4 <= n) {
+        uint32_t v;
+        memcpy(&v, src + ip, 4);
+        uint32_t hsh = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t cand = table[hsh];
+        table[hsh] = (uint32_t)ip + 1;
+        if (cand && ip - (cand - 1) <= 65535 && memcmp(src + cand - 1, src + ip, 4) == 0) {
+            size_t ref = cand - 1, len = 4;
+            while (ip + len < n && src[ref + len] == src[ip + len]) len++;
+            op = lz_emit(dst, op, src + anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+    return lz_emit(dst, op, src + anchor, n - anchor, 0, 0);
+}
+
+static int lz_read_len(const uint8_t *src, size_t n, size_t *ip, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= n) return 0;
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+// Returns 1 only if the block decodes to exactly out_n bytes (all reads are checked)
+static int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_n) {
+    size_t ip = 0, op = 0;
+    while (ip < n) {
+        unsigned tok = src[ip++];
+        size_t nlit = tok >> 4, ml = tok & 15;
+        if (nlit == 15 && !lz_read_len(src, n, &ip, &nlit)) return 0;
+        if (nlit > n - ip || nlit > out_n - op) return 0;
+        memcpy(dst + op, src + ip, nlit);
+        ip += nlit; op += nlit;
+        if (ip == n) break;
+        if (n - ip < 2) return 0;
+        size_t off = src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (ml == 15 && !lz_read_len(src, n, &ip, &ml)) return 0;
+        ml += 4;
+        if (off == 0 || off > op || ml > out_n - op) return 0;
+        for (size_t i = 0; i < ml; i++, op++) dst[op] = dst[op - off]; // may overlap
+    }
+    return op == out_n;
+}
+
+// Encodes tile t; src points at its top-left pixel, stride is the image row size.
+// raw needs t->w * t->h * ch bytes, out lz_bound() of that. Returns the payload size.
+static size_t ckpt_encode_tile(const uint8_t *src, size_t stride, int ch, CkptTile *t, uint8_t *raw, uint8_t *out) {
+    size_t rb = (size_t)t->w * ch, n = rb * t->h;
+    for (uint32_t y = 0; y < t->h; y++) {
+        uint8_t *r = raw + y * rb;
+        memcpy(r, src + y * stride, rb);
+        for (size_t i = rb; i-- > (size_t)ch; ) r[i] = (uint8_t)(r[i] - r[i - ch]);
+    }
+    size_t sz = lz_compress(raw, n, out);
+    t->flags = 1;
+    if (sz >= n) { // incompressible: store the original rows
+        for (uint32_t y = 0; y < t->h; y++) memcpy(out + y * rb, src + y * stride, rb);
+        sz = n;
+        t->flags = 0;
+    }
+    t->size = (uint32_t)sz;
+    return sz;
+}
+
+// Decodes a payload into raw (t->w * t->h * ch bytes, rows packed)
+static int ckpt_decode_tile(const uint8_t *payload, const CkptTile *t, int ch, uint8_t *raw) {
+    size_t rb = (size_t)t->w * ch, n = rb * t->h;
+    if (!t->flags) {
+        if (t->size != n) return 0;
+        memcpy(raw, payload, n);
+        return 1;
+    }
+    if (!lz_decompress(payload, t->size, raw, n)) return 0;
+    for (uint32_t y = 0; y < t->h; y++) {
+        uint8_t *r = raw + y * rb;
+        for (size_t i = ch; i < rb; i++) r[i] = (uint8_t)(r[i] + r[i - ch]);
+    }
+    return 1;
+}
+
+// Copies the part of a decoded tile inside the region [rx0, rx1) x [ry0, ry1) to dst,
+// which holds that region with rows of dst_stride bytes
+static void ckpt_copy_tile(const CkptTile *t, const uint8_t *raw, int ch, uint8_t *dst, size_t dst_stride,
+                           int rx0, int ry0, int rx1, int ry1) {
+    int xa = (int)t->x0 > rx0 ? (int)t->x0 : rx0, xb = (int)(t->x0 + t->w) < rx1 ? (int)(t->x0 + t->w) : rx1;
+    int ya = (int)t->y0 > ry0 ? (int)t->y0 : ry0, yb = (int)(t->y0 + t->h) < ry1 ? (int)(t->y0 + t->h) : ry1;
+    for (int y = ya; y < yb; y++)
+        memcpy(dst + (size_t)(y - ry0) * dst_stride + (size_t)(xa - rx0) * ch,
+               raw + ((size_t)(y - t->y0) * t->w + (size_t)(xa - t->x0)) * ch, (size_t)(xb - xa) * ch);
+}
+
+static int ckpt_tile_hits(const CkptTile *t, int rx0, int ry0, int rx1, int ry1) {
+    return (int)t->x0 < rx1 && (int)(t->x0 + t->w) > rx0 && (int)t->y0 < ry1 && (int)(t->y0 + t->h) > ry0;
+}
+
+// Sanity checks of a header and index read from disk
+static int ckpt_valid(const CkptHeader *hd, const CkptTile *t, uint32_t n) {
+    if (memcmp(hd->magic, CKPT_MAGIC, 8) != 0 || (hd->ch != 1 && hd->ch != 3) || !hd->w || !hd->h) return 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!t[i].w || !t[i].h || t[i].x0 >= hd->w || t[i].y0 >= hd->h) return 0;
+        if (t[i].w > hd->w - t[i].x0 || t[i].h > hd->h - t[i].y0) return 0;
+        if (t[i].size > lz_bound((size_t)t[i].w * t[i].h * hd->ch)) return 0;
+    }
+    return 1;
+}
+
+// The header and the index are serialized field by field, little-endian at fixed
+// offsets, so files do not depend on the host byte order or on struct padding
+#define CKPT_HEADER_BYTES 24  // magic[8], w, h, ch, ntiles
+#define CKPT_ENTRY_BYTES 32   // offset (u64), x0, y0, w, h, size, flags
+
+static void le_put(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t le_get(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+// Header and n index entries in file form (CKPT_HEADER_BYTES + n * CKPT_ENTRY_BYTES bytes)
+static void ckpt_pack(uint8_t *b, const CkptHeader *hd, const CkptTile *t, size_t n) {
+    if (hd) {
+        memcpy(b, hd->magic, 8);
+        le_put(b + 8, hd->w, 4); le_put(b + 12, hd->h, 4); le_put(b + 16, hd->ch, 4); le_put(b + 20, hd->ntiles, 4);
+        b += CKPT_HEADER_BYTES;
+    }
+    for (size_t i = 0; i < n; i++, b += CKPT_ENTRY_BYTES) {
+        le_put(b, t[i].offset, 8);
+        le_put(b + 8, t[i].x0, 4); le_put(b + 12, t[i].y0, 4); le_put(b + 16, t[i].w, 4);
+        le_put(b + 20, t[i].h, 4); le_put(b + 24, t[i].size, 4); le_put(b + 28, t[i].flags, 4);
+    }
+}
+
+// Reads and checks the header and the index; *tiles is malloc'd, NULL on failure
+static int ckpt_read_index(FILE *f, CkptHeader *hd, CkptTile **tiles) {
+    uint8_t hb[CKPT_HEADER_BYTES];
+    *tiles = NULL;
+    if (fread(hb, 1, sizeof hb, f) != sizeof hb) return 0;
+    memcpy(hd->magic, hb, 8);
+    hd->w = (uint32_t)le_get(hb + 8, 4); hd->h = (uint32_t)le_get(hb + 12, 4);
+    hd->ch = (uint32_t)le_get(hb + 16, 4); hd->ntiles = (uint32_t)le_get(hb + 20, 4);
+    if (hd->ntiles == 0 || (uint64_t)hd->ntiles > (uint64_t)hd->w * hd->h) return 0;
+    CkptTile *t = (CkptTile*)malloc((size_t)hd->ntiles * sizeof(CkptTile));
+    uint8_t *b = (uint8_t*)malloc((size_t)hd->ntiles * CKPT_ENTRY_BYTES);
+    int ok = t && b && fread(b, CKPT_ENTRY_BYTES, hd->ntiles, f) == hd->ntiles;
+    for (uint32_t i = 0; ok && i < hd->ntiles; i++) {
+        const uint8_t *e = b + (size_t)i * CKPT_ENTRY_BYTES;
+        t[i].offset = le_get(e, 8);
+        t[i].x0 = (uint32_t)le_get(e + 8, 4); t[i].y0 = (uint32_t)le_get(e + 12, 4);
+        t[i].w = (uint32_t)le_get(e + 16, 4); t[i].h = (uint32_t)le_get(e + 20, 4);
+        t[i].size = (uint32_t)le_get(e + 24, 4); t[i].flags = (uint32_t)le_get(e + 28, 4);
+    }
+    free(b);
+    if (!ok || !ckpt_valid(hd, t, hd->ntiles)) { free(t); return 0; }
+    *tiles = t;
+    return 1;
+}
+
+// Each rank compresses the tiles of its own strip (the last tile row of a strip
+// may be shorter). MPI_Exscan gives every rank the position of its index entries
+// and payloads, and all ranks write their parts with collective MPI-IO.
+static void mpi_ckpt_save(MPIImage *img, const char *path) {
+    if (!img->loaded) { if (img->rank == 0) printf("No image loaded\n"); return; }
+    double t0 = now_sec();
+    int ch = img->ch, tx = (img->w + CKPT_TILE - 1) / CKPT_TILE, ty = (img->local_h + CKPT_TILE - 1) / CKPT_TILE;
+    long long n = (long long)tx * ty;
+    size_t rb = (size_t)img->w * ch, tb = (size_t)CKPT_TILE * CKPT_TILE * ch;
+    CkptTile *tiles = (CkptTile*)calloc(n ? n : 1, sizeof(CkptTile));
+    uint8_t *raw = (uint8_t*)malloc(tb), *arena = (uint8_t*)malloc(lz_bound(tb) * (n ? n : 1));
+    if (!tiles || !raw || !arena) { fprintf(stderr, "malloc failed\n"); MPI_Abort(MPI_COMM_WORLD, 1); }
+
+    long long mine[2] = {n, 0}, before[2] = {0, 0}, total[2];
+    for (long long i = 0; i < n; i++) {
+        CkptTile *t = &tiles[i];
+        t->x0 = (uint32_t)(i % tx) * CKPT_TILE;
+        t->y0 = (uint32_t)(img->start_row + (i / tx) * CKPT_TILE);
+        t->w = (t->x0 + CKPT_TILE < (uint32_t)img->w) ? CKPT_TILE : img->w - t->x0;
+        t->h = (t->y0 + CKPT_TILE < (uint32_t)(img->start_row + img->local_h)) ? CKPT_TILE : img->start_row + img->local_h - t->y0;
+        // payloads are packed back to back; each fits in its lz_bound() share of the arena
+        mine[1] += ckpt_encode_tile(img->cur + (t->y0 - img->start_row + 1) * rb + (size_t)t->x0 * ch, rb, ch, t, raw, arena + mine[1]);
+    }
+    MPI_Exscan(mine, before, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (img->rank == 0) before[0] = before[1] = 0;  // Exscan leaves rank 0 undefined
+    MPI_Allreduce(mine, total, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    uint64_t base = CKPT_HEADER_BYTES + (uint64_t)total[0] * CKPT_ENTRY_BYTES, off = base + before[1];
+    for (long long i = 0; i < n; i++) { tiles[i].offset = off; off += tiles[i].size; }
+    uint8_t *idx = (uint8_t*)malloc(CKPT_HEADER_BYTES + (size_t)n * CKPT_ENTRY_BYTES);
+    if (!idx) { fprintf(stderr, "malloc failed\n"); MPI_Abort(MPI_COMM_WORLD, 1); }
+    CkptHeader hd = { CKPT_MAGIC, (uint32_t)img->w, (uint32_t)img->h, (uint32_t)ch, (uint32_t)total[0] };
+    ckpt_pack(idx, &hd, tiles, (size_t)n);  // rank 0 writes the header, every rank its own entries
+
+    MPI_File fh;
+    int ok = MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) == MPI_SUCCESS;
+    if (ok) {
+        MPI_File_set_size(fh, 0);
+        if (img->rank == 0) MPI_File_write_at(fh, 0, idx, CKPT_HEADER_BYTES, MPI_BYTE, MPI_STATUS_IGNORE);
+        MPI_File_write_at_all(fh, (MPI_Offset)(CKPT_HEADER_BYTES + before[0] * CKPT_ENTRY_BYTES), idx + CKPT_HEADER_BYTES,
+                              (int)(n * CKPT_ENTRY_BYTES), MPI_BYTE, MPI_STATUS_IGNORE);
+        MPI_File_write_at_all(fh, (MPI_Offset)(base + before[1]), arena, (int)mine[1], MPI_BYTE, MPI_STATUS_IGNORE);
+        MPI_File_close(&fh);
+    }
+    if (img->rank == 0) {
+        if (ok) printf("CHECKPOINT %s tiles=%lld raw=%zu stored=%llu time=%.6f sec\n", path, total[0], rb * img->h,
+                       (unsigned long long)(base + total[1]), now_sec() - t0);
+        else printf("Failed to save %s\n", path);
+    }
+    free(tiles); free(raw); free(arena); free(idx);
+}
+
+// Rank 0 reads and checks the index and broadcasts it; every rank then reads and
+// decodes only the tiles that intersect its strip of the restored region
+static void mpi_ckpt_restore(MPIImage *img, const char *path, const int *region) {
+    double t0 = now_sec();
+    CkptHeader hd;
+    CkptTile *tiles = NULL;
+    int ok = 1, rg[4];
+    if (img->rank == 0) {
+        FILE *f = fopen(path, "rb");
+        ok = f && ckpt_read_index(f, &hd, &tiles);
+        if (f) fclose(f);
+        if (!ok) printf("Failed to load %s\n", path);
+        else {
+            rg[0] = 0; rg[1] = 0; rg[2] = (int)hd.w; rg[3] = (int)hd.h;
+            if (region) {
+                memcpy(rg, region, sizeof rg);
+                if (rg[0] > rg[2]) { int t = rg[0]; rg[0] = rg[2]; rg[2] = t; }
+                if (rg[1] > rg[3]) { int t = rg[1]; rg[1] = rg[3]; rg[3] = t; }
+                if (rg[0] < 0 || rg[1] < 0 || rg[2] > (int)hd.w || rg[3] > (int)hd.h || rg[0] == rg[2] || rg[1] == rg[3]) {
+                    printf("Invalid set of coordinates\n");
+                    ok = 0;
+                }
+            }
+        }
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!ok) { free(tiles); return; }
+    MPI_Bcast(&hd, sizeof hd, MPI_BYTE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(rg, 4, MPI_INT, 0, MPI_COMM_WORLD);
+    if (img->rank != 0) tiles = (CkptTile*)malloc((size_t)hd.ntiles * sizeof(CkptTile));
+    if (!tiles) { fprintf(stderr, "malloc failed\n"); MPI_Abort(MPI_COMM_WORLD, 1); }
+    MPI_Bcast(tiles, (int)(hd.ntiles * sizeof(CkptTile)), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    // strip of this rank inside the new image = rows [ry0, ry1) of the file
+    MPIImage nw = *img;
+    nw.w = rg[2] - rg[0]; nw.h = rg[3] - rg[1]; nw.ch = (int)hd.ch;
+    compute_row_partition(&nw);
+    int rx0 = rg[0], rx1 = rg[2], ry0 = rg[1] + nw.start_row, ry1 = ry0 + nw.local_h;
+    size_t rb = (size_t)nw.w * nw.ch, need = (size_t)(nw.local_h + 2) * rb, tb = 0;
+    long long covered = 0;
+    for (uint32_t i = 0; i < hd.ntiles; i++) {
+        const CkptTile *t = &tiles[i];
+        if (!ckpt_tile_hits(t, rx0, ry0, rx1, ry1)) continue;
+        size_t b = (size_t)t->w * t->h * hd.ch;
+        if (b > tb) tb = b;
+        long long cw = ((int)(t->x0 + t->w) < rx1 ? (int)(t->x0 + t->w) : rx1) - ((int)t->x0 > rx0 ? (int)t->x0 : rx0);
+        long long chh = ((int)(t->y0 + t->h) < ry1 ? (int)(t->y0 + t->h) : ry1) - ((int)t->y0 > ry0 ? (int)t->y0 : ry0);
+        covered += cw * chh;
+    }
+    uint8_t *cur = (uint8_t*)malloc(need), *next = (uint8_t*)malloc(need);
+    uint8_t *raw = (uint8_t*)malloc(tb ? tb : 1), *payload = (uint8_t*)malloc(lz_bound(tb));
+    if (!cur || !next || !raw || !payload) { fprintf(stderr, "malloc failed\n"); MPI_Abort(MPI_COMM_WORLD, 1); }
+    ok = covered == (long long)nw.w * nw.local_h;
+
+    MPI_File fh;
+    int opened = MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) == MPI_SUCCESS;
+    ok = ok && opened;
+    for (uint32_t i = 0; ok && i < hd.ntiles; i++) {
+        const CkptTile *t = &tiles[i];
+        if (!ckpt_tile_hits(t, rx0, ry0, rx1, ry1)) continue;
+        MPI_Status st;
+        int got = 0;
+        ok = MPI_File_read_at(fh, (MPI_Offset)t->offset, payload, (int)t->size, MPI_BYTE, &st) == MPI_SUCCESS &&
+             MPI_Get_count(&st, MPI_BYTE, &got) == MPI_SUCCESS && got == (int)t->size &&
+             ckpt_decode_tile(payload, t, nw.ch, raw);
+        if (ok) ckpt_copy_tile(t, raw, nw.ch, cur + rb, rb, rx0, ry0, rx1, ry1);
+    }
+    if (opened) MPI_File_close(&fh);
+    uint32_t used = 0;  // tiles overlapping the restored region, as the serial editor counts them
+    if (img->rank == 0)
+        for (uint32_t i = 0; i < hd.ntiles; i++) used += ckpt_tile_hits(&tiles[i], rg[0], rg[1], rg[2], rg[3]);
+    free(tiles); free(raw); free(payload);
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!ok) {
+        free(cur); free(next);
+        if (img->rank == 0) printf("Failed to load %s\n", path);
+        return;
+    }
+
+    free(img->cur); free(img->next);
+    nw.cur = cur; nw.next = next; nw.cap_bytes = need;
+    nw.x1 = 0; nw.y1 = 0; nw.x2 = nw.w; nw.y2 = nw.h;
+    nw.loaded = 1;
+    *img = nw;
+    build_counts_displs_rank0(img);
+    exchange_halo(img);
+    if (img->rank == 0) printf("RESTORE %s tiles=%u/%u time=%.6f sec\n", path, used, hd.ntiles, now_sec() - t0);
+}
+
 static void mpi_bench(MPIImage *img, int iters, const char *what) {
     static const double K_GAUSS[3][3] = {{1./16,2./16,1./16},{2./16,4./16,2./16},{1./16,2./16,1./16}};
     if (!img->loaded || strcmp(what, "GAUSS_SOBEL") != 0) { if (img->rank == 0) printf("Invalid/No image\n"); return; }
@@ -299,8 +1111,8 @@ static void mpi_bench(MPIImage *img, int iters, const char *what) {
 }
 
 // ==== Command Processing ====
-typedef enum { CMD_INVALID, CMD_LOAD, CMD_SAVE, CMD_SELECT_ALL, CMD_BENCH, CMD_EXIT } CmdType;
-typedef struct { int type, iters; char arg1[256]; } Cmd;
+typedef enum { CMD_INVALID, CMD_LOAD, CMD_SAVE, CMD_SELECT_ALL, CMD_BENCH, CMD_CONVERT, CMD_NOISE, CMD_DITHER, CMD_STATS, CMD_CHECKPOINT, CMD_RESTORE, CMD_EXIT } CmdType;
+typedef struct { int type, iters, region[4]; double amount; unsigned long long seed; char arg1[256]; } Cmd;
 
 int main(int argc, char **argv) {
     MPI_Init(&argc, &argv);
@@ -317,6 +1129,22 @@ int main(int argc, char **argv) {
             else if (strcmp(token, "SAVE") == 0) { cmd.type = CMD_SAVE; scanf("%255s", cmd.arg1); }
             else if (strcmp(token, "SELECT") == 0) { scanf("%63s", token); cmd.type = (strcmp(token, "ALL")==0) ? CMD_SELECT_ALL : CMD_INVALID; }
             else if (strcmp(token, "BENCH") == 0) { cmd.type = CMD_BENCH; scanf("%d %255s", &cmd.iters, cmd.arg1); }
+            else if (strcmp(token, "GRAYSCALE") == 0 || strcmp(token, "TO_RGB") == 0) { cmd.type = CMD_CONVERT; strcpy(cmd.arg1, token); }
+            else if (strcmp(token, "CONVERT") == 0) { cmd.type = CMD_CONVERT; cmd.iters = 1; scanf("%255s", cmd.arg1); }
+            else if (strcmp(token, "NOISE") == 0) { cmd.type = (scanf("%255s %lf %llu", cmd.arg1, &cmd.amount, &cmd.seed) == 3) ? CMD_NOISE : CMD_INVALID; }
+            else if (strcmp(token, "DITHER") == 0) { cmd.type = (scanf("%255s %d", cmd.arg1, &cmd.iters) == 2) ? CMD_DITHER : CMD_INVALID; }
+            else if (strcmp(token, "STATS") == 0) {
+                char line[300];  // optional reference path on the same line
+                cmd.type = CMD_STATS;
+                if (!fgets(line, sizeof line, stdin) || sscanf(line, "%255s", cmd.arg1) != 1) cmd.arg1[0] = '\0';
+            }
+            else if (strcmp(token, "CHECKPOINT") == 0) { cmd.type = CMD_CHECKPOINT; scanf("%255s", cmd.arg1); }
+            else if (strcmp(token, "RESTORE") == 0) {
+                char line[300];  // RESTORE <path> [x1 y1 x2 y2]; iters = region given
+                int got = fgets(line, sizeof line, stdin) ? sscanf(line, "%255s %d %d %d %d", cmd.arg1, &cmd.region[0], &cmd.region[1], &cmd.region[2], &cmd.region[3]) : 0;
+                cmd.type = (got == 1 || got == 5) ? CMD_RESTORE : CMD_INVALID;
+                cmd.iters = (got == 5);
+            }
             else if (strcmp(token, "EXIT") == 0) cmd.type = CMD_EXIT;
         }
         MPI_Bcast(&cmd, sizeof(Cmd), MPI_BYTE, 0, MPI_COMM_WORLD);
@@ -326,6 +1154,16 @@ int main(int argc, char **argv) {
         else if (cmd.type == CMD_SELECT_ALL && img.loaded) { img.x1 = 0; img.y1 = 0; img.x2 = img.w; img.y2 = img.h; }
         else if (cmd.type == CMD_BENCH) mpi_bench(&img, cmd.iters, cmd.arg1);
         else if (cmd.type == CMD_SAVE) mpi_save_gather(&img, cmd.arg1);
+        else if (cmd.type == CMD_CHECKPOINT) mpi_ckpt_save(&img, cmd.arg1);
+        else if (cmd.type == CMD_RESTORE) mpi_ckpt_restore(&img, cmd.arg1, cmd.iters ? cmd.region : NULL);
+        else if (cmd.type == CMD_STATS) mpi_stats(&img, cmd.arg1[0] ? cmd.arg1 : NULL);
+        else if (cmd.type == CMD_NOISE) mpi_noise(&img, cmd.arg1, cmd.amount, cmd.seed);
+        else if (cmd.type == CMD_DITHER) mpi_dither(&img, cmd.arg1, cmd.iters);
+        else if (cmd.type == CMD_CONVERT) {
+            const ColorKernel *k = find_color_kernel(cmd.arg1);
+            if (k && (!cmd.iters || k->in_ch == k->out_ch)) mpi_convert(&img, k);
+            else if (img.rank == 0) printf("CONVERT parameter invalid\n");
+        }
     }
 
     mpi_img_free(&img);
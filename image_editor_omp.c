@@ -2,26 +2,38 @@
 // OpenMP parallel pentru P5/P6 (PGM/PPM binar) + selectie + filtre 3x3 + Sobel + Equalize + BENCH
 // gcc -O3 -march=native -std=c11 -fopenmp image_editor_omp.c -lm -o editor_omp
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <math.h>
 #include <time.h>
+#include <sched.h>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+// un run [x0, x1) de pixeli selectati pe un rand
+typedef struct { int x0, x1; } Run;
+
 typedef struct {
     int w, h;           // columns, rows
     int ch;             // 1 (P5) sau 3 (P6)
     uint8_t *data;      // size = w*h*ch
     uint8_t *tmp;       // buffer temporar (reutilizat)
     size_t tmp_cap;
-    // selectie [x1,x2) [y1,y2)
+    // bounding box-ul selectiei [x1,x2) [y1,y2)
     int x1, y1, x2, y2;
+    // selectia ca run-uri: randul y are runs[row_start[y] .. row_start[y+1])
+    Run *runs;
+    int *row_start;     // h + 1 elemente
+    int nruns, runs_cap;
+    int sel_rows;       // randuri deja inchise cat timp se construieste selectia
+    long long sel_area; // pixeli selectati (estimarea de lucru pentru politica de executie)
     int loaded;
 } Image;
 
@@ -41,10 +53,18 @@ static double now_sec(void) {
     return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
 }
 
+// Mesajele operatiilor pe imagine; NULL le opreste (STREAM ruleaza operatiile
+// pentru fiecare cadru si raporteaza doar un sumar)
+static FILE *msg_out;
+#define say(...) do { if (msg_out) fprintf(msg_out, __VA_ARGS__); } while (0)
+
 static void img_free(Image *img) {
     free(img->data); img->data = NULL;
     free(img->tmp);  img->tmp  = NULL;
     img->tmp_cap = 0;
+    free(img->runs); img->runs = NULL;
+    free(img->row_start); img->row_start = NULL;
+    img->nruns = img->runs_cap = 0;
     img->loaded = 0;
     img->w = img->h = img->ch = 0;
     img->x1 = img->y1 = img->x2 = img->y2 = 0;
@@ -85,55 +105,68 @@ static int read_token(FILE *f, char *buf, size_t n) {
     return i > 0;
 }
 
-static int img_load_pnm(Image *img, const char *path) {
-    FILE *f = fopen(path, "rb");
-    if (!f) return 0;
+static int sel_rect(Image *img, int x1, int y1, int x2, int y2);
+
+// Citeste o imagine P5 sau P6 dintr-un stream deschis (pot urma alte cadre)
+static int img_read_pnm(Image *img, FILE *f) {
     char tok[64];
-    if (!read_token(f, tok, sizeof(tok))) { fclose(f); return 0; }
+    if (!read_token(f, tok, sizeof(tok))) return 0;
     int ch = 0;
     if (strcmp(tok, "P5") == 0) ch = 1;
     else if (strcmp(tok, "P6") == 0) ch = 3;
-    else { fclose(f); return 0; }
+    else return 0;
 
-    if (!read_token(f, tok, sizeof(tok))) { fclose(f); return 0; }
+    if (!read_token(f, tok, sizeof(tok))) return 0;
     int w = atoi(tok);
-    if (!read_token(f, tok, sizeof(tok))) { fclose(f); return 0; }
+    if (!read_token(f, tok, sizeof(tok))) return 0;
     int h = atoi(tok);
-    if (!read_token(f, tok, sizeof(tok))) { fclose(f); return 0; }
+    if (!read_token(f, tok, sizeof(tok))) return 0;
     int maxval = atoi(tok);
-    if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 255) { fclose(f); return 0; }
+    if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 255) return 0;
 
     size_t sz = (size_t)w * (size_t)h * (size_t)ch;
     uint8_t *data = (uint8_t*)malloc(sz);
-    if (!data) { fclose(f); return 0; }
+    if (!data) return 0;
 
     size_t got = fread(data, 1, sz, f);
-    fclose(f);
     if (got != sz) { free(data); return 0; }
 
     img_free(img);
     img->data = data;
     img->w = w; img->h = h; img->ch = ch;
     img->loaded = 1;
-    img->x1 = 0; img->y1 = 0; img->x2 = w; img->y2 = h;
+    if (!sel_rect(img, 0, 0, w, h)) { img_free(img); return 0; }
     return 1;
 }
 
-static int img_save_pnm(const Image *img, const char *path) {
-    if (!img->loaded) return 0;
-    FILE *f = fopen(path, "wb");
+static int img_load_pnm(Image *img, const char *path) {
+    FILE *f = fopen(path, "rb");
     if (!f) return 0;
+    int ok = img_read_pnm(img, f);
+    fclose(f);
+    return ok;
+}
+
+// Scrie o imagine P5/P6 intr-un stream deschis
+static int img_write_pnm(const Image *img, FILE *f) {
+    if (!img->loaded) return 0;
     fprintf(f, (img->ch == 1) ? "P5\n" : "P6\n");
     fprintf(f, "%d %d\n255\n", img->w, img->h);
     size_t sz = (size_t)img->w * (size_t)img->h * (size_t)img->ch;
-    size_t wr = fwrite(img->data, 1, sz, f);
-    fclose(f);
-    return wr == sz;
+    return fwrite(img->data, 1, sz, f) == sz;
+}
+
+static int img_save_pnm(const Image *img, const char *path) {
+    if (!img->loaded) return 0;
+    FILE *f = fopen(path, "wb");
+    if (!f) return 0;
+    int ok = img_write_pnm(img, f);
+    return (fclose(f) == 0) && ok;
 }
 
 static void img_select_all(Image *img) {
     if (!img->loaded) { printf("No image loaded\n"); return; }
-    img->x1 = 0; img->y1 = 0; img->x2 = img->w; img->y2 = img->h;
+    if (!sel_rect(img, 0, 0, img->w, img->h)) { fprintf(stderr, "malloc failed\n"); return; }
     printf("Selected ALL\n");
 }
 
@@ -145,13 +178,160 @@ static void img_select_rect(Image *img, int x1, int y1, int x2, int y2) {
         printf("Invalid set of coordinates\n");
         return;
     }
-    img->x1 = x1; img->y1 = y1; img->x2 = x2; img->y2 = y2;
+    if (!sel_rect(img, x1, y1, x2, y2)) { fprintf(stderr, "malloc failed\n"); return; }
     printf("Selected %d %d %d %d\n", x1, y1, x2, y2);
 }
 
+// ======= Selectii ca run-uri pe randuri =======
+// Orice selectie (dreptunghi, elipsa, poligon, masca) e pastrata ca run-uri sortate
+// pe fiecare rand; kernel-urile viziteaza doar run-urile, deci costul e proportional
+// cu aria regiunii, nu cu dimensiunea imaginii.
+
+// incepe o selectie noua; run-urile se adauga in ordinea crescatoare a randurilor
+static int sel_begin(Image *img) {
+    free(img->row_start);
+    img->row_start = (int*)malloc(((size_t)img->h + 1) * sizeof(int));
+    if (!img->row_start) return 0;
+    img->nruns = 0;
+    img->sel_rows = 0;
+    img->row_start[0] = 0;
+    return 1;
+}
+
+static int sel_push(Image *img, int y, int x0, int x1) {
+    if (x0 < 0) x0 = 0;
+    if (x1 > img->w) x1 = img->w;
+    if (x1 <= x0 || y < img->sel_rows - 1) return 1;
+    while (img->sel_rows <= y) img->row_start[++img->sel_rows] = img->nruns; // inchide randurile anterioare
+    if (img->nruns == img->runs_cap) {
+        int cap = img->runs_cap ? 2 * img->runs_cap : 256;
+        Run *r = (Run*)realloc(img->runs, (size_t)cap * sizeof(Run));
+        if (!r) return 0;
+        img->runs = r; img->runs_cap = cap;
+    }
+    img->runs[img->nruns].x0 = x0;
+    img->runs[img->nruns].x1 = x1;
+    img->row_start[y + 1] = ++img->nruns;
+    return 1;
+}
+
+// inchide randurile ramase si recalculeaza bounding box-ul; intoarce aria
+static long long sel_end(Image *img) {
+    while (img->sel_rows < img->h) img->row_start[++img->sel_rows] = img->nruns;
+    long long area = 0;
+    int bx1 = img->w, by1 = img->h, bx2 = 0, by2 = 0;
+    for (int y = 0; y < img->h; y++) {
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            area += img->runs[r].x1 - img->runs[r].x0;
+            if (img->runs[r].x0 < bx1) bx1 = img->runs[r].x0;
+            if (img->runs[r].x1 > bx2) bx2 = img->runs[r].x1;
+            if (y < by1) by1 = y;
+            by2 = y + 1;
+        }
+    }
+    if (area == 0) bx1 = by1 = bx2 = by2 = 0;
+    img->sel_area = area;
+    img->x1 = bx1; img->y1 = by1; img->x2 = bx2; img->y2 = by2;
+    return area;
+}
+
+// dreptunghiul [x1, x2) x [y1, y2) ca un run pe rand (fara verificari/mesaje)
+static int sel_rect(Image *img, int x1, int y1, int x2, int y2) {
+    if (!sel_begin(img)) return 0;
+    for (int y = y1; y < y2; y++)
+        if (!sel_push(img, y, x1, x2)) return 0;
+    sel_end(img);
+    return 1;
+}
+
+// pixelii cu centrul in interiorul elipsei
+static long long sel_ellipse(Image *img, double cx, double cy, double rx, double ry) {
+    if (!sel_begin(img)) return -1;
+    int ya = (int)floor(cy - ry - 1.0), yb = (int)ceil(cy + ry + 1.0);
+    if (ya < 0) ya = 0;
+    if (yb > img->h) yb = img->h;
+    for (int y = ya; y < yb; y++) {
+        double dy = (y + 0.5 - cy) / ry;
+        if (dy < -1.0 || dy > 1.0) continue;
+        double half = rx * sqrt(1.0 - dy * dy);
+        if (!sel_push(img, y, (int)ceil(cx - half - 0.5), (int)floor(cx + half - 0.5) + 1)) return -1;
+    }
+    return sel_end(img);
+}
+
+// scanline cu regula par-impar, esantionat in centrele pixelilor
+static long long sel_polygon(Image *img, int n, const double *px, const double *py) {
+    if (!sel_begin(img)) return -1;
+    double *xs = (double*)malloc((size_t)n * sizeof(double));
+    if (!xs) return -1;
+    double ymin = py[0], ymax = py[0];
+    for (int i = 1; i < n; i++) {
+        if (py[i] < ymin) ymin = py[i];
+        if (py[i] > ymax) ymax = py[i];
+    }
+    int ya = (int)floor(ymin), yb = (int)ceil(ymax);
+    if (ya < 0) ya = 0;
+    if (yb > img->h) yb = img->h;
+    for (int y = ya; y < yb; y++) {
+        double yc = y + 0.5;
+        int k = 0;
+        for (int i = 0, j = n - 1; i < n; j = i++) {
+            if ((py[i] <= yc && yc < py[j]) || (py[j] <= yc && yc < py[i])) {
+                double x = px[i] + (yc - py[i]) * (px[j] - px[i]) / (py[j] - py[i]);
+                int m = k++;
+                while (m > 0 && xs[m - 1] > x) { xs[m] = xs[m - 1]; m--; } // insertion sort
+                xs[m] = x;
+            }
+        }
+        for (int i = 0; i + 1 < k; i += 2)
+            if (!sel_push(img, y, (int)ceil(xs[i] - 0.5), (int)ceil(xs[i + 1] - 0.5))) { free(xs); return -1; }
+    }
+    free(xs);
+    return sel_end(img);
+}
+
+// pixelii nenuli ai unei masti P5 de aceeasi dimensiune cu imaginea
+static long long sel_mask(Image *img, const char *path) {
+    Image m = {0};
+    if (!img_load_pnm(&m, path)) return -1;
+    if (m.w != img->w || m.h != img->h || m.ch != 1) { img_free(&m); return -1; }
+    if (!sel_begin(img)) { img_free(&m); return -1; }
+    for (int y = 0; y < img->h; y++) {
+        const uint8_t *row = m.data + (size_t)y * img->w;
+        int x = 0;
+        while (x < img->w) {
+            while (x < img->w && !row[x]) x++;
+            int x0 = x;
+            while (x < img->w && row[x]) x++;
+            if (x > x0 && !sel_push(img, y, x0, x)) { img_free(&m); return -1; }
+        }
+    }
+    img_free(&m);
+    return sel_end(img);
+}
+
+// taie run-ul r la coloanele [lo, hi); 0 daca nu ramane nimic
+static inline int sel_clip(const Image *img, int r, int lo, int hi, int *xa, int *xb) {
+    *xa = img->runs[r].x0 > lo ? img->runs[r].x0 : lo;
+    *xb = img->runs[r].x1 < hi ? img->runs[r].x1 : hi;
+    return *xb > *xa;
+}
+
+// copiaza pixelii selectati din randurile [y1, y2) din tmp inapoi in data
+static void sel_commit(Image *img, int y1, int y2) {
+    for (int y = y1; y < y2; y++)
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (!sel_clip(img, r, 1, img->w - 1, &xa, &xb)) continue;
+            size_t off = ((size_t)y * img->w + xa) * img->ch;
+            memcpy(img->data + off, img->tmp + off, (size_t)(xb - xa) * img->ch);
+        }
+}
+
 static void img_crop(Image *img) {
     if (!img->loaded) { printf("No image loaded\n"); return; }
-    int nw = img->x2 - img->x1;
+    if (img->nruns == 0) { printf("Invalid set of coordinates\n"); return; }
+    int nw = img->x2 - img->x1;  // se taie la bounding box-ul selectiei
     int nh = img->y2 - img->y1;
     size_t nsz = (size_t)nw * (size_t)nh * (size_t)img->ch;
     uint8_t *nd = (uint8_t*)malloc(nsz);
@@ -169,244 +349,2444 @@ static void img_crop(Image *img) {
     printf("Image cropped\n");
 }
 
-// ======= OPENMP: Convolutie 3x3 paralela =======
-static void apply_conv3x3(Image *img, const double K[3][3], const char *msg) {
-    if (!img->loaded) { printf("No image loaded\n"); return; }
+// ======= Executor work-stealing pe tile =======
+// Fiecare thread are un deque de indici de task-uri (un interval [head, tail)).
+// Proprietarul scoate de la tail, hotii fura jumatate din interval de la head,
+// alegand victima aleator. Costul neuniform per pixel (selectii, filtre viitoare)
+// se echilibreaza singur, spre deosebire de schedule(static).
+#define WS_MAX_THREADS 256
 
-    int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
-    if (x1 == 0) x1++;
-    if (y1 == 0) y1++;
-    if (x2 == img->w) x2--;
-    if (y2 == img->h) y2--;
-    if (x2 - x1 <= 0 || y2 - y1 <= 0) { printf("%s done\n", msg); return; }
+typedef void (*WsTaskFn)(void *ctx, int task);
 
-    size_t sz = (size_t)img->w * (size_t)img->h * (size_t)img->ch;
-    if (!img_ensure_tmp(img, sz)) { fprintf(stderr, "malloc failed\n"); return; }
+typedef struct {
+#ifdef _OPENMP
+    omp_lock_t lock;
+#endif
+    int head, tail;                 // task-urile inca nefacute ale acestui thread
+    unsigned rng;                   // xorshift32 pentru alegerea victimei
+    long long tasks, steals, failed_steals;
+    double busy, idle;              // secunde in task-uri / in asteptare (cumulativ)
+    char pad[64];                   // fara false sharing intre workeri
+} WsWorker;
 
-    memcpy(img->tmp, img->data, sz);
-
-    // fiecare (y,x,c) scrie in tmp la index unic -> thread-safe
-    #pragma omp parallel for collapse(2) schedule(static)
-    for (int y = y1; y < y2; y++) {
-        for (int x = x1; x < x2; x++) {
-            size_t base = ((size_t)y * img->w + x) * (size_t)img->ch;
-            for (int c = 0; c < img->ch; c++) {
-                double sum = 0.0;
-                for (int ky = -1; ky <= 1; ky++) {
-                    for (int kx = -1; kx <= 1; kx++) {
-                        size_t idx = ((size_t)(y + ky) * img->w + (x + kx)) * (size_t)img->ch + (size_t)c;
-                        sum += K[ky + 1][kx + 1] * (double)img->data[idx];
-                    }
-                }
-                img->tmp[base + (size_t)c] = clamp_u8_double(sum);
-            }
-        }
+static WsWorker ws_workers[WS_MAX_THREADS];
+static int ws_ready = 0;
+static int ws_tile_w = 64, ws_tile_h = 16;  // forma tile-ului (TILES / TILES AUTO)
+static int ws_threads = 0;                  // thread-uri pentru ws_run, 0 -> toate (politica de executie)
+static int ws_steal = 1;                    // 0 -> doar impartirea initiala dupa cost, fara furt
+static int ws_simd = 1;                     // varianta kernel-urilor pe tile-uri: SIMD sau scalar
+// rezultatul AUTOTUNE e masurat doar pe filtrele 3x3: conv_into_tmp il aplica pe
+// durata filtrului, piramidele si checkpoint-urile raman pe furt + SIMD
+static int tune_steal = 1, tune_simd = 1;
+
+typedef struct { int x0, y0, x1, y1; } Tile;
+
+static void ws_init(void) {
+    if (ws_ready) return;
+    for (int i = 0; i < WS_MAX_THREADS; i++) {
+#ifdef _OPENMP
+        omp_init_lock(&ws_workers[i].lock);
+#endif
+        ws_workers[i].rng = 2463534242u + 977u * (unsigned)i;
     }
+    ws_ready = 1;
+}
 
-    uint8_t *t = img->data; img->data = img->tmp; img->tmp = t;
-    printf("%s done\n", msg);
+static void ws_destroy(void) {
+    if (!ws_ready) return;
+#ifdef _OPENMP
+    for (int i = 0; i < WS_MAX_THREADS; i++) omp_destroy_lock(&ws_workers[i].lock);
+#endif
+    ws_ready = 0;
 }
 
-// ======= OPENMP: Sobel paralel =======
-static void apply_sobel(Image *img) {
-    if (!img->loaded) { printf("No image loaded\n"); return; }
+// primul task al thread-ului k din T cand task-urile se impart dupa costul cumulat
+static int ws_split(const long long *cost, int ntasks, int k, int T) {
+    long long target = cost[ntasks] / T * k + cost[ntasks] % T * k / T;
+    int lo = 0, hi = ntasks;
+    while (lo < hi) {  // primul i cu cost[i] >= target
+        int mid = lo + (hi - lo) / 2;
+        if (cost[mid] < target) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
 
-    int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
-    if (x1 == 0) x1++;
-    if (y1 == 0) y1++;
-    if (x2 == img->w) x2--;
-    if (y2 == img->h) y2--;
-    if (x2 - x1 <= 0 || y2 - y1 <= 0) { printf("APPLY SOBEL done\n"); return; }
+static inline unsigned ws_rand(WsWorker *w) {
+    unsigned x = w->rng;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return w->rng = x;
+}
 
-    static const int Gx[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
-    static const int Gy[3][3] = {{ 1, 2, 1}, { 0, 0, 0}, {-1,-2,-1}};
+// Ruleaza fn(ctx, 0..ntasks-1) pe toate thread-urile, cu work-stealing.
+// cost (optional, ntasks+1 sume prefix) imparte initial task-urile dupa cost, nu dupa numar.
+static void ws_run(int ntasks, const long long *cost, WsTaskFn fn, void *ctx) {
+    if (ntasks <= 0) return;
+    ws_init();
+    int nt = 1;
+#ifdef _OPENMP
+    nt = ws_threads > 0 ? ws_threads : omp_get_max_threads();
+    if (nt > WS_MAX_THREADS) nt = WS_MAX_THREADS;
+    if (nt > ntasks) nt = ntasks;
+#endif
+    if (nt <= 1) {
+        // un singur thread: fara regiune paralela, task-urile ruleaza pe loc
+        WsWorker *w = &ws_workers[0];
+        double t0 = now_sec();
+        for (int i = 0; i < ntasks; i++) fn(ctx, i);
+        w->tasks += ntasks;
+        w->busy += now_sec() - t0;
+        return;
+    }
+#ifdef _OPENMP
+    int remaining = ntasks;
 
-    size_t sz = (size_t)img->w * (size_t)img->h * (size_t)img->ch;
-    if (!img_ensure_tmp(img, sz)) { fprintf(stderr, "malloc failed\n"); return; }
+    #pragma omp parallel num_threads(nt)
+    {
+        int me = omp_get_thread_num(), T = omp_get_num_threads();
+        WsWorker *w = &ws_workers[me];
+        double t_start = now_sec(), busy = 0.0;
 
-    memcpy(img->tmp, img->data, sz);
-
-    #pragma omp parallel for collapse(2) schedule(static)
-    for (int y = y1; y < y2; y++) {
-        for (int x = x1; x < x2; x++) {
-            size_t base = ((size_t)y * img->w + x) * (size_t)img->ch;
-            for (int c = 0; c < img->ch; c++) {
-                int sx = 0, sy = 0;
-                for (int ky = -1; ky <= 1; ky++) {
-                    for (int kx = -1; kx <= 1; kx++) {
-                        size_t idx = ((size_t)(y + ky) * img->w + (x + kx)) * (size_t)img->ch + (size_t)c;
-                        int v = (int)img->data[idx];
-                        sx += v * Gx[ky + 1][kx + 1];
-                        sy += v * Gy[ky + 1][kx + 1];
-                    }
+        // distributie initiala pe blocuri contigue (localitate buna daca nu se fura)
+        int lo = (int)((long long)ntasks * me / T), hi = (int)((long long)ntasks * (me + 1) / T);
+        if (cost) {
+            lo = ws_split(cost, ntasks, me, T);
+            hi = ws_split(cost, ntasks, me + 1, T);
+        }
+        omp_set_lock(&w->lock);
+        w->head = lo;
+        w->tail = hi;
+        omp_unset_lock(&w->lock);
+        #pragma omp barrier
+
+        for (;;) {
+            int task = -1;
+            omp_set_lock(&w->lock);
+            if (w->head < w->tail) task = --w->tail;
+            omp_unset_lock(&w->lock);
+
+            if (task < 0 && !ws_steal) break;  // fara furt: bariera implicita asteapta restul
+            if (task < 0 && T > 1) {
+                // deque gol: fura jumatate din deque-ul unei victime aleatoare
+                int v = (int)(ws_rand(w) % (unsigned)(T - 1));
+                if (v >= me) v++;
+                WsWorker *vw = &ws_workers[v];
+                lo = hi = 0;
+                omp_set_lock(&vw->lock);
+                int len = vw->tail - vw->head;
+                if (len > 0) {
+                    int k = (len + 1) / 2;
+                    lo = vw->head; hi = lo + k;
+                    vw->head = hi;
                 }
-                double mag = sqrt((double)sx * (double)sx + (double)sy * (double)sy);
-                img->tmp[base + (size_t)c] = clamp_u8_double(mag);
+                omp_unset_lock(&vw->lock);
+                if (hi > lo) {
+                    w->steals++;
+                    task = hi - 1;
+                    omp_set_lock(&w->lock);
+                    w->head = lo; w->tail = hi - 1;
+                    omp_unset_lock(&w->lock);
+                } else {
+                    w->failed_steals++;
+                    sched_yield();  // nu ocupam core-ul cat asteptam ultimele task-uri
+                }
+            }
+
+            if (task >= 0) {
+                double t0 = now_sec();
+                fn(ctx, task);
+                busy += now_sec() - t0;
+                w->tasks++;
+                #pragma omp atomic
+                remaining--;
+            } else {
+                int left;
+                #pragma omp atomic read
+                left = remaining;
+                if (left == 0) break;
             }
         }
+        w->busy += busy;
+        w->idle += (now_sec() - t_start) - busy;
     }
+#endif
+}
 
-    uint8_t *t = img->data; img->data = img->tmp; img->tmp = t;
-    printf("APPLY SOBEL done\n");
+// Afiseaza si reseteaza statisticile (echilibrul se valideaza pe masini cu multe core-uri)
+static void ws_report(void) {
+    ws_init();
+    int nt = 1;
+#ifdef _OPENMP
+    nt = omp_get_max_threads();
+    if (nt > WS_MAX_THREADS) nt = WS_MAX_THREADS;
+#endif
+    long long tasks = 0, steals = 0, failed = 0;
+    double busy = 0.0, idle = 0.0, max_busy = 0.0;
+    for (int i = 0; i < nt; i++) {
+        WsWorker *w = &ws_workers[i];
+        printf("WSSTATS thread=%d tasks=%lld steals=%lld failed_steals=%lld busy=%.6f idle=%.6f\n",
+               i, w->tasks, w->steals, w->failed_steals, w->busy, w->idle);
+        tasks += w->tasks; steals += w->steals; failed += w->failed_steals;
+        busy += w->busy; idle += w->idle;
+        if (w->busy > max_busy) max_busy = w->busy;
+        w->tasks = w->steals = w->failed_steals = 0;
+        w->busy = w->idle = 0.0;
+    }
+    double imbalance = (busy > 0.0) ? max_busy / (busy / nt) : 1.0;
+    printf("WSSTATS total threads=%d tile=%dx%d tasks=%lld steals=%lld failed_steals=%lld busy=%.6f idle=%.6f imbalance=%.3f\n",
+           nt, ws_tile_w, ws_tile_h, tasks, steals, failed, busy, idle, imbalance);
 }
 
-static void histogram(const Image *img, int xstars, int bins) {
-    if (!img->loaded) { printf("No image loaded\n"); return; }
-    if (img->ch != 1) { printf("Black and white image needed\n"); return; }
-    if (bins <= 0 || 256 % bins != 0) { printf("Invalid command\n"); return; }
+// Imparte bounding box-ul [x1,x2) x [y1,y2) in tile-uri tw x th, pastreaza doar
+// tile-urile care intersecteaza selectia si calculeaza in cost[] suma prefix a
+// pixelilor selectati -> echilibrare dupa lungimea run-urilor, nu dupa randuri.
+static Tile *make_tiles(const Image *img, int x1, int y1, int x2, int y2, int tw, int th,
+                        int *count, long long **cost) {
+    int nx = (x2 - x1 + tw - 1) / tw, ny = (y2 - y1 + th - 1) / th;
+    Tile *t = (Tile*)malloc((size_t)nx * ny * sizeof(Tile));
+    long long *c = (long long*)malloc(((size_t)nx * ny + 1) * sizeof(long long));
+    long long *px = (long long*)calloc((size_t)nx, sizeof(long long));
+    if (!t || !c || !px) { free(t); free(c); free(px); return NULL; }
+    int n = 0;
+    c[0] = 0;
+    for (int y = y1; y < y2; y += th) {
+        int yb = (y + th < y2) ? y + th : y2;
+        // pixelii selectati din fiecare coloana de tile-uri a acestei benzi
+        memset(px, 0, (size_t)nx * sizeof(long long));
+        for (int yy = y; yy < yb; yy++)
+            for (int r = img->row_start[yy]; r < img->row_start[yy + 1]; r++) {
+                int xa, xb;
+                if (!sel_clip(img, r, x1, x2, &xa, &xb)) continue;
+                for (int i = (xa - x1) / tw; i < nx && x1 + i * tw < xb; i++) {
+                    int lo = x1 + i * tw > xa ? x1 + i * tw : xa;
+                    int hi = x1 + (i + 1) * tw < xb ? x1 + (i + 1) * tw : xb;
+                    px[i] += hi - lo;
+                }
+            }
+        for (int i = 0; i < nx; i++) {
+            if (!px[i]) continue;
+            t[n].x0 = x1 + i * tw; t[n].y0 = y;
+            t[n].x1 = (x1 + (i + 1) * tw < x2) ? x1 + (i + 1) * tw : x2;
+            t[n].y1 = yb;
+            c[n + 1] = c[n] + px[i];
+            n++;
+        }
+    }
+    free(px);
+    *count = n;
+    *cost = c;
+    return t;
+}
 
-    int fr[256] = {0};
-    for (int i = 0; i < img->w * img->h; i++) fr[img->data[i]]++;
+// ======= OPENMP: Convolutie 3x3 / Sobel pe tile-uri =======
+typedef struct {
+    Image *img;
+    const double (*K)[3];   // NULL -> Sobel
+    const Tile *tiles;
+} ConvJob;
 
-    int group = 256 / bins;
-    int maxbin = 0;
-    for (int b = 0; b < bins; b++) {
-        int s = 0;
-        for (int k = 0; k < group; k++) s += fr[b * group + k];
-        if (s > maxbin) maxbin = s;
+// Filtrul pe run-ul [xa, xb) al randului y, scris in tmp (fiecare (y,x,c) are indexul
+// lui -> thread-safe). simd != 0: bucla pe esantioane (x * ch + c) cu cei 9 vecini la
+// offset-uri fixe, vectorizabila; aceeasi ordine a sumei -> rezultat identic bit cu bit.
+static void conv_run(Image *img, const double K[3][3], int y, int xa, int xb, int simd) {
+    int ch = img->ch;
+    size_t rb = (size_t)img->w * ch;
+    if (simd) {
+        const uint8_t *u = img->data + (size_t)(y - 1) * rb, *m = u + rb, *d = m + rb;
+        uint8_t *o = img->tmp + (size_t)y * rb;
+        const double k0 = K[0][0], k1 = K[0][1], k2 = K[0][2], k3 = K[1][0], k4 = K[1][1],
+                     k5 = K[1][2], k6 = K[2][0], k7 = K[2][1], k8 = K[2][2];
+        #pragma omp simd
+        for (int i = xa * ch; i < xb * ch; i++) {
+            double sum = 0.0;
+            sum += k0 * (double)u[i - ch]; sum += k1 * (double)u[i]; sum += k2 * (double)u[i + ch];
+            sum += k3 * (double)m[i - ch]; sum += k4 * (double)m[i]; sum += k5 * (double)m[i + ch];
+            sum += k6 * (double)d[i - ch]; sum += k7 * (double)d[i]; sum += k8 * (double)d[i + ch];
+            o[i] = clamp_u8_double(sum);
+        }
+        return;
     }
-    for (int b = 0; b < bins; b++) {
-        int s = 0;
-        for (int k = 0; k < group; k++) s += fr[b * group + k];
-        int stars = (maxbin == 0) ? 0 : (int)lrint((double)s / (double)maxbin * (double)xstars);
-        printf("%d\t|\t", stars);
-        for (int i = 0; i < stars; i++) putchar('*');
-        putchar('\n');
+    for (int x = xa; x < xb; x++) {
+        size_t base = ((size_t)y * img->w + x) * (size_t)ch;
+        for (int c = 0; c < ch; c++) {
+            double sum = 0.0;
+            for (int ky = -1; ky <= 1; ky++) {
+                for (int kx = -1; kx <= 1; kx++) {
+                    size_t idx = ((size_t)(y + ky) * img->w + (x + kx)) * (size_t)ch + (size_t)c;
+                    sum += K[ky + 1][kx + 1] * (double)img->data[idx];
+                }
+            }
+            img->tmp[base + (size_t)c] = clamp_u8_double(sum);
+        }
     }
 }
 
-// ======= OPENMP: Equalize cu histograma paralela (optional, dar util) =======
-static void equalize(Image *img) {
-    if (!img->loaded) { printf("No image loaded\n"); return; }
-    if (img->ch != 1) { printf("Black and white image needed\n"); return; }
-
-    size_t area = (size_t)img->w * (size_t)img->h;
-    int fr[256] = {0};
-
-    // histograma paralela: fiecare thread are fr_local[256], apoi reduce
-    #pragma omp parallel
-    {
-        int local[256] = {0};
+static void sobel_run(Image *img, int y, int xa, int xb, int simd) {
+    static const int Gx[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+    static const int Gy[3][3] = {{ 1, 2, 1}, { 0, 0, 0}, {-1,-2,-1}};
+    int ch = img->ch;
+    size_t rb = (size_t)img->w * ch;
+    if (simd) {
+        const uint8_t *u = img->data + (size_t)(y - 1) * rb, *m = u + rb, *d = m + rb;
+        uint8_t *o = img->tmp + (size_t)y * rb;
+        #pragma omp simd
+        for (int i = xa * ch; i < xb * ch; i++) {
+            int sx = (u[i + ch] - u[i - ch]) + 2 * (m[i + ch] - m[i - ch]) + (d[i + ch] - d[i - ch]);
+            int sy = (u[i - ch] + 2 * u[i] + u[i + ch]) - (d[i - ch] + 2 * d[i] + d[i + ch]);
+            o[i] = clamp_u8_double(sqrt((double)sx * (double)sx + (double)sy * (double)sy));
+        }
+        return;
+    }
+    for (int x = xa; x < xb; x++) {
+        size_t base = ((size_t)y * img->w + x) * (size_t)ch;
+        for (int c = 0; c < ch; c++) {
+            int sx = 0, sy = 0;
+            for (int ky = -1; ky <= 1; ky++) {
+                for (int kx = -1; kx <= 1; kx++) {
+                    size_t idx = ((size_t)(y + ky) * img->w + (x + kx)) * (size_t)ch + (size_t)c;
+                    int v = (int)img->data[idx];
+                    sx += v * Gx[ky + 1][kx + 1];
+                    sy += v * Gy[ky + 1][kx + 1];
+                }
+            }
+            double mag = sqrt((double)sx * (double)sx + (double)sy * (double)sy);
+            img->tmp[base + (size_t)c] = clamp_u8_double(mag);
+        }
+    }
+}
 
-        #pragma omp for schedule(static)
-        for (size_t i = 0; i < area; i++) {
-            local[ img->data[i] ]++;
+static void conv_tile_task(void *ctx, int task) {
+    const ConvJob *j = (const ConvJob*)ctx;
+    Image *img = j->img;
+    const Tile *t = &j->tiles[task];
+    for (int y = t->y0; y < t->y1; y++)
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (sel_clip(img, r, t->x0, t->x1, &xa, &xb)) conv_run(img, j->K, y, xa, xb, ws_simd);
         }
+}
 
-        #pragma omp critical
-        {
-            for (int k = 0; k < 256; k++) fr[k] += local[k];
+static void sobel_tile_task(void *ctx, int task) {
+    const ConvJob *j = (const ConvJob*)ctx;
+    Image *img = j->img;
+    const Tile *t = &j->tiles[task];
+    for (int y = t->y0; y < t->y1; y++)
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (sel_clip(img, r, t->x0, t->x1, &xa, &xb)) sobel_run(img, y, xa, xb, ws_simd);
         }
-    }
+}
 
-    int cdf[256];
-    int run = 0;
-    for (int i = 0; i < 256; i++) { run += fr[i]; cdf[i] = run; }
+// copiaza rezultatul unui tile din tmp in data (tile-urile sunt disjuncte)
+static void commit_tile_task(void *ctx, int task) {
+    const ConvJob *j = (const ConvJob*)ctx;
+    Image *img = j->img;
+    const Tile *t = &j->tiles[task];
+    for (int y = t->y0; y < t->y1; y++)
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (!sel_clip(img, r, t->x0, t->x1, &xa, &xb)) continue;
+            size_t off = ((size_t)y * img->w + xa) * img->ch;
+            memcpy(img->data + off, img->tmp + off, (size_t)(xb - xa) * img->ch);
+        }
+}
 
-    #pragma omp parallel for schedule(static)
-    for (size_t i = 0; i < area; i++) {
-        int v = img->data[i];
-        double nv = 255.0 * (double)cdf[v] / (double)area;
-        img->data[i] = clamp_u8_double(nv);
-    }
+// Calculeaza filtrul in img->tmp doar pe pixelii selectati (commit != 0 -> ii copiaza
+// inapoi in data). Nu mai copiem toata imaginea: costul e proportional cu selectia.
+static int conv_into_tmp(Image *img, const double K[3][3], int x1, int y1, int x2, int y2,
+                         int tw, int th, int commit) {
+    size_t sz = (size_t)img->w * (size_t)img->h * (size_t)img->ch;
+    if (!img_ensure_tmp(img, sz)) return 0;
 
-    printf("Equalize done\n");
+    int nt;
+    long long *cost;
+    Tile *tiles = make_tiles(img, x1, y1, x2, y2, tw, th, &nt, &cost);
+    if (!tiles) return 0;
+    ConvJob job = { img, K, tiles };
+    ws_steal = tune_steal; ws_simd = tune_simd;
+    ws_run(nt, cost, K ? conv_tile_task : sobel_tile_task, &job);
+    if (commit) ws_run(nt, cost, commit_tile_task, &job);
+    ws_steal = ws_simd = 1;
+    free(tiles);
+    free(cost);
+    return 1;
 }
 
-static void bench(Image *img, int iters, const char *what) {
-    if (!img->loaded) { printf("No image loaded\n"); return; }
-    if (iters <= 0) { printf("Invalid command\n"); return; }
+// ======= Autotuning pentru forma tile-ului =======
+// formele candidat (TILES AUTO, AUTOTUNE); latimea se taie la latimea selectiei
+static const int TILE_CANDS[][2] = {
+    {16, 16}, {32, 32}, {64, 16}, {64, 64}, {128, 8}, {256, 4}, {256, 32}, {1 << 30, 4}
+};
 
-    static const double K_EDGE[3][3] = {
-        {-1,-1,-1},{-1, 8,-1},{-1,-1,-1}
-    };
-    static const double K_SHARP[3][3] = {
-        { 0,-1, 0},{-1, 5,-1},{ 0,-1, 0}
-    };
-    static const double K_BLUR[3][3] = {
-        {1.0/9,1.0/9,1.0/9},{1.0/9,1.0/9,1.0/9},{1.0/9,1.0/9,1.0/9}
-    };
+// Masoara GAUSSIAN_BLUR pe selectia curenta cu cateva forme candidat si o pastreaza
+// pe cea mai rapida. Imaginea nu e modificata (rezultatele raman in tmp).
+static void tiles_autotune(Image *img) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
     static const double K_GAUSS[3][3] = {
         {1.0/16,2.0/16,1.0/16},{2.0/16,4.0/16,2.0/16},{1.0/16,2.0/16,1.0/16}
     };
+    int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
+    if (x1 == 0) x1++;
+    if (y1 == 0) y1++;
+    if (x2 == img->w) x2--;
+    if (y2 == img->h) y2--;
+    if (x2 - x1 <= 0 || y2 - y1 <= 0) { printf("Invalid set of coordinates\n"); return; }
 
-    double t0 = now_sec();
-    for (int i = 0; i < iters; i++) {
-        if (strcmp(what, "SOBEL") == 0) apply_sobel(img);
-        else if (strcmp(what, "GAUSS_SOBEL") == 0) {
-            apply_conv3x3(img, K_GAUSS, "APPLY GAUSSIAN_BLUR");
-            apply_sobel(img);
-        } else if (strcmp(what, "PIPE") == 0) {
-            apply_conv3x3(img, K_GAUSS, "APPLY GAUSSIAN_BLUR");
-            apply_sobel(img);
-            apply_conv3x3(img, K_SHARP, "APPLY SHARPEN");
-        } else if (strcmp(what, "EDGE") == 0) apply_conv3x3(img, K_EDGE, "APPLY EDGE");
-        else if (strcmp(what, "SHARPEN") == 0) apply_conv3x3(img, K_SHARP, "APPLY SHARPEN");
-        else if (strcmp(what, "BLUR") == 0) apply_conv3x3(img, K_BLUR, "APPLY BLUR");
-        else if (strcmp(what, "GAUSSIAN_BLUR") == 0) apply_conv3x3(img, K_GAUSS, "APPLY GAUSSIAN_BLUR");
-        else { printf("Invalid command\n"); return; }
+    double best = 1e30;
+    int bw = ws_tile_w, bh = ws_tile_h;
+    for (size_t i = 0; i < sizeof(TILE_CANDS) / sizeof(TILE_CANDS[0]); i++) {
+        int tw = TILE_CANDS[i][0] < x2 - x1 ? TILE_CANDS[i][0] : x2 - x1;
+        int th = TILE_CANDS[i][1];
+        double t = 1e30;
+        for (int rep = 0; rep < 3; rep++) {  // minimul din 3 rulari
+            double t0 = now_sec();
+            if (!conv_into_tmp(img, K_GAUSS, x1, y1, x2, y2, tw, th, 0)) { fprintf(stderr, "malloc failed\n"); return; }
+            double dt = now_sec() - t0;
+            if (dt < t) t = dt;
+        }
+        if (t < best) { best = t; bw = tw; bh = th; }
     }
-    double t1 = now_sec();
-    printf("BENCH %s iters=%d time=%.6f sec\n", what, iters, t1 - t0);
+    ws_tile_w = bw; ws_tile_h = bh;
+    printf("TILES %dx%d (%.6f sec)\n", bw, bh, best);
 }
 
-int main(void) {
-    Image img = (Image){0};
-    char cmd[64];
+// ======= Politica de executie adaptiva =======
+// Pe imagini mici (thumbnail-uri) pornirea regiunii paralele costa mai mult decat
+// filtrul. Pentru fiecare comanda estimam lucrul (esantioane selectate x cost per
+// esantion) si alegem varianta cea mai rapida: SERIAL (bucla scalara pe thread-ul
+// curent), SIMD (bucla vectorizata, tot pe thread-ul curent) sau THREADS cu t
+// thread-uri. Costurile se masoara o data per masina si se pastreaza in profil.
+enum { EXEC_AUTO, EXEC_SERIAL, EXEC_SIMD, EXEC_THREADS };
+static const char *const EXEC_NAMES[] = {"AUTO", "SERIAL", "SIMD", "THREADS"};
+enum { KC_CONV, KC_SOBEL, KC_POINT };  // clase de kernel cu cost masurat
 
-    while (scanf("%63s", cmd) == 1) {
-        if (strcmp(cmd, "LOAD") == 0) {
-            char path[256];
-            scanf("%255s", path);
-            if (img_load_pnm(&img, path)) printf("Loaded %s\n", path);
-            else printf("Failed to load %s\n", path);
+typedef struct {
+    int calibrated;
+    int max_threads;                  // thread-urile disponibile la calibrare
+    double conv_ser, conv_simd;       // ns per esantion (pixel x canal)
+    double sobel_ser, sobel_simd;
+    double point;                     // ns per esantion, operatii punctuale (conversii etc.)
+    double fork[WS_MAX_THREADS + 1];  // ns: costul fix al unei regiuni cu t thread-uri
+    double speedup[WS_MAX_THREADS + 1]; // accelerarea masurata a filtrului pe t thread-uri
+    // rezultatul AUTOTUNE (tuned = 0 -> valorile implicite)
+    int tuned, tile_w, tile_h, threads, steal, simd;
+} ExecProfile;
 
-        } else if (strcmp(cmd, "SAVE") == 0) {
-            char path[256];
-            scanf("%255s", path);
-            if (!img.loaded) { printf("No image loaded\n"); continue; }
-            if (img_save_pnm(&img, path)) printf("Saved %s\n", path);
-            else printf("Failed to save %s\n", path);
+static ExecProfile pol;
+static int pol_mode = EXEC_AUTO, pol_forced_threads = 1;  // POLICY SERIAL / SIMD / THREADS n
 
-        } else if (strcmp(cmd, "SELECT") == 0) {
-            char next[64];
-            scanf("%63s", next);
-            if (strcmp(next, "ALL") == 0) img_select_all(&img);
-            else {
-                int x1 = atoi(next), y1, x2, y2;
-                if (scanf("%d %d %d", &y1, &x2, &y2) != 3) { printf("Invalid command\n"); continue; }
-                img_select_rect(&img, x1, y1, x2, y2);
-            }
+static int pol_max_threads(void) {
+#ifdef _OPENMP
+    int nt = omp_get_max_threads();
+    return nt < WS_MAX_THREADS ? nt : WS_MAX_THREADS;
+#else
+    return 1;
+#endif
+}
 
-        } else if (strcmp(cmd, "CROP") == 0) {
-            img_crop(&img);
+// EDITOR_PROFILE alege fisierul (sir gol -> fara cache), implicit ~/.editor_omp.profile
+static const char *pol_path(void) {
+    static char buf[512];
+    const char *p = getenv("EDITOR_PROFILE");
+    if (p) return p[0] ? p : NULL;
+    const char *home = getenv("HOME");
+    snprintf(buf, sizeof buf, "%s/.editor_omp.profile", (home && home[0]) ? home : ".");
+    return buf;
+}
 
-        } else if (strcmp(cmd, "HISTOGRAM") == 0) {
-            int xstars, bins;
-            if (scanf("%d %d", &xstars, &bins) != 2) { printf("Invalid command\n"); continue; }
-            histogram(&img, xstars, bins);
+// profilul are linii key=value; cheile necunoscute se ignora
+static int pol_load(void) {
+    const char *path = pol_path();
+    FILE *f = path ? fopen(path, "r") : NULL;
+    if (!f) return 0;
+    ExecProfile p;
+    memset(&p, 0, sizeof p);
+    char line[256], key[64];
+    double v;
+    int t;
+    while (fgets(line, sizeof line, f)) {
+        if (sscanf(line, " %63[^= \t] = %lf", key, &v) != 2) continue;
+        if (strcmp(key, "max_threads") == 0) p.max_threads = (int)v;
+        else if (strcmp(key, "conv_ser_ns") == 0) p.conv_ser = v;
+        else if (strcmp(key, "conv_simd_ns") == 0) p.conv_simd = v;
+        else if (strcmp(key, "sobel_ser_ns") == 0) p.sobel_ser = v;
+        else if (strcmp(key, "sobel_simd_ns") == 0) p.sobel_simd = v;
+        else if (strcmp(key, "point_ns") == 0) p.point = v;
+        else if (sscanf(key, "fork_ns_%d", &t) == 1 && t >= 1 && t <= WS_MAX_THREADS) p.fork[t] = v;
+        else if (sscanf(key, "speedup_%d", &t) == 1 && t >= 1 && t <= WS_MAX_THREADS) p.speedup[t] = v;
+        else if (strcmp(key, "tune_tile_w") == 0) p.tile_w = (int)v;
+        else if (strcmp(key, "tune_tile_h") == 0) p.tile_h = (int)v;
+        else if (strcmp(key, "tune_threads") == 0) p.threads = (int)v;
+        else if (strcmp(key, "tune_steal") == 0) p.steal = (int)v;
+        else if (strcmp(key, "tune_simd") == 0) p.simd = (int)v;
+    }
+    fclose(f);
+    // rezultatul AUTOTUNE nu depinde de calibrare: ramane si cand recalibram (si e
+    // salvat din nou), cu thread-urile limitate la cate sunt disponibile acum
+    int tmax = pol_max_threads();
+    p.tuned = p.tile_w > 0 && p.tile_h > 0 && p.threads >= 1;
+    if (p.threads > tmax) p.threads = tmax;
+    pol.tuned = p.tuned;
+    pol.tile_w = p.tile_w; pol.tile_h = p.tile_h;
+    pol.threads = p.threads; pol.steal = p.steal; pol.simd = p.simd;
+    if (pol.tuned) {
+        ws_tile_w = pol.tile_w; ws_tile_h = pol.tile_h;
+        tune_steal = pol.steal != 0; tune_simd = pol.simd != 0;
+    }
+    // calibrare facuta cu alt numar de thread-uri (OMP_NUM_THREADS) sau incompleta -> recalibram
+    if (p.max_threads != tmax || p.conv_ser <= 0.0 || p.conv_simd <= 0.0 ||
+        p.sobel_ser <= 0.0 || p.sobel_simd <= 0.0 || p.point <= 0.0) return 0;
+    for (t = 2; t <= p.max_threads; t++)
+        if (p.speedup[t] <= 0.0) return 0;
+    p.calibrated = 1;
+    pol = p;
+    return 1;
+}
 
-        } else if (strcmp(cmd, "EQUALIZE") == 0) {
-            equalize(&img);
+static int pol_save(void) {
+    const char *path = pol_path();
+    FILE *f = path ? fopen(path, "w") : NULL;
+    if (!f) return 0;
+    fprintf(f, "# editor_omp execution profile\n");
+    fprintf(f, "max_threads=%d\n", pol.max_threads);
+    fprintf(f, "conv_ser_ns=%.4f\nconv_simd_ns=%.4f\n", pol.conv_ser, pol.conv_simd);
+    fprintf(f, "sobel_ser_ns=%.4f\nsobel_simd_ns=%.4f\n", pol.sobel_ser, pol.sobel_simd);
+    fprintf(f, "point_ns=%.4f\n", pol.point);
+    for (int t = 2; t <= pol.max_threads; t++)
+        fprintf(f, "fork_ns_%d=%.0f\nspeedup_%d=%.3f\n", t, pol.fork[t], t, pol.speedup[t]);
+    if (pol.tuned)
+        fprintf(f, "tune_tile_w=%d\ntune_tile_h=%d\ntune_threads=%d\ntune_steal=%d\ntune_simd=%d\n",
+                pol.tile_w, pol.tile_h, pol.threads, pol.steal, pol.simd);
+    return fclose(f) == 0;
+}
 
-        } else if (strcmp(cmd, "APPLY") == 0) {
-            char what[64];
-            scanf("%63s", what);
+static void cvt_rgb_to_ycbcr_row(const uint8_t *src, uint8_t *dst, int n);
 
-            static const double K_EDGE[3][3] = { {-1,-1,-1},{-1, 8,-1},{-1,-1,-1} };
-            static const double K_SHARP[3][3]= { { 0,-1, 0},{-1, 5,-1},{ 0,-1, 0} };
-            static const double K_BLUR[3][3] = { {1.0/9,1.0/9,1.0/9},{1.0/9,1.0/9,1.0/9},{1.0/9,1.0/9,1.0/9} };
-            static const double K_GAUSS[3][3]= { {1.0/16,2.0/16,1.0/16},{2.0/16,4.0/16,2.0/16},{1.0/16,2.0/16,1.0/16} };
+// Masoara kernel-urile pe o imagine sintetica 192x192 RGB (minimul din 5 rulari),
+// apoi pentru fiecare numar de thread-uri costul unei regiuni paralele goale si
+// accelerarea reala a filtrului pe executor (pe o masina incarcata poate fi < 1).
+// Intoarce 1 daca profilul a fost salvat.
+static int pol_calibrate(void) {
+    static const double K_GAUSS[3][3] = {
+        {1.0/16,2.0/16,1.0/16},{2.0/16,4.0/16,2.0/16},{1.0/16,2.0/16,1.0/16}
+    };
+    Image c = (Image){0};
+    c.w = c.h = 192; c.ch = 3;
+    size_t sz = (size_t)c.w * c.h * c.ch;
+    c.data = (uint8_t*)malloc(sz);
+    if (!c.data || !img_ensure_tmp(&c, sz) || !sel_rect(&c, 0, 0, c.w, c.h)) { img_free(&c); return 0; }
+    unsigned r = 2463534242u;
+    for (size_t i = 0; i < sz; i++) { r ^= r << 13; r ^= r >> 17; r ^= r << 5; c.data[i] = (uint8_t)r; }
 
-            if (!img.loaded) { printf("No image loaded\n"); continue; }
+    double best[5] = {1e30, 1e30, 1e30, 1e30, 1e30};
+    for (int rep = 0; rep < 5; rep++) {
+        for (int k = 0; k < 5; k++) {
+            double t0 = now_sec();
+            for (int y = 1; y < c.h - 1; y++) {
+                if (k < 2) conv_run(&c, K_GAUSS, y, 1, c.w - 1, k);
+                else if (k < 4) sobel_run(&c, y, 1, c.w - 1, k - 2);
+                else cvt_rgb_to_ycbcr_row(c.data + (size_t)y * c.w * 3, c.tmp + (size_t)y * c.w * 3, c.w);
+            }
+            double dt = now_sec() - t0;
+            if (dt < best[k]) best[k] = dt;
+        }
+    }
+    double n = (double)(c.w - 2) * (c.h - 2) * c.ch;
+    pol.conv_ser = best[0] * 1e9 / n;
+    pol.conv_simd = best[1] * 1e9 / n;
+    pol.sobel_ser = best[2] * 1e9 / n;
+    pol.sobel_simd = best[3] * 1e9 / n;
+    pol.point = best[4] * 1e9 / ((double)(c.h - 2) * c.w * c.ch);
+
+    pol.max_threads = pol_max_threads();
+    pol.fork[1] = 0.0;
+    pol.speedup[1] = 1.0;
+    for (int t = 2; t <= pol.max_threads; t++) {
+        double b = 1e30, run = 1e30;
+        for (int rep = 0; rep < 20; rep++) {
+            double t0 = now_sec();
+            #pragma omp parallel num_threads(t)
+            {
+                #pragma omp barrier
+            }
+            double dt = now_sec() - t0;
+            if (dt < b) b = dt;
+        }
+        ws_threads = t;
+        int steal = tune_steal, simd = tune_simd;
+        tune_steal = tune_simd = 1;
+        for (int rep = 0; rep < 5; rep++) {
+            double t0 = now_sec();
+            conv_into_tmp(&c, K_GAUSS, 1, 1, c.w - 1, c.h - 1, ws_tile_w, ws_tile_h, 0);
+            double dt = now_sec() - t0;
+            if (dt < run) run = dt;
+        }
+        ws_threads = 0;
+        tune_steal = steal; tune_simd = simd;
+        pol.fork[t] = b * 1e9;
+        run -= b;
+        pol.speedup[t] = run > 0.0 ? best[1] / run : (double)t;
+    }
+    img_free(&c);
+    pol.calibrated = 1;
+    return pol_save();
+}
+
+// profilul din cache sau, prima data pe masina asta, calibrarea
+static void pol_ensure(void) {
+    if (!pol.calibrated && !pol_load()) pol_calibrate();
+}
+
+// Alege varianta pentru n esantioane din clasa kind; *threads = 1 pentru SERIAL/SIMD.
+// THREADS: costul fix al regiunii + lucrul SIMD impartit la accelerarea masurata.
+static int pol_pick(int kind, long long n, int *threads) {
+    *threads = 1;
+    if (pol_mode == EXEC_SERIAL || pol_mode == EXEC_SIMD) return pol_mode;
+    if (pol_mode == EXEC_THREADS) { *threads = pol_forced_threads; return EXEC_THREADS; }
+    pol_ensure();
+    if (!pol.calibrated) { *threads = pol_max_threads(); return EXEC_THREADS; }
+
+    double ser = kind == KC_CONV ? pol.conv_ser : kind == KC_SOBEL ? pol.sobel_ser : pol.point;
+    double simd = kind == KC_CONV ? pol.conv_simd : kind == KC_SOBEL ? pol.sobel_simd : pol.point;
+    int mode = simd < ser ? EXEC_SIMD : EXEC_SERIAL;
+    double best = (double)n * (simd < ser ? simd : ser);
+    int tmax = pol.tuned ? pol.threads : pol.max_threads;  // AUTOTUNE limiteaza thread-urile
+    // thread-urile trebuie sa castige clar (10%), altfel zgomotul de masurare ar alege
+    // regiuni paralele care nu aduc nimic
+    double lim = 0.9 * best;
+    for (int t = 2; t <= tmax; t++) {
+        double est = pol.fork[t] + (double)n * simd / pol.speedup[t];
+        if (est < lim && est < best) { best = est; mode = EXEC_THREADS; *threads = t; }
+    }
+    return mode;
+}
+
+// thread-uri pentru o bucla "omp parallel for" cu n esantioane de cost punctual;
+// kernel-urile mai scumpe isi scaleaza n (cost relativ fata de o conversie de culoare)
+static int pol_threads(long long n) {
+    int t;
+    pol_pick(KC_POINT, n, &t);
+    return t;
+}
+
+// Filtrul 3x3 (K == NULL -> Sobel) pe selectie dupa politica: SERIAL/SIMD pe
+// thread-ul curent, fara tile-uri si fara regiune paralela; THREADS pe executor.
+static int conv_exec(Image *img, const double K[3][3], int x1, int y1, int x2, int y2) {
+    int t, mode = pol_pick(K ? KC_CONV : KC_SOBEL, img->sel_area * img->ch, &t);
+    if (mode == EXEC_THREADS) {
+        ws_threads = t;
+        int ok = conv_into_tmp(img, K, x1, y1, x2, y2, ws_tile_w, ws_tile_h, 1);
+        ws_threads = 0;
+        return ok;
+    }
+    if (!img_ensure_tmp(img, (size_t)img->w * (size_t)img->h * (size_t)img->ch)) return 0;
+    int simd = mode == EXEC_SIMD;
+    for (int y = y1; y < y2; y++)
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (!sel_clip(img, r, x1, x2, &xa, &xb)) continue;
+            if (K) conv_run(img, K, y, xa, xb, simd);
+            else sobel_run(img, y, xa, xb, simd);
+        }
+    sel_commit(img, y1, y2);  // run-urile sunt in bounding box, deci [1, w-1) == [x1, x2)
+    return 1;
+}
+
+// POLICY: profilul si alegerea pentru APPLY / APPLY_SOBEL pe selectia curenta
+static void pol_report(const Image *img) {
+    pol_ensure();
+    const char *path = pol_path();
+    printf("POLICY mode=%s", EXEC_NAMES[pol_mode]);
+    if (pol_mode == EXEC_THREADS) printf(" threads=%d", pol_forced_threads);
+    printf(" profile=%s calibrated=%d max_threads=%d\n", path ? path : "-", pol.calibrated, pol.max_threads);
+    printf("POLICY ns/sample conv_ser=%.3f conv_simd=%.3f sobel_ser=%.3f sobel_simd=%.3f point=%.3f\n",
+           pol.conv_ser, pol.conv_simd, pol.sobel_ser, pol.sobel_simd, pol.point);
+    for (int t = 2; t <= pol.max_threads; t++)
+        printf("POLICY threads=%d fork_ns=%.0f speedup=%.2f\n", t, pol.fork[t], pol.speedup[t]);
+    if (pol.tuned)
+        printf("POLICY tuned tile=%dx%d threads=%d schedule=%s variant=%s\n", pol.tile_w, pol.tile_h,
+               pol.threads, pol.steal ? "STEAL" : "STATIC", pol.simd ? "SIMD" : "SCALAR");
+    if (!img->loaded) return;
+    for (int k = KC_CONV; k <= KC_SOBEL; k++) {
+        int t, mode = pol_pick(k, img->sel_area * img->ch, &t);
+        printf("POLICY %s samples=%lld -> %s threads=%d\n", k == KC_CONV ? "APPLY" : "APPLY_SOBEL",
+               img->sel_area * img->ch, EXEC_NAMES[mode], t);
+    }
+}
+
+// kernelul 3x3 al unui filtru APPLY (EDGE, SHARPEN, BLUR, GAUSSIAN_BLUR); NULL daca nu exista
+static const double (*filter_kernel(const char *name))[3] {
+    static const double KE[3][3] = {{-1,-1,-1},{-1,8,-1},{-1,-1,-1}}, KS[3][3] = {{0,-1,0},{-1,5,-1},{0,-1,0}};
+    static const double KB[3][3] = {{1./9,1./9,1./9},{1./9,1./9,1./9},{1./9,1./9,1./9}};
+    static const double KG[3][3] = {{1./16,2./16,1./16},{2./16,4./16,2./16},{1./16,2./16,1./16}};
+    if (strcmp(name, "EDGE") == 0) return KE;
+    if (strcmp(name, "SHARPEN") == 0) return KS;
+    if (strcmp(name, "BLUR") == 0) return KB;
+    if (strcmp(name, "GAUSSIAN_BLUR") == 0) return KG;
+    return NULL;
+}
+
+static void apply_conv3x3(Image *img, const double K[3][3], const char *msg) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+
+    int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
+    if (x1 == 0) x1++;
+    if (y1 == 0) y1++;
+    if (x2 == img->w) x2--;
+    if (y2 == img->h) y2--;
+    if (x2 - x1 <= 0 || y2 - y1 <= 0) { say("%s done\n", msg); return; }
+
+    if (!conv_exec(img, K, x1, y1, x2, y2)) { fprintf(stderr, "malloc failed\n"); return; }
+    say("%s done\n", msg);
+}
+
+static void apply_sobel(Image *img) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+
+    int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
+    if (x1 == 0) x1++;
+    if (y1 == 0) y1++;
+    if (x2 == img->w) x2--;
+    if (y2 == img->h) y2--;
+    if (x2 - x1 <= 0 || y2 - y1 <= 0) { say("APPLY SOBEL done\n"); return; }
+
+    if (!conv_exec(img, NULL, x1, y1, x2, y2)) { fprintf(stderr, "malloc failed\n"); return; }
+    say("APPLY SOBEL done\n");
+}
+
+// ======= Conversii de spatiu de culoare (virgula fixa, doar intregi) =======
+// Kernel-urile lucreaza pe cate un rand in layout-ul intercalat, fara double,
+// deci -O3 -march=native le vectorizeaza si rezultatul e identic bit cu bit
+// intre editorul serial, OMP si MPI. Pentru 3->3, src si dst pot coincide.
+typedef void (*RowKernel)(const uint8_t *src, uint8_t *dst, int n);
+
+// luma BT.601 cu ponderi pe 8 biti (77 + 150 + 29 = 256)
+static void cvt_rgb_to_gray_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        dst[i] = (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+    }
+}
+
+// copiaza valoarea gri pe toate cele 3 canale
+static void cvt_gray_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        uint8_t v = src[i];
+        dst[3 * i] = v; dst[3 * i + 1] = v; dst[3 * i + 2] = v;
+    }
+}
+
+// YCbCr full-range (JPEG), coeficienti in virgula fixa pe 16 biti
+static void cvt_rgb_to_ycbcr_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        int y  = ( 19595 * r + 38470 * g +  7471 * b + 32768) >> 16;
+        int cb = (-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16;
+        int cr = ( 32768 * r - 27439 * g -  5329 * b + (128 << 16) + 32768) >> 16;
+        dst[3 * i] = clamp_u8_int(y);
+        dst[3 * i + 1] = clamp_u8_int(cb);
+        dst[3 * i + 2] = clamp_u8_int(cr);
+    }
+}
+
+static void cvt_ycbcr_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int y = src[3 * i] << 16, cb = src[3 * i + 1] - 128, cr = src[3 * i + 2] - 128;
+        dst[3 * i]     = clamp_u8_int((y + 91881 * cr + 32768) >> 16);
+        dst[3 * i + 1] = clamp_u8_int((y - 22554 * cb - 46802 * cr + 32768) >> 16);
+        dst[3 * i + 2] = clamp_u8_int((y + 116130 * cb + 32768) >> 16);
+    }
+}
+
+// HSV pe 8 biti: nuanta scalata la [0, 255] (43 unitati pe sector de 60 grade)
+static void cvt_rgb_to_hsv_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        int mx = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        int mn = r < g ? (r < b ? r : b) : (g < b ? g : b);
+        int d = mx - mn, h = 0, s = 0;
+        if (d != 0) {
+            s = (255 * d + mx / 2) / mx;
+            if (mx == r) h = (43 * (g - b)) / d;
+            else if (mx == g) h = 85 + (43 * (b - r)) / d;
+            else h = 171 + (43 * (r - g)) / d;
+        }
+        dst[3 * i] = (uint8_t)(h & 255);
+        dst[3 * i + 1] = (uint8_t)s;
+        dst[3 * i + 2] = (uint8_t)mx;
+    }
+}
+
+static void cvt_hsv_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int h = src[3 * i], s = src[3 * i + 1], v = src[3 * i + 2];
+        int region = h / 43, rem = (h - region * 43) * 6;
+        int p = (v * (255 - s)) >> 8;
+        int q = (v * (255 - ((s * rem) >> 8))) >> 8;
+        int t = (v * (255 - ((s * (255 - rem)) >> 8))) >> 8;
+        int r, g, b;
+        if (s == 0) { r = g = b = v; }
+        else switch (region) {
+            case 0:  r = v; g = t; b = p; break;
+            case 1:  r = q; g = v; b = p; break;
+            case 2:  r = p; g = v; b = t; break;
+            case 3:  r = p; g = q; b = v; break;
+            case 4:  r = t; g = p; b = v; break;
+            default: r = v; g = p; b = q; break;
+        }
+        dst[3 * i] = (uint8_t)r; dst[3 * i + 1] = (uint8_t)g; dst[3 * i + 2] = (uint8_t)b;
+    }
+}
+
+typedef struct {
+    const char *name;   // argumentul comenzii / mesaj
+    int in_ch, out_ch;
+    RowKernel fn;
+} ColorKernel;
+
+static const ColorKernel COLOR_KERNELS[] = {
+    {"GRAYSCALE", 3, 1, cvt_rgb_to_gray_row},
+    {"TO_RGB",    1, 3, cvt_gray_to_rgb_row},
+    {"RGB2YCBCR", 3, 3, cvt_rgb_to_ycbcr_row},
+    {"YCBCR2RGB", 3, 3, cvt_ycbcr_to_rgb_row},
+    {"RGB2HSV",   3, 3, cvt_rgb_to_hsv_row},
+    {"HSV2RGB",   3, 3, cvt_hsv_to_rgb_row},
+};
+
+static const ColorKernel *find_color_kernel(const char *name) {
+    for (size_t i = 0; i < sizeof(COLOR_KERNELS) / sizeof(COLOR_KERNELS[0]); i++)
+        if (strcmp(COLOR_KERNELS[i].name, name) == 0) return &COLOR_KERNELS[i];
+    return NULL;
+}
+
+// ======= OPENMP: conversie pe toata imaginea (ignora selectia, poate schimba ch) =======
+static void img_convert(Image *img, const ColorKernel *k) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    if (img->ch != k->in_ch) {
+        say(k->in_ch == 1 ? "Black and white image needed\n" : "Color image needed\n");
+        return;
+    }
+    size_t in_rb = (size_t)img->w * k->in_ch, out_rb = (size_t)img->w * k->out_ch;
+    size_t sz = out_rb * img->h;
+    if (!img_ensure_tmp(img, sz)) { fprintf(stderr, "malloc failed\n"); return; }
+
+    int nt = pol_threads((long long)img->w * img->h * k->in_ch);
+    #pragma omp parallel for schedule(static) num_threads(nt)
+    for (int y = 0; y < img->h; y++)
+        k->fn(img->data + (size_t)y * in_rb, img->tmp + (size_t)y * out_rb, img->w);
+
+    // vechiul data devine tmp; stim sigur doar ca are dimensiunea vechii imagini
+    uint8_t *t = img->data; img->data = img->tmp; img->tmp = t;
+    img->tmp_cap = in_rb * img->h;
+    img->ch = k->out_ch;
+    say("%s done\n", k->name);
+}
+
+// ======= OPENMP: pipeline fuzionat RGB->YCbCr, filtru 3x3 doar pe Y, YCbCr->RGB =======
+// Crominanta nu e filtrata, deci marginile de culoare nu se amesteca.
+static void apply_conv3x3_luma(Image *img, const double K[3][3], const char *msg) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    if (img->ch != 3) { say("Color image needed\n"); return; }
+    int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
+    if (x1 == 0) x1++;
+    if (y1 == 0) y1++;
+    if (x2 == img->w) x2--;
+    if (y2 == img->h) y2--;
+    if (x2 - x1 <= 0 || y2 - y1 <= 0) { say("%s done\n", msg); return; }
+
+    // tmp = copie YCbCr a randurilor [y1-1, y2+1) + cate un rand de iesire per thread
+    size_t rb = (size_t)img->w * 3;
+    int rows = y2 - y1 + 2;
+    // un esantion de filtru + doua conversii per pixel ~ doua esantioane de filtru
+    int nt;
+    pol_pick(KC_CONV, 2 * img->sel_area, &nt);
+    if (!img_ensure_tmp(img, (size_t)rows * rb + (size_t)nt * rb)) { fprintf(stderr, "malloc failed\n"); return; }
+    uint8_t *ycc = img->tmp;
+
+    #pragma omp parallel num_threads(nt)
+    {
+        int tid = 0;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+#endif
+        uint8_t *out = img->tmp + (size_t)rows * rb + (size_t)tid * rb;
+
+        // doar coloanele bounding box-ului (+1 halo) trec prin YCbCr
+        #pragma omp for schedule(static)
+        for (int r = 0; r < rows; r++) {
+            size_t off = (size_t)(y1 - 1 + r) * rb + (size_t)(x1 - 1) * 3;
+            cvt_rgb_to_ycbcr_row(img->data + off, ycc + off - (size_t)(y1 - 1) * rb, x2 - x1 + 2);
+        }
+
+        // fiecare rand de iesire e scris de un singur thread -> thread-safe
+        #pragma omp for schedule(dynamic, 4)
+        for (int y = y1; y < y2; y++) {
+            const uint8_t *row = ycc + (size_t)(y - y1 + 1) * rb;
+            for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+                int xa, xb;
+                if (!sel_clip(img, r, x1, x2, &xa, &xb)) continue;
+                for (int x = xa; x < xb; x++) {
+                    double sum = 0.0;
+                    for (int ky = -1; ky <= 1; ky++)
+                        for (int kx = -1; kx <= 1; kx++)
+                            sum += K[ky + 1][kx + 1] * (double)row[(ptrdiff_t)ky * (ptrdiff_t)rb + (x + kx) * 3];
+                    uint8_t *o = out + (size_t)(x - x1) * 3;
+                    o[0] = clamp_u8_double(sum);
+                    o[1] = row[x * 3 + 1];
+                    o[2] = row[x * 3 + 2];
+                }
+                cvt_ycbcr_to_rgb_row(out + (size_t)(xa - x1) * 3, img->data + (size_t)y * rb + (size_t)xa * 3, xb - xa);
+            }
+        }
+    }
+    say("%s done\n", msg);
+}
+
+// ======= Piramide de imagini (Gaussiana + Laplaciana) =======
+#define PYR_MAX_LEVELS 16
+#define PYR_BAND_ROWS 16   // randuri per banda (unitatea de planificare)
+
+typedef struct {
+    int levels, ch;
+    int w[PYR_MAX_LEVELS], h[PYR_MAX_LEVELS];
+    size_t off[PYR_MAX_LEVELS + 1]; // nivelul l ocupa [off[l], off[l+1]) in fiecare buffer
+    uint8_t *gauss;     // toate nivelurile Gaussiene, contigue (nivelul 0 = imaginea)
+    uint8_t *work;      // acelasi layout; destinatia filtrelor si a lui COLLAPSE
+    int16_t *lap;       // benzi Laplaciene L_l = G_l - expand(G_l+1); ultimul nivel nu are
+} Pyramid;
+
+// o banda de randuri [y0, y1) dintr-un nivel
+typedef struct { int level, y0, y1; } PyrBand;
+
+static const int BINOM5[5] = {1, 4, 6, 4, 1};
+
+static inline int clampi(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static void pyr_free(Pyramid *p) {
+    free(p->gauss); free(p->work); free(p->lap);
+    memset(p, 0, sizeof(*p));
+}
+
+// lista benzilor tuturor nivelurilor -> o singura bucla paralela acopera toata piramida
+static PyrBand *pyr_bands(const Pyramid *p, int *count) {
+    int n = 0;
+    for (int l = 0; l < p->levels; l++) n += (p->h[l] + PYR_BAND_ROWS - 1) / PYR_BAND_ROWS;
+    PyrBand *b = (PyrBand*)malloc((size_t)n * sizeof(PyrBand));
+    if (!b) return NULL;
+    n = 0;
+    for (int l = 0; l < p->levels; l++)
+        for (int y = 0; y < p->h[l]; y += PYR_BAND_ROWS) {
+            b[n].level = l; b[n].y0 = y;
+            b[n].y1 = (y + PYR_BAND_ROWS < p->h[l]) ? y + PYR_BAND_ROWS : p->h[l];
+            n++;
+        }
+    *count = n;
+    return b;
+}
+
+// blur binomial 5x5 fuzionat cu decimarea 2x: se calculeaza doar esantioanele pastrate.
+// vbuf are sw*ch int-uri (suma verticala pentru un rand de iesire).
+static void pyr_reduce_rows(const uint8_t *src, int sw, int sh, uint8_t *dst, int dw, int ch,
+                            int y0, int y1, int *vbuf) {
+    size_t srb = (size_t)sw * ch;
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *r[5];
+        for (int j = 0; j < 5; j++) r[j] = src + (size_t)clampi(2 * y + j - 2, 0, sh - 1) * srb;
+        for (size_t i = 0; i < srb; i++)
+            vbuf[i] = r[0][i] + 4 * r[1][i] + 6 * r[2][i] + 4 * r[3][i] + r[4][i];
+        for (int x = 0; x < dw; x++) {
+            for (int c = 0; c < ch; c++) {
+                int s = 0;
+                for (int i = 0; i < 5; i++)
+                    s += BINOM5[i] * vbuf[(size_t)clampi(2 * x + i - 2, 0, sw - 1) * ch + c];
+                dst[((size_t)y * dw + x) * ch + c] = (uint8_t)((s + 128) >> 8);
+            }
+        }
+    }
+}
+
+// expandeaza nivelul grosier g (cw x chh) in pozitia fina (x, y); ponderile insumeaza 64
+static inline int pyr_expand_at(const uint8_t *g, int cw, int chh, int ch, int x, int y, int c) {
+    int s = 0;
+    for (int j = -2; j <= 2; j++) {
+        if ((y - j) & 1) continue;
+        int yy = clampi((y - j) / 2, 0, chh - 1);
+        for (int i = -2; i <= 2; i++) {
+            if ((x - i) & 1) continue;
+            int xx = clampi((x - i) / 2, 0, cw - 1);
+            s += BINOM5[j + 2] * BINOM5[i + 2] * g[((size_t)yy * cw + xx) * ch + c];
+        }
+    }
+    return (s + 32) >> 6;
+}
+
+// filtru 3x3 (sau Sobel daca K == NULL) pe randurile [y0, y1) ale unui nivel; marginile se copiaza
+static void pyr_filter_rows(const uint8_t *src, uint8_t *dst, int w, int h, int ch,
+                            int y0, int y1, const double K[3][3]) {
+    static const int Gx[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+    static const int Gy[3][3] = {{ 1, 2, 1}, { 0, 0, 0}, {-1,-2,-1}};
+    size_t rb = (size_t)w * ch;
+    for (int y = y0; y < y1; y++) {
+        if (y == 0 || y == h - 1 || w < 3) { memcpy(dst + (size_t)y * rb, src + (size_t)y * rb, rb); continue; }
+        memcpy(dst + (size_t)y * rb, src + (size_t)y * rb, (size_t)ch);
+        memcpy(dst + (size_t)y * rb + rb - ch, src + (size_t)y * rb + rb - ch, (size_t)ch);
+        for (int x = 1; x < w - 1; x++) {
+            for (int c = 0; c < ch; c++) {
+                size_t idx = (size_t)y * rb + (size_t)x * ch + c;
+                if (K) {
+                    double sum = 0.0;
+                    for (int ky = -1; ky <= 1; ky++)
+                        for (int kx = -1; kx <= 1; kx++)
+                            sum += K[ky + 1][kx + 1] * (double)src[idx + (ptrdiff_t)ky * (ptrdiff_t)rb + kx * ch];
+                    dst[idx] = clamp_u8_double(sum);
+                } else {
+                    int sx = 0, sy = 0;
+                    for (int ky = -1; ky <= 1; ky++)
+                        for (int kx = -1; kx <= 1; kx++) {
+                            int v = src[idx + (ptrdiff_t)ky * (ptrdiff_t)rb + kx * ch];
+                            sx += v * Gx[ky + 1][kx + 1];
+                            sy += v * Gy[ky + 1][kx + 1];
+                        }
+                    dst[idx] = clamp_u8_double(sqrt((double)sx * (double)sx + (double)sy * (double)sy));
+                }
+            }
+        }
+    }
+}
+
+// ======= OPENMP: construieste piramidele Gaussiana si Laplaciana ale intregii imagini =======
+static void pyr_build(Pyramid *p, const Image *img, int levels) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    if (levels < 1 || levels > PYR_MAX_LEVELS) { printf("Invalid command\n"); return; }
+    pyr_free(p);
+    p->levels = levels; p->ch = img->ch;
+    p->w[0] = img->w; p->h[0] = img->h; p->off[0] = 0;
+    for (int l = 0; l < levels; l++) {
+        if (l > 0) { p->w[l] = (p->w[l - 1] + 1) / 2; p->h[l] = (p->h[l - 1] + 1) / 2; }
+        p->off[l + 1] = p->off[l] + (size_t)p->w[l] * p->h[l] * p->ch;
+    }
+    size_t total = p->off[levels];
+    p->gauss = (uint8_t*)malloc(total);
+    p->work = (uint8_t*)malloc(total);
+    p->lap = (int16_t*)malloc(total * sizeof(int16_t));
+    if (!p->gauss || !p->work || !p->lap) { pyr_free(p); fprintf(stderr, "malloc failed\n"); return; }
+    memcpy(p->gauss, img->data, p->off[1]);
+
+    // nivelurile Gaussiene depind unul de altul -> paralelizam randurile fiecarui nivel
+    #pragma omp parallel
+    {
+        int *vbuf = (int*)malloc((size_t)img->w * img->ch * sizeof(int));
+        for (int l = 1; l < levels; l++) {
+            #pragma omp for schedule(static)
+            for (int y = 0; y < p->h[l]; y++)
+                pyr_reduce_rows(p->gauss + p->off[l - 1], p->w[l - 1], p->h[l - 1],
+                                p->gauss + p->off[l], p->w[l], p->ch, y, y + 1, vbuf);
+        }
+        free(vbuf);
+    }
+
+    // benzile Laplaciene sunt independente -> toate nivelurile intr-o singura trecere
+    int nb;
+    PyrBand *bands = pyr_bands(p, &nb);
+    if (!bands) { pyr_free(p); fprintf(stderr, "malloc failed\n"); return; }
+    #pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < nb; b++) {
+        int l = bands[b].level;
+        if (l + 1 >= levels) continue;
+        const uint8_t *g = p->gauss + p->off[l], *gc = p->gauss + p->off[l + 1];
+        int16_t *L = p->lap + p->off[l];
+        for (int y = bands[b].y0; y < bands[b].y1; y++)
+            for (int x = 0; x < p->w[l]; x++)
+                for (int c = 0; c < p->ch; c++) {
+                    size_t i = ((size_t)y * p->w[l] + x) * p->ch + c;
+                    L[i] = (int16_t)(g[i] - pyr_expand_at(gc, p->w[l + 1], p->h[l + 1], p->ch, x, y, c));
+                }
+    }
+    free(bands);
+    printf("PYRAMID BUILD done (%d levels, %.3fx pixels)\n", levels, (double)total / (double)p->off[1]);
+}
+
+// ======= OPENMP: un filtru pe toate nivelurile intr-o singura trecere peste benzi =======
+typedef struct {
+    Pyramid *p;
+    const double (*K)[3];
+    const PyrBand *bands;
+} PyrJob;
+
+static void pyr_band_task(void *ctx, int i) {
+    const PyrJob *j = (const PyrJob*)ctx;
+    const Pyramid *p = j->p;
+    int l = j->bands[i].level;
+    pyr_filter_rows(p->gauss + p->off[l], p->work + p->off[l], p->w[l], p->h[l], p->ch,
+                    j->bands[i].y0, j->bands[i].y1, j->K);
+}
+
+static void pyr_apply(Pyramid *p, const double K[3][3], const char *msg) {
+    if (!p->levels) { printf("No pyramid built\n"); return; }
+    int nb;
+    PyrBand *bands = pyr_bands(p, &nb);
+    if (!bands) { fprintf(stderr, "malloc failed\n"); return; }
+    PyrJob job = { p, K, bands };
+    ws_run(nb, NULL, pyr_band_task, &job);
+    free(bands);
+    uint8_t *t = p->gauss; p->gauss = p->work; p->work = t;
+    printf("PYRAMID %s done\n", msg);
+}
+
+// scaleaza banda Laplaciana a unui nivel (gain > 1 accentueaza detaliile, 0 le elimina)
+static void pyr_band_gain(Pyramid *p, int level, double gain) {
+    if (!p->levels) { printf("No pyramid built\n"); return; }
+    if (level < 0 || level + 1 >= p->levels) { printf("Invalid command\n"); return; }
+    int16_t *L = p->lap + p->off[level];
+    size_t n = p->off[level + 1] - p->off[level];
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; i++) {
+        long v = lrint(gain * L[i]);
+        L[i] = (int16_t)(v < -32768 ? -32768 : (v > 32767 ? 32767 : v));
+    }
+    printf("PYRAMID BAND %d done\n", level);
+}
+
+// reconstruieste nivelul 0 din ultimul nivel Gaussian + benzile Laplaciene
+static void pyr_collapse(Pyramid *p, Image *img) {
+    if (!p->levels) { printf("No pyramid built\n"); return; }
+    int top = p->levels - 1;
+    memcpy(p->work + p->off[top], p->gauss + p->off[top], p->off[top + 1] - p->off[top]);
+    for (int l = top - 1; l >= 0; l--) {
+        const uint8_t *gc = p->work + p->off[l + 1];
+        const int16_t *L = p->lap + p->off[l];
+        uint8_t *g = p->work + p->off[l];
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < p->h[l]; y++)
+            for (int x = 0; x < p->w[l]; x++)
+                for (int c = 0; c < p->ch; c++) {
+                    size_t i = ((size_t)y * p->w[l] + x) * p->ch + c;
+                    g[i] = clamp_u8_int(L[i] + pyr_expand_at(gc, p->w[l + 1], p->h[l + 1], p->ch, x, y, c));
+                }
+    }
+    uint8_t *nd = (uint8_t*)malloc(p->off[1]);
+    if (!nd) { fprintf(stderr, "malloc failed\n"); return; }
+    memcpy(nd, p->work, p->off[1]);
+    free(img->data);
+    img->data = nd;
+    img->tmp_cap = 0; // imaginea poate fi crescut de la BUILD; fortam realocarea lui tmp
+    img->w = p->w[0]; img->h = p->h[0]; img->ch = p->ch;
+    img->loaded = 1;
+    if (!sel_rect(img, 0, 0, img->w, img->h)) fprintf(stderr, "malloc failed\n");
+    printf("PYRAMID COLLAPSE done\n");
+}
+
+// scrie un nivel Gaussian ca fisier PNM
+static int pyr_save_level(const Pyramid *p, int level, const char *path) {
+    if (level < 0 || level >= p->levels) return 0;
+    Image lv = {0};
+    lv.w = p->w[level]; lv.h = p->h[level]; lv.ch = p->ch;
+    lv.data = p->gauss + p->off[level];
+    lv.loaded = 1;
+    return img_save_pnm(&lv, path);
+}
+
+static void histogram(const Image *img, int xstars, int bins) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    if (img->ch != 1) { printf("Black and white image needed\n"); return; }
+    if (bins <= 0 || 256 % bins != 0) { printf("Invalid command\n"); return; }
+
+    int fr[256] = {0};
+    for (int i = 0; i < img->w * img->h; i++) fr[img->data[i]]++;
+
+    int group = 256 / bins;
+    int maxbin = 0;
+    for (int b = 0; b < bins; b++) {
+        int s = 0;
+        for (int k = 0; k < group; k++) s += fr[b * group + k];
+        if (s > maxbin) maxbin = s;
+    }
+    for (int b = 0; b < bins; b++) {
+        int s = 0;
+        for (int k = 0; k < group; k++) s += fr[b * group + k];
+        int stars = (maxbin == 0) ? 0 : (int)lrint((double)s / (double)maxbin * (double)xstars);
+        printf("%d\t|\t", stars);
+        for (int i = 0; i < stars; i++) putchar('*');
+        putchar('\n');
+    }
+}
+
+// ======= Zgomot si dithering =======
+// Zgomotul vine din Philox4x32-10 (RNG bazat pe contor): numerele unui pixel depind
+// doar de (seed, stream, indexul global al pixelului), nu de ordinea de parcurgere,
+// deci imaginea e aceeasi pentru orice numar de thread-uri (si identica cu serial/MPI).
+enum { NOISE_GAUSSIAN, NOISE_SALT_PEPPER };
+
+typedef struct { uint32_t v[4]; } Philox4;
+
+static Philox4 philox4x32_10(uint64_t idx, uint32_t stream, uint64_t seed) {
+    uint32_t c0 = (uint32_t)idx, c1 = (uint32_t)(idx >> 32), c2 = stream, c3 = 0;
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+    for (int r = 0; r < 10; r++) {
+        uint64_t p0 = (uint64_t)0xD2511F53u * c0, p1 = (uint64_t)0xCD9E8D57u * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0, n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1; c3 = (uint32_t)p0;
+        c0 = n0; c2 = n2;
+        k0 += 0x9E3779B9u; k1 += 0xBB67AE85u;
+    }
+    Philox4 out = {{c0, c1, c2, c3}};
+    return out;
+}
+
+// 32 de biti aleatori -> (0, 1)
+static inline double u01(uint32_t u) { return ((double)u + 0.5) * (1.0 / 4294967296.0); }
+
+// Adauga zgomot pe n pixeli consecutivi; idx = indexul global al primului
+static void noise_span(uint8_t *p, int n, int ch, uint64_t idx, int kind, double amount, uint64_t seed) {
+    const double TWO_PI = 6.283185307179586;
+    for (int i = 0; i < n; i++, p += ch) {
+        Philox4 r = philox4x32_10(idx + (uint64_t)i, (uint32_t)kind, seed);
+        if (kind == NOISE_GAUSSIAN) {
+            // Box-Muller: un bloc Philox da pana la 4 normale, destul pentru RGB
+            double a = sqrt(-2.0 * log(u01(r.v[0]))), b = sqrt(-2.0 * log(u01(r.v[2])));
+            double z[3] = { a * cos(TWO_PI * u01(r.v[1])), a * sin(TWO_PI * u01(r.v[1])), b * cos(TWO_PI * u01(r.v[3])) };
+            for (int c = 0; c < ch; c++) p[c] = clamp_u8_double((double)p[c] + amount * z[c]);
+        } else {
+            double u = u01(r.v[0]);
+            if (u < 0.5 * amount) memset(p, 0, (size_t)ch);
+            else if (u < amount) memset(p, 255, (size_t)ch);
+        }
+    }
+}
+
+static const uint8_t BAYER8[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42}, {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38}, {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41}, {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37}, {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+// Valoarea nivelului q din `levels` niveluri egal distantate
+static inline int dither_level(int q, int levels) { return (q * 255 + (levels - 1) / 2) / (levels - 1); }
+
+// Dithering ordonat (Bayer 8x8) pe n pixeli de la coloana x a randului y:
+// q = floor(v * (levels-1) / 255 + (b + 0.5) / 64), calculat in intregi
+static void dither_ordered_span(uint8_t *p, int n, int ch, int x, int y, int levels) {
+    const uint8_t *b = BAYER8[y & 7];
+    for (int i = 0; i < n; i++, p += ch) {
+        int t = (2 * b[(x + i) & 7] + 1) * 255;
+        for (int c = 0; c < ch; c++)
+            p[c] = (uint8_t)dither_level((p[c] * (levels - 1) * 128 + t) / (255 * 128), levels);
+    }
+}
+
+// Floyd-Steinberg pe pixelii [x0, x1) ai unui rand, de la stanga la dreapta. Erorile
+// sunt intregi, partile difuzate se tin in unitati de 1/16: above[] = ce a impins in
+// jos randul anterior, below[] primeste 3/16, 5/16, 1/16 din erorile randului, carry[]
+// = cei 7/16 de la vecinul din stanga. above/below sunt indexate cu x + 1, deci
+// coloanele -1 si w exista si nu trebuie verificate.
+static void dither_fs_span(uint8_t *row, int x0, int x1, int ch, int levels,
+                           const int16_t *above, int16_t *below, int *carry) {
+    for (int x = x0; x < x1; x++) {
+        uint8_t *p = row + (size_t)x * ch;
+        for (int c = 0; c < ch; c++) {
+            int v16 = p[c] * 16 + above[(size_t)(x + 1) * ch + c] + carry[c];
+            int v = (v16 + 8 + 16 * 1024) / 16 - 1024; // rotunjire, si pentru v16 < 0
+            int q = (clamp_u8_int(v) * (levels - 1) + 127) / 255;
+            int out = dither_level(q, levels);
+            int e = v - out;
+            p[c] = (uint8_t)out;
+            carry[c] = 7 * e;
+            below[(size_t)x * ch + c] += (int16_t)(3 * e);
+            below[(size_t)(x + 1) * ch + c] += (int16_t)(5 * e);
+            below[(size_t)(x + 2) * ch + c] += (int16_t)e;
+        }
+    }
+}
+
+// ======= OPENMP: zgomot (randuri independente, RNG fara stare) =======
+static void add_noise(Image *img, const char *kind, double amount, unsigned long long seed) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    int k;
+    if (strcmp(kind, "GAUSSIAN") == 0 && amount >= 0.0) k = NOISE_GAUSSIAN;
+    else if (strcmp(kind, "SALT_PEPPER") == 0 && amount >= 0.0 && amount <= 1.0) k = NOISE_SALT_PEPPER;
+    else { say("NOISE parameter invalid\n"); return; }
+
+    // Philox + Box-Muller costa cam cat 8 conversii de culoare per esantion
+    int nt = pol_threads(img->sel_area * img->ch * (k == NOISE_GAUSSIAN ? 8 : 4));
+    #pragma omp parallel for schedule(dynamic, 8) num_threads(nt)
+    for (int y = img->y1; y < img->y2; y++) {
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            uint64_t idx = (uint64_t)y * img->w + img->runs[r].x0;
+            noise_span(img->data + idx * img->ch, img->runs[r].x1 - img->runs[r].x0, img->ch, idx, k, amount, seed);
+        }
+    }
+    say("NOISE %s done\n", kind);
+}
+
+// ======= OPENMP: Floyd-Steinberg pe wavefront =======
+// Pixelul (y, x) depinde de (y, x-1) si de (y-1, x-1..x+1), deci randul y poate
+// lucra la coloana x de indata ce randul y-1 a terminat coloana x+1: randurile
+// merg in paralel, fiecare cu doua coloane in urma celui de deasupra. Fiecare
+// rand isi publica progresul (prog[]) la fiecare FS_CHUNK pixeli.
+#define FS_CHUNK 32
+
+static void dither_fs_wavefront(Image *img, int levels) {
+    int y1 = img->y1, y2 = img->y2, rows = y2 - y1;
+    size_t rb = (size_t)img->w * img->ch, ab = (size_t)(img->w + 2) * img->ch;
+    // acc[i] = erorile primite de randul y1+i de la randul de deasupra
+    int16_t *acc = (int16_t*)calloc((size_t)(rows + 1) * ab, sizeof(int16_t));
+    int *prog = (int*)calloc((size_t)rows, sizeof(int));
+    if (!acc || !prog) { free(acc); free(prog); fprintf(stderr, "malloc failed\n"); return; }
+
+    // schedule(static, 1): fiecare thread ia randurile in ordine crescatoare -> fara deadlock
+    int nt = pol_threads(img->sel_area * img->ch * 4);
+    #pragma omp parallel for schedule(static, 1) num_threads(nt)
+    for (int i = 0; i < rows; i++) {
+        int y = y1 + i;
+        int16_t *above = acc + (size_t)i * ab, *below = above + ab;
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int carry[3] = {0, 0, 0};
+            for (int x = img->runs[r].x0; x < img->runs[r].x1; x += FS_CHUNK) {
+                int xe = (x + FS_CHUNK < img->runs[r].x1) ? x + FS_CHUNK : img->runs[r].x1;
+                if (i > 0) {
+                    // asteptam ca randul de deasupra sa fi trecut de coloana xe
+                    int need = (xe + 1 < img->w) ? xe + 1 : img->w, p;
+                    for (;;) {
+                        #pragma omp atomic read seq_cst
+                        p = prog[i - 1];
+                        if (p >= need) break;
+                        sched_yield();
+                    }
+                }
+                dither_fs_span(img->data + (size_t)y * rb, x, xe, img->ch, levels, above, below, carry);
+                #pragma omp atomic write seq_cst
+                prog[i] = xe;
+            }
+        }
+        #pragma omp atomic write seq_cst
+        prog[i] = img->w;
+    }
+    free(acc);
+    free(prog);
+}
+
+static void dither(Image *img, const char *kind, int levels) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    if (levels < 2 || levels > 256 || (strcmp(kind, "ORDERED") != 0 && strcmp(kind, "FS") != 0)) {
+        say("DITHER parameter invalid\n");
+        return;
+    }
+    if (kind[0] == 'O') {
+        size_t rb = (size_t)img->w * img->ch;
+        int nt = pol_threads(img->sel_area * img->ch * 2);
+        #pragma omp parallel for schedule(dynamic, 8) num_threads(nt)
+        for (int y = img->y1; y < img->y2; y++) {
+            for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+                int x0 = img->runs[r].x0;
+                dither_ordered_span(img->data + (size_t)y * rb + (size_t)x0 * img->ch, img->runs[r].x1 - x0, img->ch, x0, y, levels);
+            }
+        }
+    } else {
+        dither_fs_wavefront(img, levels);
+    }
+    say("DITHER %s done\n", kind);
+}
+
+// ======= Statistici de imagine =======
+// O singura trecere alimenteaza histograma pe canal (din ea rezulta exact min, max,
+// medie, varianta si percentile), eroarea patratica fata de o referinta si sumele
+// blocurilor SSIM 8x8. Totul se aduna in intregi (SSIM-ul fiecarui bloc in unitati
+// de 2^-32), deci rezultatul nu depinde de cum sunt impartite randurile.
+#define SSIM_B 8
+
+typedef struct { long long sx, sy, sxx, syy, sxy, n; } SsimSums;
+
+static const int STATS_PCT[] = {1, 5, 25, 50, 75, 95, 99};
+
+// Aduna `rows` randuri din a (si din referinta b, daca nu e NULL). Randurile sunt
+// din acelasi rand de blocuri, cu sumele blocurilor in s[bx * ch + c].
+static void stats_rows(const uint8_t *a, const uint8_t *b, int w, int ch, int rows,
+                       long long *hist, long long *sse, SsimSums *s) {
+    size_t rb = (size_t)w * ch;
+    for (int r = 0; r < rows; r++, a += rb) {
+        for (int x = 0; x < w; x++)
+            for (int c = 0; c < ch; c++) hist[c * 256 + a[(size_t)x * ch + c]]++;
+        if (!b) continue;
+
+        long long e = 0;
+        #pragma omp simd reduction(+:e)
+        for (size_t i = 0; i < rb; i++) {
+            int d = (int)a[i] - (int)b[i];
+            e += d * d;
+        }
+        *sse += e;
+
+        for (int x0 = 0; x0 < w; x0 += SSIM_B) {
+            int x1 = (x0 + SSIM_B < w) ? x0 + SSIM_B : w;
+            SsimSums *bs = s + (size_t)(x0 / SSIM_B) * ch;
+            for (int c = 0; c < ch; c++) {
+                int sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+                for (int x = x0; x < x1; x++) {
+                    int u = a[(size_t)x * ch + c], v = b[(size_t)x * ch + c];
+                    sx += u; sy += v; sxx += u * u; syy += v * v; sxy += u * v;
+                }
+                bs[c].sx += sx; bs[c].sy += sy; bs[c].sxx += sxx; bs[c].syy += syy; bs[c].sxy += sxy;
+                bs[c].n += x1 - x0;
+            }
+        }
+        b += rb;
+    }
+}
+
+// SSIM-ul celor nb blocuri ale unui rand de blocuri terminat, in unitati de 2^-32; goleste s
+static long long ssim_blockrow_q(SsimSums *s, int nb) {
+    const double C1 = 6.5025, C2 = 58.5225;  // (0.01 * 255)^2, (0.03 * 255)^2
+    long long q = 0;
+    for (int i = 0; i < nb; i++) {
+        double n = (double)s[i].n, mx = s[i].sx / n, my = s[i].sy / n;
+        double vx = s[i].sxx / n - mx * mx, vy = s[i].syy / n - my * my, cxy = s[i].sxy / n - mx * my;
+        double v = (2.0 * mx * my + C1) * (2.0 * cxy + C2) / ((mx * mx + my * my + C1) * (vx + vy + C2));
+        q += llrint(v * 4294967296.0);
+    }
+    memset(s, 0, (size_t)nb * sizeof(SsimSums));
+    return q;
+}
+
+// Raport usor de parsat (key=value, o inregistrare pe linie)
+static void stats_print(const long long *hist, int w, int h, int ch, const char *ref, long long sse, long long ssim_q) {
+    long long n = (long long)w * h;
+    printf("STATS w=%d h=%d ch=%d pixels=%lld\n", w, h, ch, n);
+    for (int c = 0; c < ch; c++) {
+        const long long *hc = hist + c * 256;
+        long long sum = 0, sq = 0;
+        int mn = -1, mx = 0;
+        for (int v = 0; v < 256; v++) {
+            if (!hc[v]) continue;
+            if (mn < 0) mn = v;
+            mx = v;
+            sum += hc[v] * v;
+            sq += hc[v] * v * v;
+        }
+        double mean = (double)sum / (double)n;
+        double var = ((double)sq - (double)sum * mean) / (double)n;
+        printf("STATS c=%d min=%d max=%d mean=%.4f var=%.4f", c, mn, mx, mean, var < 0 ? 0.0 : var);
+        long long cum = 0;
+        int v = 0;
+        for (size_t k = 0; k < sizeof(STATS_PCT) / sizeof(STATS_PCT[0]); k++) {
+            // nearest rank: cel mai mic v cu cum(v) >= p% din pixeli
+            while (v < 255 && (cum + hc[v]) * 100 < (long long)STATS_PCT[k] * n) cum += hc[v++];
+            printf(" p%d=%d", STATS_PCT[k], v);
+        }
+        putchar('\n');
+    }
+    if (!ref) return;
+    long long samples = n * ch, blocks = (long long)((w + SSIM_B - 1) / SSIM_B) * ((h + SSIM_B - 1) / SSIM_B) * ch;
+    double mse = (double)sse / (double)samples;
+    printf("STATS ref=%s mse=%.6f ", ref, mse);
+    if (sse == 0) printf("psnr=inf");
+    else printf("psnr=%.4f", 10.0 * log10(255.0 * 255.0 / mse));
+    printf(" ssim=%.6f\n", (double)ssim_q / 4294967296.0 / (double)blocks);
+}
+
+// ======= OPENMP: statistici cu reductii pe tablouri (histograma, SSE, SSIM) =======
+static void stats(const Image *img, const char *ref_path) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    Image ref = {0};
+    if (ref_path && (!img_load_pnm(&ref, ref_path) || ref.w != img->w || ref.h != img->h || ref.ch != img->ch)) {
+        printf("Invalid reference %s\n", ref_path);
+        img_free(&ref);
+        return;
+    }
+    size_t rb = (size_t)img->w * img->ch;
+    int nb = (img->w + SSIM_B - 1) / SSIM_B * img->ch;
+    int nby = (img->h + SSIM_B - 1) / SSIM_B;
+    long long hist[3 * 256] = {0}, sse = 0, q = 0;
+    int failed = 0;
+
+    int nt = pol_threads((long long)img->h * rb * (ref_path ? 8 : 2));
+    #pragma omp parallel reduction(+:hist[:3 * 256], sse, q, failed) num_threads(nt)
+    {
+        // sumele SSIM sunt private: fiecare thread termina randurile de blocuri pe care le ia
+        SsimSums *s = (SsimSums*)calloc((size_t)nb, sizeof(SsimSums));
+        if (!s) failed = 1;
+        #pragma omp for schedule(dynamic, 4)
+        for (int by = 0; by < nby; by++) {
+            if (!s) continue;
+            int y = by * SSIM_B, rows = (y + SSIM_B < img->h) ? SSIM_B : img->h - y;
+            stats_rows(img->data + (size_t)y * rb, ref_path ? ref.data + (size_t)y * rb : NULL, img->w, img->ch, rows, hist, &sse, s);
+            if (ref_path) q += ssim_blockrow_q(s, nb);
+        }
+        free(s);
+    }
+    if (failed) fprintf(stderr, "malloc failed\n");
+    else stats_print(hist, img->w, img->h, img->ch, ref_path, sse, q);
+    img_free(&ref);
+}
+
+// ======= Checkpoint-uri comprimate pe tile-uri =======
+// Format (little-endian): header, ntiles intrari in index, apoi payload-urile.
+// Fiecare tile e un dreptunghi independent: cine scrie poate taia imaginea cum ii
+// convine, iar cine citeste decodeaza doar tile-urile de care are nevoie. Payload-ul
+// = randurile tile-ului cu filtru delta fata de pixelul anterior + LZ, sau randurile
+// brute daca compresia nu castiga nimic.
+#define CKPT_MAGIC "PNMCKPT1"
+#define CKPT_TILE 128
+#define LZ_HASH_BITS 12
+
+typedef struct { char magic[8]; uint32_t w, h, ch, ntiles; } CkptHeader;
+typedef struct { uint64_t offset; uint32_t x0, y0, w, h, size, flags; } CkptTile; // flags: 1 = delta + LZ
+
+// Marginea superioara a dimensiunii comprimate pentru n octeti
+static size_t lz_bound(size_t n) { return n + n / 255 + 16; }
+
+static size_t lz_put_len(uint8_t *dst, size_t op, size_t len) {
+    for (; len >= 255; len -= 255) dst[op++] = 255;
+    dst[op++] = (uint8_t)len;
+    return op;
+}
+
+// O secventa in stil LZ4: token (nr. literali << 4 | lungime match - 4; un nibble de 15
+// continua in octeti extra), literalii, offset pe 16 biti si lungimea extra.
+// Ultima secventa a unui bloc are doar literali.
+static size_t lz_emit(uint8_t *dst, size_t op, const uint8_t *lit, size_t nlit, size_t off, size_t mlen) {
+    size_t ml = mlen ? mlen - 4 : 0;
+    dst[op++] = (uint8_t)(((nlit < 15 ? nlit : 15) << 4) | (ml < 15 ? ml : 15));
+    if (nlit >= 15) op = lz_put_len(dst, op, nlit - 15);
+    memcpy(dst + op, lit, nlit);
+    op += nlit;
+    if (!mlen) return op;
+    dst[op++] = (uint8_t)(off & 255);
+    dst[op++] = (uint8_t)(off >> 8);
+    if (ml >= 15) op = lz_put_len(dst, op, ml - 15);
+    return op;
+}
+
+// Potrivire greedy cu o singura sonda in hash; dst trebuie sa aiba lz_bound(n) octeti
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+    uint32_t table[1 << LZ_HASH_BITS] = {0}; // pozitia + 1 a ultimului prefix de 4 octeti
+    size_t ip = 0, anchor = 0, op = 0;
+    while (ip + 4 <= n) {
+        uint32_t v;
+        memcpy(&v, src + ip, 4);
+        uint32_t hsh = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t cand = table[hsh];
+        table[hsh] = (uint32_t)ip + 1;
+        if (cand && ip - (cand - 1) <= 65535 && memcmp(src + cand - 1, src + ip, 4) == 0) {
+            size_t ref = cand - 1, len = 4;
+            while (ip + len < n && src[ref + len] == src[ip + len]) len++;
+            op = lz_emit(dst, op, src + anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+    return lz_emit(dst, op, src + anchor, n - anchor, 0, 0);
+}
+
+static int lz_read_len(const uint8_t *src, size_t n, size_t *ip, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= n) return 0;
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+// Intoarce 1 doar daca blocul se decodeaza in exact out_n octeti (toate citirile verificate)
+static int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_n) {
+    size_t ip = 0, op = 0;
+    while (ip < n) {
+        unsigned tok = src[ip++];
+        size_t nlit = tok >> 4, ml = tok & 15;
+        if (nlit == 15 && !lz_read_len(src, n, &ip, &nlit)) return 0;
+        if (nlit > n - ip || nlit > out_n - op) return 0;
+        memcpy(dst + op, src + ip, nlit);
+        ip += nlit; op += nlit;
+        if (ip == n) break;
+        if (n - ip < 2) return 0;
+        size_t off = src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (ml == 15 && !lz_read_len(src, n, &ip, &ml)) return 0;
+        ml += 4;
+        if (off == 0 || off > op || ml > out_n - op) return 0;
+        for (size_t i = 0; i < ml; i++, op++) dst[op] = dst[op - off]; // se poate suprapune
+    }
+    return op == out_n;
+}
+
+// Codifica tile-ul t; src = pixelul din stanga-sus, stride = dimensiunea unui rand.
+// raw are nevoie de t->w * t->h * ch octeti, out de lz_bound() din asta. Intoarce marimea payload-ului.
+static size_t ckpt_encode_tile(const uint8_t *src, size_t stride, int ch, CkptTile *t, uint8_t *raw, uint8_t *out) {
+    size_t rb = (size_t)t->w * ch, n = rb * t->h;
+    for (uint32_t y = 0; y < t->h; y++) {
+        uint8_t *r = raw + y * rb;
+        memcpy(r, src + y * stride, rb);
+        for (size_t i = rb; i-- > (size_t)ch; ) r[i] = (uint8_t)(r[i] - r[i - ch]);
+    }
+    size_t sz = lz_compress(raw, n, out);
+    t->flags = 1;
+    if (sz >= n) { // necompresibil: pastram randurile originale
+        for (uint32_t y = 0; y < t->h; y++) memcpy(out + y * rb, src + y * stride, rb);
+        sz = n;
+        t->flags = 0;
+    }
+    t->size = (uint32_t)sz;
+    return sz;
+}
+
+// Decodeaza un payload in raw (t->w * t->h * ch octeti, randuri compacte)
+static int ckpt_decode_tile(const uint8_t *payload, const CkptTile *t, int ch, uint8_t *raw) {
+    size_t rb = (size_t)t->w * ch, n = rb * t->h;
+    if (!t->flags) {
+        if (t->size != n) return 0;
+        memcpy(raw, payload, n);
+        return 1;
+    }
+    if (!lz_decompress(payload, t->size, raw, n)) return 0;
+    for (uint32_t y = 0; y < t->h; y++) {
+        uint8_t *r = raw + y * rb;
+        for (size_t i = ch; i < rb; i++) r[i] = (uint8_t)(r[i] + r[i - ch]);
+    }
+    return 1;
+}
+
+// Copiaza partea unui tile decodat din regiunea [rx0, rx1) x [ry0, ry1) in dst,
+// care contine acea regiune cu randuri de dst_stride octeti
+static void ckpt_copy_tile(const CkptTile *t, const uint8_t *raw, int ch, uint8_t *dst, size_t dst_stride,
+                           int rx0, int ry0, int rx1, int ry1) {
+    int xa = (int)t->x0 > rx0 ? (int)t->x0 : rx0, xb = (int)(t->x0 + t->w) < rx1 ? (int)(t->x0 + t->w) : rx1;
+    int ya = (int)t->y0 > ry0 ? (int)t->y0 : ry0, yb = (int)(t->y0 + t->h) < ry1 ? (int)(t->y0 + t->h) : ry1;
+    for (int y = ya; y < yb; y++)
+        memcpy(dst + (size_t)(y - ry0) * dst_stride + (size_t)(xa - rx0) * ch,
+               raw + ((size_t)(y - t->y0) * t->w + (size_t)(xa - t->x0)) * ch, (size_t)(xb - xa) * ch);
+}
+
+static int ckpt_tile_hits(const CkptTile *t, int rx0, int ry0, int rx1, int ry1) {
+    return (int)t->x0 < rx1 && (int)(t->x0 + t->w) > rx0 && (int)t->y0 < ry1 && (int)(t->y0 + t->h) > ry0;
+}
+
+// Verificari pentru header-ul si indexul citite de pe disc
+static int ckpt_valid(const CkptHeader *hd, const CkptTile *t, uint32_t n) {
+    if (memcmp(hd->magic, CKPT_MAGIC, 8) != 0 || (hd->ch != 1 && hd->ch != 3) || !hd->w || !hd->h) return 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!t[i].w || !t[i].h || t[i].x0 >= hd->w || t[i].y0 >= hd->h) return 0;
+        if (t[i].w > hd->w - t[i].x0 || t[i].h > hd->h - t[i].y0) return 0;
+        if (t[i].size > lz_bound((size_t)t[i].w * t[i].h * hd->ch)) return 0;
+    }
+    return 1;
+}
+
+// Header-ul si indexul se scriu camp cu camp, little-endian la offset-uri fixe,
+// deci fisierul nu depinde de ordinea octetilor pe masina sau de padding-ul structurilor
+#define CKPT_HEADER_BYTES 24  // magic[8], w, h, ch, ntiles
+#define CKPT_ENTRY_BYTES 32   // offset (u64), x0, y0, w, h, size, flags
+
+static void le_put(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t le_get(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+// header-ul si n intrari din index in forma din fisier (CKPT_HEADER_BYTES + n * CKPT_ENTRY_BYTES octeti)
+static void ckpt_pack(uint8_t *b, const CkptHeader *hd, const CkptTile *t, size_t n) {
+    if (hd) {
+        memcpy(b, hd->magic, 8);
+        le_put(b + 8, hd->w, 4); le_put(b + 12, hd->h, 4); le_put(b + 16, hd->ch, 4); le_put(b + 20, hd->ntiles, 4);
+        b += CKPT_HEADER_BYTES;
+    }
+    for (size_t i = 0; i < n; i++, b += CKPT_ENTRY_BYTES) {
+        le_put(b, t[i].offset, 8);
+        le_put(b + 8, t[i].x0, 4); le_put(b + 12, t[i].y0, 4); le_put(b + 16, t[i].w, 4);
+        le_put(b + 20, t[i].h, 4); le_put(b + 24, t[i].size, 4); le_put(b + 28, t[i].flags, 4);
+    }
+}
+
+// scrie header-ul si indexul la pozitia curenta din fisier
+static int ckpt_write_index(FILE *f, const CkptHeader *hd, const CkptTile *t) {
+    size_t len = CKPT_HEADER_BYTES + (size_t)hd->ntiles * CKPT_ENTRY_BYTES;
+    uint8_t *b = (uint8_t*)malloc(len);
+    if (!b) return 0;
+    ckpt_pack(b, hd, t, hd->ntiles);
+    int ok = fwrite(b, 1, len, f) == len;
+    free(b);
+    return ok;
+}
+
+// citeste si verifica header-ul si indexul; *tiles e alocat cu malloc, NULL la eroare
+static int ckpt_read_index(FILE *f, CkptHeader *hd, CkptTile **tiles) {
+    uint8_t hb[CKPT_HEADER_BYTES];
+    *tiles = NULL;
+    if (fread(hb, 1, sizeof hb, f) != sizeof hb) return 0;
+    memcpy(hd->magic, hb, 8);
+    hd->w = (uint32_t)le_get(hb + 8, 4); hd->h = (uint32_t)le_get(hb + 12, 4);
+    hd->ch = (uint32_t)le_get(hb + 16, 4); hd->ntiles = (uint32_t)le_get(hb + 20, 4);
+    if (hd->ntiles == 0 || (uint64_t)hd->ntiles > (uint64_t)hd->w * hd->h) return 0;
+    CkptTile *t = (CkptTile*)malloc((size_t)hd->ntiles * sizeof(CkptTile));
+    uint8_t *b = (uint8_t*)malloc((size_t)hd->ntiles * CKPT_ENTRY_BYTES);
+    int ok = t && b && fread(b, CKPT_ENTRY_BYTES, hd->ntiles, f) == hd->ntiles;
+    for (uint32_t i = 0; ok && i < hd->ntiles; i++) {
+        const uint8_t *e = b + (size_t)i * CKPT_ENTRY_BYTES;
+        t[i].offset = le_get(e, 8);
+        t[i].x0 = (uint32_t)le_get(e + 8, 4); t[i].y0 = (uint32_t)le_get(e + 12, 4);
+        t[i].w = (uint32_t)le_get(e + 16, 4); t[i].h = (uint32_t)le_get(e + 20, 4);
+        t[i].size = (uint32_t)le_get(e + 24, 4); t[i].flags = (uint32_t)le_get(e + 28, 4);
+    }
+    free(b);
+    if (!ok || !ckpt_valid(hd, t, hd->ntiles)) { free(t); return 0; }
+    *tiles = t;
+    return 1;
+}
+
+// ======= OPENMP: checkpoint cu compresie/decompresie paralela pe tile-uri =======
+typedef struct {
+    const uint8_t *src;       // imaginea (la scriere)
+    uint8_t *dst;             // regiunea restaurata (la citire)
+    CkptTile *tiles;
+    uint8_t **payload;        // payload-ul fiecarui tile
+    uint8_t *raw;             // cate un tile brut per thread
+    size_t stride, tb;
+    int ch, rx0, ry0, rx1, ry1;
+    int failed;
+} CkptJob;
+
+static inline uint8_t *ckpt_thread_raw(const CkptJob *j) {
+    int tid = 0;
+#ifdef _OPENMP
+    tid = omp_get_thread_num();
+#endif
+    return j->raw + (size_t)tid * j->tb;
+}
+
+static void ckpt_encode_task(void *ctx, int i) {
+    CkptJob *j = (CkptJob*)ctx;
+    CkptTile *t = &j->tiles[i];
+    ckpt_encode_tile(j->src + t->y0 * j->stride + (size_t)t->x0 * j->ch, j->stride, j->ch, t, ckpt_thread_raw(j), j->payload[i]);
+}
+
+static void ckpt_decode_task(void *ctx, int i) {
+    CkptJob *j = (CkptJob*)ctx;
+    const CkptTile *t = &j->tiles[i];
+    if (!j->payload[i]) return;  // tile in afara regiunii
+    uint8_t *raw = ckpt_thread_raw(j);
+    if (!ckpt_decode_tile(j->payload[i], t, j->ch, raw)) {
+        #pragma omp atomic write
+        j->failed = 1;
+        return;
+    }
+    ckpt_copy_tile(t, raw, j->ch, j->dst, j->stride, j->rx0, j->ry0, j->rx1, j->ry1);
+}
+
+static int ckpt_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Tile-urile se comprima in paralel (fiecare in slotul lui), apoi se scriu in ordine
+static void ckpt_save(const Image *img, const char *path) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    double t0 = now_sec();
+    int tx = (img->w + CKPT_TILE - 1) / CKPT_TILE, ty = (img->h + CKPT_TILE - 1) / CKPT_TILE;
+    uint32_t n = (uint32_t)tx * (uint32_t)ty;
+    CkptJob job = {0};
+    job.src = img->data; job.ch = img->ch;
+    job.stride = (size_t)img->w * img->ch;
+    job.tb = (size_t)CKPT_TILE * CKPT_TILE * img->ch;
+    job.tiles = (CkptTile*)calloc(n, sizeof(CkptTile));
+    job.payload = (uint8_t**)calloc(n, sizeof(uint8_t*));
+    job.raw = (uint8_t*)malloc(job.tb * (size_t)ckpt_threads());
+    uint8_t *arena = (uint8_t*)malloc(lz_bound(job.tb) * n);
+    if (!job.tiles || !job.payload || !job.raw || !arena) {
+        fprintf(stderr, "malloc failed\n");
+        free(job.tiles); free(job.payload); free(job.raw); free(arena);
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        CkptTile *t = &job.tiles[i];
+        t->x0 = (i % tx) * CKPT_TILE; t->y0 = (i / tx) * CKPT_TILE;
+        t->w = (t->x0 + CKPT_TILE < (uint32_t)img->w) ? CKPT_TILE : img->w - t->x0;
+        t->h = (t->y0 + CKPT_TILE < (uint32_t)img->h) ? CKPT_TILE : img->h - t->y0;
+        job.payload[i] = arena + lz_bound(job.tb) * i;
+    }
+    ws_run((int)n, NULL, ckpt_encode_task, &job);
+
+    uint64_t off = CKPT_HEADER_BYTES + (uint64_t)n * CKPT_ENTRY_BYTES;
+    for (uint32_t i = 0; i < n; i++) { job.tiles[i].offset = off; off += job.tiles[i].size; }
+
+    CkptHeader hd = { CKPT_MAGIC, (uint32_t)img->w, (uint32_t)img->h, (uint32_t)img->ch, n };
+    FILE *f = fopen(path, "wb");
+    int ok = f && ckpt_write_index(f, &hd, job.tiles);
+    for (uint32_t i = 0; ok && i < n; i++) ok = fwrite(job.payload[i], 1, job.tiles[i].size, f) == job.tiles[i].size;
+    if (f) ok = (fclose(f) == 0) && ok;
+    if (ok) printf("CHECKPOINT %s tiles=%u raw=%zu stored=%llu time=%.6f sec\n", path, n, job.stride * img->h, (unsigned long long)off, now_sec() - t0);
+    else printf("Failed to save %s\n", path);
+    free(job.tiles); free(job.payload); free(job.raw); free(arena);
+}
+
+// Citeste header-ul si indexul; intoarce fisierul deschis sau NULL
+static FILE *ckpt_open(const char *path, CkptHeader *hd, CkptTile **tiles) {
+    FILE *f = fopen(path, "rb");
+    *tiles = NULL;
+    if (!f) return NULL;
+    if (!ckpt_read_index(f, hd, tiles)) { fclose(f); return NULL; }
+    return f;
+}
+
+// Restaureaza tot checkpoint-ul sau doar regiunea [x1, x2) x [y1, y2); se citesc si
+// se decomprima (in paralel) doar tile-urile care intersecteaza regiunea
+static void ckpt_restore(Image *img, const char *path, const int *region) {
+    double t0 = now_sec();
+    CkptHeader hd;
+    CkptTile *tiles;
+    FILE *f = ckpt_open(path, &hd, &tiles);
+    if (!f) { printf("Failed to load %s\n", path); return; }
+
+    int x1 = 0, y1 = 0, x2 = (int)hd.w, y2 = (int)hd.h;
+    if (region) {
+        x1 = region[0]; y1 = region[1]; x2 = region[2]; y2 = region[3];
+        if (x1 > x2) { int t = x1; x1 = x2; x2 = t; }
+        if (y1 > y2) { int t = y1; y1 = y2; y2 = t; }
+        if (x1 < 0 || y1 < 0 || x2 > (int)hd.w || y2 > (int)hd.h || x1 == x2 || y1 == y2) {
+            printf("Invalid set of coordinates\n");
+            fclose(f); free(tiles);
+            return;
+        }
+    }
+    CkptJob job = {0};
+    job.tiles = tiles; job.ch = (int)hd.ch;
+    job.rx0 = x1; job.ry0 = y1; job.rx1 = x2; job.ry1 = y2;
+    job.stride = (size_t)(x2 - x1) * hd.ch;
+    size_t total = 0;
+    long long covered = 0;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < hd.ntiles; i++) {
+        const CkptTile *t = &tiles[i];
+        if (!ckpt_tile_hits(t, x1, y1, x2, y2)) continue;
+        size_t b = (size_t)t->w * t->h * hd.ch;
+        if (b > job.tb) job.tb = b;
+        total += t->size;
+        long long cw = ((int)(t->x0 + t->w) < x2 ? (int)(t->x0 + t->w) : x2) - ((int)t->x0 > x1 ? (int)t->x0 : x1);
+        long long chh = ((int)(t->y0 + t->h) < y2 ? (int)(t->y0 + t->h) : y2) - ((int)t->y0 > y1 ? (int)t->y0 : y1);
+        covered += cw * chh;
+        used++;
+    }
+    job.dst = (uint8_t*)malloc(job.stride * (y2 - y1));
+    job.raw = (uint8_t*)malloc(job.tb * (size_t)ckpt_threads());
+    job.payload = (uint8_t**)calloc(hd.ntiles, sizeof(uint8_t*));
+    uint8_t *arena = (uint8_t*)malloc(total ? total : 1);
+    int ok = job.dst && job.raw && job.payload && arena && covered == (long long)(x2 - x1) * (y2 - y1);
+
+    // I/O secvential doar pentru tile-urile atinse, decompresie paralela
+    size_t pos = 0;
+    for (uint32_t i = 0; ok && i < hd.ntiles; i++) {
+        const CkptTile *t = &tiles[i];
+        if (!ckpt_tile_hits(t, x1, y1, x2, y2)) continue;
+        job.payload[i] = arena + pos;
+        ok = fseeko(f, (off_t)t->offset, SEEK_SET) == 0 && fread(job.payload[i], 1, t->size, f) == t->size;
+        pos += t->size;
+    }
+    fclose(f);
+    if (ok) {
+        ws_run((int)hd.ntiles, NULL, ckpt_decode_task, &job);
+        ok = !job.failed;
+    }
+    free(tiles); free(job.raw); free(job.payload); free(arena);
+    if (!ok) { free(job.dst); printf("Failed to load %s\n", path); return; }
+
+    img_free(img);
+    img->data = job.dst;
+    img->w = x2 - x1; img->h = y2 - y1; img->ch = (int)hd.ch;
+    img->loaded = 1;
+    if (!sel_rect(img, 0, 0, img->w, img->h)) { img_free(img); fprintf(stderr, "malloc failed\n"); return; }
+    printf("RESTORE %s tiles=%u/%u time=%.6f sec\n", path, used, hd.ntiles, now_sec() - t0);
+}
+
+// ======= OPENMP: Equalize cu histograma paralela (optional, dar util) =======
+static void equalize(Image *img) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    if (img->ch != 1) { say("Black and white image needed\n"); return; }
+
+    size_t area = (size_t)img->w * (size_t)img->h;
+    int fr[256] = {0};
+    int nt = pol_threads((long long)area);
+
+    // histograma paralela: fiecare thread are fr_local[256], apoi reduce
+    #pragma omp parallel num_threads(nt)
+    {
+        int local[256] = {0};
+
+        #pragma omp for schedule(static)
+        for (size_t i = 0; i < area; i++) {
+            local[ img->data[i] ]++;
+        }
+
+        #pragma omp critical
+        {
+            for (int k = 0; k < 256; k++) fr[k] += local[k];
+        }
+    }
+
+    int cdf[256];
+    int run = 0;
+    for (int i = 0; i < 256; i++) { run += fr[i]; cdf[i] = run; }
+
+    #pragma omp parallel for schedule(static) num_threads(nt)
+    for (size_t i = 0; i < area; i++) {
+        int v = img->data[i];
+        double nv = 255.0 * (double)cdf[v] / (double)area;
+        img->data[i] = clamp_u8_double(nv);
+    }
+
+    say("Equalize done\n");
+}
+
+// ======= Fluxuri de cadre =======
+// STREAM citeste cadre P5/P6 concatenate si ruleaza un script de filtre (o operatie
+// pe linie) pe fiecare cadru. Pasii TEMPORAL tin un ring buffer cu ultimele n cadre
+// de intrare: AVG pastreaza o suma curenta, MEDIAN sorteaza cele n valori ale unui pixel.
+#define STREAM_MAX_STEPS 32
+#define TEMPORAL_MAX 16
+
+enum { ST_APPLY, ST_SOBEL, ST_LUMA, ST_CONVERT, ST_NOISE, ST_DITHER, ST_EQUALIZE, ST_TAVG, ST_TMEDIAN };
+
+typedef struct {
+    int op, n;                    // n: nivelurile DITHER sau fereastra TEMPORAL
+    char name[64];                // filtrul, conversia, tipul de zgomot / dithering
+    const double (*K)[3];
+    const ColorKernel *ck;
+    double amount;
+    unsigned long long seed;
+    uint8_t *ring;                // TEMPORAL: n cadre, cel mai vechi la head cand e plin
+    uint32_t *sum;                // TEMPORAL AVG: suma curenta a ring-ului
+    int fw, fh, fch, count, head;
+} StreamStep;
+
+static void stream_free_steps(StreamStep *st, int n) {
+    for (int i = 0; i < n; i++) { free(st[i].ring); free(st[i].sum); }
+}
+
+// Parseaza scriptul; intoarce numarul de pasi sau -1 (si raporteaza linia gresita)
+static int stream_parse(const char *path, StreamStep *st) {
+    FILE *f = fopen(path, "r");
+    if (!f) { fprintf(stderr, "Failed to load %s\n", path); return -1; }
+    char line[256], op[64];
+    int n = 0, lineno = 0;
+    while (fgets(line, sizeof line, f)) {
+        lineno++;
+        if (sscanf(line, "%63s", op) != 1 || op[0] == '#') continue;
+        if (n == STREAM_MAX_STEPS) { fprintf(stderr, "%s:%d: too many steps\n", path, lineno); fclose(f); return -1; }
+        StreamStep *s = &st[n];
+        memset(s, 0, sizeof *s);
+        int ok = 1;
+        if (strcmp(op, "APPLY") == 0 || strcmp(op, "APPLY_LUMA") == 0) {
+            ok = sscanf(line, "%*s %63s", s->name) == 1;
+            if (ok && strcmp(op, "APPLY") == 0 && strcmp(s->name, "SOBEL") == 0) s->op = ST_SOBEL;
+            else {
+                s->op = (op[5] == '_') ? ST_LUMA : ST_APPLY;
+                ok = ok && (s->K = filter_kernel(s->name)) != NULL;
+            }
+        } else if (strcmp(op, "APPLY_SOBEL") == 0) {
+            s->op = ST_SOBEL;
+        } else if (strcmp(op, "GRAYSCALE") == 0 || strcmp(op, "TO_RGB") == 0 || strcmp(op, "CONVERT") == 0) {
+            s->op = ST_CONVERT;
+            if (op[0] == 'C') ok = sscanf(line, "%*s %63s", s->name) == 1;
+            else strcpy(s->name, op);
+            ok = ok && (s->ck = find_color_kernel(s->name)) != NULL && (op[0] != 'C' || s->ck->in_ch == s->ck->out_ch);
+        } else if (strcmp(op, "NOISE") == 0) {
+            s->op = ST_NOISE;
+            ok = sscanf(line, "%*s %63s %lf %llu", s->name, &s->amount, &s->seed) == 3;
+        } else if (strcmp(op, "DITHER") == 0) {
+            s->op = ST_DITHER;
+            ok = sscanf(line, "%*s %63s %d", s->name, &s->n) == 2;
+        } else if (strcmp(op, "EQUALIZE") == 0) {
+            s->op = ST_EQUALIZE;
+        } else if (strcmp(op, "TEMPORAL") == 0) {
+            ok = sscanf(line, "%*s %63s %d", s->name, &s->n) == 2 && s->n >= 1 && s->n <= TEMPORAL_MAX;
+            if (ok && strcmp(s->name, "AVG") == 0) s->op = ST_TAVG;
+            else if (ok && strcmp(s->name, "MEDIAN") == 0) s->op = ST_TMEDIAN;
+            else ok = 0;
+        } else {
+            ok = 0;
+        }
+        if (!ok) { fprintf(stderr, "%s:%d: invalid step\n", path, lineno); fclose(f); return -1; }
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+// Pune cadrul in ring si il inlocuieste cu media / mediana temporala a cadrelor din
+// ring (mai putine de n la inceputul fluxului); pixelii sunt independenti -> omp for
+static void stream_temporal(StreamStep *s, Image *img) {
+    size_t sz = (size_t)img->w * img->h * img->ch;
+    if (s->fw != img->w || s->fh != img->h || s->fch != img->ch) {
+        // primul cadru sau alta dimensiune: istoricul o ia de la capat
+        free(s->ring); free(s->sum);
+        s->ring = (uint8_t*)malloc(sz * s->n);
+        s->sum = (uint32_t*)calloc(sz, sizeof(uint32_t));
+        s->fw = s->fh = s->fch = 0;
+        if (!s->ring || !s->sum) { fprintf(stderr, "malloc failed\n"); return; }
+        s->fw = img->w; s->fh = img->h; s->fch = img->ch;
+        s->count = s->head = 0;
+    }
+    uint8_t *slot = s->ring + (size_t)s->head * sz;
+    // mediana sorteaza pana la n valori per esantion
+    int nt = pol_threads((long long)sz * (s->op == ST_TAVG ? 1 : s->n));
+    if (s->op == ST_TAVG && s->count == s->n) {
+        #pragma omp parallel for schedule(static) num_threads(nt)
+        for (size_t i = 0; i < sz; i++) s->sum[i] -= slot[i];
+    }
+    memcpy(slot, img->data, sz);
+    if (s->count < s->n) s->count++;
+    s->head = (s->head + 1) % s->n;
+
+    int c = s->count;
+    if (s->op == ST_TAVG) {
+        #pragma omp parallel for schedule(static) num_threads(nt)
+        for (size_t i = 0; i < sz; i++) {
+            s->sum[i] += img->data[i];
+            img->data[i] = (uint8_t)((s->sum[i] + (uint32_t)c / 2) / (uint32_t)c);
+        }
+        return;
+    }
+    #pragma omp parallel for schedule(static) num_threads(nt)
+    for (size_t i = 0; i < sz; i++) {
+        uint8_t v[TEMPORAL_MAX];
+        for (int k = 0; k < c; k++) { // insertion sort pe cele c valori
+            uint8_t x = s->ring[(size_t)k * sz + i];
+            int j = k;
+            for (; j > 0 && v[j - 1] > x; j--) v[j] = v[j - 1];
+            v[j] = x;
+        }
+        img->data[i] = (uint8_t)((v[(c - 1) / 2] + v[c / 2] + 1) / 2);
+    }
+}
+
+// Ruleaza scriptul pe un cadru; seed-ul NOISE avanseaza cu numarul cadrului
+static void stream_filter(StreamStep *st, int n, Image *img, long long frame) {
+    for (int i = 0; i < n; i++) {
+        StreamStep *s = &st[i];
+        switch (s->op) {
+        case ST_APPLY:    if (img->ch == 3) apply_conv3x3(img, s->K, "APPLY"); break;
+        case ST_SOBEL:    apply_sobel(img); break;
+        case ST_LUMA:     apply_conv3x3_luma(img, s->K, "APPLY_LUMA"); break;
+        case ST_CONVERT:  img_convert(img, s->ck); break;
+        case ST_NOISE:    add_noise(img, s->name, s->amount, s->seed + (unsigned long long)frame); break;
+        case ST_DITHER:   dither(img, s->name, s->n); break;
+        case ST_EQUALIZE: equalize(img); break;
+        default:          stream_temporal(s, img); break;
+        }
+    }
+}
+
+// ======= OPENMP: pipeline pe cadre =======
+// La pasul i trei sectiuni lucreaza in paralel: citirea cadrului i+1, filtrarea
+// cadrului i (filtrele isi deschid propriile regiuni paralele, de aici nivelul 2 de
+// paralelism) si scrierea cadrului i-1. Cadrele se rotesc prin 3 sloturi.
+// Intoarce numarul de cadre sau -1; operatiile ruleaza fara mesaje.
+static long long stream_run(FILE *in, FILE *out, const char *script) {
+    StreamStep st[STREAM_MAX_STEPS];
+    int n = stream_parse(script, st);
+    if (n < 0) return -1;
+    FILE *saved = msg_out;
+    msg_out = NULL;
+    pol_ensure();  // calibrarea nu ruleaza in sectiunile paralele
+#ifdef _OPENMP
+    int levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+#endif
+    Image fr[3];
+    memset(fr, 0, sizeof fr);
+    int has[3] = {0, 0, 0}, eof, ok = 1;
+    long long frames = 0;
+    has[0] = img_read_pnm(&fr[0], in);
+    eof = !has[0];
+    for (long long i = 0; ok; i++) {
+        int rd = (int)((i + 1) % 3), fl = (int)(i % 3), wr = (int)((i + 2) % 3);
+        if (!has[fl] && !has[wr]) break;
+        #pragma omp parallel sections num_threads(3)
+        {
+            #pragma omp section
+            {
+                if (!eof) { has[rd] = img_read_pnm(&fr[rd], in); eof = !has[rd]; }
+            }
+            #pragma omp section
+            {
+                if (has[fl]) stream_filter(st, n, &fr[fl], i);
+            }
+            #pragma omp section
+            {
+                if (has[wr]) { ok = img_write_pnm(&fr[wr], out); has[wr] = 0; frames++; }
+            }
+        }
+    }
+    fflush(out);
+#ifdef _OPENMP
+    omp_set_max_active_levels(levels);
+#endif
+    msg_out = saved;
+    for (int k = 0; k < 3; k++) img_free(&fr[k]);
+    stream_free_steps(st, n);
+    return ok ? frames : -1;
+}
+
+static void stream_report(long long frames, double sec) {
+    say("STREAM frames=%lld time=%.6f sec fps=%.2f\n", frames, sec, sec > 0 ? frames / sec : 0.0);
+}
+
+// STREAM <in> <out> <script>; caile pot fi si named pipes
+static void stream_cmd(const char *in_path, const char *out_path, const char *script) {
+    FILE *in = fopen(in_path, "rb");
+    if (!in) { say("Failed to load %s\n", in_path); return; }
+    FILE *out = fopen(out_path, "wb");
+    if (!out) { fclose(in); say("Failed to save %s\n", out_path); return; }
+    double t0 = now_sec();
+    long long frames = stream_run(in, out, script);
+    fclose(in);
+    if (fclose(out) != 0) frames = -1;
+    if (frames < 0) say("STREAM failed\n");
+    else stream_report(frames, now_sec() - t0);
+}
+
+
+// un pas din lantul de filtre al BENCH / AUTOTUNE; 0 daca numele nu e cunoscut
+static int bench_step(Image *img, const char *what) {
+    const double (*K_GAUSS)[3] = filter_kernel("GAUSSIAN_BLUR"), (*K)[3] = filter_kernel(what);
+    char msg[80];
+    snprintf(msg, sizeof msg, "APPLY %s", what);
+    if (strcmp(what, "SOBEL") == 0) apply_sobel(img);
+    else if (strcmp(what, "GAUSS_SOBEL") == 0) {
+        apply_conv3x3(img, K_GAUSS, "APPLY GAUSSIAN_BLUR");
+        apply_sobel(img);
+    } else if (strcmp(what, "PIPE") == 0) {
+        apply_conv3x3(img, K_GAUSS, "APPLY GAUSSIAN_BLUR");
+        apply_sobel(img);
+        apply_conv3x3(img, filter_kernel("SHARPEN"), "APPLY SHARPEN");
+    } else if (K) apply_conv3x3(img, K, msg);
+    else return 0;
+    return 1;
+}
+
+static void bench(Image *img, int iters, const char *what) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    if (iters <= 0) { printf("Invalid command\n"); return; }
+
+    double t0 = now_sec();
+    for (int i = 0; i < iters; i++) {
+        if (!bench_step(img, what)) { printf("Invalid command\n"); return; }
+    }
+    double t1 = now_sec();
+    printf("BENCH %s iters=%d time=%.6f sec\n", what, iters, t1 - t0);
+}
+
+// ======= OPENMP: AUTOTUNE =======
+// Cauta pe imaginea si selectia curente, cu un lant de filtre BENCH, forma tile-ului,
+// numarul de thread-uri, planificarea executorului (furt sau doar impartirea dupa
+// cost) si varianta kernel-urilor (SIMD / scalar). Coborare pe coordonate: cate un
+// parametru pe rand cu ceilalti fixati, in doua treceri. Fiecare configuratie ruleaza
+// lantul de iters ori pe imaginea originala si pastreaza minimul. Rezultatul intra
+// in profilul masinii, incarcat automat la pornire.
+typedef struct { int tile_w, tile_h, threads, steal, simd; } TuneCfg;
+
+static double tune_measure(Image *img, const uint8_t *orig, size_t sz, const char *what, int iters,
+                           const TuneCfg *c) {
+    ws_tile_w = c->tile_w; ws_tile_h = c->tile_h;
+    tune_steal = c->steal; tune_simd = c->simd;
+    pol_mode = c->threads > 1 ? EXEC_THREADS : (c->simd ? EXEC_SIMD : EXEC_SERIAL);
+    pol_forced_threads = c->threads;
+    double best = 1e30;
+    for (int i = 0; i < iters; i++) {
+        memcpy(img->data, orig, sz);
+        double t0 = now_sec();
+        bench_step(img, what);
+        double dt = now_sec() - t0;
+        if (dt < best) best = dt;
+    }
+    return best;
+}
+
+static void autotune(Image *img, const char *what, int iters) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    if (img->x2 - img->x1 < 3 || img->y2 - img->y1 < 3) { printf("Invalid set of coordinates\n"); return; }
+    size_t sz = (size_t)img->w * img->h * img->ch;
+    uint8_t *orig = (uint8_t*)malloc(sz);
+    if (!orig) { fprintf(stderr, "malloc failed\n"); return; }
+    memcpy(orig, img->data, sz);
+    FILE *saved = msg_out;
+    msg_out = NULL;
+    int ok = bench_step(img, what);
+    memcpy(img->data, orig, sz);
+    if (!ok) { msg_out = saved; free(orig); printf("Invalid command\n"); return; }
+    pol_ensure();
+
+    int thr[32], nthr = 0;
+    for (int t = 1; t < pol.max_threads && nthr < 31; t *= 2) thr[nthr++] = t;
+    thr[nthr++] = pol.max_threads;
+    int sel_w = img->x2 - img->x1;
+    int mode0 = pol_mode, forced0 = pol_forced_threads, configs = 1;
+
+    TuneCfg cur = { ws_tile_w, ws_tile_h, pol.tuned ? pol.threads : pol.max_threads, tune_steal, tune_simd };
+    double start = tune_measure(img, orig, sz, what, iters, &cur), best = start;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int dim = 0; dim < 4; dim++) {
+            int nc = dim == 0 ? (int)(sizeof(TILE_CANDS) / sizeof(TILE_CANDS[0])) : dim == 1 ? nthr : 2;
+            for (int i = 0; i < nc; i++) {
+                TuneCfg c = cur;
+                if (dim == 0) {
+                    c.tile_w = TILE_CANDS[i][0] < sel_w ? TILE_CANDS[i][0] : sel_w;
+                    c.tile_h = TILE_CANDS[i][1];
+                } else if (dim == 1) c.threads = thr[i];
+                else if (dim == 2) c.steal = 1 - i;
+                else c.simd = 1 - i;
+                if (memcmp(&c, &cur, sizeof c) == 0) continue;
+                double t = tune_measure(img, orig, sz, what, iters, &c);
+                configs++;
+                if (t < best) { best = t; cur = c; }
+            }
+        }
+    }
+    memcpy(img->data, orig, sz);
+    free(orig);
+    msg_out = saved;
+    pol_mode = mode0; pol_forced_threads = forced0;
+
+    ws_tile_w = cur.tile_w; ws_tile_h = cur.tile_h;
+    tune_steal = cur.steal; tune_simd = cur.simd;
+    pol.tuned = 1;
+    pol.tile_w = cur.tile_w; pol.tile_h = cur.tile_h;
+    pol.threads = cur.threads; pol.steal = cur.steal; pol.simd = cur.simd;
+    printf("AUTOTUNE %s tile=%dx%d threads=%d schedule=%s variant=%s time=%.6f sec (start %.6f sec, %d configs)\n",
+           what, cur.tile_w, cur.tile_h, cur.threads, cur.steal ? "STEAL" : "STATIC", cur.simd ? "SIMD" : "SCALAR",
+           best, start, configs);
+    if (pol_save()) printf("AUTOTUNE saved to %s\n", pol_path());
+    else printf("AUTOTUNE profile not saved\n");
+}
+
+int main(int argc, char **argv) {
+    msg_out = stdout;
+    pol_load();  // profilul masinii (calibrare + AUTOTUNE), daca exista
+    // --stream <script>: cadre din stdin, cadre filtrate la stdout, sumarul la stderr
+    if (argc == 3 && strcmp(argv[1], "--stream") == 0) {
+        msg_out = stderr;
+        double t0 = now_sec();
+        long long frames = stream_run(stdin, stdout, argv[2]);
+        if (frames >= 0) stream_report(frames, now_sec() - t0);
+        ws_destroy();
+        return frames < 0;
+    }
+    Image img = (Image){0};
+    Pyramid pyr = {0};
+    char cmd[64];
+
+    while (scanf("%63s", cmd) == 1) {
+        if (strcmp(cmd, "LOAD") == 0) {
+            char path[256];
+            scanf("%255s", path);
+            if (img_load_pnm(&img, path)) printf("Loaded %s\n", path);
+            else printf("Failed to load %s\n", path);
+
+        } else if (strcmp(cmd, "SAVE") == 0) {
+            char path[256];
+            scanf("%255s", path);
+            if (!img.loaded) { printf("No image loaded\n"); continue; }
+            if (img_save_pnm(&img, path)) printf("Saved %s\n", path);
+            else printf("Failed to save %s\n", path);
+
+        } else if (strcmp(cmd, "STREAM") == 0) {
+            char in[256], out[256], script[256];
+            if (scanf("%255s %255s %255s", in, out, script) != 3) { printf("Invalid command\n"); continue; }
+            stream_cmd(in, out, script);
+
+        } else if (strcmp(cmd, "CHECKPOINT") == 0) {
+            char path[256];
+            scanf("%255s", path);
+            ckpt_save(&img, path);
+
+        } else if (strcmp(cmd, "RESTORE") == 0) {
+            // RESTORE <path> [x1 y1 x2 y2]
+            char line[300], path[256];
+            int r[4];
+            if (!fgets(line, sizeof line, stdin)) line[0] = '\0';
+            int got = sscanf(line, "%255s %d %d %d %d", path, &r[0], &r[1], &r[2], &r[3]);
+            if (got != 1 && got != 5) { printf("Invalid command\n"); continue; }
+            ckpt_restore(&img, path, got == 5 ? r : NULL);
+
+        } else if (strcmp(cmd, "SELECT") == 0) {
+            char next[64];
+            scanf("%63s", next);
+            if (strcmp(next, "ALL") == 0) img_select_all(&img);
+            else if (strcmp(next, "ELLIPSE") == 0) {
+                double cx, cy, rx, ry;
+                if (scanf("%lf %lf %lf %lf", &cx, &cy, &rx, &ry) != 4) { printf("Invalid command\n"); continue; }
+                if (!img.loaded) { printf("No image loaded\n"); continue; }
+                if (rx <= 0 || ry <= 0 || sel_ellipse(&img, cx, cy, rx, ry) <= 0) {
+                    sel_rect(&img, 0, 0, img.w, img.h);
+                    printf("Invalid set of coordinates\n");
+                } else printf("Selected ELLIPSE %d runs\n", img.nruns);
+            } else if (strcmp(next, "POLYGON") == 0) {
+                int n;
+                if (scanf("%d", &n) != 1 || n < 3 || n > 100000) { printf("Invalid command\n"); continue; }
+                double *px = (double*)malloc(sizeof(double) * (size_t)n);
+                double *py = (double*)malloc(sizeof(double) * (size_t)n);
+                int ok = px && py;
+                for (int i = 0; ok && i < n; i++) ok = scanf("%lf %lf", &px[i], &py[i]) == 2;
+                if (!img.loaded) printf("No image loaded\n");
+                else if (!ok || sel_polygon(&img, n, px, py) <= 0) {
+                    sel_rect(&img, 0, 0, img.w, img.h);
+                    printf("Invalid set of coordinates\n");
+                } else printf("Selected POLYGON %d runs\n", img.nruns);
+                free(px);
+                free(py);
+            } else if (strcmp(next, "MASK") == 0) {
+                char path[256];
+                scanf("%255s", path);
+                if (!img.loaded) { printf("No image loaded\n"); continue; }
+                if (sel_mask(&img, path) <= 0) {
+                    sel_rect(&img, 0, 0, img.w, img.h);
+                    printf("Invalid mask %s\n", path);
+                } else printf("Selected MASK %d runs\n", img.nruns);
+            } else {
+                int x1 = atoi(next), y1, x2, y2;
+                if (scanf("%d %d %d", &y1, &x2, &y2) != 3) { printf("Invalid command\n"); continue; }
+                img_select_rect(&img, x1, y1, x2, y2);
+            }
+
+        } else if (strcmp(cmd, "CROP") == 0) {
+            img_crop(&img);
+
+        } else if (strcmp(cmd, "HISTOGRAM") == 0) {
+            int xstars, bins;
+            if (scanf("%d %d", &xstars, &bins) != 2) { printf("Invalid command\n"); continue; }
+            histogram(&img, xstars, bins);
+
+        } else if (strcmp(cmd, "EQUALIZE") == 0) {
+            equalize(&img);
+
+        } else if (strcmp(cmd, "APPLY") == 0) {
+            char what[64], msg[80];
+            scanf("%63s", what);
+            const double (*K)[3] = filter_kernel(what);
+            snprintf(msg, sizeof msg, "APPLY %s", what);
+
+            if (!img.loaded) { printf("No image loaded\n"); continue; }
             if (img.ch == 1) { printf("Easy, Charlie Chaplin\n"); continue; }
 
-            if (strcmp(what, "EDGE") == 0) apply_conv3x3(&img, K_EDGE, "APPLY EDGE");
-            else if (strcmp(what, "SHARPEN") == 0) apply_conv3x3(&img, K_SHARP, "APPLY SHARPEN");
-            else if (strcmp(what, "BLUR") == 0) apply_conv3x3(&img, K_BLUR, "APPLY BLUR");
-            else if (strcmp(what, "GAUSSIAN_BLUR") == 0) apply_conv3x3(&img, K_GAUSS, "APPLY GAUSSIAN_BLUR");
+            if (K) apply_conv3x3(&img, K, msg);
+            else printf("APPLY parameter invalid\n");
+
+        } else if (strcmp(cmd, "APPLY_LUMA") == 0) {
+            char what[64], msg[80];
+            scanf("%63s", what);
+            const double (*K)[3] = filter_kernel(what);
+            snprintf(msg, sizeof msg, "APPLY_LUMA %s", what);
+
+            if (K) apply_conv3x3_luma(&img, K, msg);
             else printf("APPLY parameter invalid\n");
 
+        } else if (strcmp(cmd, "STATS") == 0) {
+            // calea referintei e optionala -> citim restul liniei
+            char line[300], ref[256];
+            if (!fgets(line, sizeof line, stdin)) line[0] = '\0';
+            stats(&img, sscanf(line, "%255s", ref) == 1 ? ref : NULL);
+
+        } else if (strcmp(cmd, "NOISE") == 0) {
+            char what[64];
+            double amount;
+            unsigned long long seed;
+            if (scanf("%63s %lf %llu", what, &amount, &seed) != 3) { printf("Invalid command\n"); continue; }
+            add_noise(&img, what, amount, seed);
+
+        } else if (strcmp(cmd, "DITHER") == 0) {
+            char what[64];
+            int levels;
+            if (scanf("%63s %d", what, &levels) != 2) { printf("Invalid command\n"); continue; }
+            dither(&img, what, levels);
+
+        } else if (strcmp(cmd, "GRAYSCALE") == 0 || strcmp(cmd, "TO_RGB") == 0) {
+            img_convert(&img, find_color_kernel(cmd));
+
+        } else if (strcmp(cmd, "CONVERT") == 0) {
+            char what[64];
+            scanf("%63s", what);
+            const ColorKernel *k = find_color_kernel(what);
+            if (!k || k->in_ch != k->out_ch) { printf("CONVERT parameter invalid\n"); continue; }
+            img_convert(&img, k);
+
+        } else if (strcmp(cmd, "PYRAMID") == 0) {
+            char what[64];
+            scanf("%63s", what);
+
+            if (strcmp(what, "BUILD") == 0) {
+                int levels;
+                if (scanf("%d", &levels) != 1) { printf("Invalid command\n"); continue; }
+                pyr_build(&pyr, &img, levels);
+            } else if (strcmp(what, "APPLY") == 0) {
+                char f[64], msg[80];
+                scanf("%63s", f);
+                const double (*K)[3] = filter_kernel(f);
+                snprintf(msg, sizeof msg, "APPLY %s", f);
+                if (strcmp(f, "SOBEL") == 0) pyr_apply(&pyr, NULL, "APPLY SOBEL");
+                else if (K) pyr_apply(&pyr, K, msg);
+                else printf("APPLY parameter invalid\n");
+            } else if (strcmp(what, "BAND") == 0) {
+                int level; double gain;
+                if (scanf("%d %lf", &level, &gain) != 2) { printf("Invalid command\n"); continue; }
+                pyr_band_gain(&pyr, level, gain);
+            } else if (strcmp(what, "SAVE") == 0) {
+                int level; char path[256];
+                if (scanf("%d %255s", &level, path) != 2) { printf("Invalid command\n"); continue; }
+                if (pyr_save_level(&pyr, level, path)) printf("Saved %s\n", path);
+                else printf("Failed to save %s\n", path);
+            } else if (strcmp(what, "COLLAPSE") == 0) {
+                pyr_collapse(&pyr, &img);
+            } else {
+                printf("Invalid command\n");
+            }
+
+        } else if (strcmp(cmd, "TILES") == 0) {
+            char what[64];
+            scanf("%63s", what);
+            if (strcmp(what, "AUTO") == 0) { tiles_autotune(&img); continue; }
+            int tw = atoi(what), th;
+            if (scanf("%d", &th) != 1 || tw <= 0 || th <= 0) { printf("Invalid command\n"); continue; }
+            ws_tile_w = tw; ws_tile_h = th;
+            printf("TILES %dx%d\n", tw, th);
+
+        } else if (strcmp(cmd, "POLICY") == 0) {
+            // POLICY SHOW | AUTO | SERIAL | SIMD | THREADS <n> | CALIBRATE
+            char what[64];
+            scanf("%63s", what);
+            if (strcmp(what, "SHOW") == 0) { pol_report(&img); continue; }
+            if (strcmp(what, "CALIBRATE") == 0) {
+                if (pol_calibrate()) printf("POLICY calibrated, saved to %s\n", pol_path());
+                else printf("POLICY calibrated, profile not saved\n");
+                continue;
+            }
+            int mode = -1;
+            for (int k = 0; k < 4; k++) if (strcmp(what, EXEC_NAMES[k]) == 0) mode = k;
+            if (mode == EXEC_THREADS && (scanf("%d", &pol_forced_threads) != 1 || pol_forced_threads <= 0)) mode = -1;
+            if (mode < 0) { pol_forced_threads = 1; printf("Invalid command\n"); continue; }
+            pol_mode = mode;
+            printf("POLICY %s\n", what);
+
+        } else if (strcmp(cmd, "AUTOTUNE") == 0) {
+            // AUTOTUNE <lant BENCH> [iters]
+            char what[64], line[128];
+            int iters = 3;
+            if (!fgets(line, sizeof line, stdin) || sscanf(line, "%63s %d", what, &iters) < 1 || iters <= 0) {
+                printf("Invalid command\n");
+                continue;
+            }
+            autotune(&img, what, iters);
+
+        } else if (strcmp(cmd, "WSSTATS") == 0) {
+            ws_report();
+
         } else if (strcmp(cmd, "APPLY_SOBEL") == 0) {
             apply_sobel(&img);
 
@@ -423,6 +2803,8 @@ int main(void) {
         }
     }
 
+    pyr_free(&pyr);
     img_free(&img);
+    ws_destroy();
     return 0;
 }
@@ -1,6 +1,19 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
 #include <math.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Largest network handled by the permutation engine (N = 2^24) */
+#define OMEGA_MAX_K 24
+
 /**
  * Shuffle permutation: performs a circular left shift on the bits.
  * It identifies the number of bits 'k', masks bits outside the block,
@@ -53,7 +66,144 @@ void traseuOmega(int src, int dest, int k) {
     printf("=== Final Output reached: %d ===\n", val);
 }
 
-int main() {
+// ---------- Full-Permutation Routing ----------
+
+/*
+ * Destination-tag routing of a whole permutation perm[src] = dest, N = 2^k.
+ * Every stage is a perfect shuffle followed by N/2 switches; at stage s the
+ * switch sets the low bit of the position to bit k-1-s of dest. After stage s
+ * packet src -> dest is therefore at
+ *     pos_s = (low k-1-s bits of src, top s+1 bits of dest),
+ * and two packets collide at stage s exactly when their pos_s are equal. The
+ * packets whose dest shares its top s+1 bits fill one block of B = 2^(k-1-s)
+ * consecutive destinations, so stage s is conflict-free iff, within every
+ * block of the inverse permutation, the values inv[d] mod B are all distinct.
+ * That is an OR of one-hot bits per block and a popcount: no per-packet
+ * branches, and SIMD loops for blocks of up to 64 destinations.
+ */
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Safe malloc with error checking */
+static void *xmalloc(size_t n) {
+    void *p = malloc(n);
+    if (!p) {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+/**
+ * Counts, for every stage s, the packets that lose their switch output there
+ * (collisions[s]: B minus the distinct positions of each block). inv is the
+ * inverse permutation. Returns the first blocking stage, or -1 when the
+ * permutation is Omega-passable.
+ */
+int omega_conflicts(const int *inv, int k, long long *collisions) {
+    int N = 1 << k, first = -1;
+    for (int s = 0; s < k; s++) {
+        int B = 1 << (k - 1 - s), blocks = N / B;
+        long long lost = 0;
+        if (B <= 64) {
+            uint64_t full = B == 64 ? ~0ull : (1ull << B) - 1;
+            #pragma omp parallel for reduction(+:lost) schedule(static)
+            for (int t = 0; t < blocks; t++) {
+                const int *d = inv + (size_t)t * B;
+                uint64_t m = 0;
+                #pragma omp simd reduction(|:m)
+                for (int c = 0; c < B; c++) m |= 1ull << (d[c] & (B - 1));
+                if (m != full) lost += B - __builtin_popcountll(m);
+            }
+        } else {
+            // blocks larger than a word: one bitmap of B bits per block, set and then counted
+            #pragma omp parallel reduction(+:lost)
+            {
+                uint64_t *map = xmalloc(sizeof(uint64_t) * (size_t)(B / 64));
+                #pragma omp for schedule(static)
+                for (int t = 0; t < blocks; t++) {
+                    const int *d = inv + (size_t)t * B;
+                    memset(map, 0, sizeof(uint64_t) * (size_t)(B / 64));
+                    for (int c = 0; c < B; c++) map[(d[c] & (B - 1)) >> 6] |= 1ull << (d[c] & 63);
+                    long long set = 0;
+                    #pragma omp simd reduction(+:set)
+                    for (int w = 0; w < B / 64; w++) set += __builtin_popcountll(map[w]);
+                    lost += B - set;
+                }
+                free(map);
+            }
+        }
+        collisions[s] = lost;
+        if (lost && first < 0) first = s;
+    }
+    return first;
+}
+
+/**
+ * Switch settings of a passable permutation: bit i of row s (N/2 bits, one
+ * word per 64 switches) is 1 when switch i of stage s is crossed, i.e. when
+ * bit k-1-s differs between the source and the destination of its packets.
+ */
+void omega_settings(const int *perm, int k, uint64_t *rows) {
+    int N = 1 << k, words = N / 2 > 64 ? N / 128 : 1;
+    memset(rows, 0, sizeof(uint64_t) * (size_t)words * k);
+    for (int s = 0; s < k; s++) {
+        uint64_t *row = rows + (size_t)s * words;
+        int b = k - 1 - s;
+        for (int src = 0; src < N; src++) {
+            int dest = perm[src];
+            if (!(((src ^ dest) >> b) & 1)) continue;
+            int sw = (((src << (s + 1)) | (dest >> b)) & (N - 1)) >> 1;
+            row[sw >> 6] |= 1ull << (sw & 63);
+        }
+    }
+}
+
+/**
+ * Pushes every packet through the shuffles and the configured switches and
+ * checks that it leaves on perm[src].
+ */
+int omega_verify(const int *perm, int k, const uint64_t *rows) {
+    int N = 1 << k, words = N / 2 > 64 ? N / 128 : 1;
+    long long bad = 0;
+    #pragma omp parallel for reduction(+:bad) schedule(static)
+    for (int src = 0; src < N; src++) {
+        int pos = src;
+        for (int s = 0; s < k; s++) {
+            pos = ((pos << 1) & (N - 1)) | (pos >> (k - 1));  // shuffle
+            int sw = pos >> 1;
+            pos ^= (int)(rows[(size_t)s * words + (sw >> 6)] >> (sw & 63)) & 1;
+        }
+        bad += pos != perm[src];
+    }
+    return bad == 0;
+}
+
+static int parse_perm(const char *s, int **out) {
+    int cap = 128, n = 0;
+    int *v = xmalloc(sizeof(int) * cap);
+    const char *p = s;
+    while (*p) {
+        while (*p && isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+        char *e;
+        long val = strtol(p, &e, 10);
+        if (p == e) { if (*p == ',') { p++; continue; } break; }
+        if (n == cap) { cap *= 2; v = realloc(v, sizeof(int) * cap); }
+        v[n++] = (int)val;
+        p = e;
+        if (*p == ',') p++;
+    }
+    *out = v;
+    return n;
+}
+
+/* Original demo: paths of a few hard-coded (source, destination) pairs */
+static void demo(void) {
     int k = 3;       // Network dimension 2^k x 2^k (8x8)
     int m = 2;       // Number of routing pairs
     int pairs[2][2] = { {0, 3}, {5, 6} };
@@ -63,6 +213,104 @@ int main() {
     for (int i = 0; i < m; i++) {
         traseuOmega(pairs[i][0], pairs[i][1], k);
     }
+}
+
+/**
+ * Without arguments: the original demo. Otherwise routes a whole permutation of
+ * N = 2^k wires: -perm p0,p1,... (k from its length), or -k <k> with -random
+ * [-seed s], -shift <s> or -bitrev (identity by default). -settings prints the
+ * switch rows of a passable permutation.
+ */
+int main(int argc, char **argv) {
+    if (argc == 1) {
+        demo();
+        return 0;
+    }
+    int k = -1, N = 0, *perm = NULL, random = 0, bitrev = 0, settings = 0, shift = 0;
+    unsigned long long seed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-k") && i + 1 < argc) k = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-perm") && i + 1 < argc) N = parse_perm(argv[++i], &perm);
+        else if (!strcmp(argv[i], "-random")) random = 1;
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-shift") && i + 1 < argc) shift = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-bitrev")) bitrev = 1;
+        else if (!strcmp(argv[i], "-settings")) settings = 1;
+    }
+    if (perm) {
+        int kp = 0;
+        while ((1 << kp) < N) kp++;
+        if (N < 2 || (1 << kp) != N || (k >= 0 && k != kp)) {
+            fprintf(stderr, "Error: -perm needs N = 2^k >= 2 items (got %d).\n", N);
+            free(perm);
+            return 1;
+        }
+        k = kp;
+    }
+    if (k < 1 || k > OMEGA_MAX_K) {
+        fprintf(stderr, "Error: -k must be between 1 and %d.\n", OMEGA_MAX_K);
+        free(perm);
+        return 1;
+    }
+    N = 1 << k;
+    if (!perm) {
+        perm = xmalloc(sizeof(int) * (size_t)N);
+        unsigned long long x = seed ? seed : 88172645463325252ull;
+        for (int i = 0; i < N; i++) {
+            int r = 0;
+            for (int j = 0; bitrev && j < k; j++) r |= ((i >> j) & 1) << (k - 1 - j);
+            perm[i] = bitrev ? r : (i + shift) & (N - 1);
+        }
+        for (int i = N - 1; random && i > 0; i--) {  // Fisher-Yates, xorshift64
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            int j = (int)(x % (unsigned long long)(i + 1));
+            int t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+        }
+    }
 
-    return 0;
+    int *inv = xmalloc(sizeof(int) * (size_t)N);
+    memset(inv, 0xff, sizeof(int) * (size_t)N);
+    for (int i = 0; i < N; i++) {
+        unsigned d = (unsigned)perm[i];
+        if (d >= (unsigned)N || inv[d] >= 0) {
+            fprintf(stderr, "Error: the input is not a permutation of 0..%d.\n", N - 1);
+            free(inv);
+            free(perm);
+            return 1;
+        }
+        inv[d] = i;
+    }
+
+    long long collisions[OMEGA_MAX_K];
+    double t0 = now_sec();
+    int first = omega_conflicts(inv, k, collisions);
+    double t1 = now_sec();
+    int rc = 0;
+    if (first < 0) {
+        printf("Omega N=%d: passable (check %.3f ms)\n", N, (t1 - t0) * 1e3);
+        int words = N / 2 > 64 ? N / 128 : 1;
+        uint64_t *rows = xmalloc(sizeof(uint64_t) * (size_t)words * k);
+        double t2 = now_sec();
+        omega_settings(perm, k, rows);
+        double t3 = now_sec();
+        for (int s = 0; settings && s < k; s++) {
+            printf("stage %d:", s);
+            for (int i = 0; i < N / 2; i++) printf(" %d", (int)(rows[(size_t)s * words + (i >> 6)] >> (i & 63)) & 1);
+            printf("\n");
+        }
+        int ok = omega_verify(perm, k, rows);
+        printf("Settings: %.3f ms, Verification: %s\n", (t3 - t2) * 1e3, ok ? "OK" : "FAILED");
+        rc = !ok;
+        free(rows);
+    } else {
+        int blocked = 0;
+        for (int s = 0; s < k; s++) blocked += collisions[s] > 0;
+        printf("Omega N=%d: blocked at stage %d, %d of %d stages have conflicts (check %.3f ms)\n",
+               N, first, blocked, k, (t1 - t0) * 1e3);
+        for (int s = 0; s < k; s++)
+            if (collisions[s]) printf(" stage %d: %lld packets lose their switch output\n", s, collisions[s]);
+    }
+    free(inv);
+    free(perm);
+    return rc;
 }
@@ -2,22 +2,32 @@
 // Serial baseline for P5/P6 (PGM/PPM binary) + selection + 3x3 filters + Sobel + Equalize + BENCH
 // Compilation: gcc -O3 -march=native -std=c11 image_editor_serial.c -lm -o editor_serial
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <math.h>
 #include <time.h>
 
+// One run [x0, x1) of selected pixels on a row
+typedef struct { int x0, x1; } Run;
+
 typedef struct {
     int w, h;           // columns, rows
     int ch;             // 1 (P5 - Grayscale) or 3 (P6 - RGB)
     uint8_t *data;      // primary image buffer (size = w*h*ch)
     uint8_t *tmp;       // reusable temporary buffer for filtering
     size_t tmp_cap;     // current capacity of the tmp buffer
-    // Selection coordinates [x1, x2) [y1, y2)
+    // Bounding box of the selection [x1, x2) [y1, y2)
     int x1, y1, x2, y2;
+    // Selection as per-row runs: row y owns runs[row_start[y] .. row_start[y+1])
+    Run *runs;
+    int *row_start;     // h + 1 entries
+    int nruns, runs_cap;
+    int sel_rows;       // rows already closed while a selection is being built
     int loaded;         // boolean flag for image state
 } Image;
 
@@ -42,11 +52,19 @@ static double now_sec(void) {
     return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
 }
 
+// Status messages of the image operations; NULL silences them (STREAM runs the
+// operations once per frame and reports only a summary)
+static FILE *msg_out;
+#define say(...) do { if (msg_out) fprintf(msg_out, __VA_ARGS__); } while (0)
+
 // Frees all memory associated with the image
 static void img_free(Image *img) {
     free(img->data); img->data = NULL;
     free(img->tmp);  img->tmp  = NULL;
     img->tmp_cap = 0;
+    free(img->runs); img->runs = NULL;
+    free(img->row_start); img->row_start = NULL;
+    img->nruns = img->runs_cap = 0;
     img->loaded = 0;
     img->w = img->h = img->ch = 0;
     img->x1 = img->y1 = img->x2 = img->y2 = 0;
@@ -87,61 +105,73 @@ static int read_token(FILE *f, char *buf, size_t n) {
     return i > 0;
 }
 
-// Loads a P5 or P6 image from disk
-static int img_load_pnm(Image *img, const char *path) {
-    FILE *f = fopen(path, "rb");
-    if (!f) return 0;
+static int sel_rect(Image *img, int x1, int y1, int x2, int y2);
 
+// Reads one P5 or P6 image from an open stream (frames may follow it)
+static int img_read_pnm(Image *img, FILE *f) {
     char tok[64];
-    if (!read_token(f, tok, sizeof(tok))) { fclose(f); return 0; }
+    if (!read_token(f, tok, sizeof(tok))) return 0;
     int ch = 0;
     if (strcmp(tok, "P5") == 0) ch = 1;
     else if (strcmp(tok, "P6") == 0) ch = 3;
-    else { fclose(f); return 0; }
+    else return 0;
 
-    if (!read_token(f, tok, sizeof(tok))) { fclose(f); return 0; }
+    if (!read_token(f, tok, sizeof(tok))) return 0;
     int w = atoi(tok);
-    if (!read_token(f, tok, sizeof(tok))) { fclose(f); return 0; }
+    if (!read_token(f, tok, sizeof(tok))) return 0;
     int h = atoi(tok);
-    if (!read_token(f, tok, sizeof(tok))) { fclose(f); return 0; }
+    if (!read_token(f, tok, sizeof(tok))) return 0;
     int maxval = atoi(tok);
 
-    if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 255) { fclose(f); return 0; }
+    if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 255) return 0;
 
     size_t sz = (size_t)w * (size_t)h * (size_t)ch;
     uint8_t *data = (uint8_t*)malloc(sz);
-    if (!data) { fclose(f); return 0; }
+    if (!data) return 0;
 
     // Read raw pixel data
     size_t got = fread(data, 1, sz, f);
-    fclose(f);
     if (got != sz) { free(data); return 0; }
 
     img_free(img);
     img->data = data;
     img->w = w; img->h = h; img->ch = ch;
     img->loaded = 1;
-    img->x1 = 0; img->y1 = 0; img->x2 = w; img->y2 = h;
+    if (!sel_rect(img, 0, 0, w, h)) { img_free(img); return 0; }
     return 1;
 }
 
+// Loads a P5 or P6 image from disk
+static int img_load_pnm(Image *img, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    int ok = img_read_pnm(img, f);
+    fclose(f);
+    return ok;
+}
+
+// Writes one P5/P6 image to an open stream
+static int img_write_pnm(const Image *img, FILE *f) {
+    if (!img->loaded) return 0;
+    fprintf(f, (img->ch == 1) ? "P5\n" : "P6\n");
+    fprintf(f, "%d %d\n255\n", img->w, img->h);
+    size_t sz = (size_t)img->w * (size_t)img->h * (size_t)img->ch;
+    return fwrite(img->data, 1, sz, f) == sz;
+}
+
 // Saves the current image to a PNM file
 static int img_save_pnm(const Image *img, const char *path) {
     if (!img->loaded) return 0;
     FILE *f = fopen(path, "wb");
     if (!f) return 0;
-    fprintf(f, (img->ch == 1) ? "P5\n" : "P6\n");
-    fprintf(f, "%d %d\n255\n", img->w, img->h);
-    size_t sz = (size_t)img->w * (size_t)img->h * (size_t)img->ch;
-    size_t wr = fwrite(img->data, 1, sz, f);
-    fclose(f);
-    return wr == sz;
+    int ok = img_write_pnm(img, f);
+    return (fclose(f) == 0) && ok;
 }
 
 // Selects the entire image area
 static void img_select_all(Image *img) {
     if (!img->loaded) { printf("No image loaded\n"); return; }
-    img->x1 = 0; img->y1 = 0; img->x2 = img->w; img->y2 = img->h;
+    if (!sel_rect(img, 0, 0, img->w, img->h)) { fprintf(stderr, "malloc failed\n"); return; }
     printf("Selected ALL\n");
 }
 
@@ -154,14 +184,159 @@ static void img_select_rect(Image *img, int x1, int y1, int x2, int y2) {
         printf("Invalid set of coordinates\n");
         return;
     }
-    img->x1 = x1; img->y1 = y1; img->x2 = x2; img->y2 = y2;
+    if (!sel_rect(img, x1, y1, x2, y2)) { fprintf(stderr, "malloc failed\n"); return; }
     printf("Selected %d %d %d %d\n", x1, y1, x2, y2);
 }
 
+// ==== Span selections ====
+// Every selection is stored as sorted per-row runs; kernels visit only the runs,
+// so filtering a small non-rectangular region costs in proportion to its area.
+
+// Starts a new selection; runs must then be pushed in non-decreasing row order
+static int sel_begin(Image *img) {
+    free(img->row_start);
+    img->row_start = (int*)malloc(((size_t)img->h + 1) * sizeof(int));
+    if (!img->row_start) return 0;
+    img->nruns = 0;
+    img->sel_rows = 0;
+    img->row_start[0] = 0;
+    return 1;
+}
+
+static int sel_push(Image *img, int y, int x0, int x1) {
+    if (x0 < 0) x0 = 0;
+    if (x1 > img->w) x1 = img->w;
+    if (x1 <= x0 || y < img->sel_rows - 1) return 1;
+    while (img->sel_rows <= y) img->row_start[++img->sel_rows] = img->nruns; // close earlier rows
+    if (img->nruns == img->runs_cap) {
+        int cap = img->runs_cap ? 2 * img->runs_cap : 256;
+        Run *r = (Run*)realloc(img->runs, (size_t)cap * sizeof(Run));
+        if (!r) return 0;
+        img->runs = r; img->runs_cap = cap;
+    }
+    img->runs[img->nruns].x0 = x0;
+    img->runs[img->nruns].x1 = x1;
+    img->row_start[y + 1] = ++img->nruns;
+    return 1;
+}
+
+// Closes the remaining rows and recomputes the bounding box; returns the area
+static long long sel_end(Image *img) {
+    while (img->sel_rows < img->h) img->row_start[++img->sel_rows] = img->nruns;
+    long long area = 0;
+    int bx1 = img->w, by1 = img->h, bx2 = 0, by2 = 0;
+    for (int y = 0; y < img->h; y++) {
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            area += img->runs[r].x1 - img->runs[r].x0;
+            if (img->runs[r].x0 < bx1) bx1 = img->runs[r].x0;
+            if (img->runs[r].x1 > bx2) bx2 = img->runs[r].x1;
+            if (y < by1) by1 = y;
+            by2 = y + 1;
+        }
+    }
+    if (area == 0) bx1 = by1 = bx2 = by2 = 0;
+    img->x1 = bx1; img->y1 = by1; img->x2 = bx2; img->y2 = by2;
+    return area;
+}
+
+// Rectangle [x1, x2) x [y1, y2) as one run per row (no checks, no output)
+static int sel_rect(Image *img, int x1, int y1, int x2, int y2) {
+    if (!sel_begin(img)) return 0;
+    for (int y = y1; y < y2; y++)
+        if (!sel_push(img, y, x1, x2)) return 0;
+    sel_end(img);
+    return 1;
+}
+
+// Pixels whose centers lie inside the ellipse
+static long long sel_ellipse(Image *img, double cx, double cy, double rx, double ry) {
+    if (!sel_begin(img)) return -1;
+    int ya = (int)floor(cy - ry - 1.0), yb = (int)ceil(cy + ry + 1.0);
+    if (ya < 0) ya = 0;
+    if (yb > img->h) yb = img->h;
+    for (int y = ya; y < yb; y++) {
+        double dy = (y + 0.5 - cy) / ry;
+        if (dy < -1.0 || dy > 1.0) continue;
+        double half = rx * sqrt(1.0 - dy * dy);
+        if (!sel_push(img, y, (int)ceil(cx - half - 0.5), (int)floor(cx + half - 0.5) + 1)) return -1;
+    }
+    return sel_end(img);
+}
+
+// Scanline fill with the even-odd rule, sampled at pixel centers
+static long long sel_polygon(Image *img, int n, const double *px, const double *py) {
+    if (!sel_begin(img)) return -1;
+    double *xs = (double*)malloc((size_t)n * sizeof(double));
+    if (!xs) return -1;
+    double ymin = py[0], ymax = py[0];
+    for (int i = 1; i < n; i++) {
+        if (py[i] < ymin) ymin = py[i];
+        if (py[i] > ymax) ymax = py[i];
+    }
+    int ya = (int)floor(ymin), yb = (int)ceil(ymax);
+    if (ya < 0) ya = 0;
+    if (yb > img->h) yb = img->h;
+    for (int y = ya; y < yb; y++) {
+        double yc = y + 0.5;
+        int k = 0;
+        for (int i = 0, j = n - 1; i < n; j = i++) {
+            if ((py[i] <= yc && yc < py[j]) || (py[j] <= yc && yc < py[i])) {
+                double x = px[i] + (yc - py[i]) * (px[j] - px[i]) / (py[j] - py[i]);
+                int m = k++;
+                while (m > 0 && xs[m - 1] > x) { xs[m] = xs[m - 1]; m--; } // insertion sort
+                xs[m] = x;
+            }
+        }
+        for (int i = 0; i + 1 < k; i += 2)
+            if (!sel_push(img, y, (int)ceil(xs[i] - 0.5), (int)ceil(xs[i + 1] - 0.5))) { free(xs); return -1; }
+    }
+    free(xs);
+    return sel_end(img);
+}
+
+// Non-zero pixels of a P5 mask with the same size as the image
+static long long sel_mask(Image *img, const char *path) {
+    Image m = {0};
+    if (!img_load_pnm(&m, path)) return -1;
+    if (m.w != img->w || m.h != img->h || m.ch != 1) { img_free(&m); return -1; }
+    if (!sel_begin(img)) { img_free(&m); return -1; }
+    for (int y = 0; y < img->h; y++) {
+        const uint8_t *row = m.data + (size_t)y * img->w;
+        int x = 0;
+        while (x < img->w) {
+            while (x < img->w && !row[x]) x++;
+            int x0 = x;
+            while (x < img->w && row[x]) x++;
+            if (x > x0 && !sel_push(img, y, x0, x)) { img_free(&m); return -1; }
+        }
+    }
+    img_free(&m);
+    return sel_end(img);
+}
+
+// Clips run r to the columns [lo, hi); returns 0 when nothing is left
+static inline int sel_clip(const Image *img, int r, int lo, int hi, int *xa, int *xb) {
+    *xa = img->runs[r].x0 > lo ? img->runs[r].x0 : lo;
+    *xb = img->runs[r].x1 < hi ? img->runs[r].x1 : hi;
+    return *xb > *xa;
+}
+
+// Copies the selected pixels of rows [y1, y2) from tmp back into data
+static void sel_commit(Image *img, int y1, int y2) {
+    for (int y = y1; y < y2; y++)
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (!sel_clip(img, r, 1, img->w - 1, &xa, &xb)) continue;
+            size_t off = ((size_t)y * img->w + xa) * img->ch;
+            memcpy(img->data + off, img->tmp + off, (size_t)(xb - xa) * img->ch);
+        }
+}
+
 // Crops the image to the current selection
 static void img_crop(Image *img) {
     if (!img->loaded) { printf("No image loaded\n"); return; }
-    int nw = img->x2 - img->x1;
+    if (img->nruns == 0) { printf("Invalid set of coordinates\n"); return; }
+    int nw = img->x2 - img->x1;  // crops to the bounding box of the selection
     int nh = img->y2 - img->y1;
     size_t nsz = (size_t)nw * (size_t)nh * (size_t)img->ch;
     uint8_t *nd = (uint8_t*)malloc(nsz);
@@ -179,9 +354,21 @@ static void img_crop(Image *img) {
     printf("Image cropped\n");
 }
 
+// 3x3 kernel of an APPLY filter name (EDGE, SHARPEN, BLUR, GAUSSIAN_BLUR); NULL if unknown
+static const double (*filter_kernel(const char *name))[3] {
+    static const double KE[3][3] = {{-1,-1,-1},{-1,8,-1},{-1,-1,-1}}, KS[3][3] = {{0,-1,0},{-1,5,-1},{0,-1,0}};
+    static const double KB[3][3] = {{1./9,1./9,1./9},{1./9,1./9,1./9},{1./9,1./9,1./9}};
+    static const double KG[3][3] = {{1./16,2./16,1./16},{2./16,4./16,2./16},{1./16,2./16,1./16}};
+    if (strcmp(name, "EDGE") == 0) return KE;
+    if (strcmp(name, "SHARPEN") == 0) return KS;
+    if (strcmp(name, "BLUR") == 0) return KB;
+    if (strcmp(name, "GAUSSIAN_BLUR") == 0) return KG;
+    return NULL;
+}
+
 // Applies a generic 3x3 convolution kernel to the selected area
 static void apply_conv3x3(Image *img, const double K[3][3], const char *msg) {
-    if (!img->loaded) { printf("No image loaded\n"); return; }
+    if (!img->loaded) { say("No image loaded\n"); return; }
     int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
     
     // Safety check: avoid processing image borders to prevent out-of-bounds access
@@ -189,69 +376,1040 @@ static void apply_conv3x3(Image *img, const double K[3][3], const char *msg) {
     if (y1 == 0) y1++;
     if (x2 == img->w) x2--;
     if (y2 == img->h) y2--;
-    if (x2 - x1 <= 0 || y2 - y1 <= 0) { printf("%s done\n", msg); return; }
+    if (x2 - x1 <= 0 || y2 - y1 <= 0) { say("%s done\n", msg); return; }
 
     size_t sz = (size_t)img->w * img->h * img->ch;
     if (!img_ensure_tmp(img, sz)) { fprintf(stderr, "malloc failed\n"); return; }
-    memcpy(img->tmp, img->data, sz);
 
+    // Only the selected runs are computed (into tmp) and then copied back
     for (int y = y1; y < y2; y++) {
-        for (int x = x1; x < x2; x++) {
-            size_t base = ((size_t)y * img->w + x) * img->ch;
-            for (int c = 0; c < img->ch; c++) {
-                double sum = 0.0;
-                for (int ky = -1; ky <= 1; ky++) {
-                    for (int kx = -1; kx <= 1; kx++) {
-                        size_t idx = ((size_t)(y + ky) * img->w + (x + kx)) * img->ch + (size_t)c;
-                        sum += K[ky + 1][kx + 1] * (double)img->data[idx];
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (!sel_clip(img, r, x1, x2, &xa, &xb)) continue;
+            for (int x = xa; x < xb; x++) {
+                size_t base = ((size_t)y * img->w + x) * img->ch;
+                for (int c = 0; c < img->ch; c++) {
+                    double sum = 0.0;
+                    for (int ky = -1; ky <= 1; ky++) {
+                        for (int kx = -1; kx <= 1; kx++) {
+                            size_t idx = ((size_t)(y + ky) * img->w + (x + kx)) * img->ch + (size_t)c;
+                            sum += K[ky + 1][kx + 1] * (double)img->data[idx];
+                        }
                     }
+                    img->tmp[base + (size_t)c] = clamp_u8_double(sum);
                 }
-                img->tmp[base + (size_t)c] = clamp_u8_double(sum);
             }
         }
     }
-    // Swap buffers to finalize changes
-    uint8_t *t = img->data; img->data = img->tmp; img->tmp = t;
-    printf("%s done\n", msg);
+    sel_commit(img, y1, y2);
+    say("%s done\n", msg);
 }
 
 // Specialized function for Sobel Edge Detection
 static void apply_sobel(Image *img) {
-    if (!img->loaded) { printf("No image loaded\n"); return; }
+    if (!img->loaded) { say("No image loaded\n"); return; }
     int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
     if (x1 == 0) x1++;
     if (y1 == 0) y1++;
     if (x2 == img->w) x2--;
     if (y2 == img->h) y2--;
-    if (x2 - x1 <= 0 || y2 - y1 <= 0) { printf("APPLY SOBEL done\n"); return; }
+    if (x2 - x1 <= 0 || y2 - y1 <= 0) { say("APPLY SOBEL done\n"); return; }
 
     static const int Gx[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
     static const int Gy[3][3] = {{ 1, 2, 1}, { 0, 0, 0}, {-1,-2,-1}};
 
     size_t sz = (size_t)img->w * img->h * img->ch;
     if (!img_ensure_tmp(img, sz)) { fprintf(stderr, "malloc failed\n"); return; }
-    memcpy(img->tmp, img->data, sz);
 
     for (int y = y1; y < y2; y++) {
-        for (int x = x1; x < x2; x++) {
-            size_t base = ((size_t)y * img->w + x) * img->ch;
-            for (int c = 0; c < img->ch; c++) {
-                int sx = 0, sy = 0;
-                for (int ky = -1; ky <= 1; ky++) {
-                    for (int kx = -1; kx <= 1; kx++) {
-                        size_t idx = ((size_t)(y + ky) * img->w + (x + kx)) * img->ch + (size_t)c;
-                        int v = (int)img->data[idx];
-                        sx += v * Gx[ky + 1][kx + 1];
-                        sy += v * Gy[ky + 1][kx + 1];
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (!sel_clip(img, r, x1, x2, &xa, &xb)) continue;
+            for (int x = xa; x < xb; x++) {
+                size_t base = ((size_t)y * img->w + x) * img->ch;
+                for (int c = 0; c < img->ch; c++) {
+                    int sx = 0, sy = 0;
+                    for (int ky = -1; ky <= 1; ky++) {
+                        for (int kx = -1; kx <= 1; kx++) {
+                            size_t idx = ((size_t)(y + ky) * img->w + (x + kx)) * img->ch + (size_t)c;
+                            int v = (int)img->data[idx];
+                            sx += v * Gx[ky + 1][kx + 1];
+                            sy += v * Gy[ky + 1][kx + 1];
+                        }
                     }
+                    double mag = sqrt((double)sx * (double)sx + (double)sy * (double)sy);
+                    img->tmp[base + (size_t)c] = clamp_u8_double(mag);
                 }
-                double mag = sqrt((double)sx * (double)sx + (double)sy * (double)sy);
-                img->tmp[base + (size_t)c] = clamp_u8_double(mag);
             }
         }
     }
+    sel_commit(img, y1, y2);
+    say("APPLY SOBEL done\n");
+}
+
+// ==== Color-space conversion (fixed-point, integer only) ====
+// Row kernels work on the interleaved layout and use only integer arithmetic,
+// so -O3 -march=native vectorizes them and the serial, OMP and MPI editors
+// produce bit-identical results. src and dst may alias for 3->3 kernels.
+typedef void (*RowKernel)(const uint8_t *src, uint8_t *dst, int n);
+
+// BT.601 luma with 8-bit weights (77 + 150 + 29 = 256)
+static void cvt_rgb_to_gray_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        dst[i] = (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+    }
+}
+
+// Replicates the gray value on all three channels
+static void cvt_gray_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        uint8_t v = src[i];
+        dst[3 * i] = v; dst[3 * i + 1] = v; dst[3 * i + 2] = v;
+    }
+}
+
+// Full-range (JPEG) YCbCr with 16-bit fixed-point coefficients
+static void cvt_rgb_to_ycbcr_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        int y  = ( 19595 * r + 38470 * g +  7471 * b + 32768) >> 16;
+        int cb = (-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16;
+        int cr = ( 32768 * r - 27439 * g -  5329 * b + (128 << 16) + 32768) >> 16;
+        dst[3 * i] = clamp_u8_int(y);
+        dst[3 * i + 1] = clamp_u8_int(cb);
+        dst[3 * i + 2] = clamp_u8_int(cr);
+    }
+}
+
+static void cvt_ycbcr_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int y = src[3 * i] << 16, cb = src[3 * i + 1] - 128, cr = src[3 * i + 2] - 128;
+        dst[3 * i]     = clamp_u8_int((y + 91881 * cr + 32768) >> 16);
+        dst[3 * i + 1] = clamp_u8_int((y - 22554 * cb - 46802 * cr + 32768) >> 16);
+        dst[3 * i + 2] = clamp_u8_int((y + 116130 * cb + 32768) >> 16);
+    }
+}
+
+// 8-bit HSV: hue is scaled to [0, 255] (43 units per 60 degree sector)
+static void cvt_rgb_to_hsv_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int r = src[3 * i], g = src[3 * i + 1], b = src[3 * i + 2];
+        int mx = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        int mn = r < g ? (r < b ? r : b) : (g < b ? g : b);
+        int d = mx - mn, h = 0, s = 0;
+        if (d != 0) {
+            s = (255 * d + mx / 2) / mx;
+            if (mx == r) h = (43 * (g - b)) / d;
+            else if (mx == g) h = 85 + (43 * (b - r)) / d;
+            else h = 171 + (43 * (r - g)) / d;
+        }
+        dst[3 * i] = (uint8_t)(h & 255);
+        dst[3 * i + 1] = (uint8_t)s;
+        dst[3 * i + 2] = (uint8_t)mx;
+    }
+}
+
+static void cvt_hsv_to_rgb_row(const uint8_t *src, uint8_t *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        int h = src[3 * i], s = src[3 * i + 1], v = src[3 * i + 2];
+        int region = h / 43, rem = (h - region * 43) * 6;
+        int p = (v * (255 - s)) >> 8;
+        int q = (v * (255 - ((s * rem) >> 8))) >> 8;
+        int t = (v * (255 - ((s * (255 - rem)) >> 8))) >> 8;
+        int r, g, b;
+        if (s == 0) { r = g = b = v; }
+        else switch (region) {
+            case 0:  r = v; g = t; b = p; break;
+            case 1:  r = q; g = v; b = p; break;
+            case 2:  r = p; g = v; b = t; break;
+            case 3:  r = p; g = q; b = v; break;
+            case 4:  r = t; g = p; b = v; break;
+            default: r = v; g = p; b = q; break;
+        }
+        dst[3 * i] = (uint8_t)r; dst[3 * i + 1] = (uint8_t)g; dst[3 * i + 2] = (uint8_t)b;
+    }
+}
+
+typedef struct {
+    const char *name;   // command argument / message
+    int in_ch, out_ch;
+    RowKernel fn;
+} ColorKernel;
+
+static const ColorKernel COLOR_KERNELS[] = {
+    {"GRAYSCALE", 3, 1, cvt_rgb_to_gray_row},
+    {"TO_RGB",    1, 3, cvt_gray_to_rgb_row},
+    {"RGB2YCBCR", 3, 3, cvt_rgb_to_ycbcr_row},
+    {"YCBCR2RGB", 3, 3, cvt_ycbcr_to_rgb_row},
+    {"RGB2HSV",   3, 3, cvt_rgb_to_hsv_row},
+    {"HSV2RGB",   3, 3, cvt_hsv_to_rgb_row},
+};
+
+static const ColorKernel *find_color_kernel(const char *name) {
+    for (size_t i = 0; i < sizeof(COLOR_KERNELS) / sizeof(COLOR_KERNELS[0]); i++)
+        if (strcmp(COLOR_KERNELS[i].name, name) == 0) return &COLOR_KERNELS[i];
+    return NULL;
+}
+
+// Converts the whole image (conversions ignore the selection since they may change ch)
+static void img_convert(Image *img, const ColorKernel *k) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    if (img->ch != k->in_ch) {
+        say(k->in_ch == 1 ? "Black and white image needed\n" : "Color image needed\n");
+        return;
+    }
+    size_t in_rb = (size_t)img->w * k->in_ch, out_rb = (size_t)img->w * k->out_ch;
+    size_t sz = out_rb * img->h;
+    if (!img_ensure_tmp(img, sz)) { fprintf(stderr, "malloc failed\n"); return; }
+
+    for (int y = 0; y < img->h; y++)
+        k->fn(img->data + (size_t)y * in_rb, img->tmp + (size_t)y * out_rb, img->w);
+
+    // the old data buffer becomes tmp; only its image-sized part is known to be allocated
     uint8_t *t = img->data; img->data = img->tmp; img->tmp = t;
-    printf("APPLY SOBEL done\n");
+    img->tmp_cap = in_rb * img->h;
+    img->ch = k->out_ch;
+    say("%s done\n", k->name);
+}
+
+// Fused pipeline: RGB->YCbCr pre-stage, 3x3 filter on luma only, YCbCr->RGB post-stage.
+// Chroma is never filtered, so color edges do not bleed.
+static void apply_conv3x3_luma(Image *img, const double K[3][3], const char *msg) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    if (img->ch != 3) { say("Color image needed\n"); return; }
+    int x1 = img->x1, y1 = img->y1, x2 = img->x2, y2 = img->y2;
+    if (x1 == 0) x1++;
+    if (y1 == 0) y1++;
+    if (x2 == img->w) x2--;
+    if (y2 == img->h) y2--;
+    if (x2 - x1 <= 0 || y2 - y1 <= 0) { say("%s done\n", msg); return; }
+
+    // tmp = YCbCr copy of rows [y1-1, y2+1) followed by one output row
+    size_t rb = (size_t)img->w * 3;
+    int rows = y2 - y1 + 2;
+    if (!img_ensure_tmp(img, (size_t)(rows + 1) * rb)) { fprintf(stderr, "malloc failed\n"); return; }
+    uint8_t *ycc = img->tmp, *out = img->tmp + (size_t)rows * rb;
+
+    for (int r = 0; r < rows; r++) {
+        size_t off = (size_t)(y1 - 1 + r) * rb + (size_t)(x1 - 1) * 3;
+        cvt_rgb_to_ycbcr_row(img->data + off, ycc + off - (size_t)(y1 - 1) * rb, x2 - x1 + 2);
+    }
+
+    for (int y = y1; y < y2; y++) {
+        const uint8_t *row = ycc + (size_t)(y - y1 + 1) * rb;
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            int xa, xb;
+            if (!sel_clip(img, r, x1, x2, &xa, &xb)) continue;
+            for (int x = xa; x < xb; x++) {
+                double sum = 0.0;
+                for (int ky = -1; ky <= 1; ky++)
+                    for (int kx = -1; kx <= 1; kx++)
+                        sum += K[ky + 1][kx + 1] * (double)row[(ptrdiff_t)ky * (ptrdiff_t)rb + (x + kx) * 3];
+                uint8_t *o = out + (size_t)(x - x1) * 3;
+                o[0] = clamp_u8_double(sum);
+                o[1] = row[x * 3 + 1];
+                o[2] = row[x * 3 + 2];
+            }
+            cvt_ycbcr_to_rgb_row(out + (size_t)(xa - x1) * 3, img->data + (size_t)y * rb + (size_t)xa * 3, xb - xa);
+        }
+    }
+    say("%s done\n", msg);
+}
+
+// ==== Image pyramids (Gaussian + Laplacian) ====
+#define PYR_MAX_LEVELS 16
+#define PYR_BAND_ROWS 16   // rows per scheduling band of a level
+
+typedef struct {
+    int levels, ch;
+    int w[PYR_MAX_LEVELS], h[PYR_MAX_LEVELS];
+    size_t off[PYR_MAX_LEVELS + 1]; // level l occupies [off[l], off[l+1]) in every buffer
+    uint8_t *gauss;     // all Gaussian levels, stored contiguously (level 0 = full image)
+    uint8_t *work;      // same layout; destination of per-level filters and of COLLAPSE
+    int16_t *lap;       // Laplacian bands L_l = G_l - expand(G_l+1); the top level has none
+} Pyramid;
+
+// A band of rows [y0, y1) of one pyramid level
+typedef struct { int level, y0, y1; } PyrBand;
+
+static const int BINOM5[5] = {1, 4, 6, 4, 1};
+
+static inline int clampi(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static void pyr_free(Pyramid *p) {
+    free(p->gauss); free(p->work); free(p->lap);
+    memset(p, 0, sizeof(*p));
+}
+
+// Lists the row bands of every level, so a single loop covers the whole pyramid
+static PyrBand *pyr_bands(const Pyramid *p, int *count) {
+    int n = 0;
+    for (int l = 0; l < p->levels; l++) n += (p->h[l] + PYR_BAND_ROWS - 1) / PYR_BAND_ROWS;
+    PyrBand *b = (PyrBand*)malloc((size_t)n * sizeof(PyrBand));
+    if (!b) return NULL;
+    n = 0;
+    for (int l = 0; l < p->levels; l++)
+        for (int y = 0; y < p->h[l]; y += PYR_BAND_ROWS) {
+            b[n].level = l; b[n].y0 = y;
+            b[n].y1 = (y + PYR_BAND_ROWS < p->h[l]) ? y + PYR_BAND_ROWS : p->h[l];
+            n++;
+        }
+    *count = n;
+    return b;
+}
+
+// Fused 5x5 binomial blur + 2x decimation: only the retained samples are computed.
+// vbuf holds sw*ch ints (vertical taps of one output row).
+static void pyr_reduce_rows(const uint8_t *src, int sw, int sh, uint8_t *dst, int dw, int ch,
+                            int y0, int y1, int *vbuf) {
+    size_t srb = (size_t)sw * ch;
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *r[5];
+        for (int j = 0; j < 5; j++) r[j] = src + (size_t)clampi(2 * y + j - 2, 0, sh - 1) * srb;
+        for (size_t i = 0; i < srb; i++)
+            vbuf[i] = r[0][i] + 4 * r[1][i] + 6 * r[2][i] + 4 * r[3][i] + r[4][i];
+        for (int x = 0; x < dw; x++) {
+            for (int c = 0; c < ch; c++) {
+                int s = 0;
+                for (int i = 0; i < 5; i++)
+                    s += BINOM5[i] * vbuf[(size_t)clampi(2 * x + i - 2, 0, sw - 1) * ch + c];
+                dst[((size_t)y * dw + x) * ch + c] = (uint8_t)((s + 128) >> 8);
+            }
+        }
+    }
+}
+
+// Upsamples the coarse level g (cw x chh) at fine position (x, y); weights sum to 64
+static inline int pyr_expand_at(const uint8_t *g, int cw, int chh, int ch, int x, int y, int c) {
+    int s = 0;
+    for (int j = -2; j <= 2; j++) {
+        if ((y - j) & 1) continue;
+        int yy = clampi((y - j) / 2, 0, chh - 1);
+        for (int i = -2; i <= 2; i++) {
+            if ((x - i) & 1) continue;
+            int xx = clampi((x - i) / 2, 0, cw - 1);
+            s += BINOM5[j + 2] * BINOM5[i + 2] * g[((size_t)yy * cw + xx) * ch + c];
+        }
+    }
+    return (s + 32) >> 6;
+}
+
+// 3x3 filter (or Sobel when K == NULL) on rows [y0, y1) of one level; borders are copied
+static void pyr_filter_rows(const uint8_t *src, uint8_t *dst, int w, int h, int ch,
+                            int y0, int y1, const double K[3][3]) {
+    static const int Gx[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+    static const int Gy[3][3] = {{ 1, 2, 1}, { 0, 0, 0}, {-1,-2,-1}};
+    size_t rb = (size_t)w * ch;
+    for (int y = y0; y < y1; y++) {
+        if (y == 0 || y == h - 1 || w < 3) { memcpy(dst + (size_t)y * rb, src + (size_t)y * rb, rb); continue; }
+        memcpy(dst + (size_t)y * rb, src + (size_t)y * rb, (size_t)ch);
+        memcpy(dst + (size_t)y * rb + rb - ch, src + (size_t)y * rb + rb - ch, (size_t)ch);
+        for (int x = 1; x < w - 1; x++) {
+            for (int c = 0; c < ch; c++) {
+                size_t idx = (size_t)y * rb + (size_t)x * ch + c;
+                if (K) {
+                    double sum = 0.0;
+                    for (int ky = -1; ky <= 1; ky++)
+                        for (int kx = -1; kx <= 1; kx++)
+                            sum += K[ky + 1][kx + 1] * (double)src[idx + (ptrdiff_t)ky * (ptrdiff_t)rb + kx * ch];
+                    dst[idx] = clamp_u8_double(sum);
+                } else {
+                    int sx = 0, sy = 0;
+                    for (int ky = -1; ky <= 1; ky++)
+                        for (int kx = -1; kx <= 1; kx++) {
+                            int v = src[idx + (ptrdiff_t)ky * (ptrdiff_t)rb + kx * ch];
+                            sx += v * Gx[ky + 1][kx + 1];
+                            sy += v * Gy[ky + 1][kx + 1];
+                        }
+                    dst[idx] = clamp_u8_double(sqrt((double)sx * (double)sx + (double)sy * (double)sy));
+                }
+            }
+        }
+    }
+}
+
+// Builds the Gaussian and Laplacian pyramids of the whole image
+static void pyr_build(Pyramid *p, const Image *img, int levels) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    if (levels < 1 || levels > PYR_MAX_LEVELS) { printf("Invalid command\n"); return; }
+    pyr_free(p);
+    p->levels = levels; p->ch = img->ch;
+    p->w[0] = img->w; p->h[0] = img->h; p->off[0] = 0;
+    for (int l = 0; l < levels; l++) {
+        if (l > 0) { p->w[l] = (p->w[l - 1] + 1) / 2; p->h[l] = (p->h[l - 1] + 1) / 2; }
+        p->off[l + 1] = p->off[l] + (size_t)p->w[l] * p->h[l] * p->ch;
+    }
+    size_t total = p->off[levels];
+    p->gauss = (uint8_t*)malloc(total);
+    p->work = (uint8_t*)malloc(total);
+    p->lap = (int16_t*)malloc(total * sizeof(int16_t));
+    int *vbuf = (int*)malloc((size_t)img->w * img->ch * sizeof(int));
+    if (!p->gauss || !p->work || !p->lap || !vbuf) {
+        free(vbuf); pyr_free(p); fprintf(stderr, "malloc failed\n"); return;
+    }
+    memcpy(p->gauss, img->data, p->off[1]);
+
+    for (int l = 1; l < levels; l++)
+        pyr_reduce_rows(p->gauss + p->off[l - 1], p->w[l - 1], p->h[l - 1],
+                        p->gauss + p->off[l], p->w[l], p->ch, 0, p->h[l], vbuf);
+    free(vbuf);
+
+    for (int l = 0; l + 1 < levels; l++) {
+        const uint8_t *g = p->gauss + p->off[l], *gc = p->gauss + p->off[l + 1];
+        int16_t *L = p->lap + p->off[l];
+        for (int y = 0; y < p->h[l]; y++)
+            for (int x = 0; x < p->w[l]; x++)
+                for (int c = 0; c < p->ch; c++) {
+                    size_t i = ((size_t)y * p->w[l] + x) * p->ch + c;
+                    L[i] = (int16_t)(g[i] - pyr_expand_at(gc, p->w[l + 1], p->h[l + 1], p->ch, x, y, c));
+                }
+    }
+    printf("PYRAMID BUILD done (%d levels, %.3fx pixels)\n", levels, (double)total / (double)p->off[1]);
+}
+
+// Runs one 3x3 filter over every Gaussian level in a single pass over all row bands
+static void pyr_apply(Pyramid *p, const double K[3][3], const char *msg) {
+    if (!p->levels) { printf("No pyramid built\n"); return; }
+    int nb;
+    PyrBand *bands = pyr_bands(p, &nb);
+    if (!bands) { fprintf(stderr, "malloc failed\n"); return; }
+    for (int i = 0; i < nb; i++) {
+        int l = bands[i].level;
+        pyr_filter_rows(p->gauss + p->off[l], p->work + p->off[l], p->w[l], p->h[l], p->ch,
+                        bands[i].y0, bands[i].y1, K);
+    }
+    free(bands);
+    uint8_t *t = p->gauss; p->gauss = p->work; p->work = t;
+    printf("PYRAMID %s done\n", msg);
+}
+
+// Scales the Laplacian band of one level (gain > 1 boosts detail, 0 removes it)
+static void pyr_band_gain(Pyramid *p, int level, double gain) {
+    if (!p->levels) { printf("No pyramid built\n"); return; }
+    if (level < 0 || level + 1 >= p->levels) { printf("Invalid command\n"); return; }
+    int16_t *L = p->lap + p->off[level];
+    size_t n = p->off[level + 1] - p->off[level];
+    for (size_t i = 0; i < n; i++) {
+        long v = lrint(gain * L[i]);
+        L[i] = (int16_t)(v < -32768 ? -32768 : (v > 32767 ? 32767 : v));
+    }
+    printf("PYRAMID BAND %d done\n", level);
+}
+
+// Reconstructs level 0 from the top Gaussian level and the Laplacian bands
+static void pyr_collapse(Pyramid *p, Image *img) {
+    if (!p->levels) { printf("No pyramid built\n"); return; }
+    int top = p->levels - 1;
+    memcpy(p->work + p->off[top], p->gauss + p->off[top], p->off[top + 1] - p->off[top]);
+    for (int l = top - 1; l >= 0; l--) {
+        const uint8_t *gc = p->work + p->off[l + 1];
+        const int16_t *L = p->lap + p->off[l];
+        uint8_t *g = p->work + p->off[l];
+        for (int y = 0; y < p->h[l]; y++)
+            for (int x = 0; x < p->w[l]; x++)
+                for (int c = 0; c < p->ch; c++) {
+                    size_t i = ((size_t)y * p->w[l] + x) * p->ch + c;
+                    g[i] = clamp_u8_int(L[i] + pyr_expand_at(gc, p->w[l + 1], p->h[l + 1], p->ch, x, y, c));
+                }
+    }
+    uint8_t *nd = (uint8_t*)malloc(p->off[1]);
+    if (!nd) { fprintf(stderr, "malloc failed\n"); return; }
+    memcpy(nd, p->work, p->off[1]);
+    free(img->data);
+    img->data = nd;
+    img->tmp_cap = 0; // the image may have grown since BUILD; force tmp to be resized
+    img->w = p->w[0]; img->h = p->h[0]; img->ch = p->ch;
+    img->loaded = 1;
+    if (!sel_rect(img, 0, 0, img->w, img->h)) fprintf(stderr, "malloc failed\n");
+    printf("PYRAMID COLLAPSE done\n");
+}
+
+// Writes one Gaussian level as a PNM file
+static int pyr_save_level(const Pyramid *p, int level, const char *path) {
+    if (level < 0 || level >= p->levels) return 0;
+    Image lv = {0};
+    lv.w = p->w[level]; lv.h = p->h[level]; lv.ch = p->ch;
+    lv.data = p->gauss + p->off[level];
+    lv.loaded = 1;
+    return img_save_pnm(&lv, path);
+}
+
+// ==== Noise and dithering ====
+// Noise comes from Philox4x32-10, a counter-based RNG: the numbers of a pixel
+// depend only on (seed, stream, global pixel index), never on the visiting
+// order, so the serial, OMP and MPI editors produce the same image.
+enum { NOISE_GAUSSIAN, NOISE_SALT_PEPPER };
+
+typedef struct { uint32_t v[4]; } Philox4;
+
+static Philox4 philox4x32_10(uint64_t idx, uint32_t stream, uint64_t seed) {
+    uint32_t c0 = (uint32_t)idx, c1 = (uint32_t)(idx >> 32), c2 = stream, c3 = 0;
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+    for (int r = 0; r < 10; r++) {
+        uint64_t p0 = (uint64_t)0xD2511F53u * c0, p1 = (uint64_t)0xCD9E8D57u * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0, n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1; c3 = (uint32_t)p0;
+        c0 = n0; c2 = n2;
+        k0 += 0x9E3779B9u; k1 += 0xBB67AE85u;
+    }
+    Philox4 out = {{c0, c1, c2, c3}};
+    return out;
+}
+
+// Maps 32 random bits to (0, 1)
+static inline double u01(uint32_t u) { return ((double)u + 0.5) * (1.0 / 4294967296.0); }
+
+// Adds noise to n consecutive pixels; idx is the global index of the first one
+static void noise_span(uint8_t *p, int n, int ch, uint64_t idx, int kind, double amount, uint64_t seed) {
+    const double TWO_PI = 6.283185307179586;
+    for (int i = 0; i < n; i++, p += ch) {
+        Philox4 r = philox4x32_10(idx + (uint64_t)i, (uint32_t)kind, seed);
+        if (kind == NOISE_GAUSSIAN) {
+            // Box-Muller: one Philox block gives up to 4 normals, enough for RGB
+            double a = sqrt(-2.0 * log(u01(r.v[0]))), b = sqrt(-2.0 * log(u01(r.v[2])));
+            double z[3] = { a * cos(TWO_PI * u01(r.v[1])), a * sin(TWO_PI * u01(r.v[1])), b * cos(TWO_PI * u01(r.v[3])) };
+            for (int c = 0; c < ch; c++) p[c] = clamp_u8_double((double)p[c] + amount * z[c]);
+        } else {
+            double u = u01(r.v[0]);
+            if (u < 0.5 * amount) memset(p, 0, (size_t)ch);
+            else if (u < amount) memset(p, 255, (size_t)ch);
+        }
+    }
+}
+
+static const uint8_t BAYER8[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42}, {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38}, {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41}, {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37}, {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+// Value of quantization level q out of `levels` evenly spaced levels
+static inline int dither_level(int q, int levels) { return (q * 255 + (levels - 1) / 2) / (levels - 1); }
+
+// Ordered (Bayer 8x8) dithering of n pixels starting at column x of row y:
+// q = floor(v * (levels-1) / 255 + (b + 0.5) / 64), done in integers
+static void dither_ordered_span(uint8_t *p, int n, int ch, int x, int y, int levels) {
+    const uint8_t *b = BAYER8[y & 7];
+    for (int i = 0; i < n; i++, p += ch) {
+        int t = (2 * b[(x + i) & 7] + 1) * 255;
+        for (int c = 0; c < ch; c++)
+            p[c] = (uint8_t)dither_level((p[c] * (levels - 1) * 128 + t) / (255 * 128), levels);
+    }
+}
+
+// Floyd-Steinberg on pixels [x0, x1) of one row, raster order. Errors are integers
+// and the diffused parts are kept in 1/16 units: above[] holds what the previous
+// row pushed down, below[] receives 3/16, 5/16, 1/16 of this row's errors, carry[]
+// the 7/16 from the left neighbour. above/below are indexed by x + 1, so columns
+// -1 and w exist and need no bounds checks.
+static void dither_fs_span(uint8_t *row, int x0, int x1, int ch, int levels,
+                           const int16_t *above, int16_t *below, int *carry) {
+    for (int x = x0; x < x1; x++) {
+        uint8_t *p = row + (size_t)x * ch;
+        for (int c = 0; c < ch; c++) {
+            int v16 = p[c] * 16 + above[(size_t)(x + 1) * ch + c] + carry[c];
+            int v = (v16 + 8 + 16 * 1024) / 16 - 1024; // round to nearest, also for v16 < 0
+            int q = (clamp_u8_int(v) * (levels - 1) + 127) / 255;
+            int out = dither_level(q, levels);
+            int e = v - out;
+            p[c] = (uint8_t)out;
+            carry[c] = 7 * e;
+            below[(size_t)x * ch + c] += (int16_t)(3 * e);
+            below[(size_t)(x + 1) * ch + c] += (int16_t)(5 * e);
+            below[(size_t)(x + 2) * ch + c] += (int16_t)e;
+        }
+    }
+}
+
+static void add_noise(Image *img, const char *kind, double amount, unsigned long long seed) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    int k;
+    if (strcmp(kind, "GAUSSIAN") == 0 && amount >= 0.0) k = NOISE_GAUSSIAN;
+    else if (strcmp(kind, "SALT_PEPPER") == 0 && amount >= 0.0 && amount <= 1.0) k = NOISE_SALT_PEPPER;
+    else { say("NOISE parameter invalid\n"); return; }
+
+    for (int y = img->y1; y < img->y2; y++)
+        for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+            uint64_t idx = (uint64_t)y * img->w + img->runs[r].x0;
+            noise_span(img->data + idx * img->ch, img->runs[r].x1 - img->runs[r].x0, img->ch, idx, k, amount, seed);
+        }
+    say("NOISE %s done\n", kind);
+}
+
+static void dither(Image *img, const char *kind, int levels) {
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    if (levels < 2 || levels > 256 || (strcmp(kind, "ORDERED") != 0 && strcmp(kind, "FS") != 0)) {
+        say("DITHER parameter invalid\n");
+        return;
+    }
+    size_t rb = (size_t)img->w * img->ch;
+    if (kind[0] == 'O') {
+        for (int y = img->y1; y < img->y2; y++)
+            for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+                int x0 = img->runs[r].x0;
+                dither_ordered_span(img->data + (size_t)y * rb + (size_t)x0 * img->ch, img->runs[r].x1 - x0, img->ch, x0, y, levels);
+            }
+    } else {
+        // two error rows; errors pushed outside the selection are never read
+        size_t ab = (size_t)(img->w + 2) * img->ch;
+        int16_t *acc = (int16_t*)calloc(2 * ab, sizeof(int16_t));
+        if (!acc) { fprintf(stderr, "malloc failed\n"); return; }
+        int16_t *above = acc, *below = acc + ab;
+        for (int y = img->y1; y < img->y2; y++) {
+            memset(below, 0, ab * sizeof(int16_t));
+            for (int r = img->row_start[y]; r < img->row_start[y + 1]; r++) {
+                int carry[3] = {0, 0, 0};
+                dither_fs_span(img->data + (size_t)y * rb, img->runs[r].x0, img->runs[r].x1, img->ch, levels, above, below, carry);
+            }
+            int16_t *t = above; above = below; below = t;
+        }
+        free(acc);
+    }
+    say("DITHER %s done\n", kind);
+}
+
+// ==== Image statistics ====
+// One pass feeds a per-channel histogram (min, max, mean, variance and the
+// percentiles all follow exactly from it), the squared error against a
+// reference and the sums of the 8x8 SSIM blocks. Everything is accumulated in
+// integers (the SSIM of each block in 2^-32 units), so the output does not
+// depend on how the rows are split between threads or ranks.
+#define SSIM_B 8
+
+typedef struct { long long sx, sy, sxx, syy, sxy, n; } SsimSums;
+
+static const int STATS_PCT[] = {1, 5, 25, 50, 75, 95, 99};
+
+// Accumulates `rows` rows of a (and of the reference b, unless NULL). The rows
+// belong to one block row, whose block sums are s[bx * ch + c].
+static void stats_rows(const uint8_t *a, const uint8_t *b, int w, int ch, int rows,
+                       long long *hist, long long *sse, SsimSums *s) {
+    size_t rb = (size_t)w * ch;
+    for (int r = 0; r < rows; r++, a += rb) {
+        for (int x = 0; x < w; x++)
+            for (int c = 0; c < ch; c++) hist[c * 256 + a[(size_t)x * ch + c]]++;
+        if (!b) continue;
+
+        long long e = 0;  // plain reduction, vectorized by the compiler
+        for (size_t i = 0; i < rb; i++) {
+            int d = (int)a[i] - (int)b[i];
+            e += d * d;
+        }
+        *sse += e;
+
+        for (int x0 = 0; x0 < w; x0 += SSIM_B) {
+            int x1 = (x0 + SSIM_B < w) ? x0 + SSIM_B : w;
+            SsimSums *bs = s + (size_t)(x0 / SSIM_B) * ch;
+            for (int c = 0; c < ch; c++) {
+                int sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+                for (int x = x0; x < x1; x++) {
+                    int u = a[(size_t)x * ch + c], v = b[(size_t)x * ch + c];
+                    sx += u; sy += v; sxx += u * u; syy += v * v; sxy += u * v;
+                }
+                bs[c].sx += sx; bs[c].sy += sy; bs[c].sxx += sxx; bs[c].syy += syy; bs[c].sxy += sxy;
+                bs[c].n += x1 - x0;
+            }
+        }
+        b += rb;
+    }
+}
+
+// SSIM of the nb blocks of a finished block row, summed in 2^-32 units; clears s
+static long long ssim_blockrow_q(SsimSums *s, int nb) {
+    const double C1 = 6.5025, C2 = 58.5225;  // (0.01 * 255)^2, (0.03 * 255)^2
+    long long q = 0;
+    for (int i = 0; i < nb; i++) {
+        double n = (double)s[i].n, mx = s[i].sx / n, my = s[i].sy / n;
+        double vx = s[i].sxx / n - mx * mx, vy = s[i].syy / n - my * my, cxy = s[i].sxy / n - mx * my;
+        double v = (2.0 * mx * my + C1) * (2.0 * cxy + C2) / ((mx * mx + my * my + C1) * (vx + vy + C2));
+        q += llrint(v * 4294967296.0);
+    }
+    memset(s, 0, (size_t)nb * sizeof(SsimSums));
+    return q;
+}
+
+// Prints the machine-readable report (key=value, one record per line)
+static void stats_print(const long long *hist, int w, int h, int ch, const char *ref, long long sse, long long ssim_q) {
+    long long n = (long long)w * h;
+    printf("STATS w=%d h=%d ch=%d pixels=%lld\n", w, h, ch, n);
+    for (int c = 0; c < ch; c++) {
+        const long long *hc = hist + c * 256;
+        long long sum = 0, sq = 0;
+        int mn = -1, mx = 0;
+        for (int v = 0; v < 256; v++) {
+            if (!hc[v]) continue;
+            if (mn < 0) mn = v;
+            mx = v;
+            sum += hc[v] * v;
+            sq += hc[v] * v * v;
+        }
+        double mean = (double)sum / (double)n;
+        double var = ((double)sq - (double)sum * mean) / (double)n;
+        printf("STATS c=%d min=%d max=%d mean=%.4f var=%.4f", c, mn, mx, mean, var < 0 ? 0.0 : var);
+        long long cum = 0;
+        int v = 0;
+        for (size_t k = 0; k < sizeof(STATS_PCT) / sizeof(STATS_PCT[0]); k++) {
+            // nearest rank: smallest v with cum(v) >= p% of the pixels
+            while (v < 255 && (cum + hc[v]) * 100 < (long long)STATS_PCT[k] * n) cum += hc[v++];
+            printf(" p%d=%d", STATS_PCT[k], v);
+        }
+        putchar('\n');
+    }
+    if (!ref) return;
+    long long samples = n * ch, blocks = (long long)((w + SSIM_B - 1) / SSIM_B) * ((h + SSIM_B - 1) / SSIM_B) * ch;
+    double mse = (double)sse / (double)samples;
+    printf("STATS ref=%s mse=%.6f ", ref, mse);
+    if (sse == 0) printf("psnr=inf");
+    else printf("psnr=%.4f", 10.0 * log10(255.0 * 255.0 / mse));
+    printf(" ssim=%.6f\n", (double)ssim_q / 4294967296.0 / (double)blocks);
+}
+
+static void stats(const Image *img, const char *ref_path) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    Image ref = {0};
+    if (ref_path && (!img_load_pnm(&ref, ref_path) || ref.w != img->w || ref.h != img->h || ref.ch != img->ch)) {
+        printf("Invalid reference %s\n", ref_path);
+        img_free(&ref);
+        return;
+    }
+    size_t rb = (size_t)img->w * img->ch;
+    int nb = (img->w + SSIM_B - 1) / SSIM_B * img->ch;
+    long long *hist = (long long*)calloc(3 * 256, sizeof(long long)), sse = 0, q = 0;
+    SsimSums *s = (SsimSums*)calloc((size_t)nb, sizeof(SsimSums));
+    if (!hist || !s) { fprintf(stderr, "malloc failed\n"); free(hist); free(s); img_free(&ref); return; }
+
+    for (int y = 0; y < img->h; y += SSIM_B) {
+        int rows = (y + SSIM_B < img->h) ? SSIM_B : img->h - y;
+        stats_rows(img->data + (size_t)y * rb, ref_path ? ref.data + (size_t)y * rb : NULL, img->w, img->ch, rows, hist, &sse, s);
+        if (ref_path) q += ssim_blockrow_q(s, nb);
+    }
+    stats_print(hist, img->w, img->h, img->ch, ref_path, sse, q);
+    free(hist);
+    free(s);
+    img_free(&ref);
+}
+
+// ==== Compressed tiled checkpoints ====
+// File layout (little-endian): header, ntiles index entries, then the tile
+// payloads. Every tile is an independent rectangle, so a writer may cut the image
+// however suits it and a reader decodes only the tiles it needs. A payload is the
+// tile's rows, delta-filtered against the previous pixel and LZ-compressed, or the
+// raw rows when compression does not pay off.
+#define CKPT_MAGIC "PNMCKPT1"
+#define CKPT_TILE 128
+#define LZ_HASH_BITS 12
+
+typedef struct { char magic[8]; uint32_t w, h, ch, ntiles; } CkptHeader;
+typedef struct { uint64_t offset; uint32_t x0, y0, w, h, size, flags; } CkptTile; // flags: 1 = delta + LZ
+
+// Upper bound of the compressed size of n bytes
+static size_t lz_bound(size_t n) { return n + n / 255 + 16; }
+
+static size_t lz_put_len(uint8_t *dst, size_t op, size_t len) {
+    for (; len >= 255; len -= 255) dst[op++] = 255;
+    dst[op++] = (uint8_t)len;
+    return op;
+}
+
+// One LZ4-style sequence: token (literal count << 4 | match length - 4, a nibble of
+// 15 continues in extra bytes), the literals, a 16-bit offset and the extra length.
+// The last sequence of a block has literals only.
+static size_t lz_emit(uint8_t *dst, size_t op, const uint8_t *lit, size_t nlit, size_t off, size_t mlen) {
+    size_t ml = mlen ? mlen - 4 : 0;
+    dst[op++] = (uint8_t)(((nlit < 15 ? nlit : 15) << 4) | (ml < 15 ? ml : 15));
+    if (nlit >= 15) op = lz_put_len(dst, op, nlit - 15);
+    memcpy(dst + op, lit, nlit);
+    op += nlit;
+    if (!mlen) return op;
+    dst[op++] = (uint8_t)(off & 255);
+    dst[op++] = (uint8_t)(off >> 8);
+    if (ml >= 15) op = lz_put_len(dst, op, ml - 15);
+    return op;
+}
+
+// Greedy single-probe hash matcher; dst must hold lz_bound(n) bytes
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+    uint32_t table[1 << LZ_HASH_BITS] = {0}; // position + 1 of the last 4-byte prefix
+    size_t ip = 0, anchor = 0, op = 0;
+    while (ip + 4 <= n) {
+        uint32_t v;
+        memcpy(&v, src + ip, 4);
+        uint32_t hsh = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t cand = table[hsh];
+        table[hsh] = (uint32_t)ip + 1;
+        if (cand && ip - (cand - 1) <= 65535 && memcmp(src + cand - 1, src + ip, 4) == 0) {
+            size_t ref = cand - 1, len = 4;
+            while (ip + len < n && src[ref + len] == src[ip + len]) len++;
+            op = lz_emit(dst, op, src + anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+    return lz_emit(dst, op, src + anchor, n - anchor, 0, 0);
+}
+
+static int lz_read_len(const uint8_t *src, size_t n, size_t *ip, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= n) return 0;
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+// Returns 1 only if the block decodes to exactly out_n bytes (all reads are checked)
+static int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_n) {
+    size_t ip = 0, op = 0;
+    while (ip < n) {
+        unsigned tok = src[ip++];
+        size_t nlit = tok >> 4, ml = tok & 15;
+        if (nlit == 15 && !lz_read_len(src, n, &ip, &nlit)) return 0;
+        if (nlit > n - ip || nlit > out_n - op) return 0;
+        memcpy(dst + op, src + ip, nlit);
+        ip += nlit; op += nlit;
+        if (ip == n) break;
+        if (n - ip < 2) return 0;
+        size_t off = src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (ml == 15 && !lz_read_len(src, n, &ip, &ml)) return 0;
+        ml += 4;
+        if (off == 0 || off > op || ml > out_n - op) return 0;
+        for (size_t i = 0; i < ml; i++, op++) dst[op] = dst[op - off]; // may overlap
+    }
+    return op == out_n;
+}
+
+// Encodes tile t; src points at its top-left pixel, stride is the image row size.
+// raw needs t->w * t->h * ch bytes, out lz_bound() of that. Returns the payload size.
+static size_t ckpt_encode_tile(const uint8_t *src, size_t stride, int ch, CkptTile *t, uint8_t *raw, uint8_t *out) {
+    size_t rb = (size_t)t->w * ch, n = rb * t->h;
+    for (uint32_t y = 0; y < t->h; y++) {
+        uint8_t *r = raw + y * rb;
+        memcpy(r, src + y * stride, rb);
+        for (size_t i = rb; i-- > (size_t)ch; ) r[i] = (uint8_t)(r[i] - r[i - ch]);
+    }
+    size_t sz = lz_compress(raw, n, out);
+    t->flags = 1;
+    if (sz >= n) { // incompressible: store the original rows
+        for (uint32_t y = 0; y < t->h; y++) memcpy(out + y * rb, src + y * stride, rb);
+        sz = n;
+        t->flags = 0;
+    }
+    t->size = (uint32_t)sz;
+    return sz;
+}
+
+// Decodes a payload into raw (t->w * t->h * ch bytes, rows packed)
+static int ckpt_decode_tile(const uint8_t *payload, const CkptTile *t, int ch, uint8_t *raw) {
+    size_t rb = (size_t)t->w * ch, n = rb * t->h;
+    if (!t->flags) {
+        if (t->size != n) return 0;
+        memcpy(raw, payload, n);
+        return 1;
+    }
+    if (!lz_decompress(payload, t->size, raw, n)) return 0;
+    for (uint32_t y = 0; y < t->h; y++) {
+        uint8_t *r = raw + y * rb;
+        for (size_t i = ch; i < rb; i++) r[i] = (uint8_t)(r[i] + r[i - ch]);
+    }
+    return 1;
+}
+
+// Copies the part of a decoded tile inside the region [rx0, rx1) x [ry0, ry1) to dst,
+// which holds that region with rows of dst_stride bytes
+static void ckpt_copy_tile(const CkptTile *t, const uint8_t *raw, int ch, uint8_t *dst, size_t dst_stride,
+                           int rx0, int ry0, int rx1, int ry1) {
+    int xa = (int)t->x0 > rx0 ? (int)t->x0 : rx0, xb = (int)(t->x0 + t->w) < rx1 ? (int)(t->x0 + t->w) : rx1;
+    int ya = (int)t->y0 > ry0 ? (int)t->y0 : ry0, yb = (int)(t->y0 + t->h) < ry1 ? (int)(t->y0 + t->h) : ry1;
+    for (int y = ya; y < yb; y++)
+        memcpy(dst + (size_t)(y - ry0) * dst_stride + (size_t)(xa - rx0) * ch,
+               raw + ((size_t)(y - t->y0) * t->w + (size_t)(xa - t->x0)) * ch, (size_t)(xb - xa) * ch);
+}
+
+static int ckpt_tile_hits(const CkptTile *t, int rx0, int ry0, int rx1, int ry1) {
+    return (int)t->x0 < rx1 && (int)(t->x0 + t->w) > rx0 && (int)t->y0 < ry1 && (int)(t->y0 + t->h) > ry0;
+}
+
+// Sanity checks of a header and index read from disk
+static int ckpt_valid(const CkptHeader *hd, const CkptTile *t, uint32_t n) {
+    if (memcmp(hd->magic, CKPT_MAGIC, 8) != 0 || (hd->ch != 1 && hd->ch != 3) || !hd->w || !hd->h) return 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!t[i].w || !t[i].h || t[i].x0 >= hd->w || t[i].y0 >= hd->h) return 0;
+        if (t[i].w > hd->w - t[i].x0 || t[i].h > hd->h - t[i].y0) return 0;
+        if (t[i].size > lz_bound((size_t)t[i].w * t[i].h * hd->ch)) return 0;
+    }
+    return 1;
+}
+
+// The header and the index are serialized field by field, little-endian at fixed
+// offsets, so files do not depend on the host byte order or on struct padding
+#define CKPT_HEADER_BYTES 24  // magic[8], w, h, ch, ntiles
+#define CKPT_ENTRY_BYTES 32   // offset (u64), x0, y0, w, h, size, flags
+
+static void le_put(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t le_get(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+// Header and n index entries in file form (CKPT_HEADER_BYTES + n * CKPT_ENTRY_BYTES bytes)
+static void ckpt_pack(uint8_t *b, const CkptHeader *hd, const CkptTile *t, size_t n) {
+    if (hd) {
+        memcpy(b, hd->magic, 8);
+        le_put(b + 8, hd->w, 4); le_put(b + 12, hd->h, 4); le_put(b + 16, hd->ch, 4); le_put(b + 20, hd->ntiles, 4);
+        b += CKPT_HEADER_BYTES;
+    }
+    for (size_t i = 0; i < n; i++, b += CKPT_ENTRY_BYTES) {
+        le_put(b, t[i].offset, 8);
+        le_put(b + 8, t[i].x0, 4); le_put(b + 12, t[i].y0, 4); le_put(b + 16, t[i].w, 4);
+        le_put(b + 20, t[i].h, 4); le_put(b + 24, t[i].size, 4); le_put(b + 28, t[i].flags, 4);
+    }
+}
+
+// Writes the header and the index at the current file position
+static int ckpt_write_index(FILE *f, const CkptHeader *hd, const CkptTile *t) {
+    size_t len = CKPT_HEADER_BYTES + (size_t)hd->ntiles * CKPT_ENTRY_BYTES;
+    uint8_t *b = (uint8_t*)malloc(len);
+    if (!b) return 0;
+    ckpt_pack(b, hd, t, hd->ntiles);
+    int ok = fwrite(b, 1, len, f) == len;
+    free(b);
+    return ok;
+}
+
+// Reads and checks the header and the index; *tiles is malloc'd, NULL on failure
+static int ckpt_read_index(FILE *f, CkptHeader *hd, CkptTile **tiles) {
+    uint8_t hb[CKPT_HEADER_BYTES];
+    *tiles = NULL;
+    if (fread(hb, 1, sizeof hb, f) != sizeof hb) return 0;
+    memcpy(hd->magic, hb, 8);
+    hd->w = (uint32_t)le_get(hb + 8, 4); hd->h = (uint32_t)le_get(hb + 12, 4);
+    hd->ch = (uint32_t)le_get(hb + 16, 4); hd->ntiles = (uint32_t)le_get(hb + 20, 4);
+    if (hd->ntiles == 0 || (uint64_t)hd->ntiles > (uint64_t)hd->w * hd->h) return 0;
+    CkptTile *t = (CkptTile*)malloc((size_t)hd->ntiles * sizeof(CkptTile));
+    uint8_t *b = (uint8_t*)malloc((size_t)hd->ntiles * CKPT_ENTRY_BYTES);
+    int ok = t && b && fread(b, CKPT_ENTRY_BYTES, hd->ntiles, f) == hd->ntiles;
+    for (uint32_t i = 0; ok && i < hd->ntiles; i++) {
+        const uint8_t *e = b + (size_t)i * CKPT_ENTRY_BYTES;
+        t[i].offset = le_get(e, 8);
+        t[i].x0 = (uint32_t)le_get(e + 8, 4); t[i].y0 = (uint32_t)le_get(e + 12, 4);
+        t[i].w = (uint32_t)le_get(e + 16, 4); t[i].h = (uint32_t)le_get(e + 20, 4);
+        t[i].size = (uint32_t)le_get(e + 24, 4); t[i].flags = (uint32_t)le_get(e + 28, 4);
+    }
+    free(b);
+    if (!ok || !ckpt_valid(hd, t, hd->ntiles)) { free(t); return 0; }
+    *tiles = t;
+    return 1;
+}
+
+static void ckpt_save(const Image *img, const char *path) {
+    if (!img->loaded) { printf("No image loaded\n"); return; }
+    double t0 = now_sec();
+    int tx = (img->w + CKPT_TILE - 1) / CKPT_TILE, ty = (img->h + CKPT_TILE - 1) / CKPT_TILE;
+    uint32_t n = (uint32_t)tx * (uint32_t)ty;
+    size_t stride = (size_t)img->w * img->ch, tb = (size_t)CKPT_TILE * CKPT_TILE * img->ch;
+    CkptTile *tiles = (CkptTile*)calloc(n, sizeof(CkptTile));
+    uint8_t *raw = (uint8_t*)malloc(tb), *out = (uint8_t*)malloc(lz_bound(tb));
+    FILE *f = fopen(path, "wb");
+    if (!tiles || !raw || !out || !f) {
+        printf("Failed to save %s\n", path);
+        if (f) fclose(f);
+        free(tiles); free(raw); free(out);
+        return;
+    }
+    CkptHeader hd = { CKPT_MAGIC, (uint32_t)img->w, (uint32_t)img->h, (uint32_t)img->ch, n };
+    // placeholder index, rewritten once the payload offsets are known
+    int ok = ckpt_write_index(f, &hd, tiles);
+    uint64_t off = CKPT_HEADER_BYTES + (uint64_t)n * CKPT_ENTRY_BYTES;
+    for (uint32_t i = 0; ok && i < n; i++) {
+        CkptTile *t = &tiles[i];
+        t->x0 = (i % tx) * CKPT_TILE; t->y0 = (i / tx) * CKPT_TILE;
+        t->w = (t->x0 + CKPT_TILE < (uint32_t)img->w) ? CKPT_TILE : img->w - t->x0;
+        t->h = (t->y0 + CKPT_TILE < (uint32_t)img->h) ? CKPT_TILE : img->h - t->y0;
+        t->offset = off;
+        size_t sz = ckpt_encode_tile(img->data + t->y0 * stride + (size_t)t->x0 * img->ch, stride, img->ch, t, raw, out);
+        ok = fwrite(out, 1, sz, f) == sz;
+        off += sz;
+    }
+    ok = ok && fseeko(f, 0, SEEK_SET) == 0 && ckpt_write_index(f, &hd, tiles);
+    ok = (fclose(f) == 0) && ok;
+    if (ok) printf("CHECKPOINT %s tiles=%u raw=%zu stored=%llu time=%.6f sec\n", path, n, stride * img->h, (unsigned long long)off, now_sec() - t0);
+    else printf("Failed to save %s\n", path);
+    free(tiles); free(raw); free(out);
+}
+
+// Reads the header and the tile index; returns the open file or NULL
+static FILE *ckpt_open(const char *path, CkptHeader *hd, CkptTile **tiles) {
+    FILE *f = fopen(path, "rb");
+    *tiles = NULL;
+    if (!f) return NULL;
+    if (!ckpt_read_index(f, hd, tiles)) { fclose(f); return NULL; }
+    return f;
+}
+
+// Restores the whole checkpoint, or only the region [x1, x2) x [y1, y2) of it;
+// only the tiles that intersect the region are read and decompressed
+static void ckpt_restore(Image *img, const char *path, const int *region) {
+    double t0 = now_sec();
+    CkptHeader hd;
+    CkptTile *tiles;
+    FILE *f = ckpt_open(path, &hd, &tiles);
+    if (!f) { printf("Failed to load %s\n", path); return; }
+
+    int x1 = 0, y1 = 0, x2 = (int)hd.w, y2 = (int)hd.h;
+    if (region) {
+        x1 = region[0]; y1 = region[1]; x2 = region[2]; y2 = region[3];
+        if (x1 > x2) { int t = x1; x1 = x2; x2 = t; }
+        if (y1 > y2) { int t = y1; y1 = y2; y2 = t; }
+        if (x1 < 0 || y1 < 0 || x2 > (int)hd.w || y2 > (int)hd.h || x1 == x2 || y1 == y2) {
+            printf("Invalid set of coordinates\n");
+            fclose(f); free(tiles);
+            return;
+        }
+    }
+    size_t stride = (size_t)(x2 - x1) * hd.ch, tb = 0;
+    long long covered = 0;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < hd.ntiles; i++) {
+        if (!ckpt_tile_hits(&tiles[i], x1, y1, x2, y2)) continue;
+        size_t b = (size_t)tiles[i].w * tiles[i].h * hd.ch;
+        if (b > tb) tb = b;
+        long long cw = ((int)(tiles[i].x0 + tiles[i].w) < x2 ? (int)(tiles[i].x0 + tiles[i].w) : x2) - ((int)tiles[i].x0 > x1 ? (int)tiles[i].x0 : x1);
+        long long chh = ((int)(tiles[i].y0 + tiles[i].h) < y2 ? (int)(tiles[i].y0 + tiles[i].h) : y2) - ((int)tiles[i].y0 > y1 ? (int)tiles[i].y0 : y1);
+        covered += cw * chh;
+        used++;
+    }
+    uint8_t *data = (uint8_t*)malloc(stride * (y2 - y1));
+    uint8_t *raw = (uint8_t*)malloc(tb), *payload = (uint8_t*)malloc(lz_bound(tb));
+    int ok = data && raw && payload && covered == (long long)(x2 - x1) * (y2 - y1); // tiles must tile the region
+    for (uint32_t i = 0; ok && i < hd.ntiles; i++) {
+        const CkptTile *t = &tiles[i];
+        if (!ckpt_tile_hits(t, x1, y1, x2, y2)) continue;
+        ok = fseeko(f, (off_t)t->offset, SEEK_SET) == 0 && fread(payload, 1, t->size, f) == t->size &&
+             ckpt_decode_tile(payload, t, hd.ch, raw);
+        if (ok) ckpt_copy_tile(t, raw, hd.ch, data, stride, x1, y1, x2, y2);
+    }
+    fclose(f);
+    free(tiles); free(raw); free(payload);
+    if (!ok) { free(data); printf("Failed to load %s\n", path); return; }
+
+    img_free(img);
+    img->data = data;
+    img->w = x2 - x1; img->h = y2 - y1; img->ch = (int)hd.ch;
+    img->loaded = 1;
+    if (!sel_rect(img, 0, 0, img->w, img->h)) { img_free(img); fprintf(stderr, "malloc failed\n"); return; }
+    printf("RESTORE %s tiles=%u/%u time=%.6f sec\n", path, used, hd.ntiles, now_sec() - t0);
 }
 
 // Generates an ASCII histogram for Grayscale images
@@ -283,8 +1441,8 @@ static void histogram(const Image *img, int xstars, int bins) {
 
 // Enhances Grayscale contrast using Histogram Equalization
 static void equalize(Image *img) {
-    if (!img->loaded) { printf("No image loaded\n"); return; }
-    if (img->ch != 1) { printf("Black and white image needed\n"); return; }
+    if (!img->loaded) { say("No image loaded\n"); return; }
+    if (img->ch != 1) { say("Black and white image needed\n"); return; }
     
     int fr[256] = {0};
     size_t area = (size_t)img->w * img->h;
@@ -301,7 +1459,181 @@ static void equalize(Image *img) {
         double nv = 255.0 * (double)cdf[v] / (double)area;
         img->data[i] = clamp_u8_double(nv);
     }
-    printf("Equalize done\n");
+    say("Equalize done\n");
+}
+
+// ==== Frame streams ====
+// STREAM reads concatenated P5/P6 frames and runs a filter script (one operation
+// per line) on every frame. TEMPORAL steps keep a ring buffer of their last n
+// input frames: AVG keeps a running sum, MEDIAN sorts the n samples of a pixel.
+#define STREAM_MAX_STEPS 32
+#define TEMPORAL_MAX 16
+
+enum { ST_APPLY, ST_SOBEL, ST_LUMA, ST_CONVERT, ST_NOISE, ST_DITHER, ST_EQUALIZE, ST_TAVG, ST_TMEDIAN };
+
+typedef struct {
+    int op, n;                    // n: DITHER levels or TEMPORAL window
+    char name[64];                // filter, conversion, noise or dither kind
+    const double (*K)[3];
+    const ColorKernel *ck;
+    double amount;
+    unsigned long long seed;
+    uint8_t *ring;                // TEMPORAL: n frames, the oldest at head once full
+    uint32_t *sum;                // TEMPORAL AVG: running sum of the ring
+    int fw, fh, fch, count, head;
+} StreamStep;
+
+static void stream_free_steps(StreamStep *st, int n) {
+    for (int i = 0; i < n; i++) { free(st[i].ring); free(st[i].sum); }
+}
+
+// Parses the script; returns the number of steps or -1 (with the bad line reported)
+static int stream_parse(const char *path, StreamStep *st) {
+    FILE *f = fopen(path, "r");
+    if (!f) { fprintf(stderr, "Failed to load %s\n", path); return -1; }
+    char line[256], op[64];
+    int n = 0, lineno = 0;
+    while (fgets(line, sizeof line, f)) {
+        lineno++;
+        if (sscanf(line, "%63s", op) != 1 || op[0] == '#') continue;
+        if (n == STREAM_MAX_STEPS) { fprintf(stderr, "%s:%d: too many steps\n", path, lineno); fclose(f); return -1; }
+        StreamStep *s = &st[n];
+        memset(s, 0, sizeof *s);
+        int ok = 1;
+        if (strcmp(op, "APPLY") == 0 || strcmp(op, "APPLY_LUMA") == 0) {
+            ok = sscanf(line, "%*s %63s", s->name) == 1;
+            if (ok && strcmp(op, "APPLY") == 0 && strcmp(s->name, "SOBEL") == 0) s->op = ST_SOBEL;
+            else {
+                s->op = (op[5] == '_') ? ST_LUMA : ST_APPLY;
+                ok = ok && (s->K = filter_kernel(s->name)) != NULL;
+            }
+        } else if (strcmp(op, "APPLY_SOBEL") == 0) {
+            s->op = ST_SOBEL;
+        } else if (strcmp(op, "GRAYSCALE") == 0 || strcmp(op, "TO_RGB") == 0 || strcmp(op, "CONVERT") == 0) {
+            s->op = ST_CONVERT;
+            if (op[0] == 'C') ok = sscanf(line, "%*s %63s", s->name) == 1;
+            else strcpy(s->name, op);
+            ok = ok && (s->ck = find_color_kernel(s->name)) != NULL && (op[0] != 'C' || s->ck->in_ch == s->ck->out_ch);
+        } else if (strcmp(op, "NOISE") == 0) {
+            s->op = ST_NOISE;
+            ok = sscanf(line, "%*s %63s %lf %llu", s->name, &s->amount, &s->seed) == 3;
+        } else if (strcmp(op, "DITHER") == 0) {
+            s->op = ST_DITHER;
+            ok = sscanf(line, "%*s %63s %d", s->name, &s->n) == 2;
+        } else if (strcmp(op, "EQUALIZE") == 0) {
+            s->op = ST_EQUALIZE;
+        } else if (strcmp(op, "TEMPORAL") == 0) {
+            ok = sscanf(line, "%*s %63s %d", s->name, &s->n) == 2 && s->n >= 1 && s->n <= TEMPORAL_MAX;
+            if (ok && strcmp(s->name, "AVG") == 0) s->op = ST_TAVG;
+            else if (ok && strcmp(s->name, "MEDIAN") == 0) s->op = ST_TMEDIAN;
+            else ok = 0;
+        } else {
+            ok = 0;
+        }
+        if (!ok) { fprintf(stderr, "%s:%d: invalid step\n", path, lineno); fclose(f); return -1; }
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+// Pushes the frame into the step's ring and replaces it with the temporal average
+// or median of the frames in the ring (fewer than n at the start of the stream)
+static void stream_temporal(StreamStep *s, Image *img) {
+    size_t sz = (size_t)img->w * img->h * img->ch;
+    if (s->fw != img->w || s->fh != img->h || s->fch != img->ch) {
+        // first frame or a size change: restart the history
+        free(s->ring); free(s->sum);
+        s->ring = (uint8_t*)malloc(sz * s->n);
+        s->sum = (uint32_t*)calloc(sz, sizeof(uint32_t));
+        s->fw = s->fh = s->fch = 0;
+        if (!s->ring || !s->sum) { fprintf(stderr, "malloc failed\n"); return; }
+        s->fw = img->w; s->fh = img->h; s->fch = img->ch;
+        s->count = s->head = 0;
+    }
+    uint8_t *slot = s->ring + (size_t)s->head * sz;
+    if (s->op == ST_TAVG && s->count == s->n)
+        for (size_t i = 0; i < sz; i++) s->sum[i] -= slot[i];
+    memcpy(slot, img->data, sz);
+    if (s->count < s->n) s->count++;
+    s->head = (s->head + 1) % s->n;
+
+    int c = s->count;
+    if (s->op == ST_TAVG) {
+        for (size_t i = 0; i < sz; i++) {
+            s->sum[i] += img->data[i];
+            img->data[i] = (uint8_t)((s->sum[i] + (uint32_t)c / 2) / (uint32_t)c);
+        }
+        return;
+    }
+    for (size_t i = 0; i < sz; i++) {
+        uint8_t v[TEMPORAL_MAX];
+        for (int k = 0; k < c; k++) { // insertion sort of the c samples
+            uint8_t x = s->ring[(size_t)k * sz + i];
+            int j = k;
+            for (; j > 0 && v[j - 1] > x; j--) v[j] = v[j - 1];
+            v[j] = x;
+        }
+        img->data[i] = (uint8_t)((v[(c - 1) / 2] + v[c / 2] + 1) / 2);
+    }
+}
+
+// Runs the script on one frame; the NOISE seed advances with the frame number
+static void stream_filter(StreamStep *st, int n, Image *img, long long frame) {
+    for (int i = 0; i < n; i++) {
+        StreamStep *s = &st[i];
+        switch (s->op) {
+        case ST_APPLY:    if (img->ch == 3) apply_conv3x3(img, s->K, "APPLY"); break;
+        case ST_SOBEL:    apply_sobel(img); break;
+        case ST_LUMA:     apply_conv3x3_luma(img, s->K, "APPLY_LUMA"); break;
+        case ST_CONVERT:  img_convert(img, s->ck); break;
+        case ST_NOISE:    add_noise(img, s->name, s->amount, s->seed + (unsigned long long)frame); break;
+        case ST_DITHER:   dither(img, s->name, s->n); break;
+        case ST_EQUALIZE: equalize(img); break;
+        default:          stream_temporal(s, img); break;
+        }
+    }
+}
+
+// Filters every frame of in into out, one frame at a time; returns the number of
+// frames or -1. The operations run silently, the caller reports the summary.
+static long long stream_run(FILE *in, FILE *out, const char *script) {
+    StreamStep st[STREAM_MAX_STEPS];
+    int n = stream_parse(script, st);
+    if (n < 0) return -1;
+    FILE *saved = msg_out;
+    msg_out = NULL;
+    Image img = {0};
+    long long frames = 0;
+    int ok = 1;
+    while (ok && img_read_pnm(&img, in)) {
+        stream_filter(st, n, &img, frames);
+        ok = img_write_pnm(&img, out);
+        frames++;
+    }
+    fflush(out);
+    msg_out = saved;
+    img_free(&img);
+    stream_free_steps(st, n);
+    return ok ? frames : -1;
+}
+
+static void stream_report(long long frames, double sec) {
+    say("STREAM frames=%lld time=%.6f sec fps=%.2f\n", frames, sec, sec > 0 ? frames / sec : 0.0);
+}
+
+// STREAM <in> <out> <script>; the paths may be named pipes
+static void stream_cmd(const char *in_path, const char *out_path, const char *script) {
+    FILE *in = fopen(in_path, "rb");
+    if (!in) { say("Failed to load %s\n", in_path); return; }
+    FILE *out = fopen(out_path, "wb");
+    if (!out) { fclose(in); say("Failed to save %s\n", out_path); return; }
+    double t0 = now_sec();
+    long long frames = stream_run(in, out, script);
+    fclose(in);
+    if (fclose(out) != 0) frames = -1;
+    if (frames < 0) say("STREAM failed\n");
+    else stream_report(frames, now_sec() - t0);
 }
 
 // Runs a kernel N times for performance measurement
@@ -309,28 +1641,34 @@ static void bench(Image *img, int iters, const char *what) {
     if (!img->loaded) { printf("No image loaded\n"); return; }
     if (iters <= 0) { printf("Invalid command\n"); return; }
 
-    static const double K_EDGE[3][3] = {{-1,-1,-1},{-1, 8,-1},{-1,-1,-1}};
-    static const double K_SHARP[3][3] = {{ 0,-1, 0},{-1, 5,-1},{ 0,-1, 0}};
-    static const double K_BLUR[3][3] = {{1./9, 1./9, 1./9},{1./9, 1./9, 1./9},{1./9, 1./9, 1./9}};
-    static const double K_GAUSS[3][3] = {{1./16,2./16,1./16},{2./16,4./16,2./16},{1./16,2./16,1./16}};
+    const double (*K)[3] = filter_kernel(what);
+    char msg[80];
+    snprintf(msg, sizeof msg, "APPLY %s", what);
 
     double t0 = now_sec();
     for (int i = 0; i < iters; i++) {
         if (strcmp(what, "SOBEL") == 0) apply_sobel(img);
         else if (strcmp(what, "GAUSS_SOBEL") == 0) {
-            apply_conv3x3(img, K_GAUSS, "APPLY GAUSSIAN_BLUR");
+            apply_conv3x3(img, filter_kernel("GAUSSIAN_BLUR"), "APPLY GAUSSIAN_BLUR");
             apply_sobel(img);
-        } else if (strcmp(what, "EDGE") == 0) apply_conv3x3(img, K_EDGE, "APPLY EDGE");
-        else if (strcmp(what, "SHARPEN") == 0) apply_conv3x3(img, K_SHARP, "APPLY SHARPEN");
-        else if (strcmp(what, "BLUR") == 0) apply_conv3x3(img, K_BLUR, "APPLY BLUR");
-        else if (strcmp(what, "GAUSSIAN_BLUR") == 0) apply_conv3x3(img, K_GAUSS, "APPLY GAUSSIAN_BLUR");
+        } else if (K) apply_conv3x3(img, K, msg);
         else { printf("Invalid command\n"); return; }
     }
     printf("BENCH %s iters=%d time=%.6f sec\n", what, iters, now_sec() - t0);
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    msg_out = stdout;
+    // --stream <script>: frames from stdin, filtered frames to stdout, summary to stderr
+    if (argc == 3 && strcmp(argv[1], "--stream") == 0) {
+        msg_out = stderr;
+        double t0 = now_sec();
+        long long frames = stream_run(stdin, stdout, argv[2]);
+        if (frames >= 0) stream_report(frames, now_sec() - t0);
+        return frames < 0;
+    }
     Image img = {0};
+    Pyramid pyr = {0};
     char cmd[64];
     while (scanf("%63s", cmd) == 1) {
         if (strcmp(cmd, "LOAD") == 0) {
@@ -341,30 +1679,105 @@ int main(void) {
             char path[256]; scanf("%255s", path);
             if (img_save_pnm(&img, path)) printf("Saved %s\n", path);
             else printf("Failed to save %s\n", path);
+        } else if (strcmp(cmd, "STREAM") == 0) {
+            char in[256], out[256], script[256];
+            if (scanf("%255s %255s %255s", in, out, script) == 3) stream_cmd(in, out, script);
+        } else if (strcmp(cmd, "CHECKPOINT") == 0) {
+            char path[256]; scanf("%255s", path);
+            ckpt_save(&img, path);
+        } else if (strcmp(cmd, "RESTORE") == 0) {
+            char line[300], path[256]; int r[4];  // optional region x1 y1 x2 y2
+            if (!fgets(line, sizeof line, stdin)) line[0] = '\0';
+            int got = sscanf(line, "%255s %d %d %d %d", path, &r[0], &r[1], &r[2], &r[3]);
+            if (got == 1 || got == 5) ckpt_restore(&img, path, got == 5 ? r : NULL);
+            else printf("Invalid command\n");
         } else if (strcmp(cmd, "SELECT") == 0) {
             char next[64]; scanf("%63s", next);
             if (strcmp(next, "ALL") == 0) img_select_all(&img);
-            else {
+            else if (strcmp(next, "ELLIPSE") == 0) {
+                double cx, cy, rx, ry;
+                if (scanf("%lf %lf %lf %lf", &cx, &cy, &rx, &ry) != 4) continue;
+                if (!img.loaded) printf("No image loaded\n");
+                else if (rx <= 0 || ry <= 0 || sel_ellipse(&img, cx, cy, rx, ry) <= 0) { sel_rect(&img, 0, 0, img.w, img.h); printf("Invalid set of coordinates\n"); }
+                else printf("Selected ELLIPSE %d runs\n", img.nruns);
+            } else if (strcmp(next, "POLYGON") == 0) {
+                int n; if (scanf("%d", &n) != 1 || n < 3 || n > 100000) { printf("Invalid command\n"); continue; }
+                double *px = malloc(sizeof(double) * n), *py = malloc(sizeof(double) * n);
+                int ok = px && py;
+                for (int i = 0; ok && i < n; i++) ok = scanf("%lf %lf", &px[i], &py[i]) == 2;
+                if (!img.loaded) printf("No image loaded\n");
+                else if (!ok || sel_polygon(&img, n, px, py) <= 0) { sel_rect(&img, 0, 0, img.w, img.h); printf("Invalid set of coordinates\n"); }
+                else printf("Selected POLYGON %d runs\n", img.nruns);
+                free(px); free(py);
+            } else if (strcmp(next, "MASK") == 0) {
+                char path[256]; scanf("%255s", path);
+                if (!img.loaded) printf("No image loaded\n");
+                else if (sel_mask(&img, path) <= 0) { sel_rect(&img, 0, 0, img.w, img.h); printf("Invalid mask %s\n", path); }
+                else printf("Selected MASK %d runs\n", img.nruns);
+            } else {
                 int x1 = atoi(next), y1, x2, y2;
                 if (scanf("%d %d %d", &y1, &x2, &y2) == 3) img_select_rect(&img, x1, y1, x2, y2);
             }
         } else if (strcmp(cmd, "CROP") == 0) img_crop(&img);
         else if (strcmp(cmd, "HISTOGRAM") == 0) {
             int x, b; if (scanf("%d %d", &x, &b) == 2) histogram(&img, x, b);
+        } else if (strcmp(cmd, "STATS") == 0) {
+            char line[300], ref[256];  // the reference path is optional
+            if (!fgets(line, sizeof line, stdin)) line[0] = '\0';
+            stats(&img, sscanf(line, "%255s", ref) == 1 ? ref : NULL);
         } else if (strcmp(cmd, "EQUALIZE") == 0) equalize(&img);
         else if (strcmp(cmd, "APPLY") == 0) {
-            char w[64]; scanf("%63s", w);
-            static const double KE[3][3] = {{-1,-1,-1},{-1,8,-1},{-1,-1,-1}}, KS[3][3] = {{0,-1,0},{-1,5,-1},{0,-1,0}}, KB[3][3] = {{1./9,1./9,1./9},{1./9,1./9,1./9},{1./9,1./9,1./9}}, KG[3][3] = {{1./16,2./16,1./16},{2./16,4./16,2./16},{1./16,2./16,1./16}};
+            char w[64], msg[80]; scanf("%63s", w);
+            const double (*K)[3] = filter_kernel(w);
+            snprintf(msg, sizeof msg, "APPLY %s", w);
             if (img.ch == 1) printf("Easy, Charlie Chaplin\n");
-            else if (strcmp(w, "EDGE") == 0) apply_conv3x3(&img, KE, "APPLY EDGE");
-            else if (strcmp(w, "SHARPEN") == 0) apply_conv3x3(&img, KS, "APPLY SHARPEN");
-            else if (strcmp(w, "BLUR") == 0) apply_conv3x3(&img, KB, "APPLY BLUR");
-            else if (strcmp(w, "GAUSSIAN_BLUR") == 0) apply_conv3x3(&img, KG, "APPLY GAUSSIAN_BLUR");
+            else if (K) apply_conv3x3(&img, K, msg);
+        } else if (strcmp(cmd, "APPLY_LUMA") == 0) {
+            char w[64], msg[80]; scanf("%63s", w);
+            const double (*K)[3] = filter_kernel(w);
+            snprintf(msg, sizeof msg, "APPLY_LUMA %s", w);
+            if (K) apply_conv3x3_luma(&img, K, msg);
+            else printf("APPLY parameter invalid\n");
+        } else if (strcmp(cmd, "NOISE") == 0) {
+            char w[64]; double a; unsigned long long seed;
+            if (scanf("%63s %lf %llu", w, &a, &seed) == 3) add_noise(&img, w, a, seed);
+        } else if (strcmp(cmd, "DITHER") == 0) {
+            char w[64]; int l;
+            if (scanf("%63s %d", w, &l) == 2) dither(&img, w, l);
+        } else if (strcmp(cmd, "GRAYSCALE") == 0) img_convert(&img, find_color_kernel("GRAYSCALE"));
+        else if (strcmp(cmd, "TO_RGB") == 0) img_convert(&img, find_color_kernel("TO_RGB"));
+        else if (strcmp(cmd, "CONVERT") == 0) {
+            char w[64]; scanf("%63s", w);
+            const ColorKernel *k = find_color_kernel(w);
+            if (k && k->in_ch == k->out_ch) img_convert(&img, k);
+            else printf("CONVERT parameter invalid\n");
+        } else if (strcmp(cmd, "PYRAMID") == 0) {
+            char w[64]; scanf("%63s", w);
+            if (strcmp(w, "BUILD") == 0) {
+                int n; if (scanf("%d", &n) == 1) pyr_build(&pyr, &img, n);
+            } else if (strcmp(w, "APPLY") == 0) {
+                char f[64], msg[80]; scanf("%63s", f);
+                const double (*K)[3] = filter_kernel(f);
+                snprintf(msg, sizeof msg, "APPLY %s", f);
+                if (strcmp(f, "SOBEL") == 0) pyr_apply(&pyr, NULL, "APPLY SOBEL");
+                else if (K) pyr_apply(&pyr, K, msg);
+                else printf("APPLY parameter invalid\n");
+            } else if (strcmp(w, "BAND") == 0) {
+                int l; double g; if (scanf("%d %lf", &l, &g) == 2) pyr_band_gain(&pyr, l, g);
+            } else if (strcmp(w, "SAVE") == 0) {
+                int l; char path[256];
+                if (scanf("%d %255s", &l, path) == 2) {
+                    if (pyr_save_level(&pyr, l, path)) printf("Saved %s\n", path);
+                    else printf("Failed to save %s\n", path);
+                }
+            } else if (strcmp(w, "COLLAPSE") == 0) pyr_collapse(&pyr, &img);
+            else printf("Invalid command\n");
         } else if (strcmp(cmd, "APPLY_SOBEL") == 0) apply_sobel(&img);
         else if (strcmp(cmd, "BENCH") == 0) {
             int i; char w[64]; if (scanf("%d %63s", &i, w) == 2) bench(&img, i, w);
         } else if (strcmp(cmd, "EXIT") == 0) break;
     }
+    pyr_free(&pyr);
     img_free(&img);
     return 0;
 }
@@ -0,0 +1,28 @@
+#!/bin/sh
+# STATS with a reference on many MPI ranks must match the serial editor.
+# 1000 rows on 90 ranks cut more than 64 SSIM block rows (8 rows each) between
+# ranks, so every partial block row has to be merged across the boundary.
+# Usage: tests/stats_many_ranks.sh [ranks]   (default 90; needs mpicc/mpirun)
+set -e
+RANKS=${1:-90}
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+
+gcc -O2 -std=c11 "$SRC/serial_image_editor.c" -lm -o "$T/serial"
+mpicc -O2 -std=c11 "$SRC/image_editor_mpi.c" -lm -o "$T/mpi"
+
+for f in a b; do
+    { printf 'P6\n40 1000\n255\n'; head -c 120000 /dev/urandom; } > "$T/$f.ppm"
+done
+printf 'LOAD %s\nSTATS %s\nEXIT\n' "$T/a.ppm" "$T/b.ppm" > "$T/cmds"
+
+"$T/serial" < "$T/cmds" | grep '^STATS' > "$T/serial.txt"
+mpirun --oversubscribe -np "$RANKS" "$T/mpi" < "$T/cmds" 2>/dev/null | grep '^STATS' > "$T/mpi.txt"
+
+if diff "$T/serial.txt" "$T/mpi.txt"; then
+    echo "stats_many_ranks: OK ($RANKS ranks)"
+else
+    echo "stats_many_ranks: FAILED ($RANKS ranks)"
+    exit 1
+fi